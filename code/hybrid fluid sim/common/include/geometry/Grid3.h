@@ -64,7 +64,12 @@ public:
 
   void initialize(const Index3& size)
   {
-    Base::initialize(size);
+    resize(size);
+  }
+
+  void resize(const Index3& size)
+  {
+    Base::resize(size);
     _size_xy = size.x * size.y;
   }
 
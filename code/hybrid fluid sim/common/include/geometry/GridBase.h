@@ -579,7 +579,8 @@ GridDataBase<D, T>::resize(const Index<D>& size)
   if (length != _length)
   {
     delete []_data;
-    _data = new T[_length = length];
+    // zeroed, as the solvers read some grids before writing all of them
+    _data = new T[_length = length]();
   }
   _size = size;
 }
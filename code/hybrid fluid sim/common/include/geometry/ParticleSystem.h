@@ -35,6 +35,7 @@
 
 #include "core/SoA.h"
 #include "math/Matrix4x4.h"
+#include <algorithm>
 
 namespace cg
 { // begin namespace cg
@@ -80,6 +81,29 @@ public:
     return true;
   }
 
+  // Appends up to n particles, limited by the capacity, and returns how
+  // many were appended. The new particles are the last ones of the system
+  // and must be set by the caller.
+  size_t append(size_t n)
+  {
+    n = std::min(n, _capacity - _size);
+    _size += n;
+    return n;
+  }
+
+  // Removes the particles from index size on.
+  void truncate(size_t size)
+  {
+    if (size < _size)
+      _size = size;
+  }
+
+  // Copies particle from over particle to.
+  void copy(size_t from, size_t to)
+  {
+    _data.setTuple(to, _data.tuple(from));
+  }
+
   bool remove(size_t i)
   {
     if (i >= _size)
@@ -0,0 +1,94 @@
+//[]---------------------------------------------------------------[]
+//|                                                                 |
+//| Copyright (C) 2019 Orthrus Group.                               |
+//|                                                                 |
+//| This software is provided 'as-is', without any express or       |
+//| implied warranty. In no event will the authors be held liable   |
+//| for any damages arising from the use of this software.          |
+//|                                                                 |
+//| Permission is granted to anyone to use this software for any    |
+//| purpose, including commercial applications, and to alter it and |
+//| redistribute it freely, subject to the following restrictions:  |
+//|                                                                 |
+//| 1. The origin of this software must not be misrepresented; you  |
+//| must not claim that you wrote the original software. If you use |
+//| this software in a product, an acknowledgment in the product    |
+//| documentation would be appreciated but is not required.         |
+//|                                                                 |
+//| 2. Altered source versions must be plainly marked as such, and  |
+//| must not be misrepresented as being the original software.      |
+//|                                                                 |
+//| 3. This notice may not be removed or altered from any source    |
+//| distribution.                                                   |
+//|                                                                 |
+//[]---------------------------------------------------------------[]
+//
+// OVERVIEW: MappedFile.h
+// ========
+// Class definition for read-only memory-mapped file.
+//
+// Last revision: 17/10/2026
+
+#ifndef __MappedFile_h
+#define __MappedFile_h
+
+#include <cstddef>
+
+namespace cg
+{ // begin namespace cg
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// MappedFile: read-only memory-mapped file class
+// ==========
+//
+// The pages of the file are only read from disk when first touched, so
+// a reader pays for the parts of the file it actually uses.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+
+  MappedFile(const char* filename)
+  {
+    open(filename);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator =(const MappedFile&) = delete;
+
+  ~MappedFile()
+  {
+    close();
+  }
+
+  // Maps the whole file. Returns false if it cannot be opened or mapped.
+  bool open(const char* filename);
+
+  void close();
+
+  bool isOpen() const
+  {
+    return _data != nullptr;
+  }
+
+  const char* data() const
+  {
+    return _data;
+  }
+
+  size_t size() const
+  {
+    return _size;
+  }
+
+private:
+  const char* _data{};
+  size_t _size{};
+
+}; // MappedFile
+
+} // end namespace cg
+
+#endif // __MappedFile_h
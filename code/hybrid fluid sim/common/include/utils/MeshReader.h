@@ -28,12 +28,13 @@
 // Class definition for mesh reader.
 //
 // Author: Paulo Pagliosa
-// Last revision: 15/09/2018
+// Last revision: 17/10/2026
 
 #ifndef __MeshReader_h
 #define __MeshReader_h
 
 #include "geometry/TriangleMesh.h"
+#include <string>
 
 namespace cg
 { // begin namespace cg
@@ -43,11 +44,40 @@ namespace cg
 //
 // MeshReader: mesh reader class
 // ==========
+//
+// The text formats are parsed from a memory-mapped file, split into
+// chunks parsed in parallel straight into the arrays of the mesh. If a
+// cache directory is set, read() also keeps a binary copy of each mesh
+// there, loaded instead of the file while newer than it. No cache directory
+// is set by default, so read() never writes next to the assets.
 class MeshReader
 {
 public:
+  // Reads a Wavefront OBJ file. Polygons are split into triangle fans.
   static TriangleMesh* readOBJ(const char* filename);
 
+  // Reads an ASCII or binary little endian PLY file.
+  static TriangleMesh* readPLY(const char* filename);
+
+  // Reads a mesh in the binary form written by writeCache().
+  static TriangleMesh* readCache(const char* filename);
+
+  // Writes the binary form of a mesh. Returns false on failure.
+  static bool writeCache(const TriangleMesh& mesh, const char* filename);
+
+  // Returns the directory of the binary copies kept by read(), or an
+  // empty string if read() keeps none.
+  static const std::string& cacheDirectory();
+
+  // Sets the directory of the binary copies kept by read(), created when
+  // first written to. An empty string disables the cache. Set it before
+  // any mesh is read: it is not synchronized with concurrent reads.
+  static void setCacheDirectory(const std::string& directory);
+
+  // Reads an OBJ or PLY file, chosen by the file extension, through its
+  // binary copy in the cache directory, if any. Returns nullptr on failure.
+  static TriangleMesh* read(const char* filename);
+
 }; // MeshReader
 
 } // end namespace cg
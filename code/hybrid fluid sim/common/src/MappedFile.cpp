@@ -0,0 +1,121 @@
+//[]---------------------------------------------------------------[]
+//|                                                                 |
+//| Copyright (C) 2019 Orthrus Group.                               |
+//|                                                                 |
+//| This software is provided 'as-is', without any express or       |
+//| implied warranty. In no event will the authors be held liable   |
+//| for any damages arising from the use of this software.          |
+//|                                                                 |
+//| Permission is granted to anyone to use this software for any    |
+//| purpose, including commercial applications, and to alter it and |
+//| redistribute it freely, subject to the following restrictions:  |
+//|                                                                 |
+//| 1. The origin of this software must not be misrepresented; you  |
+//| must not claim that you wrote the original software. If you use |
+//| this software in a product, an acknowledgment in the product    |
+//| documentation would be appreciated but is not required.         |
+//|                                                                 |
+//| 2. Altered source versions must be plainly marked as such, and  |
+//| must not be misrepresented as being the original software.      |
+//|                                                                 |
+//| 3. This notice may not be removed or altered from any source    |
+//| distribution.                                                   |
+//|                                                                 |
+//[]---------------------------------------------------------------[]
+//
+// OVERVIEW: MappedFile.cpp
+// ========
+// Source file for read-only memory-mapped file.
+//
+// Last revision: 17/10/2026
+
+#include "utils/MappedFile.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cg
+{ // begin namespace cg
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// MappedFile implementation
+// ==========
+bool
+MappedFile::open(const char* filename)
+{
+  close();
+#ifdef _WIN32
+  auto file = CreateFileA(filename,
+    GENERIC_READ,
+    FILE_SHARE_READ,
+    nullptr,
+    OPEN_EXISTING,
+    FILE_FLAG_SEQUENTIAL_SCAN,
+    nullptr);
+
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+
+  if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+  {
+    auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (mapping != nullptr)
+    {
+      _data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+    }
+    _size = _data != nullptr ? size_t(size.QuadPart) : 0;
+  }
+  CloseHandle(file);
+#else
+  auto fd = ::open(filename, O_RDONLY);
+
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    auto data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (data != MAP_FAILED)
+    {
+      _data = (const char*)data;
+      _size = size_t(st.st_size);
+    }
+  }
+  ::close(fd);
+#endif
+  return _data != nullptr;
+}
+
+void
+MappedFile::close()
+{
+  if (_data == nullptr)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(_data);
+#else
+  munmap((void*)_data, _size);
+#endif
+  _data = nullptr;
+  _size = 0;
+}
+
+} // end namespace cg
@@ -28,205 +28,783 @@
 // Source file for mesh reader.
 //
 // Author: Paulo Pagliosa
-// Last revision: 27/05/2019
+// Last revision: 17/10/2026
 
+#include "utils/MappedFile.h"
 #include "utils/MeshReader.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace cg
 { // begin namespace cg
 
-namespace internal
-{ // begin namespace internal
+namespace
+{ // begin anonymous namespace
+
+// Chunks smaller than this are not worth a thread of their own
+constexpr size_t minMeshChunkSize = 1 << 20;
+
+inline bool
+isBlank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool
+isDigit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+inline const char*
+skipBlanks(const char* p, const char* end)
+{
+  while (p < end && isBlank(*p))
+    ++p;
+  return p;
+}
+
+// Returns the start of the line after the one of p.
+inline const char*
+skipLine(const char* p, const char* end)
+{
+  auto eol = (const char*)memchr(p, '\n', end - p);
+  return eol != nullptr ? eol + 1 : end;
+}
+
+inline const char*
+skipToken(const char* p, const char* end)
+{
+  while (p < end && !isBlank(*p) && *p != '\n')
+    ++p;
+  return p;
+}
+
+inline bool
+isEndOfLine(const char* p, const char* end)
+{
+  return p == end || *p == '\n';
+}
+
+inline double
+powerOf10(int e)
+{
+  // exact in double, so a division by them rounds correctly
+  static const double table[] =
+  {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  return e <= 22 ? table[e] : std::pow(10.0, e);
+}
+
+// Parses a decimal number at p, without allocating or going through the
+// locale, and moves p past it. Returns false if there is no number at p.
+bool
+parseNumber(const char*& p, const char* end, double& value)
+{
+  auto s = p;
+  bool negative = false;
+
+  if (s < end && (*s == '-' || *s == '+'))
+    negative = *s++ == '-';
+
+  uint64_t mantissa = 0;
+  int exponent = 0;
+  bool hasDigits = false;
+
+  // digits beyond the 18th only change the exponent
+  for (; s < end && isDigit(*s); ++s, hasDigits = true)
+    if (mantissa < 100000000000000000ull)
+      mantissa = mantissa * 10 + (*s - '0');
+    else
+      ++exponent;
+  if (s < end && *s == '.')
+    for (++s; s < end && isDigit(*s); ++s, hasDigits = true)
+      if (mantissa < 100000000000000000ull)
+      {
+        mantissa = mantissa * 10 + (*s - '0');
+        --exponent;
+      }
+  if (!hasDigits)
+    return false;
+  if (s < end && (*s == 'e' || *s == 'E'))
+  {
+    auto e = s + 1;
+    bool negativeExponent = false;
+
+    if (e < end && (*e == '-' || *e == '+'))
+      negativeExponent = *e++ == '-';
+    if (e < end && isDigit(*e))
+    {
+      int x = 0;
+
+      for (; e < end && isDigit(*e); ++e)
+        if (x < 10000)
+          x = x * 10 + (*e - '0');
+      exponent += negativeExponent ? -x : x;
+      s = e;
+    }
+  }
+
+  auto v = double(mantissa);
+
+  if (exponent < 0)
+    v /= powerOf10(-exponent);
+  else if (exponent > 0)
+    v *= powerOf10(exponent);
+  value = negative ? -v : v;
+  p = s;
+  return true;
+}
+
+inline bool
+parseInt(const char*& p, const char* end, int64_t& value)
+{
+  auto s = p;
+  bool negative = false;
+
+  if (s < end && (*s == '-' || *s == '+'))
+    negative = *s++ == '-';
+  if (s == end || !isDigit(*s))
+    return false;
+
+  int64_t v = 0;
+
+  for (; s < end && isDigit(*s); ++s)
+    v = v * 10 + (*s - '0');
+  value = negative ? -v : v;
+  p = s;
+  return true;
+}
+
+// Runs f(0), ..., f(n - 1) on n threads, f(0) on the caller.
+template <typename F>
+void
+parallelChunks(size_t n, const F& f)
+{
+  std::vector<std::thread> threads;
+
+  threads.reserve(n);
+  for (size_t i = 1; i < n; ++i)
+    threads.emplace_back(f, i);
+  if (n > 0)
+    f(0);
+  for (auto& thread : threads)
+    thread.join();
+}
+
+// Splits [begin, end) into chunks of whole lines, one per thread.
+std::vector<const char*>
+splitLines(const char* begin, const char* end)
+{
+  auto size = size_t(end - begin);
+  auto n = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u),
+    size / minMeshChunkSize + 1);
+  std::vector<const char*> bounds{begin};
+
+  for (size_t i = 1; i < n; ++i)
+  {
+    auto p = std::max(begin + size * i / n, bounds.back());
+
+    bounds.push_back(p == begin ? p : skipLine(p - 1, end));
+  }
+  bounds.push_back(end);
+  return bounds;
+}
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// OBJ reader
+// ==========
+struct ObjChunk
+{
+  const char* begin;
+  const char* end;
+  int numberOfVertices{};
+  int numberOfTriangles{};
+  int firstVertex{};
+  int firstTriangle{};
+  bool ok{true};
+
+}; // ObjChunk
+
+inline bool
+isObjCommand(const char* p, const char* end, char c)
+{
+  return p + 1 < end && p[0] == c && isBlank(p[1]);
+}
 
 void
-readMeshSize(FILE* file, TriangleMesh::Data& data)
+countOBJ(ObjChunk& chunk)
 {
-  const unsigned int lineSize{128};
-  int nv{};
-  int nt{};
+  auto end = chunk.end;
 
-  for (char line[lineSize]; fscanf_s(file, "%s", line, lineSize) != EOF;)
-    switch (line[0])
+  for (auto p = chunk.begin; p < end; p = skipLine(p, end))
+  {
+    p = skipBlanks(p, end);
+    if (isObjCommand(p, end, 'v'))
+      chunk.numberOfVertices++;
+    else if (isObjCommand(p, end, 'f'))
     {
-      case 'v':
-        if (line[1] == '\0')
-            nv++;
-        fgets(line, lineSize, file);
-        break;
+      int n = 0;
 
-      case 'f':
-      {
-        int v;
-        int n;
-        int t;
+      for (p = skipBlanks(p + 1, end); !isEndOfLine(p, end); ++n)
+        p = skipBlanks(skipToken(p, end), end);
+      if (n >= 3)
+        chunk.numberOfTriangles += n - 2;
+    }
+  }
+}
+
+void
+parseOBJ(ObjChunk& chunk, TriangleMesh::Data& data)
+{
+  auto end = chunk.end;
+  auto vertex = data.vertices + chunk.firstVertex;
+  auto triangle = data.triangles + chunk.firstTriangle;
+  // number of vertices up to this line, for relative (negative) indices
+  int64_t nv = chunk.firstVertex;
+
+  for (auto p = chunk.begin; p < end; p = skipLine(p, end))
+  {
+    p = skipBlanks(p, end);
+    if (isObjCommand(p, end, 'v'))
+    {
+      double x[3];
 
-        fscanf_s(file, "%s", line, lineSize);
-        /* can be one of %d, %d//%d, %d/%d, %d/%d/%d %d//%d */
-        if (strstr(line, "//"))
+      p++;
+      for (int i = 0; i < 3; ++i)
+        if (!parseNumber(p = skipBlanks(p, end), end, x[i]))
         {
-          /* v//n */
-          sscanf_s(line, "%d//%d", &v, &n);
-          fscanf_s(file, "%d//%d", &v, &n);
-          fscanf_s(file, "%d//%d", &v, &n);
-          nt++;
-          while (fscanf_s(file, "%d//%d", &v, &n) > 0)
-            nt++;
+          chunk.ok = false;
+          return;
         }
-        else if (sscanf_s(line, "%d/%d/%d", &v, &t, &n) == 3)
+      (vertex++)->set(float(x[0]), float(x[1]), float(x[2]));
+      nv++;
+    }
+    else if (isObjCommand(p, end, 'f'))
+    {
+      /* each vertex can be one of v, v/t, v//n or v/t/n */
+      int v[2];
+      int n = 0;
+
+      for (p = skipBlanks(p + 1, end); !isEndOfLine(p, end); ++n)
+      {
+        int64_t i;
+
+        if (!parseInt(p, end, i) || i == 0)
         {
-          /* v/t/n */
-          fscanf_s(file, "%d/%d/%d", &v, &t, &n);
-          fscanf_s(file, "%d/%d/%d", &v, &t, &n);
-          nt++;
-          while (fscanf_s(file, "%d/%d/%d", &v, &t, &n) > 0)
-            nt++;
+          chunk.ok = false;
+          return;
         }
-        else if (sscanf_s(line, "%d/%d", &v, &t) == 2)
+        i = i > 0 ? i - 1 : nv + i;
+        if (i < 0 || i >= data.numberOfVertices)
         {
-          /* v/t */
-          fscanf_s(file, "%d/%d", &v, &t);
-          fscanf_s(file, "%d/%d", &v, &t);
-          nt++;
-          while (fscanf_s(file, "%d/%d", &v, &t) > 0)
-            nt++;
+          chunk.ok = false;
+          return;
         }
+        p = skipBlanks(skipToken(p, end), end);
+        if (n < 2)
+          v[n] = int(i);
         else
         {
-          /* v */
-          fscanf_s(file, "%d", &v);
-          fscanf_s(file, "%d", &v);
-          nt++;
-          while (fscanf_s(file, "%d", &v) > 0)
-            nt++;
+          (triangle++)->setVertices(v[0], v[1], int(i));
+          v[1] = int(i);
         }
-        break;
       }
-
-      default:
-        fgets(line, lineSize, file);
     }
-  data.numberOfVertices = nv;
-  data.numberOfTriangles = nt;
+  }
 }
 
-void
-readMeshData(FILE* file, TriangleMesh::Data& data)
+
+/////////////////////////////////////////////////////////////////////
+//
+// PLY reader
+// ==========
+enum class PlyType
+{
+  Int8,
+  UInt8,
+  Int16,
+  UInt16,
+  Int32,
+  UInt32,
+  Float32,
+  Float64,
+  Invalid
+
+}; // PlyType
+
+inline PlyType
+plyType(const std::string& name)
+{
+  if (name == "char" || name == "int8")
+    return PlyType::Int8;
+  if (name == "uchar" || name == "uint8")
+    return PlyType::UInt8;
+  if (name == "short" || name == "int16")
+    return PlyType::Int16;
+  if (name == "ushort" || name == "uint16")
+    return PlyType::UInt16;
+  if (name == "int" || name == "int32")
+    return PlyType::Int32;
+  if (name == "uint" || name == "uint32")
+    return PlyType::UInt32;
+  if (name == "float" || name == "float32")
+    return PlyType::Float32;
+  if (name == "double" || name == "float64")
+    return PlyType::Float64;
+  return PlyType::Invalid;
+}
+
+inline size_t
+plySize(PlyType type)
+{
+  static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8, 0};
+  return sizes[int(type)];
+}
+
+// Reads a binary little endian value.
+inline double
+plyValue(const char* p, PlyType type)
+{
+  switch (type)
+  {
+#define PLY_VALUE(Type, T) case PlyType::Type: { T v; memcpy(&v, p, sizeof(T)); return double(v); }
+    PLY_VALUE(Int8, int8_t)
+    PLY_VALUE(UInt8, uint8_t)
+    PLY_VALUE(Int16, int16_t)
+    PLY_VALUE(UInt16, uint16_t)
+    PLY_VALUE(Int32, int32_t)
+    PLY_VALUE(UInt32, uint32_t)
+    PLY_VALUE(Float32, float)
+    PLY_VALUE(Float64, double)
+#undef PLY_VALUE
+    default:
+      return 0;
+  }
+}
+
+struct PlyProperty
+{
+  std::string name;
+  PlyType type;
+  PlyType countType{PlyType::Invalid}; // of list properties only
+
+  bool isList() const
+  {
+    return countType != PlyType::Invalid;
+  }
+
+}; // PlyProperty
+
+struct PlyElement
+{
+  std::string name;
+  size_t count;
+  std::vector<PlyProperty> properties;
+
+  // Returns the size of a binary element, or 0 if it has lists.
+  size_t fixedSize() const
+  {
+    size_t size = 0;
+
+    for (auto& property : properties)
+      if (property.isList())
+        return 0;
+      else
+        size += plySize(property.type);
+    return size;
+  }
+
+  int find(const char* name) const
+  {
+    for (size_t i = 0; i < properties.size(); ++i)
+      if (properties[i].name == name)
+        return int(i);
+    return -1;
+  }
+
+}; // PlyElement
+
+// Reads a token of a header line.
+inline std::string
+plyToken(const char*& p, const char* end)
 {
-  const unsigned int lineSize{128};
-  auto vertex = data.vertices;
-  auto triangle = data.triangles;
+  auto s = skipBlanks(p, end);
 
-  for (char line[lineSize]; fscanf_s(file, "%s", line, lineSize) != EOF;)
-    switch (line[0])
+  p = skipToken(s, end);
+  return std::string(s, p);
+}
+
+// Parses the header. Returns the start of the body, or nullptr.
+const char*
+parsePlyHeader(const char* p,
+  const char* end,
+  bool& binary,
+  std::vector<PlyElement>& elements)
+{
+  if (end - p < 4 || memcmp(p, "ply", 3) != 0)
+    return nullptr;
+  for (p = skipLine(p, end); p < end; p = skipLine(p, end))
+  {
+    auto s = p;
+    auto keyword = plyToken(s, end);
+
+    if (keyword == "format")
     {
-      case 'v':
-      {
-        float x;
-        float y;
-        float z;
+      auto format = plyToken(s, end);
 
-        switch (line[1])
-        {
-          case '\0':
-            fscanf_s(file, "%f %f %f", &x, &y, &z);
-            vertex->set(x, y, z);
-            vertex++;
-            break;
-
-          default:
-            fgets(line, lineSize, file);
-        }
-        break;
+      if (format == "binary_little_endian")
+        binary = true;
+      else if (format != "ascii")
+        return nullptr;
+    }
+    else if (keyword == "element")
+    {
+      auto name = plyToken(s, end);
+      int64_t count;
+
+      if (!parseInt(s = skipBlanks(s, end), end, count) || count < 0)
+        return nullptr;
+      elements.push_back({name, size_t(count), {}});
+    }
+    else if (keyword == "property")
+    {
+      if (elements.empty())
+        return nullptr;
+
+      PlyProperty property;
+      auto type = plyToken(s, end);
+
+      if (type == "list")
+      {
+        property.countType = plyType(plyToken(s, end));
+        type = plyToken(s, end);
+        if (property.countType == PlyType::Invalid)
+          return nullptr;
       }
+      property.type = plyType(type);
+      property.name = plyToken(s, end);
+      if (property.type == PlyType::Invalid)
+        return nullptr;
+      elements.back().properties.push_back(property);
+    }
+    else if (keyword == "end_header")
+      return skipLine(p, end);
+  }
+  return nullptr;
+}
+
+// Returns the offsets of the x, y and z properties in a fixed size
+// element, or false if some of them is missing.
+bool
+plyOffsets(const PlyElement& element, size_t offset[3], PlyType type[3])
+{
+  for (int i = 0; i < 3; ++i)
+  {
+    const char name[2] = {"xyz"[i], '\0'};
+    auto k = element.find(name);
+
+    if (k < 0)
+      return false;
+    offset[i] = 0;
+    for (int j = 0; j < k; ++j)
+      offset[i] += plySize(element.properties[j].type);
+    type[i] = element.properties[k].type;
+  }
+  return true;
+}
+
+// Walks the elements of a binary body. The first pass only counts the
+// triangles of the faces into data; the second one reads the vertices
+// and the triangles. Returns false if the body is truncated.
+bool
+parseBinaryPly(const char* p,
+  const char* end,
+  const std::vector<PlyElement>& elements,
+  TriangleMesh::Data& data,
+  bool countOnly)
+{
+  int nt = 0;
 
-      case 'f':
+  for (auto& element : elements)
+  {
+    auto isVertex = element.name == "vertex";
+    auto isFace = element.name == "face";
+    auto stride = element.fixedSize();
+
+    if (stride != 0)
+    {
+      if (size_t(end - p) / stride < element.count)
+        return false;
+      if (isVertex && !countOnly)
       {
-        int v;
-        int n;
-        int t;
+        size_t offset[3];
+        PlyType type[3];
 
-        fscanf_s(file, "%s", line, lineSize);
-        /* Can be one of %d, %d//%d, %d/%d, %d/%d/%d %d//%d */
-        if (strstr(line, "//"))
-        {
-          /* v//n */
-          sscanf_s(line, "%d//%d", &v, &n);
-          triangle->v[0] = v - 1;
-          fscanf_s(file, "%d//%d", &v, &n);
-          triangle->v[1] = v - 1;
-          fscanf_s(file, "%d//%d", &v, &n);
-          triangle->v[2] = v - 1;
-          triangle++;
-          while (fscanf_s(file, "%d//%d", &v, &n) > 0)
+        if (!plyOffsets(element, offset, type))
+          return false;
+
+        // fixed size vertices are decoded in parallel
+        auto n = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u),
+          element.count * stride / minMeshChunkSize + 1);
+        auto base = p;
+
+        parallelChunks(n, [&](size_t c) {
+          auto last = element.count * (c + 1) / n;
+
+          for (auto i = element.count * c / n; i < last; ++i)
           {
-            triangle->v[0] = triangle[-1].v[0];
-            triangle->v[1] = triangle[-1].v[2];
-            triangle->v[2] = v - 1;
-            triangle++;
+            auto v = base + i * stride;
+
+            data.vertices[i].set(float(plyValue(v + offset[0], type[0])),
+              float(plyValue(v + offset[1], type[1])),
+              float(plyValue(v + offset[2], type[2])));
           }
+        });
+      }
+      p += stride * element.count;
+      continue;
+    }
+    for (size_t i = 0; i < element.count; ++i)
+      for (auto& property : element.properties)
+      {
+        if (!property.isList())
+        {
+          auto size = plySize(property.type);
+
+          if (size_t(end - p) < size)
+            return false;
+          if (isVertex && !countOnly && property.name.size() == 1)
+            switch (property.name[0])
+            {
+              case 'x':
+              case 'y':
+              case 'z':
+                data.vertices[i][property.name[0] - 'x'] =
+                  float(plyValue(p, property.type));
+            }
+          p += size;
+          continue;
         }
-        else if (sscanf_s(line, "%d/%d/%d", &v, &t, &n) == 3)
+
+        auto countSize = plySize(property.countType);
+        auto itemSize = plySize(property.type);
+
+        if (size_t(end - p) < countSize)
+          return false;
+
+        auto count = size_t(plyValue(p, property.countType));
+
+        p += countSize;
+        if (size_t(end - p) / itemSize < count)
+          return false;
+        if (isFace && count >= 3 && property.name.compare(0, 10, "vertex_ind") == 0)
         {
-          /* v/t/n */
-          triangle->v[0] = v - 1;
-          fscanf_s(file, "%d/%d/%d", &v, &t, &n);
-          triangle->v[1] = v - 1;
-          fscanf_s(file, "%d/%d/%d", &v, &t, &n);
-          triangle->v[2] = v - 1;
-          triangle++;
-          while (fscanf_s(file, "%d/%d/%d", &v, &t, &n) > 0)
+          if (!countOnly)
           {
-            triangle->v[0] = triangle[-1].v[0];
-            triangle->v[1] = triangle[-1].v[2];
-            triangle->v[2] = v - 1;
-            triangle++;
+            auto triangle = data.triangles + nt;
+            auto v0 = int(plyValue(p, property.type));
+            auto v1 = int(plyValue(p + itemSize, property.type));
+
+            for (size_t k = 2; k < count; ++k, ++triangle)
+            {
+              auto v2 = int(plyValue(p + k * itemSize, property.type));
+
+              triangle->setVertices(v0, v1, v2);
+              v1 = v2;
+            }
           }
+          nt += int(count - 2);
         }
-        else if (sscanf_s(line, "%d/%d", &v, &t) == 2)
+        p += count * itemSize;
+      }
+  }
+  if (countOnly)
+    data.numberOfTriangles = nt;
+  return true;
+}
+
+// Walks the elements of an ASCII body, one element per line, like
+// parseBinaryPly().
+bool
+parseAsciiPly(const char* p,
+  const char* end,
+  const std::vector<PlyElement>& elements,
+  TriangleMesh::Data& data,
+  bool countOnly)
+{
+  int nt = 0;
+
+  for (auto& element : elements)
+  {
+    auto isVertex = element.name == "vertex";
+    auto isFace = element.name == "face";
+
+    for (size_t i = 0; i < element.count; ++i, p = skipLine(p, end))
+    {
+      if (p == end)
+        return false;
+      if (countOnly && !isFace)
+        continue;
+      for (auto& property : element.properties)
+      {
+        double value;
+
+        if (!parseNumber(p = skipBlanks(p, end), end, value))
+          return false;
+        if (!property.isList())
         {
-          /* v/t */
-          triangle->v[0] = v - 1;
-          fscanf_s(file, "%d/%d", &v, &t);
-          triangle->v[1] = v - 1;
-          fscanf_s(file, "%d/%d", &v, &t);
-          triangle->v[2] = v - 1;
-          triangle++;
-          while (fscanf_s(file, "%d/%d", &v, &t) > 0)
-          {
-            triangle->v[0] = triangle[-1].v[0];
-            triangle->v[1] = triangle[-1].v[2];
-            triangle->v[2] = v - 1;
-            triangle++;
-          }
+          if (isVertex && !countOnly && property.name.size() == 1)
+            switch (property.name[0])
+            {
+              case 'x':
+              case 'y':
+              case 'z':
+                data.vertices[i][property.name[0] - 'x'] = float(value);
+            }
+          continue;
         }
-        else
+
+        auto count = size_t(value);
+        auto isIndexList = isFace && property.name.compare(0, 10, "vertex_ind") == 0;
+        int v[2];
+
+        for (size_t k = 0; k < count; ++k)
         {
-          /* v */
-          sscanf_s(line, "%d", &v);
-          triangle->v[0] = v - 1;
-          fscanf_s(file, "%d", &v);
-          triangle->v[1] = v - 1;
-          fscanf_s(file, "%d", &v);
-          triangle->v[2] = v - 1;
-          triangle++;
-          while (fscanf_s(file, "%d", &v) > 0)
+          if (!parseNumber(p = skipBlanks(p, end), end, value))
+            return false;
+          if (!isIndexList || countOnly)
+            continue;
+          if (k < 2)
+            v[k] = int(value);
+          else
           {
-            triangle->v[0] = triangle[-1].v[0];
-            triangle->v[1] = triangle[-1].v[2];
-            triangle->v[2] = v - 1;
-            triangle++;
+            data.triangles[nt + k - 2].setVertices(v[0], v[1], int(value));
+            v[1] = int(value);
           }
         }
-        break;
+        if (isIndexList && count >= 3)
+          nt += int(count - 2);
       }
-
-      default:
-        fgets(line, lineSize, file);
     }
+  }
+  if (countOnly)
+    data.numberOfTriangles = nt;
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////
+//
+// Binary cache
+// ============
+struct MeshCacheHeader
+{
+  char magic[8];
+  int32_t numberOfVertices;
+  int32_t numberOfTriangles;
+  int32_t hasNormals;
+  int32_t reserved;
+
+}; // MeshCacheHeader
+
+const char meshCacheMagic[8] = {'C', 'G', 'M', 'E', 'S', 'H', '1', '\0'};
+
+// Directory of the binary copies kept by MeshReader::read()
+inline std::string&
+meshCacheDirectory()
+{
+  static std::string directory;
+  return directory;
+}
+
+// Returns the name of the binary copy of a mesh file in the cache
+// directory: the file stem followed by a hash of the absolute path, so
+// meshes of the same name in different directories do not collide.
+inline std::filesystem::path
+meshCachePath(const char* filename)
+{
+  namespace fs = std::filesystem;
+
+  std::error_code e;
+  auto path = fs::absolute(filename, e);
+
+  if (e)
+    path = filename;
+
+  char hash[17];
+
+  snprintf(hash,
+    sizeof(hash),
+    "%016llx",
+    (unsigned long long)std::hash<std::string>{}(path.lexically_normal().string()));
+  return fs::path(meshCacheDirectory()) /
+    (path.stem().string() + '_' + hash + ".cgm");
 }
 
-} // end namespace internal
+static_assert(sizeof(vec3f) == 3 * sizeof(float), "packed vec3f expected");
+static_assert(sizeof(TriangleMesh::Triangle) == 3 * sizeof(int), "packed triangle expected");
+
+// Owns the arrays of mesh data until they are handed to a mesh.
+struct MeshDataHolder
+{
+  TriangleMesh::Data data{};
+
+  MeshDataHolder(int nv, int nt, bool normals)
+  {
+    data.numberOfVertices = nv;
+    data.numberOfTriangles = nt;
+    data.vertices = new vec3f[nv];
+    data.vertexNormals = normals ? new vec3f[nv] : nullptr;
+    data.triangles = new TriangleMesh::Triangle[nt];
+  }
+
+  ~MeshDataHolder()
+  {
+    delete []data.vertices;
+    delete []data.vertexNormals;
+    delete []data.triangles;
+  }
+
+  // Checks the vertex indices of the triangles.
+  bool isValid() const
+  {
+    auto nv = data.numberOfVertices;
+    auto t = data.triangles;
+
+    for (int i = 0; i < data.numberOfTriangles; ++i, ++t)
+      for (int j = 0; j < 3; ++j)
+        if (t->v[j] < 0 || t->v[j] >= nv)
+          return false;
+    return true;
+  }
+
+  TriangleMesh* release(bool computeNormals = true)
+  {
+    auto mesh = new TriangleMesh{std::move(data)};
+
+    if (computeNormals)
+      mesh->computeNormals();
+    return mesh;
+  }
+
+}; // MeshDataHolder
+
+} // end anonymous namespace
 
 
 /////////////////////////////////////////////////////////////////////
@@ -236,26 +814,211 @@ readMeshData(FILE* file, TriangleMesh::Data& data)
 TriangleMesh*
 MeshReader::readOBJ(const char* filename)
 {
-  FILE* file;
+  MappedFile file;
 
-  fopen_s(&file, filename, "r");
-  if (file == nullptr)
+  if (!file.open(filename))
     return nullptr;
+  printf("Reading Wavefront OBJ file %s...\n", filename);
 
-  TriangleMesh::Data data;
+  auto bounds = splitLines(file.data(), file.data() + file.size());
+  std::vector<ObjChunk> chunks;
 
-  internal::readMeshSize(file, data);
-  data.vertices = new vec3f[data.numberOfVertices];
-  data.vertexNormals = nullptr;
-  data.triangles = new TriangleMesh::Triangle[data.numberOfTriangles];
-  rewind(file);
-  printf("Reading Wavefront OBJ file %s...\n", filename);
-  internal::readMeshData(file, data);
-  fclose(file);
+  for (size_t i = 0; i + 1 < bounds.size(); ++i)
+    chunks.push_back({bounds[i], bounds[i + 1]});
+  parallelChunks(chunks.size(), [&](size_t i) {
+    countOBJ(chunks[i]);
+  });
+
+  // each chunk writes its vertices and triangles after the previous ones
+  int nv = 0;
+  int nt = 0;
+
+  for (auto& chunk : chunks)
+  {
+    chunk.firstVertex = nv;
+    chunk.firstTriangle = nt;
+    nv += chunk.numberOfVertices;
+    nt += chunk.numberOfTriangles;
+  }
+
+  MeshDataHolder holder{nv, nt, false};
+
+  parallelChunks(chunks.size(), [&](size_t i) {
+    parseOBJ(chunks[i], holder.data);
+  });
+  for (auto& chunk : chunks)
+    if (!chunk.ok)
+      return nullptr;
+  return holder.release();
+}
+
+TriangleMesh*
+MeshReader::readPLY(const char* filename)
+{
+  MappedFile file;
+
+  if (!file.open(filename))
+    return nullptr;
+  printf("Reading PLY file %s...\n", filename);
+
+  auto end = file.data() + file.size();
+  bool binary = false;
+  std::vector<PlyElement> elements;
+  auto body = parsePlyHeader(file.data(), end, binary, elements);
+
+  if (body == nullptr)
+    return nullptr;
+
+  int nv = 0;
+
+  for (auto& element : elements)
+    if (element.name == "vertex")
+    {
+      if (element.find("x") < 0 || element.find("y") < 0 || element.find("z") < 0)
+        return nullptr;
+      nv = int(element.count);
+    }
+
+  auto parse = binary ? parseBinaryPly : parseAsciiPly;
+  TriangleMesh::Data counts{};
+
+  if (!parse(body, end, elements, counts, true))
+    return nullptr;
+
+  MeshDataHolder holder{nv, counts.numberOfTriangles, false};
+
+  if (!parse(body, end, elements, holder.data, false) || !holder.isValid())
+    return nullptr;
+  return holder.release();
+}
+
+TriangleMesh*
+MeshReader::readCache(const char* filename)
+{
+  MappedFile file;
+
+  if (!file.open(filename) || file.size() < sizeof(MeshCacheHeader))
+    return nullptr;
+
+  MeshCacheHeader header;
+
+  memcpy(&header, file.data(), sizeof(header));
+  if (memcmp(header.magic, meshCacheMagic, sizeof(header.magic)) != 0 ||
+    header.numberOfVertices < 0 || header.numberOfTriangles < 0)
+    return nullptr;
+
+  auto nv = size_t(header.numberOfVertices);
+  auto nt = size_t(header.numberOfTriangles);
+  auto vertexSize = nv * sizeof(vec3f);
+  auto triangleSize = nt * sizeof(TriangleMesh::Triangle);
+
+  if (file.size() != sizeof(header) + vertexSize * (header.hasNormals ? 2 : 1) + triangleSize)
+    return nullptr;
+
+  MeshDataHolder holder{int(nv), int(nt), header.hasNormals != 0};
+  auto p = file.data() + sizeof(header);
+
+  memcpy(holder.data.vertices, p, vertexSize);
+  p += vertexSize;
+  if (header.hasNormals)
+  {
+    memcpy(holder.data.vertexNormals, p, vertexSize);
+    p += vertexSize;
+  }
+  memcpy(holder.data.triangles, p, triangleSize);
+  if (!holder.isValid())
+    return nullptr;
+  return holder.release(!header.hasNormals);
+}
+
+bool
+MeshReader::writeCache(const TriangleMesh& mesh, const char* filename)
+{
+  const auto& data = mesh.data();
+  MeshCacheHeader header{};
+
+  memcpy(header.magic, meshCacheMagic, sizeof(header.magic));
+  header.numberOfVertices = data.numberOfVertices;
+  header.numberOfTriangles = data.numberOfTriangles;
+  header.hasNormals = data.vertexNormals != nullptr;
+
+  // written aside and renamed, so a reader never sees a partial cache
+  auto temp = std::string(filename) + ".tmp";
+  std::ofstream file{temp, std::ios::binary};
+  auto vertexSize = size_t(data.numberOfVertices) * sizeof(vec3f);
+
+  file.write((const char*)&header, sizeof(header));
+  file.write((const char*)data.vertices, vertexSize);
+  if (header.hasNormals)
+    file.write((const char*)data.vertexNormals, vertexSize);
+  file.write((const char*)data.triangles,
+    size_t(data.numberOfTriangles) * sizeof(TriangleMesh::Triangle));
+  file.close();
+
+  std::error_code e;
+
+  if (file.fail())
+  {
+    std::filesystem::remove(temp, e);
+    return false;
+  }
+  std::filesystem::rename(temp, filename, e);
+  if (e)
+    std::filesystem::remove(temp, e);
+  return !e;
+}
+
+const std::string&
+MeshReader::cacheDirectory()
+{
+  return meshCacheDirectory();
+}
+
+void
+MeshReader::setCacheDirectory(const std::string& directory)
+{
+  meshCacheDirectory() = directory;
+}
+
+TriangleMesh*
+MeshReader::read(const char* filename)
+{
+  namespace fs = std::filesystem;
+
+  std::error_code e;
+  auto useCache = !cacheDirectory().empty();
+  auto cache = useCache ? meshCachePath(filename).string() : std::string{};
+
+  if (useCache)
+  {
+    auto time = fs::last_write_time(filename, e);
+
+    if (!e)
+    {
+      auto cacheTime = fs::last_write_time(cache, e);
+
+      if (!e && cacheTime >= time)
+        if (auto mesh = readCache(cache.c_str()))
+          return mesh;
+    }
+  }
+
+  auto extension = fs::path(filename).extension().string();
+
+  for (auto& c : extension)
+    c = char(tolower(c));
 
-  auto mesh = new TriangleMesh{std::move(data)};
+  TriangleMesh* mesh = nullptr;
 
-  mesh->computeNormals();
+  if (extension == ".obj")
+    mesh = readOBJ(filename);
+  else if (extension == ".ply")
+    mesh = readPLY(filename);
+  if (mesh != nullptr && useCache)
+  {
+    fs::create_directories(cacheDirectory(), e);
+    writeCache(*mesh, cache.c_str());
+  }
   return mesh;
 }
 
@@ -0,0 +1,204 @@
+#ifndef __AdaptiveDomain_h
+#define __AdaptiveDomain_h
+
+#include "geometry/Bounds3.h"
+#include "geometry/Index3.h"
+#include "math/Vector3.h"
+#include <algorithm>
+#include <cmath>
+
+namespace cg
+{
+
+/**
+* Moving window over the lattice of a simulation domain.
+*
+* The domain is a fixed lattice of size cells, from which only the window
+* around the active region of the simulation (dense smoke, particles...) is
+* allocated. The window is made of whole blocks of cells, so it only moves
+* when the active region crosses a block, and every move shifts the grid
+* data by a whole number of cells.
+*
+* \tparam D Defines the number of dimensions.
+* \tparam real A floating point type.
+*/
+template <size_t D, typename real>
+class AdaptiveDomain
+{
+public:
+  using vec_type = Vector<real, D>;
+  using bounds_type = Bounds<real, D>;
+
+  /** Constructs a domain whose window covers the whole lattice. */
+  AdaptiveDomain(const Index<D>& size, const vec_type& spacing, const vec_type& origin):
+    _size(size),
+    _spacing(spacing),
+    _origin(origin),
+    _windowMin(int64_t(0)),
+    _windowSize(size)
+  {
+    // do nothing
+  }
+
+  /** Returns the size of the whole lattice. */
+  const auto& size() const { return _size; }
+
+  /** Returns the cell spacing. */
+  const auto& spacing() const { return _spacing; }
+
+  /** Returns the origin of the whole lattice. */
+  const auto& origin() const { return _origin; }
+
+  /** Returns the bounds of the whole lattice. */
+  bounds_type bounds() const
+  {
+    return bounds_type{ _origin, _origin + _spacing * vec_type{ _size } };
+  }
+
+  /** Returns the number of cells kept around the active region. */
+  int margin() const { return _margin; }
+
+  /**
+  * Sets the number of cells kept around the active region.
+  *
+  * The active region must not travel farther than the margin between two
+  * window updates, so it should be at least the max CFL number.
+  */
+  void setMargin(int margin) { _margin = std::max(margin, 0); }
+
+  /** Returns the block size, in cells. */
+  int blockSize() const { return _blockSize; }
+
+  /** Sets the block size, in cells. */
+  void setBlockSize(int blockSize) { _blockSize = std::max(blockSize, 1); }
+
+  /** Returns the lattice index of the first cell of the window. */
+  const auto& windowMin() const { return _windowMin; }
+
+  /** Returns the window size. */
+  const auto& windowSize() const { return _windowSize; }
+
+  /** Returns the position of the min corner of the window. */
+  vec_type windowOrigin() const
+  {
+    return _origin + _spacing * vec_type{ _windowMin };
+  }
+
+  /** Returns the bounds of the window. */
+  bounds_type windowBounds() const
+  {
+    auto min = windowOrigin();
+    return bounds_type{ min, min + _spacing * vec_type{ _windowSize } };
+  }
+
+  /**
+  * Returns the closed boundary flag of the window.
+  *
+  * Window sides on the lattice boundary keep their \p flag, the other ones
+  * are open, since the fluid goes on beyond them.
+  */
+  int windowBoundaryFlag(int flag) const
+  {
+    for (size_t d = 0; d < D; ++d)
+    {
+      if (_windowMin[d] > 0)
+        flag &= ~(1 << (2 * d));
+      if (_windowMin[d] + _windowSize[d] < _size[d])
+        flag &= ~(1 << (2 * d + 1));
+    }
+    return flag;
+  }
+
+  /** Makes the window cover the whole lattice. Returns true if it moved. */
+  bool reset()
+  {
+    return setWindow(Index<D>(int64_t(0)), _size);
+  }
+
+  /**
+  * Fits the window to the cells from \p activeMin to \p activeMax
+  * (inclusive lattice indices) plus the margin.
+  *
+  * The window grows as soon as the active region gets closer than the
+  * margin to one of its sides, but a side only shrinks once the window is
+  * a whole block larger than needed there, so a region going back and forth
+  * over a block boundary does not reallocate the grids every step.
+  * Returns true if the window moved.
+  */
+  bool fit(const Index<D>& activeMin, const Index<D>& activeMax)
+  {
+    auto min = _windowMin;
+    auto max = _windowMin + _windowSize;
+
+    for (size_t d = 0; d < D; ++d)
+    {
+      auto lo = activeMin[d] - _margin;
+      auto hi = activeMax[d] + 1 + _margin;
+      auto blockLo = std::max<int64_t>(floorBlock(lo), 0);
+      auto blockHi = std::min<int64_t>(ceilBlock(hi), _size[d]);
+
+      if (lo < min[d] || min[d] + _blockSize <= blockLo)
+        min[d] = blockLo;
+      if (hi > max[d] || max[d] - _blockSize >= blockHi)
+        max[d] = blockHi;
+      if (max[d] <= min[d])
+        return false;
+    }
+    return setWindow(min, max - min);
+  }
+
+  /**
+  * Fits the window to the cells overlapping \p activeBounds plus the
+  * margin. Returns true if the window moved.
+  */
+  bool fit(const bounds_type& activeBounds)
+  {
+    Index<D> min, max;
+    for (size_t d = 0; d < D; ++d)
+    {
+      // a single point is a valid region, unlike for Bounds::empty()
+      if (activeBounds.min()[d] > activeBounds.max()[d])
+        return false;
+      min[d] = int64_t(std::floor((activeBounds.min()[d] - _origin[d]) / _spacing[d]));
+      max[d] = int64_t(std::floor((activeBounds.max()[d] - _origin[d]) / _spacing[d]));
+    }
+    return fit(min, max);
+  }
+
+  /**
+  * Sets the window to \p size cells from the lattice index \p min, as when
+  * restoring a checkpoint. Returns true if the window moved.
+  */
+  bool setWindow(const Index<D>& min, const Index<D>& size)
+  {
+    if (min == _windowMin && size == _windowSize)
+      return false;
+    _windowMin = min;
+    _windowSize = size;
+    return true;
+  }
+
+private:
+  Index<D> _size;
+  vec_type _spacing;
+  vec_type _origin;
+  Index<D> _windowMin;
+  Index<D> _windowSize;
+  int _margin{ 8 };
+  int _blockSize{ 16 };
+
+  int64_t floorBlock(int64_t i) const
+  {
+    return (i >= 0 ? i : i - _blockSize + 1) / _blockSize * _blockSize;
+  }
+
+  int64_t ceilBlock(int64_t i) const
+  {
+    return floorBlock(i + _blockSize - 1);
+  }
+
+}; // AdaptiveDomain
+
+} // end namespace cg
+
+#endif // __AdaptiveDomain_h
@@ -0,0 +1,124 @@
+#ifndef __BccLatticePointGenerator_h
+#define __BccLatticePointGenerator_h
+
+#include "PointGenerator.h"
+#include "Parallel.h"
+
+namespace cg
+{
+
+// Body-centered cubic lattice point generator.
+//
+// The lattice is made of square layers of points at spacing distance from
+// each other, stacked every half spacing along z, with every other layer
+// shifted by half spacing along x and y.
+template <typename real>
+class BccLatticePointGenerator final : public PointGenerator<3, real>
+{
+  ASSERT_REAL(real, "*BccLatticePointGenerator: real should be float or double");
+public:
+  using vec_type = Vector<real, 3>;
+  using bounds_type = Bounds<real, 3>;
+  using callback_type = typename PointGenerator<3, real>::callback_type;
+
+  // Appends the BCC lattice points inside boundingBox to points.
+  //
+  // The number of points of each layer is known beforehand, so the layers
+  // are written in parallel straight into their place in the array.
+  void generate(const bounds_type& bounds, real spacing, std::vector<vec_type>& points) const override
+  {
+    Layout layout{ bounds, spacing };
+    if (layout.layers == 0)
+      return;
+
+    auto first = points.size();
+    auto perLayer = [&](int k) {
+      auto n = layout.rowSize(k);
+      return size_t(n.x) * size_t(n.y);
+    };
+
+    std::vector<size_t> offsets(layout.layers + 1);
+    offsets[0] = first;
+    for (int k = 0; k < layout.layers; ++k)
+      offsets[k + 1] = offsets[k] + perLayer(k);
+    points.resize(offsets.back());
+
+    parallelFor(0, layout.layers, [&](int64_t k) {
+      auto id = offsets[k];
+      layout.forEachLayerPoint(int(k), [&](const vec_type& p) {
+        points[id++] = p;
+        return true;
+      });
+    });
+  }
+
+  // Invokes callback function for each BCC lattice point inside
+  // boundingBox.
+  void forEachPoint(const bounds_type& bounds, real spacing, const callback_type& callback) const override
+  {
+    Layout layout{ bounds, spacing };
+    for (int k = 0; k < layout.layers; ++k)
+      if (!layout.forEachLayerPoint(k, callback))
+        return;
+  }
+
+private:
+  struct Layout
+  {
+    vec_type min;
+    vec_type boxSize;
+    real spacing;
+    real halfSpacing;
+    int layers;
+
+    Layout(const bounds_type& bounds, real spacing):
+      min(bounds.min()),
+      boxSize(bounds.size()),
+      spacing(spacing),
+      halfSpacing(spacing * 0.5f)
+    {
+      layers = boxSize.z < 0 ? 0 : int(boxSize.z / halfSpacing) + 1;
+    }
+
+    real offset(int k) const
+    {
+      return (k & 1) ? halfSpacing : real(0.0f);
+    }
+
+    // number of points along x and y of layer k
+    Index2 rowSize(int k) const
+    {
+      auto o = offset(k);
+      auto count = [&](real size) {
+        return size < o ? int64_t(0) : int64_t((size - o) / spacing) + 1;
+      };
+      return Index2{ count(boxSize.x), count(boxSize.y) };
+    }
+
+    template <typename Callback>
+    bool forEachLayerPoint(int k, const Callback& callback) const
+    {
+      auto o = offset(k);
+      auto n = rowSize(k);
+      vec_type position;
+
+      position.z = k * halfSpacing + min.z;
+      for (int64_t j = 0; j < n.y; ++j)
+      {
+        position.y = j * spacing + o + min.y;
+        for (int64_t i = 0; i < n.x; ++i)
+        {
+          position.x = i * spacing + o + min.x;
+          if (!callback(position))
+            return false;
+        }
+      }
+      return true;
+    }
+  };
+
+}; // BccLatticePointGenerator
+
+} // end namespace cg
+
+#endif // __BccLatticePointGenerator_h
@@ -14,12 +14,13 @@ namespace cg
 * 
 * \tparam D Defines the number of dimensions.
 * \tparam real A floating point type.
+* \tparam S The storage type of the values, real or Half.
 */
-template <size_t D, typename real>
-class CellCenteredScalarGrid final: public ScalarGrid<D, real>
+template <size_t D, typename real, typename S = real>
+class CellCenteredScalarGrid final: public ScalarGrid<D, real, S>
 {
 public:
-  using Base = ScalarGrid<D, real>;     ///< Base class alias.
+  using Base = ScalarGrid<D, real, S>;  ///< Base class alias.
   using vec_type = Vector<real, D>;     ///< Vector type alias.
   using bounds_type = Bounds<real, D>;  ///< Bounding box type alias.
 
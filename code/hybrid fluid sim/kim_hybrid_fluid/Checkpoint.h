@@ -0,0 +1,214 @@
+#ifndef __Checkpoint_h
+#define __Checkpoint_h
+
+#include "geometry/Grid3.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace cg
+{
+
+/**
+* Binary checkpoint writer.
+*
+* The state is appended to an in-memory buffer, which is then written to a
+* file with a single sequential write. Values are stored as raw bytes, so a
+* checkpoint restores the exact same bits on the machine that wrote it.
+* Every block of state starts with a four-character tag, checked when the
+* checkpoint is read back.
+*/
+class CheckpointWriter
+{
+public:
+  /** Constructs a writer whose buffer starts with the file header. */
+  CheckpointWriter()
+  {
+    clear();
+  }
+
+  /** Discards the buffer, leaving the file header only. */
+  void clear()
+  {
+    _buffer.clear();
+    writeTag("SGCP");
+    write(version);
+  }
+
+  /** Returns the buffer. */
+  const auto& buffer() const { return _buffer; }
+
+  /** Appends a four-character tag. */
+  void writeTag(const char (&tag)[5])
+  {
+    writeBytes(tag, 4);
+  }
+
+  /** Appends a trivially copyable value. */
+  template <typename T>
+  void write(const T& value)
+  {
+    static_assert(std::is_trivially_copyable_v<T>, "*CheckpointWriter: T must be trivially copyable");
+    writeBytes(&value, sizeof(T));
+  }
+
+  /** Appends count values, without their count. */
+  template <typename T>
+  void write(const T* values, size_t count)
+  {
+    static_assert(std::is_trivially_copyable_v<T>, "*CheckpointWriter: T must be trivially copyable");
+    writeBytes(values, count * sizeof(T));
+  }
+
+  /** Appends the size and the values of a grid. */
+  template <int D, typename T>
+  void writeGrid(const Grid<D, T>& grid)
+  {
+    write(grid.size());
+    if (auto n = size_t(grid.length()))
+      write(&grid[0], n);
+  }
+
+  /** Writes the buffer to the file \p path. */
+  void save(const std::string& path) const
+  {
+    FILE* file = nullptr;
+#ifdef _WIN32
+    fopen_s(&file, path.c_str(), "wb");
+#else
+    file = fopen(path.c_str(), "wb");
+#endif
+    if (file == nullptr)
+      throw std::runtime_error("CheckpointWriter: cannot open " + path);
+
+    auto written = fwrite(_buffer.data(), 1, _buffer.size(), file);
+    auto closed = fclose(file) == 0;
+    if (written != _buffer.size() || !closed)
+      throw std::runtime_error("CheckpointWriter: cannot write " + path);
+  }
+
+  static constexpr uint32_t version = 3;
+
+private:
+  std::vector<char> _buffer;
+
+  void writeBytes(const void* data, size_t size)
+  {
+    auto offset = _buffer.size();
+    _buffer.resize(offset + size);
+    if (size > 0)
+      std::memcpy(_buffer.data() + offset, data, size);
+  }
+
+}; // CheckpointWriter
+
+/**
+* Binary checkpoint reader.
+*
+* Reads the whole file written by CheckpointWriter with a single sequential
+* read, then hands the state back in the order it was written.
+*/
+class CheckpointReader
+{
+public:
+  /** Reads the checkpoint file \p path. */
+  explicit CheckpointReader(const std::string& path)
+  {
+    FILE* file = nullptr;
+#ifdef _WIN32
+    fopen_s(&file, path.c_str(), "rb");
+#else
+    file = fopen(path.c_str(), "rb");
+#endif
+    if (file == nullptr)
+      throw std::runtime_error("CheckpointReader: cannot open " + path);
+
+    // checkpoints of large grids can go past the 2 GB of a long offset
+#ifdef _WIN32
+    _fseeki64(file, 0, SEEK_END);
+    auto size = _ftelli64(file);
+    _fseeki64(file, 0, SEEK_SET);
+#else
+    fseeko(file, 0, SEEK_END);
+    auto size = ftello(file);
+    fseeko(file, 0, SEEK_SET);
+#endif
+    _buffer.resize(size > 0 ? size_t(size) : 0);
+    auto count = fread(_buffer.data(), 1, _buffer.size(), file);
+    fclose(file);
+    if (size < 0 || count != _buffer.size())
+      throw std::runtime_error("CheckpointReader: cannot read " + path);
+
+    expectTag("SGCP");
+    if (read<uint32_t>() != CheckpointWriter::version)
+      throw std::runtime_error("CheckpointReader: unsupported version");
+  }
+
+  /** Reads a four-character tag and checks that it is \p tag. */
+  void expectTag(const char (&tag)[5])
+  {
+    char value[4];
+    readBytes(value, 4);
+    if (std::memcmp(value, tag, 4) != 0)
+      throw std::runtime_error(std::string("CheckpointReader: expected ") + tag);
+  }
+
+  /** Reads a trivially copyable value. */
+  template <typename T>
+  T read()
+  {
+    T value;
+    read(value);
+    return value;
+  }
+
+  /** Reads a trivially copyable value into \p value. */
+  template <typename T>
+  void read(T& value)
+  {
+    static_assert(std::is_trivially_copyable_v<T>, "*CheckpointReader: T must be trivially copyable");
+    readBytes(&value, sizeof(T));
+  }
+
+  /** Reads count values. */
+  template <typename T>
+  void read(T* values, size_t count)
+  {
+    static_assert(std::is_trivially_copyable_v<T>, "*CheckpointReader: T must be trivially copyable");
+    readBytes(values, count * sizeof(T));
+  }
+
+  /** Reads the values of a grid, which must have the size it was saved with. */
+  template <int D, typename T>
+  void readGrid(Grid<D, T>& grid)
+  {
+    if (read<Index<D>>() != grid.size())
+      throw std::runtime_error("CheckpointReader: grid size mismatch");
+    if (auto n = size_t(grid.length()))
+      read(&grid[0], n);
+  }
+
+  /** Returns true if the whole checkpoint has been read. */
+  bool atEnd() const { return _position == _buffer.size(); }
+
+private:
+  std::vector<char> _buffer;
+  size_t _position{};
+
+  void readBytes(void* data, size_t size)
+  {
+    if (size > _buffer.size() - _position)
+      throw std::runtime_error("CheckpointReader: unexpected end of file");
+    if (size > 0)
+      std::memcpy(data, _buffer.data() + _position, size);
+    _position += size;
+  }
+
+}; // CheckpointReader
+
+} // end namespace cg
+
+#endif // __Checkpoint_h
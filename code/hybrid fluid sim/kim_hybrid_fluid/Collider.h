@@ -2,6 +2,8 @@
 #define __Collider_h
 
 #include "math/Surface.h"
+#include "Checkpoint.h"
+#include "Parallel.h"
 #include <functional>
 #include <cassert>
 
@@ -67,6 +69,26 @@ public:
 		vec_type& velocity
 	);
 
+	/**
+	* Resolves collisions for an array of points in parallel.
+	*
+	* Points farther than \p radius from the bounds of the surface cannot
+	* collide and are skipped without querying the surface.
+	*
+	* \param[in] radius Radius of the colliding points.
+	* \param[in] restitutionCoefficient Defines the restitution effect.
+	* \param[in, out] positions Input and output positions of the points.
+	* \param[in, out] velocities Input and output velocities of the points.
+	* \param[in] count Number of points.
+	*/
+	void resolveCollisions(
+		real radius,
+		real restitutionCoefficient,
+		vec_type* positions,
+		vec_type* velocities,
+		size_t count
+	);
+
 	/** Returns the friction coefficient. */
 	real frictionCoefficient() const
 	{
@@ -115,6 +137,31 @@ public:
 		_onUpdateCallback = callback;
 	}
 
+	/**
+	* Writes the collider state to a checkpoint.
+	* 
+	* The base class writes the transform of the surface, which is all the
+	* state of colliders moved by their update callback.
+	*/
+	virtual void saveState(CheckpointWriter& writer) const
+	{
+		const auto& transform = _surface->transform;
+		writer.writeTag("COLL");
+		writer.write(transform.position());
+		writer.write(transform.rotation());
+		writer.write(transform.scale());
+	}
+
+	/** Reads the collider state written by Collider<D, real>::saveState. */
+	virtual void loadState(CheckpointReader& reader)
+	{
+		auto& transform = _surface->transform;
+		reader.expectTag("COLL");
+		transform.setPosition(reader.read<std::decay_t<decltype(transform.position())>>());
+		transform.setRotation(reader.read<std::decay_t<decltype(transform.rotation())>>());
+		transform.setScale(reader.read<std::decay_t<decltype(transform.scale())>>());
+	}
+
 protected:
 	/** Internal query result structure. */
 	struct ColliderQueryResult final {
@@ -122,6 +169,7 @@ protected:
 		vec_type point;
 		vec_type normal;
 		vec_type velocity;
+		bool isInside;
 	};
 
 	/** Assigns the surface instance for this collider. */
@@ -154,14 +202,21 @@ Collider<D, real>::resolveCollision(real radius, real restitutionCoefficient, ve
 	assert(_surface.get());
 #endif // _DEBUG
 
+	typename math::Surface<D, real>::QueryResult surfacePoint;
+	_surface->closestQuery(position, surfacePoint);
+
 	ColliderQueryResult colliderPoint;
-	getClosestPoint(_surface, position, colliderPoint);
+	colliderPoint.distance = surfacePoint.distance;
+	colliderPoint.point = surfacePoint.point;
+	colliderPoint.normal = surfacePoint.normal;
+	colliderPoint.isInside = surfacePoint.isInside;
 
 	if (isPenetrating(colliderPoint, position, radius))
 	{
 		auto targetNormal = colliderPoint.normal;
 		auto targetPoint = colliderPoint.point + radius * targetNormal;
-		auto colliderVelAtTargetPoint = colliderPoint.velocity;
+		// the collider velocity is only needed by penetrating points
+		auto colliderVelAtTargetPoint = velocityAt(position);
 
 		auto relativeVel = velocity - colliderVelAtTargetPoint;
 		auto normalDotRelativeVel = targetNormal.dot(relativeVel);
@@ -185,14 +240,44 @@ Collider<D, real>::resolveCollision(real radius, real restitutionCoefficient, ve
 	}
 }
 
+template<size_t D, typename real>
+inline void
+Collider<D, real>::resolveCollisions(
+	real radius,
+	real restitutionCoefficient,
+	vec_type* positions,
+	vec_type* velocities,
+	size_t count)
+{
+#ifdef _DEBUG
+	assert(_surface.get());
+#endif // _DEBUG
+
+	// conservative cull: the surface bounds grown by the radius
+	auto isBounded = _surface->isBounded();
+	auto bounds = _surface->bounds();
+	Bounds<real, D> cullBounds{
+		bounds.min() - vec_type{ radius },
+		bounds.max() + vec_type{ radius } };
+
+	parallelFor(0, int64_t(count), [&](int64_t i) {
+		if (!isBounded || cullBounds.contains(positions[i]))
+			resolveCollision(radius, restitutionCoefficient, positions[i], velocities[i]);
+		}, 256);
+}
+
 template<size_t D, typename real>
 inline void
 Collider<D, real>::getClosestPoint(const Reference<math::Surface<D, real>> surface, const vec_type& queryPoint, ColliderQueryResult& result) const
 {
-	result.distance = surface->closestDistance(queryPoint);
-	result.point = surface->closestPoint(queryPoint);
-	result.normal = surface->closestNormal(queryPoint);
+	typename math::Surface<D, real>::QueryResult surfacePoint;
+	surface->closestQuery(queryPoint, surfacePoint);
+
+	result.distance = surfacePoint.distance;
+	result.point = surfacePoint.point;
+	result.normal = surfacePoint.normal;
 	result.velocity = velocityAt(queryPoint);
+	result.isInside = surfacePoint.isInside;
 }
 
 template<size_t D, typename real>
@@ -202,7 +287,7 @@ Collider<D, real>::isPenetrating(const ColliderQueryResult& colliderPoint, const
 	// If the new candidate position of the particle is inside
 	// the volume defined by the surface OR the new distance to the surface is
 	// less than the particle's radius, this particle is in colliding state.
-	return _surface->isInside(position) || math::isNegative(colliderPoint.distance - radius);
+	return colliderPoint.isInside || math::isNegative(colliderPoint.distance - radius);
 }
 
 } // end namespace cg
@@ -0,0 +1,608 @@
+#ifndef __CsgSurface_h
+#define __CsgSurface_h
+
+#include "Box.h"
+#include "Sphere.h"
+#include <array>
+#include <stdexcept>
+#include <vector>
+
+namespace cg
+{
+
+/** Boolean operation applied by a CsgSurface child. */
+enum class CsgOperation
+{
+  Union,
+  Intersection,
+  Difference
+};
+
+/**
+* D dimensional constructive solid geometry surface.
+*
+* The children are combined from left to right: the first child defines the
+* initial solid and each one of the others is combined with the result so far
+* by its operation. Child transforms are relative to the local space of the
+* CSG surface, and CsgSurface children are merged into their parent.
+*
+* Queries do not traverse the children. CsgSurface::compile flattens them into
+* an array of primitives with precomputed world-to-local transforms and
+* bounds, which is evaluated as a postfix program without virtual calls for
+* spheres and boxes. Primitives whose bounds are farther than the query band
+* are skipped. The program is compiled whenever a child is added; it must be
+* recompiled with CsgSurface::compile after a child is moved or changed.
+*
+* \tparam D Defines the number of dimensions.
+* \tparam real A floating point type.
+*/
+template <size_t D, typename real>
+class CsgSurface : public math::Surface<D, real>
+{
+public:
+  using Base = math::Surface<D, real>;  ///< Base class alias.
+  using vec_type = Vector<real, D>;     ///< Vector type alias.
+  using bounds_type = Bounds<real, D>;  ///< Bounding box type alias.
+
+  /**
+  * Max number of values on the stack of a compiled program. Each child
+  * after the first of a nested CSG surface takes one more value.
+  */
+  static constexpr size_t maxStackSize = 32;
+
+  /** Constructs an empty CSG surface. */
+  CsgSurface(const Transform<D, real>& t = Transform<D, real>())
+    : Base(t)
+  {
+    // do nothing
+  }
+
+  /**
+  * Adds \p surface combined by \p op to the previous children. Throws,
+  * without adding it, if the program would need more than maxStackSize
+  * values.
+  */
+  void add(const Reference<Base> surface, CsgOperation op = CsgOperation::Union)
+  {
+    _children.push_back({ surface, op });
+    try
+    {
+      compile();
+    }
+    catch (...)
+    {
+      _children.pop_back();
+      compile();
+      throw;
+    }
+  }
+
+  /** Returns the number of children. */
+  auto size() const
+  {
+    return _children.size();
+  }
+
+  /**
+  * Flattens the children into the evaluation program. Throws if the
+  * program needs more than maxStackSize values; the surface is then empty.
+  */
+  void compile();
+
+  bool isBounded() const override
+  {
+    return _isBounded;
+  }
+
+protected:
+  // Surface methods
+
+  bounds_type localBounds() const override
+  {
+    return _bounds;
+  }
+
+  vec_type localClosestPoint(const vec_type& p) const override
+  {
+    return p - evaluate(p, math::Limits<real>::inf()) * localClosestNormal(p);
+  }
+
+  vec_type localClosestNormal(const vec_type& p) const override;
+
+  real localClosestDistance(const vec_type& p) const override
+  {
+    return math::abs(evaluate(p, math::Limits<real>::inf()));
+  }
+
+  bool localIsInside(const vec_type& p) const override
+  {
+    return evaluateInside(p);
+  }
+
+  real localSignedDistance(const vec_type& p) const override
+  {
+    return evaluate(p, math::Limits<real>::inf());
+  }
+
+  void batchSignedDistance(const vec_type* points, size_t count, real* distances, real band) const override
+  {
+    // the program evaluates local distances, so the band is made local too
+    auto scale = this->distanceScale();
+    auto localBand = band / scale;
+
+    for (size_t i = 0; i < count; ++i)
+      distances[i] = evaluate(this->transform.inverseTransform(points[i]), localBand) * scale;
+  }
+
+private:
+  /** Affine map p -> (rows . p) + t. */
+  struct Affine
+  {
+    std::array<vec_type, D> rows;
+    vec_type t;
+
+    vec_type apply(const vec_type& p) const
+    {
+      vec_type q;
+      for (size_t i = 0; i < D; ++i)
+        q[i] = rows[i].dot(p) + t[i];
+      return q;
+    }
+
+    /** Returns the map p -> this(other(p)). */
+    Affine compose(const Affine& other) const
+    {
+      Affine m;
+      for (size_t i = 0; i < D; ++i)
+      {
+        for (size_t j = 0; j < D; ++j)
+        {
+          real s = 0;
+          for (size_t k = 0; k < D; ++k)
+            s += rows[i][k] * other.rows[k][j];
+          m.rows[i][j] = s;
+        }
+        m.t[i] = rows[i].dot(other.t) + t[i];
+      }
+      return m;
+    }
+
+    static Affine identity()
+    {
+      Affine m;
+      for (size_t i = 0; i < D; ++i)
+      {
+        m.rows[i] = vec_type{ real(0.0f) };
+        m.rows[i][i] = 1;
+      }
+      m.t = vec_type{ real(0.0f) };
+      return m;
+    }
+  };
+
+  enum class PrimitiveType
+  {
+    Sphere,
+    Box,
+    Generic
+  };
+
+  struct Primitive
+  {
+    PrimitiveType type;
+    // maps CSG space to the local space of spheres and boxes, or to the
+    // parent space of generic surfaces
+    Affine toLocal;
+    // sphere center or box center
+    vec_type center;
+    // sphere radius in x or box half size
+    vec_type extent;
+    // bounds in CSG space
+    bounds_type bounds;
+    // converts local distances to CSG space: the smallest scale of the
+    // transforms from the primitive to the CSG surface. Generic surfaces
+    // apply their own scale
+    real distanceScale;
+    const Base* surface;
+  };
+
+  /** Pushes primitive \p index, or combines the top two values if negative. */
+  struct Instruction
+  {
+    int index;
+    CsgOperation op;
+  };
+
+  struct Child
+  {
+    Reference<Base> surface;
+    CsgOperation op;
+  };
+
+  std::vector<Child> _children;
+  std::vector<Primitive> _primitives;
+  std::vector<Instruction> _program;
+  bounds_type _bounds;
+  bool _isBounded = true;
+
+  static Affine inverseMatrix(const Transform<D, real>& t);
+
+  static Affine matrix(const Transform<D, real>& t);
+
+  static bounds_type transformBounds(const Affine& m, const bounds_type& b);
+
+  static real distanceToBounds(const bounds_type& b, const vec_type& p);
+
+  void compileChildren(
+    const std::vector<Child>& children,
+    const Affine& toParent,
+    const Affine& fromParent,
+    real scale);
+
+  void compileSurface(
+    const Reference<Base>& surface,
+    const Affine& toParent,
+    const Affine& fromParent,
+    real scale);
+
+  real evaluate(const vec_type& p, real band) const;
+
+  bool evaluateInside(const vec_type& p) const;
+
+  static real combine(real a, real b, CsgOperation op)
+  {
+    switch (op)
+    {
+    case CsgOperation::Union:
+      return math::min(a, b);
+    case CsgOperation::Intersection:
+      return math::max(a, b);
+    default:
+      return math::max(a, -b);
+    }
+  }
+
+}; // CsgSurface
+
+template<size_t D, typename real>
+inline typename CsgSurface<D, real>::Affine
+CsgSurface<D, real>::inverseMatrix(const Transform<D, real>& t)
+{
+  Affine m;
+  if constexpr (D == 2)
+  {
+    auto c = std::cos(t.rotation());
+    auto s = std::sin(t.rotation());
+    auto k = t.scale().inverse();
+    const auto& p = t.position();
+    m.rows[0] = vec_type{ c, s } * k.x;
+    m.rows[1] = vec_type{ -s, c } * k.y;
+    m.t = vec_type{ -m.rows[0].dot(p), -m.rows[1].dot(p) };
+  }
+  else
+  {
+    const auto& w = t.worldToLocalMatrix();
+    for (int i = 0; i < 3; ++i)
+    {
+      m.rows[i] = vec_type{ w[0][i], w[1][i], w[2][i] };
+      m.t[i] = w[3][i];
+    }
+  }
+  return m;
+}
+
+template<size_t D, typename real>
+inline typename CsgSurface<D, real>::Affine
+CsgSurface<D, real>::matrix(const Transform<D, real>& t)
+{
+  Affine m;
+  if constexpr (D == 2)
+  {
+    auto c = std::cos(t.rotation());
+    auto s = std::sin(t.rotation());
+    const auto& k = t.scale();
+    m.rows[0] = vec_type{ c * k.x, -s * k.y };
+    m.rows[1] = vec_type{ s * k.x, c * k.y };
+    m.t = t.position();
+  }
+  else
+  {
+    const auto& w = t.localToWorldMatrix();
+    for (int i = 0; i < 3; ++i)
+    {
+      m.rows[i] = vec_type{ w[0][i], w[1][i], w[2][i] };
+      m.t[i] = w[3][i];
+    }
+  }
+  return m;
+}
+
+template<size_t D, typename real>
+inline Bounds<real, D>
+CsgSurface<D, real>::transformBounds(const Affine& m, const bounds_type& b)
+{
+  bounds_type ret;
+  for (int i = 0; i < (1 << D); ++i)
+  {
+    auto p = b.min();
+    for (size_t d = 0; d < D; ++d)
+      if (i & (1 << d))
+        p[d] = b.max()[d];
+    ret.inflate(m.apply(p));
+  }
+  return ret;
+}
+
+template<size_t D, typename real>
+inline real
+CsgSurface<D, real>::distanceToBounds(const bounds_type& b, const vec_type& p)
+{
+  real d2 = 0;
+  for (size_t d = 0; d < D; ++d)
+  {
+    auto e = math::max(b.min()[d] - p[d], p[d] - b.max()[d]);
+    if (e > 0)
+      d2 += e * e;
+  }
+  return std::sqrt(d2);
+}
+
+template<size_t D, typename real>
+inline void
+CsgSurface<D, real>::compile()
+{
+  _primitives.clear();
+  _program.clear();
+  _isBounded = true;
+  compileChildren(_children, Affine::identity(), Affine::identity(), 1);
+
+  // the bounds of the result follow the operations of the program
+  std::vector<bounds_type> stack;
+  for (const auto& instruction : _program)
+  {
+    if (instruction.index >= 0)
+    {
+      stack.push_back(_primitives[instruction.index].bounds);
+      if (stack.size() > maxStackSize)
+      {
+        _primitives.clear();
+        _program.clear();
+        _bounds = bounds_type{};
+        throw std::runtime_error("CsgSurface: operations nested too deep");
+      }
+      continue;
+    }
+
+    auto b = stack.back();
+    stack.pop_back();
+    auto& a = stack.back();
+    if (instruction.op == CsgOperation::Union)
+    {
+      a.inflate(b);
+    }
+    else if (instruction.op == CsgOperation::Intersection)
+    {
+      vec_type min, max;
+      for (size_t d = 0; d < D; ++d)
+      {
+        min[d] = math::max(a.min()[d], b.min()[d]);
+        max[d] = math::max(min[d], math::min(a.max()[d], b.max()[d]));
+      }
+      a = bounds_type{ min, max };
+    }
+  }
+  _bounds = stack.empty() ? bounds_type{} : stack.back();
+}
+
+template<size_t D, typename real>
+inline void
+CsgSurface<D, real>::compileChildren(
+  const std::vector<Child>& children,
+  const Affine& toParent,
+  const Affine& fromParent,
+  real scale)
+{
+  for (size_t i = 0; i < children.size(); ++i)
+  {
+    compileSurface(children[i].surface, toParent, fromParent, scale);
+    if (i > 0)
+      _program.push_back({ -1, children[i].op });
+  }
+}
+
+template<size_t D, typename real>
+inline void
+CsgSurface<D, real>::compileSurface(
+  const Reference<Base>& surface,
+  const Affine& toParent,
+  const Affine& fromParent,
+  real scale)
+{
+  if (auto csg = dynamic_cast<const CsgSurface<D, real>*>(surface.get()))
+  {
+    compileChildren(
+      csg->_children,
+      inverseMatrix(csg->transform).compose(toParent),
+      fromParent.compose(matrix(csg->transform)),
+      scale * csg->distanceScale());
+    return;
+  }
+
+  Primitive primitive;
+  primitive.surface = surface.get();
+  primitive.distanceScale = scale * surface->distanceScale();
+  primitive.toLocal = inverseMatrix(surface->transform).compose(toParent);
+
+  auto fromLocal = fromParent.compose(matrix(surface->transform));
+
+  if (auto sphere = dynamic_cast<const Sphere<D, real>*>(surface.get()))
+  {
+    primitive.type = PrimitiveType::Sphere;
+    primitive.center = sphere->center;
+    primitive.extent = vec_type{ sphere->radius };
+    primitive.bounds = transformBounds(fromLocal, bounds_type{
+      sphere->center - primitive.extent,
+      sphere->center + primitive.extent });
+  }
+  else if (auto box = dynamic_cast<const Box<D, real>*>(surface.get()))
+  {
+    primitive.type = PrimitiveType::Box;
+    primitive.center = box->boxBounds.center();
+    primitive.extent = box->boxBounds.size() * real(0.5f);
+    primitive.bounds = transformBounds(fromLocal, box->boxBounds);
+  }
+  else
+  {
+    primitive.type = PrimitiveType::Generic;
+    primitive.toLocal = toParent;
+    primitive.distanceScale = scale;
+    if (surface->isBounded())
+    {
+      primitive.bounds = transformBounds(fromParent, surface->bounds());
+    }
+    else
+    {
+      primitive.bounds = bounds_type{
+        vec_type{ -math::Limits<real>::inf() },
+        vec_type{ math::Limits<real>::inf() } };
+      _isBounded = false;
+    }
+  }
+
+  _program.push_back({ int(_primitives.size()), CsgOperation::Union });
+  _primitives.push_back(primitive);
+}
+
+template<size_t D, typename real>
+inline real
+CsgSurface<D, real>::evaluate(const vec_type& p, real band) const
+{
+  if (_program.empty())
+    return band;
+
+  std::array<real, maxStackSize> stack;
+  size_t top = 0;
+
+  for (const auto& instruction : _program)
+  {
+    if (instruction.index < 0)
+    {
+      --top;
+      stack[top - 1] = combine(stack[top - 1], stack[top], instruction.op);
+      continue;
+    }
+
+    const auto& primitive = _primitives[instruction.index];
+    real d = band;
+
+    // the distance to the bounds is a lower bound of the distance to the
+    // primitive, so far primitives are clamped without being evaluated
+    if (distanceToBounds(primitive.bounds, p) < band)
+    {
+      auto q = primitive.toLocal.apply(p);
+      switch (primitive.type)
+      {
+      case PrimitiveType::Sphere:
+        d = ((q - primitive.center).length() - primitive.extent.x) * primitive.distanceScale;
+        break;
+      case PrimitiveType::Box:
+      {
+        real outside = 0;
+        real inside = -math::Limits<real>::inf();
+        for (size_t k = 0; k < D; ++k)
+        {
+          auto e = math::abs(q[k] - primitive.center[k]) - primitive.extent[k];
+          if (e > 0)
+            outside += e * e;
+          inside = math::max(inside, e);
+        }
+        d = (std::sqrt(outside) + math::min(inside, real(0.0f))) * primitive.distanceScale;
+        break;
+      }
+      default:
+        d = primitive.surface->signedDistance(q) * primitive.distanceScale;
+      }
+      d = math::clamp(d, -band, band);
+    }
+    stack[top++] = d;
+  }
+  return stack[0];
+}
+
+template<size_t D, typename real>
+inline bool
+CsgSurface<D, real>::evaluateInside(const vec_type& p) const
+{
+  if (_program.empty() || (_isBounded && !_bounds.contains(p)))
+    return false;
+
+  std::array<bool, maxStackSize> stack;
+  size_t top = 0;
+
+  for (const auto& instruction : _program)
+  {
+    if (instruction.index < 0)
+    {
+      --top;
+      auto& a = stack[top - 1];
+      auto b = stack[top];
+      if (instruction.op == CsgOperation::Union)
+        a = a || b;
+      else if (instruction.op == CsgOperation::Intersection)
+        a = a && b;
+      else
+        a = a && !b;
+      continue;
+    }
+
+    const auto& primitive = _primitives[instruction.index];
+    bool inside = false;
+
+    if (primitive.bounds.contains(p))
+    {
+      auto q = primitive.toLocal.apply(p);
+      switch (primitive.type)
+      {
+      case PrimitiveType::Sphere:
+        inside = (q - primitive.center).squaredNorm() <
+          primitive.extent.x * primitive.extent.x;
+        break;
+      case PrimitiveType::Box:
+        inside = true;
+        for (size_t k = 0; k < D; ++k)
+          inside = inside &&
+            math::abs(q[k] - primitive.center[k]) < primitive.extent[k];
+        break;
+      default:
+        inside = primitive.surface->isInside(q);
+      }
+    }
+    stack[top++] = inside;
+  }
+  return stack[0];
+}
+
+template<size_t D, typename real>
+inline Vector<real, D>
+CsgSurface<D, real>::localClosestNormal(const vec_type& p) const
+{
+  // central differences of the signed distance
+  auto h = _isBounded ? _bounds.size().max() * real(1e-4f) : real(1e-4f);
+  h = math::max(h, real(1e-6f));
+
+  vec_type n;
+  for (size_t d = 0; d < D; ++d)
+  {
+    auto e = vec_type{ real(0.0f) };
+    e[d] = h;
+    n[d] = evaluate(p + e, math::Limits<real>::inf()) -
+      evaluate(p - e, math::Limits<real>::inf());
+  }
+
+  auto length = n.length();
+  return length > 0 ? n * (1 / length) : vec_type{ real(0.0f) };
+}
+
+} // end namespace cg
+
+#endif // __CsgSurface_h
@@ -7,6 +7,7 @@
 #include "LinearArraySampler3.h"
 #include "VectorField.h"
 #include "Grid.h"
+#include "Parallel.h"
 
 namespace cg
 {
@@ -330,6 +331,37 @@ public:
     return v * 0.5f;
   }
 
+  /**
+  * Returns the largest absolute value of each velocity component.
+  * 
+  * The reduction runs in parallel straight over the face arrays, without
+  * interpolating the components to the cell centers.
+  */
+  vec_type maxAbsVelocity() const
+  {
+    vec_type result = vec_type::null();
+    for (size_t i = 0; i < D; ++i)
+    {
+      const auto& grid = *_data.get<0>(i);
+      const real* data = &grid[id_type(0)];
+      result[(int)i] = parallelReduce<real>(
+        0,
+        grid.length(),
+        real(0),
+        [data](int64_t b, int64_t e, real m) {
+          for (auto k = b; k < e; ++k)
+          {
+            auto v = std::abs(data[k]);
+            m = v > m ? v : m;
+          }
+          return m;
+        },
+        [](real a, real b) { return math::max(a, b); },
+        4096);
+    }
+    return result;
+  }
+
   /**
   * Invokes the given function \p func for each I-data point.
   * 
@@ -0,0 +1,638 @@
+#ifndef __FrameCache_h
+#define __FrameCache_h
+
+#include "CellCenteredScalarGrid.h"
+#include "FaceCenteredGrid.h"
+#include "Half.h"
+#include "Parallel.h"
+#include "utils/MappedFile.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace cg
+{
+
+/** Storage of the values of a frame cache channel. */
+enum class CacheEncoding : uint32_t
+{
+  Float32,
+  Float16 ///< IEEE half precision, for data viewed rather than resumed.
+};
+
+/** Layout of the values of a frame cache channel. */
+enum class CacheChannelKind : uint32_t
+{
+  Grid,  ///< One value per sample of a regular grid.
+  Points ///< One D-dimensional vector per point.
+};
+
+/**
+* Directory entry of a frame cache channel.
+*
+* Grid channels hold size[0] x size[1] (x size[2]) samples, x fastest, the
+* first one at origin. Point channels hold size[0] vectors of components
+* values each.
+*/
+struct FrameCacheChannel
+{
+  char name[32];
+  CacheChannelKind kind;
+  CacheEncoding encoding;
+  uint32_t dimension;
+  uint32_t components;
+  int64_t size[3];
+  float origin[3];
+  float spacing[3];
+  /** Offset of the payload from the beginning of the file. */
+  uint64_t offset;
+  uint64_t byteSize;
+
+  /** Returns the number of values of the channel. */
+  uint64_t valueCount() const
+  {
+    return uint64_t(size[0]) * uint64_t(size[1]) * uint64_t(size[2]) * components;
+  }
+
+  /** Returns the size of a value in bytes. */
+  size_t valueSize() const
+  {
+    return encoding == CacheEncoding::Float16 ? 2 : 4;
+  }
+
+}; // FrameCacheChannel
+
+/** Header of a frame cache file, followed by the channel directory. */
+struct FrameCacheHeader
+{
+  char tag[4];
+  uint32_t version;
+  int32_t frame;
+  uint32_t channelCount;
+  double time;
+
+  static constexpr uint32_t currentVersion = 1;
+  /** Payloads start at multiples of the alignment. */
+  static constexpr size_t alignment = 64;
+
+}; // FrameCacheHeader
+
+namespace internal
+{
+
+inline size_t
+alignCacheOffset(size_t offset)
+{
+  constexpr auto a = FrameCacheHeader::alignment;
+  return (offset + a - 1) / a * a;
+}
+
+} // end namespace internal
+
+/**
+* Writer of a per-frame simulation cache.
+*
+* Every frame goes to its own file, made of a FrameCacheHeader, the channel
+* directory and one payload per channel.
+*
+* Writing is a bounded producer/consumer pipeline. The channels added
+* between beginFrame and endFrame are copied as they are into a snapshot on
+* the caller thread, which is all the simulation pays for. endFrame
+* publishes the snapshot to a queue, and worker threads encode (quantize)
+* and write the queued frames while the simulation keeps stepping. The
+* caller only waits when queueDepth frames are already queued or being
+* written, so the disk slows the simulation down only if it cannot keep up
+* on average.
+*/
+class FrameCacheWriter
+{
+public:
+  /**
+  * Constructs a writer whose frame files are \p pathPrefix, followed by
+  * the frame index and ".sgfc". At most \p queueDepth published frames
+  * wait for or are being written by \p numberOfWorkers threads.
+  */
+  explicit FrameCacheWriter(const std::string& pathPrefix,
+    size_t queueDepth = 2,
+    size_t numberOfWorkers = 1):
+    _pathPrefix(pathPrefix),
+    _queueDepth(std::max<size_t>(queueDepth, 1))
+  {
+    _current = newSnapshot();
+    numberOfWorkers = std::max<size_t>(numberOfWorkers, 1);
+    for (size_t i = 0; i < numberOfWorkers; ++i)
+      _workers.emplace_back(&FrameCacheWriter::run, this);
+  }
+
+  /** Writes the queued frames and stops the worker threads. */
+  ~FrameCacheWriter()
+  {
+    {
+      std::unique_lock<std::mutex> lock{ _mutex };
+      _stop = true;
+    }
+    _condition.notify_all();
+    for (auto& worker : _workers)
+      worker.join();
+  }
+
+  FrameCacheWriter(const FrameCacheWriter&) = delete;
+  FrameCacheWriter& operator =(const FrameCacheWriter&) = delete;
+
+  /** Returns the path prefix of the frame files. */
+  const auto& pathPrefix() const { return _pathPrefix; }
+
+  /** Returns the path of the file of \p frame. */
+  std::string path(int frame) const
+  {
+    char index[16];
+    snprintf(index, sizeof(index), "%04d", frame);
+    return _pathPrefix + index + ".sgfc";
+  }
+
+  /** Returns the max number of frames queued or being written. */
+  size_t queueDepth() const { return _queueDepth; }
+
+  /** Returns the number of worker threads. */
+  size_t numberOfWorkers() const { return _workers.size(); }
+
+  /** Returns the time endFrame spent waiting for a full queue, in seconds. */
+  double stallTime() const
+  {
+    std::unique_lock<std::mutex> lock{ _mutex };
+    return _stallTime;
+  }
+
+  /** Returns the encoding of the channels added without one. */
+  auto defaultEncoding() const { return _defaultEncoding; }
+
+  /** Sets the encoding of the channels added without one. */
+  void setDefaultEncoding(CacheEncoding encoding) { _defaultEncoding = encoding; }
+
+  /** Starts the snapshot of \p frame at simulation \p time. */
+  void beginFrame(int frame, double time)
+  {
+    auto& s = *_current;
+    s.frame = frame;
+    s.time = time;
+    s.channels.clear();
+    s.sources.clear();
+    s.values.clear();
+    s.payloadSize = 0;
+  }
+
+  /** Adds the cell values of \p grid. */
+  template <size_t D, typename real, typename S>
+  void addScalarGrid(const char* name, const CellCenteredScalarGrid<D, real, S>& grid)
+  {
+    addScalarGrid(name, grid, _defaultEncoding);
+  }
+
+  template <size_t D, typename real, typename S>
+  void addScalarGrid(const char* name, const CellCenteredScalarGrid<D, real, S>& grid, CacheEncoding encoding)
+  {
+    addGrid(name, grid, grid.dataOrigin(), grid.cellSize(), encoding);
+  }
+
+  /**
+  * Adds the face values of \p grid as one grid channel per component,
+  * named \p name followed by ".u", ".v" and ".w".
+  */
+  template <size_t D, typename real>
+  void addVelocity(const char* name, const FaceCenteredGrid<D, real>& grid)
+  {
+    addVelocity(name, grid, _defaultEncoding);
+  }
+
+  template <size_t D, typename real>
+  void addVelocity(const char* name, const FaceCenteredGrid<D, real>& grid, CacheEncoding encoding)
+  {
+    std::string prefix{ name };
+    auto spacing = grid.gridSpacing();
+    addGrid((prefix + ".u").c_str(), *grid.data<0>(), grid.iOrigin<0>(), spacing, encoding);
+    addGrid((prefix + ".v").c_str(), *grid.data<1>(), grid.iOrigin<1>(), spacing, encoding);
+    if constexpr (D == 3)
+      addGrid((prefix + ".w").c_str(), *grid.data<2>(), grid.iOrigin<2>(), spacing, encoding);
+  }
+
+  /** Adds the values of \p grid, whose first sample is at \p origin. */
+  template <int D, typename real, typename T>
+  void addGrid(const char* name,
+    const Grid<D, T>& grid,
+    const Vector<real, D>& origin,
+    const Vector<real, D>& spacing,
+    CacheEncoding encoding)
+  {
+    auto& channel = addChannel(name, CacheChannelKind::Grid, encoding, D, 1);
+    for (int d = 0; d < D; ++d)
+    {
+      channel.size[d] = grid.size()[d];
+      channel.origin[d] = float(origin[d]);
+      channel.spacing[d] = float(spacing[d]);
+    }
+    appendValues(channel, grid.length() > 0 ? &grid[0] : nullptr);
+  }
+
+  /** Adds \p count points, such as particle positions or velocities. */
+  template <int D, typename real>
+  void addPoints(const char* name, const Vector<real, D>* points, size_t count)
+  {
+    addPoints(name, points, count, _defaultEncoding);
+  }
+
+  template <int D, typename real>
+  void addPoints(const char* name, const Vector<real, D>* points, size_t count, CacheEncoding encoding)
+  {
+    static_assert(sizeof(Vector<real, D>) == D * sizeof(real), "*FrameCacheWriter: vectors must be packed");
+    auto& channel = addChannel(name, CacheChannelKind::Points, encoding, D, D);
+    channel.size[0] = int64_t(count);
+    appendValues(channel, count > 0 ? &points[0][0] : (const real*)nullptr);
+  }
+
+  /**
+  * Publishes the snapshot to the workers. Waits first if the queue is
+  * full, and rethrows the error of a previous frame, if any.
+  */
+  void endFrame()
+  {
+    auto& s = *_current;
+    auto base = internal::alignCacheOffset(sizeof(FrameCacheHeader)
+      + s.channels.size() * sizeof(FrameCacheChannel));
+    for (auto& channel : s.channels)
+      channel.offset += base;
+
+    std::unique_lock<std::mutex> lock{ _mutex };
+    if (!canPublish())
+    {
+      auto start = std::chrono::steady_clock::now();
+      _condition.wait(lock, [this]() { return canPublish(); });
+      _stallTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    rethrow();
+    _queue.push_back(std::move(_current));
+    // at most queueDepth + 1 snapshots are ever allocated
+    if (_free.empty())
+      _current = newSnapshot();
+    else
+    {
+      _current = std::move(_free.back());
+      _free.pop_back();
+    }
+    lock.unlock();
+    _condition.notify_all();
+  }
+
+  /** Waits for the published frames to be written and rethrows their error, if any. */
+  void flush()
+  {
+    std::unique_lock<std::mutex> lock{ _mutex };
+    _condition.wait(lock, [this]() { return _queue.empty() && _writing == 0; });
+    rethrow();
+  }
+
+private:
+  // type of the values copied into a snapshot
+  enum class SourceType
+  {
+    Float32,
+    Float64,
+    Float16
+  };
+
+  struct Source
+  {
+    SourceType type;
+    size_t offset; // in Snapshot::values
+  };
+
+  struct Snapshot
+  {
+    int frame{};
+    double time{};
+    std::vector<FrameCacheChannel> channels;
+    std::vector<Source> sources;
+    // values as added, encoded into payload by a worker
+    std::vector<char> values;
+    std::vector<char> payload;
+    size_t payloadSize{};
+  };
+
+  using SnapshotRef = std::unique_ptr<Snapshot>;
+
+  std::string _pathPrefix;
+  size_t _queueDepth;
+  CacheEncoding _defaultEncoding{ CacheEncoding::Float32 };
+  // snapshot filled by the caller thread
+  SnapshotRef _current;
+  // published snapshots, oldest first, and snapshots ready to be reused
+  std::deque<SnapshotRef> _queue;
+  std::vector<SnapshotRef> _free;
+  size_t _writing{};
+  double _stallTime{};
+  bool _stop{};
+  std::exception_ptr _error;
+  mutable std::mutex _mutex;
+  std::condition_variable _condition;
+  std::vector<std::thread> _workers;
+
+  bool canPublish() const
+  {
+    return _queue.size() + _writing < _queueDepth;
+  }
+
+  static SnapshotRef newSnapshot()
+  {
+    return std::make_unique<Snapshot>();
+  }
+
+  FrameCacheChannel& addChannel(const char* name,
+    CacheChannelKind kind,
+    CacheEncoding encoding,
+    int dimension,
+    int components)
+  {
+    FrameCacheChannel channel{};
+    auto length = strlen(name);
+    if (length >= sizeof(channel.name))
+      throw std::runtime_error(std::string("FrameCacheWriter: channel name too long: ") + name);
+    std::memcpy(channel.name, name, length + 1);
+    channel.kind = kind;
+    channel.encoding = encoding;
+    channel.dimension = uint32_t(dimension);
+    channel.components = uint32_t(components);
+    channel.size[0] = channel.size[1] = channel.size[2] = 1;
+
+    auto& channels = _current->channels;
+    channels.push_back(channel);
+    return channels.back();
+  }
+
+  template <typename T>
+  static constexpr SourceType sourceType()
+  {
+    if constexpr (std::is_same_v<T, Half>)
+      return SourceType::Float16;
+    else if constexpr (std::is_same_v<T, double>)
+      return SourceType::Float64;
+    else
+    {
+      static_assert(std::is_same_v<T, float>, "FrameCacheWriter: unsupported value type");
+      return SourceType::Float32;
+    }
+  }
+
+  // Copies the values of a channel as they are. The encoding is left to
+  // the workers.
+  template <typename T>
+  void appendValues(FrameCacheChannel& channel, const T* values)
+  {
+    auto& s = *_current;
+    auto n = channel.valueCount();
+    channel.offset = internal::alignCacheOffset(s.payloadSize);
+    channel.byteSize = n * channel.valueSize();
+    s.payloadSize = channel.offset + channel.byteSize;
+
+    Source source{ sourceType<T>(), internal::alignCacheOffset(s.values.size()) };
+    s.values.resize(source.offset + n * sizeof(T));
+    if (n > 0)
+      std::memcpy(s.values.data() + source.offset, values, n * sizeof(T));
+    s.sources.push_back(source);
+  }
+
+  template <typename T>
+  static void encode(const T* values, size_t n, CacheEncoding encoding, char* out)
+  {
+    if (encoding == CacheEncoding::Float16)
+    {
+      if constexpr (std::is_same_v<T, Half>)
+        std::memcpy(out, values, n * 2);
+      else
+        for (size_t i = 0; i < n; ++i)
+        {
+          auto h = half::fromFloat(float(values[i]));
+          std::memcpy(out + 2 * i, &h, 2);
+        }
+    }
+    else if constexpr (std::is_same_v<T, float>)
+      std::memcpy(out, values, n * 4);
+    else
+      for (size_t i = 0; i < n; ++i)
+      {
+        auto f = float(values[i]);
+        std::memcpy(out + 4 * i, &f, 4);
+      }
+  }
+
+  // Encodes the values of a snapshot into its payload.
+  static void encode(Snapshot& s)
+  {
+    s.payload.resize(s.payloadSize);
+    auto base = internal::alignCacheOffset(sizeof(FrameCacheHeader)
+      + s.channels.size() * sizeof(FrameCacheChannel));
+    for (size_t c = 0; c < s.channels.size(); ++c)
+    {
+      const auto& channel = s.channels[c];
+      auto n = size_t(channel.valueCount());
+      auto in = s.values.data() + s.sources[c].offset;
+      auto out = s.payload.data() + (channel.offset - base);
+      switch (s.sources[c].type)
+      {
+        case SourceType::Float32:
+          encode((const float*)in, n, channel.encoding, out);
+          break;
+        case SourceType::Float64:
+          encode((const double*)in, n, channel.encoding, out);
+          break;
+        case SourceType::Float16:
+          encode((const Half*)in, n, channel.encoding, out);
+          break;
+      }
+    }
+  }
+
+  void rethrow()
+  {
+    if (_error)
+    {
+      auto error = _error;
+      _error = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock{ _mutex };
+    for (;;)
+    {
+      _condition.wait(lock, [this]() { return !_queue.empty() || _stop; });
+      if (_queue.empty())
+        return;
+
+      auto s = std::move(_queue.front());
+      _queue.pop_front();
+      ++_writing;
+      lock.unlock();
+      std::exception_ptr error;
+      try
+      {
+        encode(*s);
+        write(*s);
+      }
+      catch (...)
+      {
+        error = std::current_exception();
+      }
+      lock.lock();
+      if (error && !_error)
+        _error = error;
+      --_writing;
+      _free.push_back(std::move(s));
+      _condition.notify_all();
+    }
+  }
+
+  void write(const Snapshot& s) const
+  {
+    FrameCacheHeader header{};
+    std::memcpy(header.tag, "SGFC", 4);
+    header.version = FrameCacheHeader::currentVersion;
+    header.frame = s.frame;
+    header.channelCount = uint32_t(s.channels.size());
+    header.time = s.time;
+
+    auto path = this->path(s.frame);
+    FILE* file = nullptr;
+#ifdef _WIN32
+    fopen_s(&file, path.c_str(), "wb");
+#else
+    file = fopen(path.c_str(), "wb");
+#endif
+    if (file == nullptr)
+      throw std::runtime_error("FrameCacheWriter: cannot open " + path);
+
+    auto directorySize = s.channels.size() * sizeof(FrameCacheChannel);
+    auto padding = internal::alignCacheOffset(sizeof(header) + directorySize)
+      - sizeof(header) - directorySize;
+    const char zeros[FrameCacheHeader::alignment]{};
+    auto ok = fwrite(&header, sizeof(header), 1, file) == 1
+      && fwrite(s.channels.data(), 1, directorySize, file) == directorySize
+      && fwrite(zeros, 1, padding, file) == padding
+      && fwrite(s.payload.data(), 1, s.payload.size(), file) == s.payload.size();
+    if (fclose(file) != 0 || !ok)
+      throw std::runtime_error("FrameCacheWriter: cannot write " + path);
+  }
+
+}; // FrameCacheWriter
+
+/**
+* Reader of a frame cache file.
+*
+* The file is memory-mapped, so only the pages of the channels actually
+* read are loaded from disk.
+*/
+class FrameCacheReader
+{
+public:
+  /** Maps the frame cache file \p path and checks its directory. */
+  explicit FrameCacheReader(const std::string& path):
+    _file(path.c_str())
+  {
+    if (!_file.isOpen() || _file.size() < sizeof(FrameCacheHeader))
+      throw std::runtime_error("FrameCacheReader: cannot read " + path);
+
+    std::memcpy(&_header, _file.data(), sizeof(_header));
+    if (std::memcmp(_header.tag, "SGFC", 4) != 0
+      || _header.version != FrameCacheHeader::currentVersion)
+      throw std::runtime_error("FrameCacheReader: " + path + " is not a frame cache");
+
+    auto directorySize = size_t(_header.channelCount) * sizeof(FrameCacheChannel);
+    if (_file.size() - sizeof(_header) < directorySize)
+      throw std::runtime_error("FrameCacheReader: " + path + " is truncated");
+    _channels.resize(_header.channelCount);
+    if (directorySize > 0)
+      std::memcpy(_channels.data(), _file.data() + sizeof(_header), directorySize);
+
+    for (const auto& channel : _channels)
+      if (channel.offset > _file.size()
+        || channel.byteSize > _file.size() - channel.offset
+        || channel.byteSize != channel.valueCount() * channel.valueSize())
+        throw std::runtime_error("FrameCacheReader: " + path + " is truncated");
+  }
+
+  /** Returns the frame index. */
+  int frame() const { return _header.frame; }
+
+  /** Returns the simulation time of the frame. */
+  double time() const { return _header.time; }
+
+  /** Returns the channel directory. */
+  const auto& channels() const { return _channels; }
+
+  /** Returns the channel named \p name, or nullptr if there is none. */
+  const FrameCacheChannel* findChannel(const char* name) const
+  {
+    for (const auto& channel : _channels)
+      if (strncmp(channel.name, name, sizeof(channel.name)) == 0)
+        return &channel;
+    return nullptr;
+  }
+
+  /** Returns the encoded values of \p channel, as mapped from the file. */
+  const char* data(const FrameCacheChannel& channel) const
+  {
+    return _file.data() + channel.offset;
+  }
+
+  /** Decodes the values of \p channel into \p values. */
+  void read(const FrameCacheChannel& channel, float* values) const
+  {
+    auto in = data(channel);
+    auto n = int64_t(channel.valueCount());
+    if (channel.encoding == CacheEncoding::Float32)
+    {
+      std::memcpy(values, in, channel.byteSize);
+      return;
+    }
+    parallelRangeFor(0, n, [&](int64_t b, int64_t e) {
+      for (auto i = b; i < e; ++i)
+      {
+        uint16_t h;
+        std::memcpy(&h, in + 2 * i, 2);
+        values[i] = half::toFloat(h);
+      }
+    }, 1 << 16);
+  }
+
+  /** Decodes the values of the channel named \p name. */
+  std::vector<float> read(const char* name) const
+  {
+    auto channel = findChannel(name);
+    if (channel == nullptr)
+      throw std::runtime_error(std::string("FrameCacheReader: no channel ") + name);
+
+    std::vector<float> values(size_t(channel->valueCount()));
+    read(*channel, values.data());
+    return values;
+  }
+
+private:
+  MappedFile _file;
+  FrameCacheHeader _header;
+  std::vector<FrameCacheChannel> _channels;
+
+}; // FrameCacheReader
+
+} // end namespace cg
+
+#endif // __FrameCache_h
@@ -460,6 +460,7 @@ namespace cg
     {
       vel->velocityAt<0>(Index2{ _force_pos.x,_force_pos.y }) += (_force_dir * _source_force * _frame.timeIntervalInSeconds).x;
       vel->velocityAt<1>(Index2{ _force_pos.x,_force_pos.y }) += (_force_dir * _source_force * _frame.timeIntervalInSeconds).y;
+      _solver->invalidateMaxVelocity();
       /*auto sampled = dens->sample(dens->dataPosition(_source_pos)-_solver->gridSpacing()*.5f);
       debug("%.2f\n", sampled);*/
     }
@@ -0,0 +1,421 @@
+#ifndef __GridAdvectionSolver_h
+#define __GridAdvectionSolver_h
+
+#include "geometry/Bounds3.h"
+#include "MathUtils.h"
+#include "Parallel.h"
+#include <vector>
+
+namespace cg
+{
+
+/**
+* Semi-Lagrangian advection of scalar data stored on a regular lattice.
+*
+* The solver works in two phases. First, trace() computes the departure
+* points (and, for the higher-order modes, the arrival points) of every data
+* point inside a region of the lattice. Then, advect() can be called for any
+* number of arrays sharing that lattice, reusing the traced points. This
+* lets the smoke solver advect density, temperature and other channels
+* without tracing back the velocity field once per channel.
+*
+* Every pass reads from one buffer and writes to another, so the kernels run
+* in parallel without any ordering dependency between cells.
+*
+* \tparam D Defines the number of dimensions.
+* \tparam real A floating point type.
+*/
+template <size_t D, typename real>
+class GridAdvectionSolver
+{
+public:
+  using vec_type = Vector<real, D>;           ///< Vector type alias.
+  using bounds_type = Bounds<real, D>;        ///< Bounding box type alias.
+  using id_type = typename Index<D>::base_type; ///< Lattice id type alias.
+
+  /** Advection schemes. */
+  enum class Mode
+  {
+    /** First-order semi-Lagrangian. */
+    SemiLagrangian,
+    /** Selle et al. MacCormack, one backward and one forward trace. */
+    MacCormack,
+    /** Back and forth error compensation and correction. */
+    Bfecc
+  };
+
+  /** Interpolation used to sample the advected data. */
+  enum class Sampler
+  {
+    Linear,
+    MonotoneCubic
+  };
+
+  /** Returns the advection scheme. */
+  auto mode() const { return _mode; }
+
+  /** Sets the advection scheme. */
+  void setMode(Mode mode) { _mode = mode; }
+
+  /** Returns the sampler used to interpolate the advected data. */
+  auto sampler() const { return _sampler; }
+
+  /** Sets the sampler used to interpolate the advected data. */
+  void setSampler(Sampler sampler) { _sampler = sampler; }
+
+  /**
+  * Traces the data points of a lattice through a velocity field.
+  *
+  * The data point of index i is located at \p origin + i * \p spacing.
+  * Only the points in [\p begin, \p end) are advected; the remaining ones
+  * are copied as they are by advect(). Traced points are clamped to
+  * \p clampBounds.
+  *
+  * \param velocity Callable returning the velocity at a given position.
+  */
+  template <typename VelocityField>
+  void trace(
+    const Index<D>& size,
+    const vec_type& origin,
+    const vec_type& spacing,
+    const Index<D>& begin,
+    const Index<D>& end,
+    const bounds_type& clampBounds,
+    const VelocityField& velocity,
+    double timeInterval);
+
+  /**
+  * Advects \p input into \p output using the points computed by the last
+  * call to trace().
+  *
+  * Both arrays must have the length of the traced lattice and must not
+  * overlap. The data is stored as T, which is real or a compact storage
+  * type such as Half; values are converted to real as they are sampled and
+  * back to T as they are written, so the intermediate fields of the
+  * higher-order schemes keep the full precision.
+  */
+  template <typename T>
+  void advect(const T* input, T* output);
+
+private:
+  Mode _mode{ Mode::SemiLagrangian };
+  Sampler _sampler{ Sampler::Linear };
+
+  Index<D> _size;
+  vec_type _origin;
+  vec_type _invSpacing;
+  id_type _length{ 0 };
+
+  // lattice ids of the advected data points
+  std::vector<id_type> _ids;
+  // departure (backward) and arrival (forward) points, one per advected id
+  std::vector<vec_type> _departure;
+  std::vector<vec_type> _arrival;
+  // intermediate fields of the higher-order schemes
+  std::vector<real> _temp0;
+  std::vector<real> _temp1;
+
+  template <typename T>
+  real sample(const T* data, const vec_type& x) const;
+
+  template <typename T>
+  real sampleLinear(const T* data, const vec_type& x) const;
+
+  template <typename T>
+  real sampleCubic(const T* data, const vec_type& x) const;
+
+  template <typename T>
+  void stencilRange(const T* data, const vec_type& x, real& min, real& max) const;
+
+  template <typename T, typename U>
+  void semiLagrangian(
+    const T* input,
+    U* output,
+    const std::vector<vec_type>& points) const;
+
+}; // GridAdvectionSolver<D, real>
+
+template <size_t D, typename real>
+template <typename VelocityField>
+inline void
+GridAdvectionSolver<D, real>::trace(
+  const Index<D>& size,
+  const vec_type& origin,
+  const vec_type& spacing,
+  const Index<D>& begin,
+  const Index<D>& end,
+  const bounds_type& clampBounds,
+  const VelocityField& velocity,
+  double timeInterval)
+{
+  _size = size;
+  _origin = origin;
+  _invSpacing = spacing.inverse();
+  _length = size.prod();
+
+  Index<D> region;
+  for (int d = 0; d < int(D); ++d)
+    region[d] = math::max<id_type>(end[d] - begin[d], 0);
+
+  auto count = region.prod();
+  _ids.resize(count);
+  _departure.resize(count);
+  _arrival.resize(_mode == Mode::SemiLagrangian ? 0 : count);
+
+  auto lo = clampBounds.min();
+  auto hi = clampBounds.max();
+  auto clamp = [&lo, &hi](vec_type p) {
+    for (int d = 0; d < int(D); ++d)
+      p[d] = p[d] < lo[d] ? lo[d] : (p[d] > hi[d] ? hi[d] : p[d]);
+    return p;
+  };
+
+  auto dt = real(timeInterval);
+  bool traceForward = _mode != Mode::SemiLagrangian;
+  parallelRangeFor(0, count, [&](int64_t b, int64_t e) {
+    for (auto k = b; k < e; ++k)
+    {
+      // region-local index to lattice index
+      Index<D> index;
+      auto r = k;
+      for (int d = 0; d < int(D); ++d)
+      {
+        index[d] = begin[d] + r % region[d];
+        r /= region[d];
+      }
+
+      id_type id = 0;
+      for (int d = int(D) - 1; d >= 0; --d)
+        id = id * size[d] + index[d];
+      _ids[k] = id;
+
+      auto p = origin + spacing * vec_type{ index };
+      auto v = velocity(p);
+      _departure[k] = clamp(p - v * dt);
+      if (traceForward)
+        _arrival[k] = clamp(p + v * dt);
+    }
+    }, 256);
+}
+
+template <size_t D, typename real>
+template <typename T>
+inline void
+GridAdvectionSolver<D, real>::advect(const T* input, T* output)
+{
+  auto count = int64_t(_ids.size());
+  std::copy(input, input + _length, output);
+
+  if (_mode == Mode::SemiLagrangian)
+  {
+    semiLagrangian(input, output, _departure);
+    return;
+  }
+
+  // phiHat = A(phi)
+  _temp0.assign(input, input + _length);
+  semiLagrangian(input, _temp0.data(), _departure);
+
+  if (_mode == Mode::MacCormack)
+  {
+    // phi' = phiHat + (phi - A^R(phiHat)) / 2, limited to the stencil of phi
+    parallelRangeFor(0, count, [&](int64_t b, int64_t e) {
+      for (auto k = b; k < e; ++k)
+      {
+        auto id = _ids[k];
+        auto phiHat = _temp0[id];
+        auto value = phiHat + real(0.5f) * (input[id] - sample(_temp0.data(), _arrival[k]));
+
+        real min, max;
+        stencilRange(input, _departure[k], min, max);
+        output[id] = value < min ? min : (value > max ? max : value);
+      }
+      }, 256);
+    return;
+  }
+
+  // phiTilde = phi + (phi - A^R(A(phi))) / 2
+  _temp1.assign(input, input + _length);
+  parallelRangeFor(0, count, [&](int64_t b, int64_t e) {
+    for (auto k = b; k < e; ++k)
+    {
+      auto id = _ids[k];
+      _temp1[id] = input[id] + real(0.5f) * (input[id] - sample(_temp0.data(), _arrival[k]));
+    }
+    }, 256);
+
+  // phi' = A(phiTilde), limited to the stencil of phi
+  parallelRangeFor(0, count, [&](int64_t b, int64_t e) {
+    for (auto k = b; k < e; ++k)
+    {
+      auto id = _ids[k];
+      auto value = sample(_temp1.data(), _departure[k]);
+
+      real min, max;
+      stencilRange(input, _departure[k], min, max);
+      output[id] = value < min ? min : (value > max ? max : value);
+    }
+    }, 256);
+}
+
+template <size_t D, typename real>
+template <typename T, typename U>
+inline void
+GridAdvectionSolver<D, real>::semiLagrangian(
+  const T* input,
+  U* output,
+  const std::vector<vec_type>& points) const
+{
+  parallelRangeFor(0, int64_t(_ids.size()), [&](int64_t b, int64_t e) {
+    for (auto k = b; k < e; ++k)
+      output[_ids[k]] = sample(input, points[k]);
+    }, 256);
+}
+
+template <size_t D, typename real>
+template <typename T>
+inline real
+GridAdvectionSolver<D, real>::sample(const T* data, const vec_type& x) const
+{
+  if (_sampler == Sampler::Linear)
+    return sampleLinear(data, x);
+
+  // the tensor product of 1D monotone curves may still overshoot slightly
+  // in 2D and 3D, so we bound it by the enclosing cell values
+  real min, max;
+  auto value = sampleCubic(data, x);
+  stencilRange(data, x, min, max);
+  return value < min ? min : (value > max ? max : value);
+}
+
+template <size_t D, typename real>
+template <typename T>
+inline real
+GridAdvectionSolver<D, real>::sampleLinear(const T* data, const vec_type& x) const
+{
+  auto p = (x - _origin) * _invSpacing;
+  std::array<int64_t, D> i;
+  std::array<int64_t, D> iPlus1;
+  std::array<real, D> f;
+  for (int d = 0; d < int(D); ++d)
+  {
+    getBarycentric<real>(p[d], _size[d] - 1, &i[d], &f[d]);
+    iPlus1[d] = std::min<int64_t>(i[d] + 1, _size[d] - 1);
+  }
+
+  auto sx = _size[0];
+  if constexpr (D == 2)
+  {
+    return bilerp<real, real>(
+      data[i[0] + sx * i[1]],
+      data[iPlus1[0] + sx * i[1]],
+      data[i[0] + sx * iPlus1[1]],
+      data[iPlus1[0] + sx * iPlus1[1]],
+      f[0], f[1]);
+  }
+  else
+  {
+    auto sxy = sx * _size[1];
+    return trilerp<real, real>(
+      data[i[0] + sx * i[1] + sxy * i[2]],
+      data[iPlus1[0] + sx * i[1] + sxy * i[2]],
+      data[i[0] + sx * iPlus1[1] + sxy * i[2]],
+      data[iPlus1[0] + sx * iPlus1[1] + sxy * i[2]],
+      data[i[0] + sx * i[1] + sxy * iPlus1[2]],
+      data[iPlus1[0] + sx * i[1] + sxy * iPlus1[2]],
+      data[i[0] + sx * iPlus1[1] + sxy * iPlus1[2]],
+      data[iPlus1[0] + sx * iPlus1[1] + sxy * iPlus1[2]],
+      f[0], f[1], f[2]);
+  }
+}
+
+template <size_t D, typename real>
+template <typename T>
+inline real
+GridAdvectionSolver<D, real>::sampleCubic(const T* data, const vec_type& x) const
+{
+  auto p = (x - _origin) * _invSpacing;
+  // 4-point stencil per axis, clamped to the lattice
+  std::array<std::array<int64_t, 4>, D> s;
+  std::array<real, D> f;
+  for (int d = 0; d < int(D); ++d)
+  {
+    int64_t i;
+    getBarycentric<real>(p[d], _size[d] - 1, &i, &f[d]);
+    for (int k = 0; k < 4; ++k)
+      s[d][k] = math::min<int64_t>(math::max<int64_t>(i + k - 1, 0), _size[d] - 1);
+  }
+
+  auto sx = _size[0];
+  auto row = [&](int64_t offset) {
+    return monotonicCatmullRom<real, real>(
+      data[offset + s[0][0]],
+      data[offset + s[0][1]],
+      data[offset + s[0][2]],
+      data[offset + s[0][3]],
+      f[0]);
+  };
+
+  if constexpr (D == 2)
+  {
+    return monotonicCatmullRom<real, real>(
+      row(sx * s[1][0]),
+      row(sx * s[1][1]),
+      row(sx * s[1][2]),
+      row(sx * s[1][3]),
+      f[1]);
+  }
+  else
+  {
+    auto sxy = sx * _size[1];
+    std::array<real, 4> slice;
+    for (int k = 0; k < 4; ++k)
+    {
+      auto offset = sxy * s[2][k];
+      slice[k] = monotonicCatmullRom<real, real>(
+        row(offset + sx * s[1][0]),
+        row(offset + sx * s[1][1]),
+        row(offset + sx * s[1][2]),
+        row(offset + sx * s[1][3]),
+        f[1]);
+    }
+    return monotonicCatmullRom<real, real>(slice[0], slice[1], slice[2], slice[3], f[2]);
+  }
+}
+
+template <size_t D, typename real>
+template <typename T>
+inline void
+GridAdvectionSolver<D, real>::stencilRange(
+  const T* data,
+  const vec_type& x,
+  real& min,
+  real& max) const
+{
+  auto p = (x - _origin) * _invSpacing;
+  std::array<int64_t, D> i;
+  std::array<int64_t, D> iPlus1;
+  for (int d = 0; d < int(D); ++d)
+  {
+    real f;
+    getBarycentric<real>(p[d], _size[d] - 1, &i[d], &f);
+    iPlus1[d] = std::min<int64_t>(i[d] + 1, _size[d] - 1);
+  }
+
+  min = math::Limits<real>::inf();
+  max = -math::Limits<real>::inf();
+  constexpr int corners = 1 << D;
+  for (int c = 0; c < corners; ++c)
+  {
+    id_type id = 0;
+    for (int d = int(D) - 1; d >= 0; --d)
+      id = id * _size[d] + ((c >> d) & 1 ? iPlus1[d] : i[d]);
+    real value = data[id];
+    min = math::min(min, value);
+    max = math::max(max, value);
+  }
+}
+
+} // end namespace cg
+
+#endif // __GridAdvectionSolver_h
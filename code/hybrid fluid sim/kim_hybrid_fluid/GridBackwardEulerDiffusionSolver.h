@@ -2,9 +2,12 @@
 #define __GridBackwardEulerDiffusionSolver_h
 
 #include <Eigen/Sparse>
+#include "Checkpoint.h"
 #include "GridDiffusionSolver.h"
 #include "GridUtils.h"
 #include "MathUtils.h"
+#include "Parallel.h"
+#include "StageHash.h"
 
 using namespace Eigen;
 namespace cg
@@ -42,18 +45,67 @@ public:
 
   //void setLinearSystemSolver(const FdmLinearSystemSolver2Ptr& solver);
 
+  // Returns the max number of unknowns of a component system solved with
+  // a cached direct factorization. Larger systems are always solved by CG.
+  auto maxDirectSolverSize() const { return _maxDirectSolverSize; }
+
+  // Sets the max number of unknowns of a component system solved with a
+  // cached direct factorization.
+  void setMaxDirectSolverSize(id_type size) { _maxDirectSolverSize = size; }
+
+  // Returns the number of component systems solved with the cached
+  // factorization and by CG since the solver was created.
+  auto directSolveCount() const { return _directSolveCount; }
+  auto iterativeSolveCount() const { return _iterativeSolveCount; }
+
+  // Writes the keys of the component systems. The matrices and their
+  // factorizations are not written: they are rebuilt from the same markers
+  // and coefficients, so a restored run takes the same solve path.
+  void saveState(CheckpointWriter& writer) const;
+
+  // Reads the keys of the component systems written by saveState().
+  void loadState(CheckpointReader& reader);
+
 private:
-  // system matrix
-  SparseMatrix<real> A;
+  // Linear system of a velocity component. It only depends on the markers
+  // and on the diffusion coefficients, so it is kept from step to step and
+  // its factorization is reused while neither changes.
+  struct ComponentSystem
+  {
+    // size and content hash of the markers the matrix was built with
+    Index<D> size{ id_type(0) };
+    uint64_t markersHash{};
+    // coefficients the matrix was built with
+    vec_type c;
+    // system matrix
+    SparseMatrix<real> A;
+    // direct solver
+    SimplicialLDLT<SparseMatrix<real>> ldlt;
+    bool isAnalyzed{ false };
+    bool isFactorized{ false };
+  };
+
+  std::array<ComponentSystem, D> _systems;
+  id_type _maxDirectSolverSize{ 1 << 18 };
+  size_t _directSolveCount{};
+  size_t _iterativeSolveCount{};
   // solution vector
   Eigen::Matrix<real, -1, 1> x;
   // RHS vector
   Eigen::Matrix<real, -1, 1> b;
-  // system solver
+  // iterative solver, used while the fluid region keeps changing
   ConjugateGradient<SparseMatrix<real>, Lower | Upper> solver;
   /*FdmLinearSystemSolver2Ptr _systemSolver;*/
   GridData<D, char> _markers;
 
+  template <size_t I>
+  void solveComponent(
+    const FCGref source,
+    const vec_type& c,
+    FCGref dest,
+    const ScalarField<D, real>& boundarySdf,
+    const ScalarField<D, real>& fluidSdf);
+
   void buildMarkers(
     const Index<D>& size,
     const std::function<vec_type(const Index<D>&)>& pos,
@@ -62,7 +114,8 @@ private:
 
   void buildMatrix(
     const Index<D>& size,
-    const vec_type& c);
+    const vec_type& c,
+    SparseMatrix<real>& A);
 
   template <size_t I>
   void buildVectors(const FCGref source, const vec_type& c);
@@ -85,48 +138,111 @@ GridBackwardEulerDiffusionSolver<D, real, isDirichlet>::solve(const FCGref sourc
   auto c = (timeInterval * diffusionCoefficient) * h;
 
   // u
-  auto uPos = source->positionInSpace<0>();
-  auto uSize = source->iSize<0>();
-  buildMarkers(uSize, uPos, boundarySdf, fluidSdf);
-  buildMatrix(uSize, c);
-  buildVectors<0>(source, c);
-
-  solver.compute(A);
-  x = solver.solve(b);
-  auto info = solver.info();
-  assert(info == 0); // asserts success
-  for (int64_t i = 0; i < uSize.prod(); ++i)
-    dest->velocityAt<0>(i) = x[i];
-
+  solveComponent<0>(source, c, dest, boundarySdf, fluidSdf);
   // v
-  auto vPos = source->positionInSpace<1>();
-  auto vSize = source->iSize<1>();
-  buildMarkers(vSize, vPos, boundarySdf, fluidSdf);
-  buildMatrix(vSize, c);
-  buildVectors<1>(source, c);
-
-  solver.compute(A);
-  x = solver.solve(b);
-  info = solver.info();
-  assert(info == 0); // asserts success
-  for (int64_t i = 0; i < vSize.prod(); ++i)
-    dest->velocityAt<1>(i) = x[i];
-
+  solveComponent<1>(source, c, dest, boundarySdf, fluidSdf);
+  // w
   if constexpr (D == 3)
+    solveComponent<2>(source, c, dest, boundarySdf, fluidSdf);
+}
+
+template<size_t D, typename real, bool isDirichlet>
+template<size_t I>
+inline void
+GridBackwardEulerDiffusionSolver<D, real, isDirichlet>::solveComponent(
+  const FCGref source,
+  const vec_type& c,
+  FCGref dest,
+  const ScalarField<D, real>& boundarySdf,
+  const ScalarField<D, real>& fluidSdf)
+{
+  auto pos = source->positionInSpace<I>();
+  auto size = source->iSize<I>();
+  auto n = size.prod();
+  auto& system = _systems[I];
+
+  buildMarkers(size, pos, boundarySdf, fluidSdf);
+  auto markersHash = hashBytes(&_markers[0], size_t(n));
+  bool isSameRegion = system.size == size && system.markersHash == markersHash;
+
+  if (!isSameRegion)
+  {
+    // the fluid region changed, so the factorization would most likely be
+    // thrown away next step: rebuild the matrix and solve iteratively
+    system.size = size;
+    system.markersHash = markersHash;
+    system.c = c;
+    buildMatrix(size, c, system.A);
+    system.isAnalyzed = system.isFactorized = false;
+  }
+  else if (system.c != c || system.A.rows() != n)
   {
-    // w
-    auto wPos = source->positionInSpace<2>();
-    auto wSize = source->iSize<2>();
-    buildMarkers(wSize, wPos, boundarySdf, fluidSdf);
-    buildMatrix(wSize, c);
-    buildVectors<2>(source, c);
-
-    solver.compute(A);
-    x = solver.solve(b);
-    info = solver.info();
+    // same sparsity pattern, only the numeric factorization must be redone
+    // (the matrix is also missing after a checkpoint was loaded)
+    system.c = c;
+    buildMatrix(size, c, system.A);
+    system.isFactorized = false;
+  }
+  buildVectors<I>(source, c);
+
+  if (isSameRegion && n <= _maxDirectSolverSize)
+  {
+    if (!system.isAnalyzed)
+    {
+      system.ldlt.analyzePattern(system.A);
+      system.isAnalyzed = true;
+    }
+    if (!system.isFactorized)
+    {
+      system.ldlt.factorize(system.A);
+      system.isFactorized = system.ldlt.info() == Success;
+    }
+  }
+
+  if (system.isFactorized)
+  {
+    x = system.ldlt.solve(b);
+    ++_directSolveCount;
+  }
+  else
+  {
+    solver.compute(system.A);
+    ++_iterativeSolveCount;
+    // x holds the source velocity, a good initial guess
+    x = solver.solveWithGuess(b, x);
+    auto info = solver.info();
     assert(info == 0); // asserts success
-    for (int64_t i = 0; i < wSize.prod(); ++i)
-      dest->velocityAt<2>(i) = x[i];
+  }
+
+  for (int64_t i = 0; i < n; ++i)
+    dest->velocityAt<I>(i) = x[i];
+}
+
+template<size_t D, typename real, bool isDirichlet>
+inline void
+GridBackwardEulerDiffusionSolver<D, real, isDirichlet>::saveState(CheckpointWriter& writer) const
+{
+  writer.writeTag("BEDS");
+  for (const auto& system : _systems)
+  {
+    writer.write(system.size);
+    writer.write(system.markersHash);
+    writer.write(system.c);
+  }
+}
+
+template<size_t D, typename real, bool isDirichlet>
+inline void
+GridBackwardEulerDiffusionSolver<D, real, isDirichlet>::loadState(CheckpointReader& reader)
+{
+  reader.expectTag("BEDS");
+  for (auto& system : _systems)
+  {
+    reader.read(system.size);
+    reader.read(system.markersHash);
+    reader.read(system.c);
+    system.A.resize(0, 0);
+    system.isAnalyzed = system.isFactorized = false;
   }
 }
 
@@ -143,7 +259,7 @@ inline void cg::GridBackwardEulerDiffusionSolver<D, real, isDirichlet>::buildMar
   // alem disso, temos erros em index(), em initialize e no construtor por copia
   if constexpr (D == 3)
     _markers.initialize(size);
-  forEachIndex<D>(size, [&](const Index<D>& index) {
+  parallelForEachIndex<D>(size, [&](const Index<D>& index) {
       if (isInsideSdf(boundarySdf.sample(pos(index))))
       {
         _markers[_markers.id(index)] = kMarkers::Boundary;
@@ -162,7 +278,7 @@ inline void cg::GridBackwardEulerDiffusionSolver<D, real, isDirichlet>::buildMar
 
 template<size_t D, typename real, bool isDirichlet>
 inline void cg::GridBackwardEulerDiffusionSolver<D, real, isDirichlet>::buildMatrix(
-  const Index<D>& size, const vec_type& c)
+  const Index<D>& size, const vec_type& c, SparseMatrix<real>& A)
 {
   using Triplet = Eigen::Triplet<real, id_type>;
   auto numberOfCells = (Eigen::Index) size.prod();
@@ -170,10 +286,10 @@ inline void cg::GridBackwardEulerDiffusionSolver<D, real, isDirichlet>::buildMat
   Index<D> index;
 
   std::vector<Triplet> coefficients;
+  coefficients.reserve(numberOfCells * (2 * D + 1));
 
   // array to store cell neighbors in x+-, y+- and z+- respectively
   std::array<Index<D>, 2 * D> nbrs;
-  //coefficients.reserve(); // estimate non zero values and reserve memory to speed things up
   if constexpr (D == 2)
   {
     forEachIndex<2>(size,
@@ -213,36 +329,34 @@ inline void cg::GridBackwardEulerDiffusionSolver<D, real, isDirichlet>::buildMat
       [&](const Index3& index) {
         auto cellId = _markers.id(index);
         real centerValue = static_cast<real>(1.0);
+        neighborCellIndexes(index, nbrs);
+
         // _markers[index] == Fluid
         if (_markers[cellId] == kMarkers::Fluid)
         {
-          // try to code a compile time for so you can use the index as template parameter
           // has right neighbor
-
-          //TODO!!
-
           if (index.x + 1 < size.x)
-            createCoefficient<0>(cellId, index + Index3(1, 0, 0), centerValue, coefficients, c);
+            createCoefficient(cellId, nbrs[0], centerValue, c.x, coefficients);
 
           // has left neighbor
           if (index.x > 0)
-            createCoefficient<0>(cellId, index - Index3(1, 0, 0), centerValue, coefficients, c);
+            createCoefficient(cellId, nbrs[1], centerValue, c.x, coefficients);
 
           // has up neighbor
           if (index.y + 1 < size.y)
-            createCoefficient<1>(cellId, index + Index3(0, 1, 0), centerValue, coefficients, c);
+            createCoefficient(cellId, nbrs[2], centerValue, c.y, coefficients);
 
           // has down neighbor
           if (index.y > 0)
-            createCoefficient<1>(cellId, index - Index3(0, 1, 0), centerValue, coefficients, c);
+            createCoefficient(cellId, nbrs[3], centerValue, c.y, coefficients);
 
           // has front neighbor
           if (index.z + 1 < size.z)
-            createCoefficient<2>(cellId, index + Index3(0, 0, 1), centerValue, coefficients, c);
+            createCoefficient(cellId, nbrs[4], centerValue, c.z, coefficients);
 
           // has back neighbor
           if (index.z > 0)
-            createCoefficient<2>(cellId, index - Index3(0, 0, 1), centerValue, coefficients, c);
+            createCoefficient(cellId, nbrs[5], centerValue, c.z, coefficients);
         }
         // adding diagonal coefficient
         coefficients.push_back(Triplet(cellId, cellId, centerValue));
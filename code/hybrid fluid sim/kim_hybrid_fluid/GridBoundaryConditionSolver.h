@@ -40,6 +40,12 @@ public:
     onColliderUpdated(size, spacing, origin);
   }
 
+  // Returns a counter incremented whenever the collider SDF changes.
+  size_t colliderRevision() const
+  {
+    return _colliderRevision;
+  }
+
   // Returns the closed domain boundary flag.
   int closedDomainBoundaryFlag() const
   {
@@ -78,12 +84,19 @@ protected:
     return _gridOrigin;
   }
 
+  // Must be called by subclasses whenever they change the collider SDF.
+  void colliderSdfChanged()
+  {
+    ++_colliderRevision;
+  }
+
 private:
   Reference<Collider<D, real>> _collider;
   Index<D> _gridSize;
   vec_type _gridSpacing;
   vec_type _gridOrigin;
   int _closedDomainBoundaryFlag = cg::constants::directionAll;
+  size_t _colliderRevision{};
 
 }; // GridBoundaryConditionSolver
 
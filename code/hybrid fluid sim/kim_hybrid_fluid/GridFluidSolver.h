@@ -9,6 +9,9 @@
 #include "GridFractionalSinglePhasePressureSolver.h"
 #include "GridFractionalBoundaryConditionSolver.h"
 #include "Collider.h"
+#include "AdaptiveDomain.h"
+#include "FrameCache.h"
+#include "StageHash.h"
 #include "Constants.h"
 
 
@@ -22,7 +25,8 @@ namespace cg
     using vec = Vector<real, D>;
     template <typename T> using Ref = Reference<T>;
 
-    GridFluidSolver(const Index<D>& size, const vec& spacing, const vec& origin)
+    GridFluidSolver(const Index<D>& size, const vec& spacing, const vec& origin):
+      _domain{ size, spacing, origin }
     {
       _velocity = new FaceCenteredGrid<D, real>(size, spacing, origin);
 
@@ -50,6 +54,11 @@ namespace cg
     // Returns the CFL number from current velocity field for given time interval.
     real cfl(double timeInterval) const;
 
+    // Discards the max velocity cached at the end of the last pressure
+    // projection. Call it after changing the velocity field from outside
+    // the solver.
+    void invalidateMaxVelocity() { _isMaxVelocityValid = false; }
+
     // Returns the max allowed CFL number.
     real maxCfl() const { return _maxCfl; }
 
@@ -62,6 +71,16 @@ namespace cg
     // Sets the closed domain boundary flag.
     void setClosedDomainBoundaryFlag(int flag);
 
+    // Returns true if the pressure CG runs in float with double residual correction.
+    bool isUsingMixedPrecisionPressure() const { return _pressureSolver.isUsingMixedPrecision(); }
+
+    // Sets the mixed precision pressure solve.
+    void setUseMixedPrecisionPressure(bool flag) { _pressureSolver.setUseMixedPrecision(flag); }
+
+    // Returns the viscosity solver, e.g. to check how often it reuses its
+    // factorizations.
+    const auto& diffusionSolver() const { return _diffusionSolver; }
+
     // Returns grid size.
     const auto& size() const { return _velocity->size(); }
 
@@ -82,6 +101,25 @@ namespace cg
      TODO
     void setEmitte(const GridEmitter* emitter);*/
 
+    // Returns true if the grids only cover the window of the domain around
+    // the active region.
+    bool isUsingAdaptiveDomain() const { return _isUsingAdaptiveDomain; }
+
+    // Sets whether the grids only cover the window of the domain around the
+    // active region of the fluid. The window is updated at the beginning of
+    // every time-step; disabling it makes the grids cover the whole domain
+    // again.
+    void setUseAdaptiveDomain(bool use);
+
+    // Returns the adaptive domain, whose margin and block size can be set.
+    auto& adaptiveDomain() { return _domain; }
+
+    const auto& adaptiveDomain() const { return _domain; }
+
+    // Returns the closed boundary flag of the current grid window: sides of
+    // the window inside the domain are open.
+    int windowBoundaryFlag() const { return _boundaryConditionSolver.closedDomainBoundaryFlag(); }
+
   protected:
     // PhysicsAnimation virtual functions
     void initialize() override;
@@ -90,6 +128,24 @@ namespace cg
 
     size_t numberOfSubTimeSteps(double timeInterval) const override;
 
+    // Writes the grid window, the velocity field and the collider state.
+    void saveState(CheckpointWriter& writer) const override;
+
+    void loadState(CheckpointReader& reader) override;
+
+    // Replaces the max velocity cached for the CFL number of the next step.
+    void setMaxVelocity(const vec& maxVelocity)
+    {
+      _maxVelocity = maxVelocity;
+      _isMaxVelocityValid = true;
+    }
+
+    // Writes the velocity as "velocity.u", "velocity.v"...
+    void writeFrameCache(FrameCacheWriter& cache) const override;
+
+    // Hashes the velocity as "velocity.u", "velocity.v"...
+    void hashState(StageHashLog& log) const override;
+
     // Called at the beginning of a time-step.
     virtual void onBeginAdvanceTimeStep(double timeInterval);
 
@@ -104,12 +160,24 @@ namespace cg
 
     virtual void computeAdvection(double timeInterval);
 
+    // Computes the bounds of the region the adaptive domain window must
+    // cover. Returns false if there is no such region, in which case the
+    // window stays where it is.
+    virtual bool activeRegionBounds(Bounds<real, D>& bounds) const;
+
+    // Called after the grid window moved by offset cells.
+    virtual void onDomainWindowChanged(const Index<D>& offset);
+
     void computeGravity(double timeInterval);
 
     virtual ScalarField<D, real>* fluidSdf() const;
 
     void applyBoundaryCondition();
 
+    // Extrapolates the velocity into the faces of the open sides, before
+    // the projection sets them from p = 0 outside the domain.
+    void applyOutflowCondition();
+
     void extrapolateIntoCollider(CellCenteredScalarGrid<D, real>& grid);
 
     ScalarField<D, real>* colliderSdf() const;
@@ -121,6 +189,12 @@ namespace cg
     real _viscosityCoefficient{ 0.0f };
     real _maxCfl{ 5.0f };
     int _closedDomainBoundaryFlag{ constants::directionAll };
+    AdaptiveDomain<D, real> _domain;
+    bool _isUsingAdaptiveDomain{ false };
+    // max absolute velocity per component, cached after the projection or
+    // the advection of the particles
+    vec _maxVelocity;
+    bool _isMaxVelocityValid{ false };
 
     Ref<FaceCenteredGrid<D, real>> _velocity;
     Ref<Collider<D, real>> _collider;
@@ -140,17 +214,26 @@ namespace cg
 
     void updateEmitter(double timeInterval);
 
+    void updateDomainWindow();
+
+    void resizeDomainWindow(const Index<D>& oldMin);
+
+    void updateDomainBoundaryFlag();
+
   }; // GridFluidSolver<D, real>
 
   template<size_t D, typename real>
   inline real
     GridFluidSolver<D, real>::cfl(double timeInterval) const
   {
+    // the projection caches the max of the grid; particle solvers replace
+    // it by the max of the particle velocities the next step splats.
+    // Particles emitted and collider faces moved when the next step begins
+    // are only seen from the step after
+    auto maxAbsVel = _isMaxVelocityValid ? _maxVelocity : _velocity->maxAbsVelocity();
     real maxVel = 0.0f;
-    forEachIndex<D>(_velocity->size(), [&](const Index<D>& index) {
-      auto v = _velocity->valueAtCellCenter(index) + timeInterval * _gravity;
-      maxVel = math::max(maxVel, v.max());
-      });
+    for (int i = 0; i < int(D); ++i)
+      maxVel = math::max<real>(maxVel, maxAbsVel[i] + std::abs(timeInterval * _gravity[i]));
 
     return real(maxVel * timeInterval / _velocity->gridSpacing().min());
   }
@@ -160,7 +243,20 @@ namespace cg
     GridFluidSolver<D, real>::setClosedDomainBoundaryFlag(int flag)
   {
     _closedDomainBoundaryFlag = flag;
-    _boundaryConditionSolver.setClosedDomainBoundaryFlag(flag);
+    updateDomainBoundaryFlag();
+  }
+
+  template<size_t D, typename real>
+  inline void
+    GridFluidSolver<D, real>::setUseAdaptiveDomain(bool use)
+  {
+    _isUsingAdaptiveDomain = use;
+    if (use)
+      return;
+
+    auto oldMin = _domain.windowMin();
+    if (_domain.reset())
+      resizeDomainWindow(oldMin);
   }
 
   template<size_t D, typename real>
@@ -170,6 +266,72 @@ namespace cg
     _collider = collider;
   }
 
+  template<size_t D, typename real>
+  inline void
+    GridFluidSolver<D, real>::saveState(CheckpointWriter& writer) const
+  {
+    PhysicsAnimation::saveState(writer);
+    writer.writeTag("GFLD");
+    writer.write(_domain.size());
+    writer.write(_domain.windowMin());
+    writer.write(_domain.windowSize());
+    writer.writeGrid(*_velocity->data<0>());
+    writer.writeGrid(*_velocity->data<1>());
+    if constexpr (D == 3)
+      writer.writeGrid(*_velocity->data<2>());
+    writer.write(_maxVelocity);
+    writer.write(_isMaxVelocityValid);
+    _diffusionSolver.saveState(writer);
+    writer.write(_collider != nullptr);
+    if (_collider != nullptr)
+      _collider->saveState(writer);
+  }
+
+  template<size_t D, typename real>
+  inline void
+    GridFluidSolver<D, real>::loadState(CheckpointReader& reader)
+  {
+    PhysicsAnimation::loadState(reader);
+    reader.expectTag("GFLD");
+    if (reader.read<Index<D>>() != _domain.size())
+      throw std::runtime_error("GridFluidSolver: domain size mismatch");
+
+    auto oldMin = _domain.windowMin();
+    auto min = reader.read<Index<D>>();
+    auto size = reader.read<Index<D>>();
+    if (_domain.setWindow(min, size))
+    {
+      _velocity = new FaceCenteredGrid<D, real>(size, _domain.spacing(), _domain.windowOrigin());
+      updateDomainBoundaryFlag();
+      onDomainWindowChanged(min - oldMin);
+    }
+    reader.readGrid(*_velocity->data<0>());
+    reader.readGrid(*_velocity->data<1>());
+    if constexpr (D == 3)
+      reader.readGrid(*_velocity->data<2>());
+    reader.read(_maxVelocity);
+    reader.read(_isMaxVelocityValid);
+    _diffusionSolver.loadState(reader);
+    if (reader.read<bool>() != (_collider != nullptr))
+      throw std::runtime_error("GridFluidSolver: collider mismatch");
+    if (_collider != nullptr)
+      _collider->loadState(reader);
+  }
+
+  template<size_t D, typename real>
+  inline void
+    GridFluidSolver<D, real>::writeFrameCache(FrameCacheWriter& cache) const
+  {
+    cache.addVelocity("velocity", *_velocity);
+  }
+
+  template<size_t D, typename real>
+  inline void
+    GridFluidSolver<D, real>::hashState(StageHashLog& log) const
+  {
+    log.addVelocity("velocity", *_velocity);
+  }
+
   template<size_t D, typename real>
   inline void
     GridFluidSolver<D, real>::initialize()
@@ -189,16 +351,22 @@ namespace cg
 #endif // _DEBUG
 
     beginAdvanceTimeStep(timeInterval);
+    this->hashStage("begin");
 
     computeExternalForces(timeInterval);
+    this->hashStage("externalForces");
 
     computeViscosity(timeInterval);
+    this->hashStage("viscosity");
 
     computePressure(timeInterval);
+    this->hashStage("pressure");
 
     computeAdvection(timeInterval);
+    this->hashStage("advection");
 
     endAdvanceTimeStep(timeInterval);
+    this->hashStage("end");
   }
 
   template<size_t D, typename real>
@@ -258,6 +426,10 @@ namespace cg
   {
     Stopwatch s;
     s.start();
+    applyOutflowCondition();
+
+    _pressureSolver.setBoundarySdfRevision(
+      _boundaryConditionSolver.colliderRevision());
     _pressureSolver.solve(
       _velocity,
       timeInterval,
@@ -269,6 +441,9 @@ namespace cg
     //debug("[INFO] Pressure solver took %lld ms\n", s.time());
 
     applyBoundaryCondition();
+
+    _maxVelocity = _velocity->maxAbsVelocity();
+    _isMaxVelocityValid = true;
   }
 
   template<size_t D, typename real>
@@ -278,6 +453,20 @@ namespace cg
     // TODO
   }
 
+  template<size_t D, typename real>
+  inline bool
+    GridFluidSolver<D, real>::activeRegionBounds(Bounds<real, D>& bounds) const
+  {
+    return false;
+  }
+
+  template<size_t D, typename real>
+  inline void
+    GridFluidSolver<D, real>::onDomainWindowChanged(const Index<D>& offset)
+  {
+    // do nothing
+  }
+
   template<size_t D, typename real>
   inline void
     GridFluidSolver<D, real>::computeGravity(double timeInterval)
@@ -330,21 +519,25 @@ namespace cg
     _boundaryConditionSolver.constrainVelocity(_velocity, depth);
   }
 
+  template<size_t D, typename real>
+  inline void
+    GridFluidSolver<D, real>::applyOutflowCondition()
+  {
+    _boundaryConditionSolver.extrapolateOutflowVelocity(*_velocity);
+  }
+
   template<size_t D, typename real>
   inline void
     GridFluidSolver<D, real>::extrapolateIntoCollider(CellCenteredScalarGrid<D, real>& grid)
   {
-    GridData<D, char> marker;
-    marker.resize(grid.dataSize());
+    GridMask<D> marker{ grid.dataSize() };
 
     for (size_t i = 0; i < grid.length(); ++i)
     {
       auto index = grid.index(i);
       auto colliderSdfQuery = colliderSdf()->sample(grid.dataPosition(index));
-      if (isInsideSdf(colliderSdfQuery))
-        marker[i] = 0;
-      else
-        marker[i] = 1;
+      if (!isInsideSdf(colliderSdfQuery))
+        marker.set(i);
     }
 
     auto depth = static_cast<unsigned int>(std::ceil(_maxCfl));
@@ -373,6 +566,9 @@ namespace cg
 
     updateEmitter(timeInterval);
 
+    if (_isUsingAdaptiveDomain)
+      updateDomainWindow();
+
     _boundaryConditionSolver.updateCollider(
       _collider,
       _velocity->size(),
@@ -409,6 +605,51 @@ namespace cg
     // TODO
   }
 
+  template<size_t D, typename real>
+  inline void
+    GridFluidSolver<D, real>::updateDomainWindow()
+  {
+    Bounds<real, D> bounds;
+    if (!activeRegionBounds(bounds))
+      return;
+
+    auto oldMin = _domain.windowMin();
+    if (_domain.fit(bounds))
+      resizeDomainWindow(oldMin);
+  }
+
+  template<size_t D, typename real>
+  inline void
+    GridFluidSolver<D, real>::resizeDomainWindow(const Index<D>& oldMin)
+  {
+    // Both the old and the new grids lie on the lattice of the domain, so
+    // the data is shifted by a whole number of cells. Faces entering the
+    // window are at rest.
+    auto offset = _domain.windowMin() - oldMin;
+    auto spacing = _domain.spacing();
+
+    Ref<FaceCenteredGrid<D, real>> velocity = new FaceCenteredGrid<D, real>(
+      _domain.windowSize(), spacing, _domain.windowOrigin());
+    copyShifted(*_velocity->data<0>(), offset, *velocity->data<0>(), real(0));
+    copyShifted(*_velocity->data<1>(), offset, *velocity->data<1>(), real(0));
+    if constexpr (D == 3)
+      copyShifted(*_velocity->data<2>(), offset, *velocity->data<2>(), real(0));
+    _velocity = velocity;
+
+    updateDomainBoundaryFlag();
+    onDomainWindowChanged(offset);
+  }
+
+  template<size_t D, typename real>
+  inline void
+    GridFluidSolver<D, real>::updateDomainBoundaryFlag()
+  {
+    // window sides inside the domain let the fluid through
+    auto flag = _domain.windowBoundaryFlag(_closedDomainBoundaryFlag);
+    _boundaryConditionSolver.setClosedDomainBoundaryFlag(flag);
+    _pressureSolver.setClosedDomainBoundaryFlag(flag);
+  }
+
 } // end namespace cg
 
 #endif // __GridFluidSolver_h
@@ -5,6 +5,8 @@
 #include "CellCenteredScalarGrid.h"
 #include "CustomVectorField.h"
 #include "GridUtils.h"
+#include "Parallel.h"
+#include <atomic>
 
 namespace cg
 {
@@ -25,6 +27,12 @@ public:
 
   void constrainVelocity(Reference<FaceCenteredGrid<D, real>> grid, unsigned extrapolationDepth = 5) override;
 
+  // Copies the normal velocity of the inner faces to the boundary faces of
+  // the open domain sides (zero gradient outflow). Meant for the velocity
+  // going into the projection, which then sets those faces from p = 0
+  // outside the domain; constrainVelocity leaves them as it set them.
+  void extrapolateOutflowVelocity(FaceCenteredGrid<D, real>& grid);
+
   ScalarField<D, real>* colliderSdf() const override
   {
     return _colliderSdf.get();
@@ -40,8 +48,82 @@ protected:
   void onColliderUpdated(const Index<D>& size, const vec_type& spacing, const vec_type& origin) override;
 
 private:
+  using FCG = FaceCenteredGrid<D, real>;
+
+  /**
+  * Collider data of the faces of one velocity component.
+  *
+  * Built once per collider update, so constrainVelocity only visits the
+  * faces near the collider and never allocates. When the collider moves,
+  * only the faces near the SDF nodes rasterized again are rebuilt. The face
+  * lists are kept in memory order.
+  */
+  struct FaceData
+  {
+    // faces completely inside the collider
+    std::vector<Index<D>> solidFaces;
+    // faces whose center is inside the collider and their SDF normals
+    std::vector<Index<D>> insideFaces;
+    std::vector<vec_type> insideNormals;
+    // 1 for faces with fluid, 0 for solid faces
+    std::vector<char> valid;
+    // work buffers
+    std::vector<real> values;
+    std::vector<char> isExtrapolated;
+  };
+
   Reference<CellCenteredScalarGrid<D, real>> _colliderSdf;
-  CustomVectorField<D, real>* _colliderVel;
+  CustomVectorField<D, real>* _colliderVel{};
+  // true if the SDF has been filled for an empty domain
+  bool _isEmptySdf{};
+  // surface and transform the SDF has been rasterized from
+  const math::Surface<D, real>* _sdfSurface{};
+  Transform<D, real> _sdfTransform;
+  // nodes [_sdfRegionMin, _sdfRegionMax) rasterized from the surface; the
+  // other nodes hold the band value
+  Index<D> _sdfRegionMin;
+  Index<D> _sdfRegionMax;
+  std::array<FaceData, D> _faces;
+  // collider revision and grid size the face data were built for
+  size_t _facesRevision{};
+  Index<D> _facesSize;
+  // SDF nodes [_sdfChangedMin, _sdfChangedMax) changed since the face data
+  // were built; if _isSdfChangedEverywhere, every node may have changed
+  Index<D> _sdfChangedMin{ id_type(0) };
+  Index<D> _sdfChangedMax{ id_type(0) };
+  bool _isSdfChangedEverywhere{ true };
+
+  void sdfChanged(const Index<D>& min, const Index<D>& max);
+
+  template <size_t I> void changedFaces(const FCG& grid, Index<D>& min, Index<D>& max) const;
+
+  template <size_t I> void buildFaceData(const FCG& grid, const Index<D>& min, const Index<D>& max);
+
+  template <size_t I> void setSolidFaces(FCG& grid);
+
+  template <size_t I> void extrapolateIntoCollider(FCG& grid, unsigned depth);
+
+  template <size_t I> void computeNoFluxVelocity(const FCG& grid);
+
+  template <size_t I> void applyNoFluxVelocity(FCG& grid);
+
+  void constrainDomainBoundary(FCG& grid);
+
+  // Zeroes the boundary faces of the closed sides or, if isOutflow, copies
+  // the inner faces to the ones of the open sides.
+  template <size_t I> void constrainDomainFaces(FCG& grid, bool isOutflow);
+
+  // width in cells of the narrow band around bounded colliders
+  static constexpr int sdfBandWidth = 4;
+
+  real sdfBand() const
+  {
+    return sdfBandWidth * _colliderSdf->cellSize().max();
+  }
+
+  void sdfRegion(const math::Surface<D, real>& surface, Index<D>& min, Index<D>& max) const;
+
+  void rasterizeSdf(const math::Surface<D, real>& surface, const Index<D>& min, const Index<D>& max);
 
 }; // GridFractionalBoundaryConditionSolver
 
@@ -57,267 +139,554 @@ GridFractionalBoundaryConditionSolver<D, real>::constrainVelocity(Reference<Face
       this->collider(), size, grid->gridSpacing(), grid->origin());
   }
 
-  // preparing data
-  std::array<
-    std::function<vec_type(const Index<D>&)>, D> positions;
-  positions[0] = grid->positionInSpace<0>();
-  positions[1] = grid->positionInSpace<1>();
-  if constexpr (D == 3)
-    positions[2] = grid->positionInSpace<2>();
-
-  std::array<GridData<D, real>, D> temps;
-  temps[0].resize(grid->iSize<0>());
-  temps[1].resize(grid->iSize<1>());
-  if constexpr (D == 3)
-    temps[2].resize(grid->iSize<2>());
+  if (this->collider() != nullptr)
+  {
+    if (_facesSize != size || _isSdfChangedEverywhere)
+    {
+      for (auto& faces : _faces)
+      {
+        faces.solidFaces.clear();
+        faces.insideFaces.clear();
+        faces.insideNormals.clear();
+      }
+      buildFaceData<0>(*grid, Index<D>{ (int64_t)0 }, grid->iSize<0>());
+      buildFaceData<1>(*grid, Index<D>{ (int64_t)0 }, grid->iSize<1>());
+      if constexpr (D == 3)
+        buildFaceData<2>(*grid, Index<D>{ (int64_t)0 }, grid->iSize<2>());
+    }
+    else if (_facesRevision != this->colliderRevision())
+    {
+      // the collider moved: rebuild the faces near the nodes that changed
+      Index<D> min, max;
+      changedFaces<0>(*grid, min, max);
+      buildFaceData<0>(*grid, min, max);
+      changedFaces<1>(*grid, min, max);
+      buildFaceData<1>(*grid, min, max);
+      if constexpr (D == 3)
+      {
+        changedFaces<2>(*grid, min, max);
+        buildFaceData<2>(*grid, min, max);
+      }
+    }
+    _facesRevision = this->colliderRevision();
+    _facesSize = size;
+    _sdfChangedMin = _sdfChangedMax = Index<D>{ (int64_t)0 };
+    _isSdfChangedEverywhere = false;
+
+    // Faces inside the collider take its velocity
+    setSolidFaces<0>(*grid);
+    setSolidFaces<1>(*grid);
+    if constexpr (D == 3)
+      setSolidFaces<2>(*grid);
+
+    // Free-slip: Extrapolate fluid velocity into the collider
+    extrapolateIntoCollider<0>(*grid, extrapolationDepth);
+    extrapolateIntoCollider<1>(*grid, extrapolationDepth);
+    if constexpr (D == 3)
+      extrapolateIntoCollider<2>(*grid, extrapolationDepth);
+
+    // No-flux: project the extrapolated velocity to the collider's surface.
+    // Every component samples the extrapolated field before any is written.
+    computeNoFluxVelocity<0>(*grid);
+    computeNoFluxVelocity<1>(*grid);
+    if constexpr (D == 3)
+      computeNoFluxVelocity<2>(*grid);
+    applyNoFluxVelocity<0>(*grid);
+    applyNoFluxVelocity<1>(*grid);
+    if constexpr (D == 3)
+      applyNoFluxVelocity<2>(*grid);
+  }
 
-  std::array<GridData<D, char>, D> markers;
-  markers[0].resize(grid->iSize<0>());
-  markers[1].resize(grid->iSize<1>());
-  if constexpr (D == 3)
-    markers[2].resize(grid->iSize<2>());
+  constrainDomainBoundary(*grid);
+}
 
-  // initialize data
-  for (size_t i = 0; i < D; ++i)
+template<size_t D, typename real>
+inline void
+GridFractionalBoundaryConditionSolver<D, real>::sdfChanged(const Index<D>& min, const Index<D>& max)
+{
+  for (size_t d = 0; d < D; ++d)
+    if (min[d] >= max[d])
+      return;
+
+  bool isEmpty = false;
+  for (size_t d = 0; d < D; ++d)
+    isEmpty = isEmpty || _sdfChangedMin[d] >= _sdfChangedMax[d];
+  for (size_t d = 0; d < D; ++d)
   {
-    fill(temps[i], static_cast<real>(0.0f));
-    fill(markers[i], (char)1);
+    _sdfChangedMin[d] = isEmpty ? min[d] : std::min(min[d], _sdfChangedMin[d]);
+    _sdfChangedMax[d] = isEmpty ? max[d] : std::max(max[d], _sdfChangedMax[d]);
   }
+}
 
-  auto h = grid->gridSpacing();
-
-  grid->forEachIndex<0>([&](const Index<D>& index) {
-    auto pt = positions[0](index);
-    auto c = vec_type(static_cast<real>(0.0f));
-    c.x = h.x * 0.5f;
-    auto phi0 = _colliderSdf->sample(pt - c);
-    auto phi1 = _colliderSdf->sample(pt + c);
-    auto frac = fractionInsideSdf(phi0, phi1);
-    frac = 1.0f - math::clamp<real>(frac, 0.0f, 1.0f);
-
-    auto id = markers[0].id(index);
-    if (frac > 0.0f)
-      markers[0][id] = 1;
-    else
+template<size_t D, typename real>
+template<size_t I>
+inline void
+GridFractionalBoundaryConditionSolver<D, real>::changedFaces(const FCG& grid, Index<D>& min, Index<D>& max) const
+{
+  auto size = grid.iSize<I>();
+  auto o = grid.positionInSpace<I>()(Index<D>{ (int64_t)0 });
+  auto h = grid.gridSpacing();
+  auto sdfOrigin = _colliderSdf->bounds().min();
+  auto sdfSpacing = _colliderSdf->cellSize();
+
+  // a face samples the SDF at its center and half a cell away along I, and
+  // the SDF gradient reads one more node: it only depends on the nodes less
+  // than 2 nodes away, plus one for rounding
+  constexpr int margin = 3;
+  for (size_t d = 0; d < D; ++d)
+  {
+    if (_sdfChangedMin[d] >= _sdfChangedMax[d])
     {
-      auto colliderVel = this->collider()->velocityAt(pt);
-      grid->velocityAt<0>(index) = colliderVel.x;
-      markers[0][id] = 0;
+      min = max = Index<D>{ (int64_t)0 };
+      return;
     }
+    auto lo = sdfOrigin[d] + sdfSpacing[d] * (_sdfChangedMin[d] - margin);
+    auto hi = sdfOrigin[d] + sdfSpacing[d] * (_sdfChangedMax[d] - 1 + margin);
+    auto l = (int64_t)std::ceil((lo - o[d]) / h[d]);
+    auto u = (int64_t)std::floor((hi - o[d]) / h[d]) + 1;
+    min[d] = std::clamp<int64_t>(l, 0, size[d]);
+    max[d] = std::clamp<int64_t>(u, min[d], size[d]);
+  }
+}
+
+template<size_t D, typename real>
+template<size_t I>
+inline void
+GridFractionalBoundaryConditionSolver<D, real>::buildFaceData(const FCG& grid, const Index<D>& min, const Index<D>& max)
+{
+  auto& faces = _faces[I];
+  auto size = grid.iSize<I>();
+  auto pos = grid.positionInSpace<I>();
+  const auto& sdf = *_colliderSdf;
+  vec_type c{ real(0) };
+  c[I] = real(0.5f) * grid.gridSpacing()[I];
+
+  // ids of the faces of the grid, and of the faces of the box [min, max)
+  auto linearId = [](const Index<D>& index, const Index<D>& size) {
+    id_type id = index[D - 1];
+    for (int d = int(D) - 2; d >= 0; --d)
+      id = id * size[d] + index[d];
+    return id;
+  };
+  auto isInBox = [&](const Index<D>& index) {
+    for (size_t d = 0; d < D; ++d)
+      if (index[d] < min[d] || index[d] >= max[d])
+        return false;
+    return true;
+  };
+
+  auto n = size_t(size.prod());
+  faces.valid.resize(n);
+  faces.isExtrapolated.resize(n);
+
+  auto box = max - min;
+  for (size_t d = 0; d < D; ++d)
+    if (box[d] <= 0)
+      return;
+
+  // 0: fluid, 1: solid, 2: fluid with its center inside the collider,
+  // 3: solid with its center inside the collider
+  std::vector<char> markers(size_t(box.prod()));
+  parallelForEachIndex<D>(box, [&](const Index<D>& offset) {
+    auto index = min + offset;
+    auto pt = pos(index);
+    auto frac = fractionInsideSdf(sdf.sample(pt - c), sdf.sample(pt + c));
+    auto isSolid = 1 - math::clamp<real>(frac, 0, 1) <= 0;
+
+    faces.valid[linearId(index, size)] = !isSolid;
+    markers[linearId(offset, box)] = char(isSolid) | char(isInsideSdf(sdf.sample(pt)) ? 2 : 0);
   });
 
-  grid->forEachIndex<1>([&](const Index<D>& index) {
-    auto pt = positions[1](index);
-    auto c = vec_type(static_cast <real>(0.0f));
-    c.y = h.y * 0.5f;
-    auto phi0 = _colliderSdf->sample(pt - c);
-    auto phi1 = _colliderSdf->sample(pt + c);
-    auto frac = fractionInsideSdf(phi0, phi1);
-    frac = 1.0f - math::clamp<real>(frac, 0.0f, 1.0f);
-
-    auto id = markers[1].id(index);
-    if (frac > 0.0f)
-      markers[1][id] = 1;
-    else
+  std::vector<Index<D>> solidFaces;
+  std::vector<Index<D>> insideFaces;
+  forEachIndex<D>(box, [&](const Index<D>& offset) {
+    auto marker = markers[linearId(offset, box)];
+    if (marker & 1)
+      solidFaces.push_back(min + offset);
+    if (marker & 2)
+      insideFaces.push_back(min + offset);
+  });
+
+  std::vector<vec_type> insideNormals(insideFaces.size());
+  parallelFor(0, int64_t(insideFaces.size()), [&](int64_t k) {
+    vec_type g = sdf.gradient(pos(insideFaces[k]));
+    insideNormals[k] = g.squaredNorm() > 0 ? g.versor() : vec_type::null();
+  });
+
+  // replaces the faces of the box, keeping the lists in memory order
+  auto merge = [&](std::vector<Index<D>>& list, std::vector<Index<D>>& added, std::vector<vec_type>* normals, std::vector<vec_type>* addedNormals) {
+    std::vector<Index<D>> merged;
+    std::vector<vec_type> mergedNormals;
+    merged.reserve(list.size() + added.size());
+    if (normals != nullptr)
+      mergedNormals.reserve(merged.capacity());
+
+    size_t k = 0;
+    auto append = [&](size_t count) {
+      for (auto end = k + count; k < end; ++k)
+      {
+        merged.push_back(added[k]);
+        if (normals != nullptr)
+          mergedNormals.push_back((*addedNormals)[k]);
+      }
+    };
+    for (size_t i = 0; i < list.size(); ++i)
     {
-      auto colliderVel = this->collider()->velocityAt(pt);
-      grid->velocityAt<1>(index) = colliderVel.y;
-      markers[1][id] = 0;
+      if (isInBox(list[i]))
+        continue;
+
+      auto id = linearId(list[i], size);
+      size_t count = 0;
+      while (k + count < added.size() && linearId(added[k + count], size) < id)
+        ++count;
+      append(count);
+      merged.push_back(list[i]);
+      if (normals != nullptr)
+        mergedNormals.push_back((*normals)[i]);
     }
+    append(added.size() - k);
+    list.swap(merged);
+    if (normals != nullptr)
+      normals->swap(mergedNormals);
+  };
+  merge(faces.solidFaces, solidFaces, nullptr, nullptr);
+  merge(faces.insideFaces, insideFaces, &faces.insideNormals, &insideNormals);
+
+  auto count = math::max(faces.solidFaces.size(), faces.insideFaces.size());
+  faces.values.resize(count);
+}
+
+template<size_t D, typename real>
+template<size_t I>
+inline void
+GridFractionalBoundaryConditionSolver<D, real>::setSolidFaces(FCG& grid)
+{
+  const auto& faces = _faces[I];
+  auto pos = grid.positionInSpace<I>();
+  auto collider = this->collider();
+
+  parallelFor(0, int64_t(faces.solidFaces.size()), [&](int64_t k) {
+    const auto& index = faces.solidFaces[k];
+    grid.velocityAt<I>(index) = collider->velocityAt(pos(index))[I];
   });
+}
 
-  if constexpr (D == 3)
+template<size_t D, typename real>
+template<size_t I>
+inline void
+GridFractionalBoundaryConditionSolver<D, real>::extrapolateIntoCollider(FCG& grid, unsigned depth)
+{
+  auto& faces = _faces[I];
+  auto& data = *grid.data<I>();
+  auto size = grid.iSize<I>();
+  auto count = int64_t(faces.solidFaces.size());
+
+  Index<D> stride;
+  stride[0] = 1;
+  for (size_t d = 1; d < D; ++d)
+    stride[d] = stride[d - 1] * size[d - 1];
+
+  // Same as extrapolateToRegion, but only the solid faces are visited
+  for (unsigned iter = 0; iter < depth; ++iter)
   {
-    grid->forEachIndex<2>([&](const Index<D>& index) {
-      auto pt = positions[2](index);
-      auto c = vec_type(static_cast <real>(0.0f));
-      c.z = h.z * 0.5f;
-      auto phi0 = _colliderSdf->sample(pt - c);
-      auto phi1 = _colliderSdf->sample(pt + c);
-      auto frac = fractionInsideSdf(phi0, phi1);
-      frac = 1.0f - math::clamp<real>(frac, 0.0f, 1.0f);
-
-      auto id = markers[2].id(index);
-      if (frac > 0.0f)
-        markers[2][id] = 1;
-      else
+    parallelFor(0, count, [&](int64_t k) {
+      const auto& index = faces.solidFaces[k];
+      auto id = data.id(index);
+      faces.isExtrapolated[id] = 0;
+      if (faces.valid[id])
+        return;
+
+      real sum = 0;
+      unsigned n = 0;
+      for (size_t d = 0; d < D; ++d)
       {
-        auto colliderVel = this->collider()->velocityAt(pt);
-        grid->velocityAt<2>(index) = colliderVel.z;
-        markers[2][id] = 0;
+        if (index[d] + 1 < size[d] && faces.valid[id + stride[d]])
+        {
+          sum += data[id + stride[d]];
+          ++n;
+        }
+        if (index[d] > 0 && faces.valid[id - stride[d]])
+        {
+          sum += data[id - stride[d]];
+          ++n;
+        }
       }
-    });
-  }
-  // Free-slip: Extrapolate fluid velocity into the collider
-  extrapolateToRegion(*grid->data<0>(), markers[0], extrapolationDepth, *grid->data<0>());
-  extrapolateToRegion(*grid->data<1>(), markers[1], extrapolationDepth, *grid->data<1>());
-  if constexpr (D == 3)
-    extrapolateToRegion(*grid->data<2>(), markers[2], extrapolationDepth, *grid->data<2>());
-
-  // No-flux: project the extrapolated velocity to the collider's surface
-  grid->forEachIndex<0>([&](const Index<D>& index) {
-    auto pt = positions[0](index);
-    auto id = temps[0].id(index);
-    if (isInsideSdf(_colliderSdf->sample(pt)))
-    {
-      auto colliderVel = this->collider()->velocityAt(pt);
-      auto vel = grid->sample(pt);
-      auto g = _colliderSdf->gradient(pt);
-      if (g.squaredNorm() > 0.0f)
+      if (n > 0)
       {
-        auto velr = vel - colliderVel;
-        auto velt = projectAndApplyFriction(
-          velr, g.normalize(), this->collider()->frictionCoefficient());
-        auto velp = velt + colliderVel;
-        temps[0][id] = velp.x;
+        faces.values[k] = sum / real(n);
+        faces.isExtrapolated[id] = 1;
       }
-      else
-        temps[0][id] = colliderVel.x;
-    }
-    else
-      temps[0][id] = grid->velocityAt<0>(index);
-    grid->velocityAt<0>(index) = temps[0][id];
-  });
+    }, 256);
 
-  grid->forEachIndex<1>([&](const Index<D>& index) {
-    auto pt = positions[1](index);
-    auto id = temps[1].id(index);
-    if (isInsideSdf(_colliderSdf->sample(pt)))
-    {
-      auto colliderVel = this->collider()->velocityAt(pt);
-      auto vel = grid->sample(pt);
-      auto g = _colliderSdf->gradient(pt);
-      if (g.squaredNorm() > 0.0f)
+    std::atomic<bool> hasChanged{ false };
+    parallelFor(0, count, [&](int64_t k) {
+      auto id = data.id(faces.solidFaces[k]);
+      if (faces.isExtrapolated[id])
       {
-        auto velr = vel - colliderVel;
-        auto velt = projectAndApplyFriction(
-          velr, g.normalize(), this->collider()->frictionCoefficient());
-        auto velp = velt + colliderVel;
-        temps[1][id] = velp.y;
+        data[id] = faces.values[k];
+        faces.valid[id] = 1;
+        hasChanged = true;
       }
-      else
-        temps[1][id] = colliderVel.y;
+    }, 256);
+
+    if (!hasChanged)
+      break;
+  }
+
+  // restore the markers for the next call
+  for (const auto& index : faces.solidFaces)
+    faces.valid[data.id(index)] = 0;
+}
+
+template<size_t D, typename real>
+template<size_t I>
+inline void
+GridFractionalBoundaryConditionSolver<D, real>::computeNoFluxVelocity(const FCG& grid)
+{
+  auto& faces = _faces[I];
+  auto pos = grid.positionInSpace<I>();
+  auto collider = this->collider();
+  auto frictionCoefficient = collider->frictionCoefficient();
+
+  parallelFor(0, int64_t(faces.insideFaces.size()), [&](int64_t k) {
+    auto pt = pos(faces.insideFaces[k]);
+    vec_type colliderVel = collider->velocityAt(pt);
+    const auto& normal = faces.insideNormals[k];
+
+    if (normal.isNull())
+    {
+      faces.values[k] = colliderVel[I];
+      return;
     }
-    else
-      temps[1][id] = grid->velocityAt<1>(index);
-    grid->velocityAt<1>(index) = temps[1][id];
-  });
 
-  if constexpr(D == 3)
-    grid->forEachIndex<2>([&](const Index<D>& index) {
-      auto pt = positions[2](index);
-      auto id = temps[2].id(index);
-      if (isInsideSdf(_colliderSdf->sample(pt)))
-      {
-        auto colliderVel = this->collider()->velocityAt(pt);
-        auto vel = grid->sample(pt);
-        auto g = _colliderSdf->gradient(pt);
-        if (g.squaredNorm() > 0.0f)
-        {
-          auto velr = vel - colliderVel;
-          auto velt = projectAndApplyFriction(
-            velr, g.normalize(), this->collider()->frictionCoefficient());
-          auto velp = velt + colliderVel;
-          temps[2][id] = velp.z;
-        }
-        else
-          temps[2][id] = colliderVel.z;
-      }
-      else
-        temps[2][id] = grid->velocityAt<2>(index);
-      grid->velocityAt<2>(index) = temps[2][id];
-    });
+    vec_type velr = grid.sample(pt) - colliderVel;
+    vec_type velt = projectAndApplyFriction<D, real>(velr, normal, frictionCoefficient);
+    faces.values[k] = velt[I] + colliderVel[I];
+  }, 256);
+}
 
+template<size_t D, typename real>
+template<size_t I>
+inline void
+GridFractionalBoundaryConditionSolver<D, real>::applyNoFluxVelocity(FCG& grid)
+{
+  const auto& faces = _faces[I];
+
+  parallelFor(0, int64_t(faces.insideFaces.size()), [&](int64_t k) {
+    grid.velocityAt<I>(faces.insideFaces[k]) = faces.values[k];
+  }, 256);
+}
+
+template<size_t D, typename real>
+inline void
+GridFractionalBoundaryConditionSolver<D, real>::constrainDomainBoundary(FCG& grid)
+{
   // No-flux: Project velocity on the domain boundary if closed
+  constrainDomainFaces<0>(grid, false);
+  constrainDomainFaces<1>(grid, false);
+  if constexpr (D == 3)
+    constrainDomainFaces<2>(grid, false);
+}
+
+template<size_t D, typename real>
+inline void
+GridFractionalBoundaryConditionSolver<D, real>::extrapolateOutflowVelocity(FCG& grid)
+{
+  // Outflow: zero-gradient normal velocity if open
+  constrainDomainFaces<0>(grid, true);
+  constrainDomainFaces<1>(grid, true);
+  if constexpr (D == 3)
+    constrainDomainFaces<2>(grid, true);
+}
+
+template<size_t D, typename real>
+template<size_t I>
+inline void
+GridFractionalBoundaryConditionSolver<D, real>::constrainDomainFaces(FCG& grid, bool isOutflow)
+{
   auto flag = this->closedDomainBoundaryFlag();
-  if (flag & constants::directionLeft)
-  {
-    if constexpr (D == 2)
-      for (id_type j = 0; j < grid->iSize<0>().y; ++j)
-        grid->velocityAt<0>(Index2{ 0, j }) = 0;
-    else
-      for (id_type k = 0; k < grid->iSize<0>().z; ++k)
-        for (id_type j = 0; j < grid->iSize<0>().y; ++j)
-          grid->velocityAt<0>(Index3{ 0, j, k }) = 0;
-  }
+  auto size = grid.iSize<I>();
+  if (size[I] < 2)
+    return;
+
+  // the faces of a side form a slab with a single face along I
+  auto slab = size;
+  slab[I] = 1;
 
-  if (flag & constants::directionRight)
+  for (int side = 0; side < 2; ++side)
   {
-    if constexpr (D == 2)
-      for (id_type j = 0; j < grid->iSize<0>().y; ++j)
-        grid->velocityAt<0>(Index2{ grid->iSize<0>().x - 1, j }) = 0;
-    else
-      for (id_type k = 0; k < grid->iSize<0>().z; ++k)
-        for (id_type j = 0; j < grid->iSize<0>().y; ++j)
-          grid->velocityAt<0>(Index3{ grid->iSize<0>().x - 1, j, k }) = 0;
+    auto isClosed = (flag & (1 << (2 * I + side))) != 0;
+    if (isClosed == isOutflow)
+      continue;
+
+    auto boundary = side == 0 ? id_type(0) : size[I] - 1;
+    auto inner = side == 0 ? id_type(1) : size[I] - 2;
+
+    forEachIndex<D>(slab, [&](Index<D> index) {
+      index[I] = inner;
+      auto value = isClosed ? real(0) : grid.velocityAt<I>(index);
+      index[I] = boundary;
+      grid.velocityAt<I>(index) = value;
+    });
   }
+}
 
-  if (flag & constants::directionDown)
+template<size_t D, typename real>
+inline void
+GridFractionalBoundaryConditionSolver<D, real>::sdfRegion(const math::Surface<D, real>& surface, Index<D>& min, Index<D>& max) const
+{
+  const auto& size = _colliderSdf->size();
+
+  min = Index<D>{ (int64_t)0 };
+  max = size;
+  if (!surface.isBounded())
+    return;
+
+  // nodes farther than the band from the surface bounds are not rasterized
+  auto spacing = _colliderSdf->cellSize();
+  auto origin = _colliderSdf->bounds().min();
+  auto band = vec_type{ sdfBand() };
+  auto bounds = surface.bounds();
+  auto lo = bounds.min() - band - origin;
+  auto hi = bounds.max() + band - origin;
+
+  for (size_t d = 0; d < D; ++d)
   {
-    if constexpr (D == 2)
-      for (id_type i = 0; i < grid->iSize<1>().x; ++i)
-        grid->velocityAt<1>(Index2{ i, 0 }) = 0;
-    else
-      for (id_type k = 0; k < grid->iSize<1>().z; ++k)
-        for (id_type i = 0; i < grid->iSize<1>().x; ++i)
-          grid->velocityAt<1>(Index3{ i, 0, k }) = 0;
+    auto l = (int64_t)std::floor(lo[d] / spacing[d]);
+    auto h = (int64_t)std::ceil(hi[d] / spacing[d]) + 1;
+    min[d] = std::clamp<int64_t>(l, 0, size[d]);
+    max[d] = std::clamp<int64_t>(h, min[d], size[d]);
   }
+}
 
-  if (flag & constants::directionUp)
+template<size_t D, typename real>
+inline void
+GridFractionalBoundaryConditionSolver<D, real>::rasterizeSdf(const math::Surface<D, real>& surface, const Index<D>& min, const Index<D>& max)
+{
+  auto& sdf = *_colliderSdf;
+  auto spacing = sdf.cellSize();
+  auto origin = sdf.bounds().min();
+  // bounded surfaces are clamped to the narrow band
+  auto band = surface.isBounded() ? sdfBand() : math::Limits<real>::inf();
+
+  // only the nodes of the union of the old and the new regions change
+  Index<D> umin, umax;
+  for (size_t d = 0; d < D; ++d)
   {
-    if constexpr (D == 2)
-      for (id_type i = 0; i < grid->iSize<1>().x; ++i)
-        grid->velocityAt<1>(Index2{ i, grid->iSize<1>().y - 1 }) = 0;
-    else
-      for (id_type k = 0; k < grid->iSize<1>().z; ++k)
-        for (id_type i = 0; i < grid->iSize<1>().x; ++i)
-          grid->velocityAt<1>(Index3{ i, grid->iSize<1>().y - 1, k }) = 0;
+    umin[d] = std::min(min[d], _sdfRegionMin[d]);
+    umax[d] = std::max(max[d], _sdfRegionMax[d]);
   }
 
-  if constexpr (D == 3)
-  {
-    if (flag & constants::directionBack)
-    {
-      for (id_type j = 0; j < grid->iSize<2>().y; ++j)
-        for (id_type i = 0; i < grid->iSize<2>().x; ++i)
-          grid->velocityAt<2>(Index3{ i, j, 0 }) = 0;
-    }
-    
-    if (flag & constants::directionFront)
+  // rows along x are evaluated at once, so surfaces can batch the queries
+  auto rowSize = umax - umin;
+  int64_t rowCount = 1;
+  for (size_t d = 1; d < D; ++d)
+    rowCount *= rowSize[d];
+
+  parallelRangeFor(0, rowCount, [&](int64_t b, int64_t e) {
+    std::vector<vec_type> points;
+    std::vector<real> values;
+
+    for (auto row = b; row < e; ++row)
     {
-      for (id_type j = 0; j < grid->iSize<2>().y; ++j)
-        for (id_type i = 0; i < grid->iSize<2>().x; ++i)
-          grid->velocityAt<2>(Index3{ i, j, grid->iSize<2>().z - 1 }) = 0;
+      Index<D> index;
+      bool inRegion = true;
+      for (size_t d = 1, r = size_t(row); d < D; ++d)
+      {
+        index[d] = umin[d] + int64_t(r % rowSize[d]);
+        r /= rowSize[d];
+        inRegion = inRegion && index[d] >= min[d] && index[d] < max[d];
+      }
+
+      for (index.x = umin.x; index.x < umax.x; ++index.x)
+        sdf[sdf.id(index)] = band;
+      if (!inRegion || min.x >= max.x)
+        continue;
+
+      // the grid sampler places node i at origin + i * spacing
+      points.clear();
+      for (index.x = min.x; index.x < max.x; ++index.x)
+        points.push_back(origin + spacing * vec_type{ index });
+      values.resize(points.size());
+      surface.signedDistance(points.data(), points.size(), values.data(), band);
+
+      index.x = min.x;
+      auto id = sdf.id(index);
+      for (size_t k = 0; k < values.size(); ++k)
+        sdf[id + k] = values[k];
     }
-  }
+  });
+  _sdfRegionMin = min;
+  _sdfRegionMax = max;
+  sdfChanged(umin, umax);
 }
 
 template<size_t D, typename real>
 inline void
 GridFractionalBoundaryConditionSolver<D, real>::onColliderUpdated(const Index<D>& size, const vec_type& spacing, const vec_type& origin)
 {
-  if (_colliderSdf == nullptr)
+  if (_colliderSdf == nullptr ||
+    _colliderSdf->size() != size ||
+    _colliderSdf->cellSize() != spacing ||
+    _colliderSdf->bounds().min() != origin)
+  {
     _colliderSdf = new CellCenteredScalarGrid<D, real>(size, spacing, origin);
+    _isEmptySdf = false;
+    _sdfSurface = nullptr;
+    _isSdfChangedEverywhere = true;
+  }
 
-  if (this->collider() != nullptr)
+  Reference<math::Surface<D, real>> surface;
+  if (auto collider = this->collider())
+    surface = collider->surface();
+
+  if (surface != nullptr)
   {
-    // TODO
-    auto surface = this->collider()->surface();
+    // the SDF only depends on the surface and its transform, so it is
+    // kept while the collider does not move
+    if (surface.get() != _sdfSurface || surface->transform != _sdfTransform)
+    {
+      if (surface.get() != _sdfSurface || _isEmptySdf)
+      {
+        // new surface: every node outside its region holds the band value
+        auto band = sdfBand();
+        auto& sdf = *_colliderSdf;
+        parallelFor(0, int64_t(sdf.length()), [&](int64_t i) {
+          sdf[i] = band;
+          }, 4096);
+        _sdfRegionMin = _sdfRegionMax = Index<D>{ (int64_t)0 };
+        _isSdfChangedEverywhere = true;
+      }
+
+      // a moving collider only rasterizes the region it left and the one
+      // it entered, so the cost scales with its size, not the domain's
+      Index<D> min, max;
+      sdfRegion(*surface, min, max);
+      rasterizeSdf(*surface, min, max);
+      _sdfSurface = surface.get();
+      _sdfTransform = surface->transform;
+      this->colliderSdfChanged();
+    }
+    _isEmptySdf = false;
   }
-  else
+  else if (!_isEmptySdf)
   {
     for (auto& v : *_colliderSdf)
       v = math::Limits<real>::inf();
+    _isEmptySdf = true;
+    _sdfSurface = nullptr;
+    _isSdfChangedEverywhere = true;
+    this->colliderSdfChanged();
+  }
 
-    if (_colliderVel != nullptr)
-      delete _colliderVel;
+  if (_colliderVel == nullptr)
     _colliderVel = new CustomVectorField<D, real>(
-      [](const vec_type&) {
-        return vec_type::null();
+      [this](const vec_type& p) {
+        auto collider = this->collider();
+        return collider != nullptr ? collider->velocityAt(p) : vec_type::null();
       },
       this->gridSpacing().x
     );
-  }
 }
 
 } // end namespace cg
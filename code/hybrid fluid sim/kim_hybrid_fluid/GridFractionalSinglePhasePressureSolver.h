@@ -2,8 +2,11 @@
 #define __GridFractionalSinglePhasePressureSolver_h
 
 #include <Eigen/Sparse>
+#include "CellCenteredScalarGrid.h"
+#include "Constants.h"
 #include "GridPressureSolver.h"
 #include "GridUtils.h"
+#include "Parallel.h"
 
 using namespace Eigen;
 
@@ -51,7 +54,8 @@ void buildSingleSystem(
   GridData<D, real>& fluidSdf,
   std::array<GridData<D, real>, D>& weights,
   const VectorField<D, real>& boundaryVel,
-  const Reference<FaceCenteredGrid<D, real>> input)
+  const Reference<FaceCenteredGrid<D, real>> input,
+  int closedFlag = constants::directionAll)
 {
   using id_type = typename cg::Index<D>::base_type;
   using Triplet = Eigen::Triplet<real, id_type>;
@@ -114,6 +118,13 @@ void buildSingleSystem(
             }
             b(id) += weights[k][iP1] * input->velocityAt(k, indexP1) * invH[k];
           }
+          else if (!(closedFlag & (1 << (2 * k + 1))))
+          {
+            // open side: Dirichlet p = 0 just outside the domain
+            term = weights[k][iP1] * invHSqr[k];
+            centerValue += term;
+            b(id) += weights[k][iP1] * input->velocityAt(k, indexP1) * invH[k];
+          }
           else
           {
             b(id) += input->velocityAt(k, indexP1) * invH[k];
@@ -138,6 +149,13 @@ void buildSingleSystem(
             }
             b(id) -= weights[k][wId] * input->velocityAt(k, index) * invH[k];
           }
+          else if (!(closedFlag & (1 << (2 * k))))
+          {
+            auto wId = weights[k].id(index);
+            term = weights[k][wId] * invHSqr[k];
+            centerValue += term;
+            b(id) -= weights[k][wId] * input->velocityAt(k, index) * invH[k];
+          }
           else
           {
             b(id) -= input->velocityAt(k, index) * invH[k];
@@ -180,6 +198,7 @@ public:
   using id_type = typename Index<D>::base_type;
   using ScalarFieldType = ScalarField<D, real>;
   using VectorFieldType = VectorField<D, real>;
+  using SdfGrid = CellCenteredScalarGrid<D, real>;
 
   GridFractionalSinglePhasePressureSolverBase()
   {
@@ -199,6 +218,91 @@ public:
     const ScalarFieldType& fluidSdf = ConstantScalarField<D, real>(-math::Limits<real>::inf()),
     const VectorFieldType& boundaryVelocity = ConstantVectorField<D, real>(vec_type{ real(0.0f) })) override;
 
+  /**
+  * Sets the revision of the boundary SDF passed to the next solves.
+  *
+  * The face weights only depend on the boundary SDF, so they are kept
+  * while the same SDF is passed with the same non-zero revision. Zero
+  * (the default) rebuilds the weights on every solve.
+  */
+  void setBoundarySdfRevision(size_t revision)
+  {
+    _boundarySdfRevision = revision;
+  }
+
+  // Returns the closed domain boundary flag.
+  int closedDomainBoundaryFlag() const
+  {
+    return _closedDomainBoundaryFlag;
+  }
+
+  /**
+  * Sets the closed domain boundary flag.
+  *
+  * The pressure is zero just outside the open sides, so fluid can flow
+  * out of the domain through them.
+  */
+  void setClosedDomainBoundaryFlag(int flag)
+  {
+    _closedDomainBoundaryFlag = flag;
+  }
+
+  // Returns true if the solves use mixed precision.
+  bool isUsingMixedPrecision() const
+  {
+    return _isUsingMixedPrecision;
+  }
+
+  /**
+  * Sets the mixed precision flag.
+  *
+  * A mixed precision solve runs the CG iterations in float and corrects
+  * the solution by iterative refinement: the residual of the system is
+  * computed in double, and the CG solves for the correction until the
+  * relative residual falls below the tolerance. This gives double
+  * accuracy while the inner iterations move floats only.
+  */
+  void setUseMixedPrecision(bool flag)
+  {
+    _isUsingMixedPrecision = flag;
+  }
+
+  // Returns the relative residual of the mixed precision solves.
+  double tolerance() const
+  {
+    return _tolerance;
+  }
+
+  // Sets the relative residual of the mixed precision solves.
+  void setTolerance(double tolerance)
+  {
+    _tolerance = math::max(tolerance, 0.0);
+  }
+
+  // Returns the max number of refinements of a mixed precision solve.
+  int maxRefinements() const
+  {
+    return _maxRefinements;
+  }
+
+  // Sets the max number of refinements of a mixed precision solve.
+  void setMaxRefinements(int n)
+  {
+    _maxRefinements = math::max(n, 1);
+  }
+
+  // Returns the number of refinements of the last mixed precision solve.
+  int refinements() const
+  {
+    return _refinements;
+  }
+
+  // Returns the relative residual reached by the last mixed precision solve.
+  double relativeResidual() const
+  {
+    return _relativeResidual;
+  }
+
 protected:
   // system matrix
   SparseMatrix<real> A;
@@ -208,22 +312,60 @@ protected:
   Eigen::Matrix<real, -1, 1> b;
   // system solver
   ConjugateGradient<SparseMatrix<real>, Lower | Upper> solver;
+  // system matrix and solver of the mixed precision solves
+  SparseMatrix<float> _floatA;
+  SparseMatrix<double> _doubleA;
+  ConjugateGradient<SparseMatrix<float>, Lower | Upper> _floatSolver;
   // array to hold the weights
   std::array<GridData<D, real>, D> _weights;
 
   GridData<D, real> _fluidSdf;
 
-  virtual void buildWeights(
+  void buildWeights(
     const FCGref input,
     const ScalarFieldType& boundarySdf,
     const ScalarFieldType& fluidSdf,
     const VectorFieldType& boundaryVelocity
-  ) = 0;
+  );
+
+  // Builds the face weights sampling the boundary SDF at the face corners.
+  virtual void buildFaceWeights(const FCGref input, const ScalarFieldType& boundarySdf) = 0;
+
+  // Builds the face weights from a boundary SDF grid whose nodes are the
+  // face corners of the input grid.
+  virtual void buildAlignedFaceWeights(const FCGref input, const SdfGrid& boundarySdf) = 0;
 
   void buildSystem(const FCGref input, const VectorFieldType& boundaryVelocity);
 
+  // Solves the system by iterative refinement of float CG solves.
+  // Returns false if the inner solver breaks down or the refinements end
+  // above the tolerance.
+  bool solveMixedPrecision();
+
   void applyPressureGradient(FCGref input, FCGref dest);
 
+  // Returns the weight of a face given the fraction of it inside the
+  // boundary. Non-zero weights are clamped to 0.01, since having
+  // nearly-zero elements in the matrix can be an issue.
+  static real faceWeight(real fraction)
+  {
+    auto weight = math::clamp<real>(1.0f - fraction, 0.0f, 1.0f);
+
+    if (weight < 0.01f && weight > 0.0f)
+      weight = 0.01f;
+    return weight;
+  }
+
+  // Returns the value of an SDF grid at a node, clamped like its sampler.
+  static real nodeValue(const SdfGrid& sdf, Index<D> node)
+  {
+    const auto& size = sdf.size();
+
+    for (size_t d = 0; d < D; ++d)
+      node[d] = math::clamp<id_type>(node[d], 0, size[d] - 1);
+    return sdf[node];
+  }
+
   enum kMarkers
   {
     Fluid,
@@ -231,6 +373,23 @@ protected:
     Boundary
   };
 
+private:
+  int _closedDomainBoundaryFlag = constants::directionAll;
+  bool _isUsingMixedPrecision{};
+  double _tolerance{ 1e-10 };
+  int _maxRefinements{ 10 };
+  int _refinements{};
+  double _relativeResidual{};
+  size_t _boundarySdfRevision{};
+  // boundary SDF and grid the current weights were built for
+  const ScalarFieldType* _weightsSdf{};
+  size_t _weightsRevision{};
+  Index<D> _weightsSize;
+  vec_type _weightsSpacing;
+  vec_type _weightsOrigin;
+
+  const SdfGrid* alignedSdfGrid(const FCGref input, const ScalarFieldType& boundarySdf) const;
+
 }; // GridFractionalSinglePhaseSolverBase
 
 template<size_t D, typename real>
@@ -246,6 +405,20 @@ GridFractionalSinglePhasePressureSolverBase<D, real>::solve(
   buildWeights(input, boundarySdf, fluidSdf, boundaryVelocity);
   buildSystem(input, boundaryVelocity);
 
+  if (_isUsingMixedPrecision)
+  {
+    if (!solveMixedPrecision())
+    {
+      std::cout << "Pressure solver problem: " << _floatSolver.info() << "\n";
+      std::cout << "Solver error: " << _relativeResidual << '\n';
+      std::cout << "Solver max error: " << _tolerance << '\n';
+      std::cout << "Solver refinements: " << _refinements << '\n';
+      x.setZero();
+    }
+    applyPressureGradient(input, dest);
+    return;
+  }
+
   solver.compute(A);
   x = solver.solve(b);
   auto info = solver.info();
@@ -262,6 +435,79 @@ GridFractionalSinglePhasePressureSolverBase<D, real>::solve(
   applyPressureGradient(input, dest);
 }
 
+template<size_t D, typename real>
+inline void
+GridFractionalSinglePhasePressureSolverBase<D, real>::buildWeights(
+  const FCGref input,
+  const ScalarFieldType& boundarySdf,
+  const ScalarFieldType& fluidSdf,
+  const VectorFieldType& boundaryVelocity)
+{
+  auto size = input->size();
+  // @note we are EXCLUDING the multigrid functionality for the sake of simplicity
+  // Build levels
+  _fluidSdf.resize(size);
+
+  auto cellPos = input->cellCenterPosition();
+
+  // build Top level grid
+  parallelForEachIndex<D>(size, [&](const Index<D>& index) {
+    _fluidSdf[_fluidSdf.id(index)] = static_cast<real>(
+      fluidSdf.sample(cellPos(index)));
+  });
+
+  // the face weights are kept while the boundary has not changed
+  if (_boundarySdfRevision != 0 &&
+    _weightsRevision == _boundarySdfRevision &&
+    _weightsSdf == &boundarySdf &&
+    _weightsSize == size &&
+    _weightsSpacing == input->gridSpacing() &&
+    _weightsOrigin == input->origin())
+    return;
+
+  for (size_t d = 0; d < D; ++d)
+  {
+    auto inc = Index<D>((int64_t)0);
+    inc[d] = 1;
+    _weights[d].resize(size + inc);
+  }
+
+  if (auto sdfGrid = alignedSdfGrid(input, boundarySdf))
+    buildAlignedFaceWeights(input, *sdfGrid);
+  else
+    buildFaceWeights(input, boundarySdf);
+
+  _weightsSdf = &boundarySdf;
+  _weightsRevision = _boundarySdfRevision;
+  _weightsSize = size;
+  _weightsSpacing = input->gridSpacing();
+  _weightsOrigin = input->origin();
+}
+
+template<size_t D, typename real>
+inline const CellCenteredScalarGrid<D, real>*
+GridFractionalSinglePhasePressureSolverBase<D, real>::alignedSdfGrid(
+  const FCGref input,
+  const ScalarFieldType& boundarySdf) const
+{
+  auto sdfGrid = dynamic_cast<const SdfGrid*>(&boundarySdf);
+  if (sdfGrid == nullptr)
+    return nullptr;
+
+  // the grid sampler places the value of node i at bounds().min() + i * h,
+  // so the nodes are the face corners when both grids share origin and
+  // spacing
+  const auto& h = input->gridSpacing();
+  auto dOrigin = sdfGrid->bounds().min() - input->origin();
+  auto dSpacing = sdfGrid->cellSize() - h;
+  auto eps = h.min() * static_cast<real>(1e-4);
+
+  for (size_t d = 0; d < D; ++d)
+    if (math::abs(dOrigin[d]) > eps || math::abs(dSpacing[d]) > eps)
+      return nullptr;
+  return sdfGrid;
+}
+
 template<size_t D, typename real>
 inline void
 GridFractionalSinglePhasePressureSolverBase<D, real>::buildSystem(const FCGref input, const VectorFieldType& boundaryVelocity)
@@ -273,7 +519,62 @@ GridFractionalSinglePhasePressureSolverBase<D, real>::buildSystem(const FCGref i
   A.data().squeeze(); // release as much memory as possible
   b.resize(numberOfCells);
 
-  buildSingleSystem(A, b, _fluidSdf, _weights, boundaryVelocity, input);
+  buildSingleSystem(A, b, _fluidSdf, _weights, boundaryVelocity, input, _closedDomainBoundaryFlag);
+}
+
+template<size_t D, typename real>
+inline bool
+GridFractionalSinglePhasePressureSolverBase<D, real>::solveMixedPrecision()
+{
+  using VectorXd = Eigen::Matrix<double, -1, 1>;
+
+  // the float CG cannot reduce the residual of a correction much further
+  constexpr double minInnerTolerance = 1e-6;
+
+  _floatA = A.template cast<float>();
+  _doubleA = A.template cast<double>();
+
+  const VectorXd rhs = b.template cast<double>();
+  const auto rhsNorm = rhs.norm();
+  VectorXd solution = VectorXd::Zero(rhs.size());
+  VectorXd residual = rhs;
+
+  _refinements = 0;
+  _relativeResidual = 0;
+  if (rhsNorm == 0)
+  {
+    x.setZero(rhs.size());
+    return true;
+  }
+  _relativeResidual = 1;
+  _floatSolver.compute(_floatA);
+  while (_refinements < _maxRefinements && _relativeResidual > _tolerance)
+  {
+    // ask each correction for what is left to reach the tolerance, so a
+    // loose tolerance takes a single float solve
+    _floatSolver.setTolerance(float(math::max(_tolerance / _relativeResidual, minInnerTolerance)));
+
+    Eigen::VectorXf correction = _floatSolver.solve(residual.template cast<float>());
+
+    if (_floatSolver.info() == Eigen::NumericalIssue || !correction.allFinite())
+      return false;
+    ++_refinements;
+    solution += correction.template cast<double>();
+
+    VectorXd next = rhs - _doubleA * solution;
+    auto r = next.norm() / rhsNorm;
+
+    // stop once the float solves no longer reduce the residual
+    if (!(r < _relativeResidual))
+    {
+      solution -= correction.template cast<double>();
+      break;
+    }
+    residual.swap(next);
+    _relativeResidual = r;
+  }
+  x = solution.template cast<real>();
+  return _relativeResidual <= _tolerance;
 }
 
 template<size_t D, typename real>
@@ -331,9 +632,25 @@ GridFractionalSinglePhasePressureSolverBase<D, real>::applyPressureGradient(FCGr
         auto theta = fractionInsideSdf(centerPhi, frontPhi);
         theta = math::max(theta, (real)0.01f);
 
-        dest->velocityAt<2>(nbrs[2]) = input->velocityAt<2>(nbrs[2]) + invH.y / theta * (x(__id(size, nbrs[2])) - x(i));
+        dest->velocityAt<2>(nbrs[2]) = input->velocityAt<2>(nbrs[2]) + invH.z / theta * (x(__id(size, nbrs[2])) - x(i));
       }
     }
+
+    // faces of open sides, with zero pressure outside the domain
+    if (!centerPhiInside)
+      continue;
+    for (int k = 0; k < int(D); ++k)
+    {
+      if (index[k] == 0 &&
+        !(_closedDomainBoundaryFlag & (1 << (2 * k))) &&
+        valueAt(_weights[k], index) > 0.0f)
+        dest->velocityAt(k, index) = input->velocityAt(k, index) + invH[k] * x(i);
+
+      if (index[k] + 1 == size[k] &&
+        !(_closedDomainBoundaryFlag & (1 << (2 * k + 1))) &&
+        valueAt(_weights[k], nbrs[k]) > 0.0f)
+        dest->velocityAt(k, nbrs[k]) = input->velocityAt(k, nbrs[k]) - invH[k] * x(i);
+    }
   }
 }
 
@@ -350,6 +667,7 @@ public:
   using id_type = Index2::base_type;
   using ScalarFieldType = typename Base::ScalarFieldType;
   using VectorFieldType = typename Base::VectorFieldType;
+  using SdfGrid = typename Base::SdfGrid;
 
   GridFractionalSinglePhasePressureSolver()
     : Base::GridFractionalSinglePhasePressureSolverBase()
@@ -358,70 +676,58 @@ public:
   }
 
 protected:
-  void buildWeights(
-    const FCGref input,
-    const ScalarFieldType& boundarySdf,
-    const ScalarFieldType& fluidSdf,
-    const VectorFieldType& boundaryVelocity
-  ) override
+  void buildFaceWeights(const FCGref input, const ScalarFieldType& boundarySdf) override
   {
-    auto size = input->size();
-    // @note we are EXCLUDING the multigrid functionality for the sake of simplicity
-    // Build levels
-    this->_fluidSdf.resize(size);
-    this->_weights[0].resize(size + Index2{ 1, 0 });
-    this->_weights[1].resize(size + Index2{ 0, 1 });
-
-    auto cellPos = input->cellCenterPosition();
     auto h = input->gridSpacing();
     auto uPos = input->positionInSpace<0>();
     auto vPos = input->positionInSpace<1>();
 
-    // build Top level grid
-    forEachIndex<2>(size, [&](const Index2& index) {
-      this->_fluidSdf[this->_fluidSdf.id(index)] = static_cast<real>(
-        fluidSdf.sample(cellPos(index)));
-    });
-
-    // u
-    forEachIndex<2>(
+    // u: corners below and above the face center
+    parallelForEachIndex<2>(
       this->_weights[0].size(),
       [&](const Index2& index) {
-        auto id = this->_weights[0].id(index);
         auto pt = uPos(index);
+        real phi0 = boundarySdf.sample(pt - vec_type(0.0f, 0.5f * h.y));
+        real phi1 = boundarySdf.sample(pt + vec_type(0.0f, 0.5f * h.y));
+        this->_weights[0][this->_weights[0].id(index)] =
+          Base::faceWeight(fractionInsideSdf(phi0, phi1));
+      }
+    );
+
+    // v: corners left and right of the face center
+    parallelForEachIndex<2>(
+      this->_weights[1].size(),
+      [&](const Index2& index) {
+        auto pt = vPos(index);
         real phi0 = boundarySdf.sample(pt - vec_type(0.5f * h.x, 0.0f));
         real phi1 = boundarySdf.sample(pt + vec_type(0.5f * h.x, 0.0f));
-        real frac = fractionInsideSdf(phi0, phi1);
-        real weight = math::clamp<real>(1.0f - frac, 0.0f, 1.0f);
-
-        // Clamp non-zero weight to kMinWeight. Having nearly-zero element
-        // in the matrix can be an issue.
-        if (weight < 0.01f && weight > 0.0f) {
-          weight = 0.01f;
-        }
+        this->_weights[1][this->_weights[1].id(index)] =
+          Base::faceWeight(fractionInsideSdf(phi0, phi1));
+      }
+    );
+  }
 
-        this->_weights[0][id] = weight;
+  void buildAlignedFaceWeights(const FCGref input, const SdfGrid& boundarySdf) override
+  {
+    // u
+    parallelForEachIndex<2>(
+      this->_weights[0].size(),
+      [&](const Index2& index) {
+        real phi0 = Base::nodeValue(boundarySdf, index);
+        real phi1 = Base::nodeValue(boundarySdf, Index2{ index.x, index.y + 1 });
+        this->_weights[0][this->_weights[0].id(index)] =
+          Base::faceWeight(fractionInsideSdf(phi0, phi1));
       }
     );
 
     // v
-    forEachIndex<2>(
+    parallelForEachIndex<2>(
       this->_weights[1].size(),
       [&](const Index2& index) {
-        auto id = this->_weights[1].id(index);
-        auto pt = uPos(index);
-        real phi0 = boundarySdf.sample(pt - vec_type(0.0f, 0.5f * h.y));
-        real phi1 = boundarySdf.sample(pt + vec_type(0.0f, 0.5f * h.y));
-        real frac = fractionInsideSdf(phi0, phi1);
-        real weight = math::clamp<real>(1.0f - frac, 0.0f, 1.0f);
-
-        // Clamp non-zero weight to kMinWeight. Having nearly-zero element
-        // in the matrix can be an issue.
-        if (weight < 0.01f && weight > 0.0f) {
-          weight = 0.01f;
-        }
-
-        this->_weights[1][id] = weight;
+        real phi0 = Base::nodeValue(boundarySdf, index);
+        real phi1 = Base::nodeValue(boundarySdf, Index2{ index.x + 1, index.y });
+        this->_weights[1][this->_weights[1].id(index)] =
+          Base::faceWeight(fractionInsideSdf(phi0, phi1));
       }
     );
   }
@@ -435,9 +741,10 @@ public:
   using FCG = typename Base::FCG;
   using FCGref = Reference<FCG>;
   using vec_type = typename Base::vec_type;
-  using id_type = Index2::base_type;
+  using id_type = Index3::base_type;
   using ScalarFieldType = typename Base::ScalarFieldType;
   using VectorFieldType = typename Base::VectorFieldType;
+  using SdfGrid = typename Base::SdfGrid;
 
   GridFractionalSinglePhasePressureSolver()
     : Base::GridFractionalSinglePhasePressureSolverBase()
@@ -445,91 +752,99 @@ public:
     // do nothing
   }
 protected:
-  void buildWeights(
-    const FCGref input,
-    const ScalarFieldType& boundarySdf,
-    const ScalarFieldType& fluidSdf,
-    const VectorFieldType& boundaryVelocity
-  ) override
+  void buildFaceWeights(const FCGref input, const ScalarFieldType& boundarySdf) override
   {
-    auto size = input->size();
-      // @note we are EXCLUDING the multigrid functionality for the sake of simplicity
-      // Build levels
-    this->_fluidSdf.resize(size);
-    this->_fluidSdf.initialize(size);
-    this->_weights[0].resize(size + Index3{ 1, 0, 0 });
-    this->_weights[1].resize(size + Index3{ 0, 1, 0 });
-    this->_weights[2].resize(size + Index3{ 0, 0, 1 });
-    
-    auto cellPos = input->cellCenterPosition();
     auto h = input->gridSpacing();
     auto uPos = input->positionInSpace<0>();
     auto vPos = input->positionInSpace<1>();
     auto wPos = input->positionInSpace<2>();
 
-    // build Top level grid
-    forEachIndex<3>(size, [&](const Index3& index) {
-      this->_fluidSdf[this->_fluidSdf.id(index)] = static_cast<real>(
-        fluidSdf.sample(cellPos(index)));
-    });
-
     // u
-    forEachIndex<3>(
+    parallelForEachIndex<3>(
       this->_weights[0].size(),
       [&](const Index3& index) {
-        auto id = this->_weights[0].id(index);
         auto pt = uPos(index);
         real phi0 = boundarySdf.sample(pt + vec_type(0.0f, -0.5f * h.y, -0.5f * h.z));
         real phi1 = boundarySdf.sample(pt + vec_type(0.0f,  0.5f * h.y, -0.5f * h.z));
         real phi2 = boundarySdf.sample(pt + vec_type(0.0f, -0.5f * h.y,  0.5f * h.z));
         real phi3 = boundarySdf.sample(pt + vec_type(0.0f,  0.5f * h.y,  0.5f * h.z));
-        real frac = fractionInside(phi0, phi1, phi2, phi3);
-        real weight = math::clamp(1.0f - frac, 0.0f, 1.0f);
-
-        if (weight < 0.01f && weight > 0.0f)
-          weight = 0.01f;
-
-        this->_weights[0][id] = weight;
+        this->_weights[0][this->_weights[0].id(index)] =
+          Base::faceWeight(fractionInside(phi0, phi1, phi2, phi3));
       }
     );
 
     // v
-    forEachIndex<3>(
+    parallelForEachIndex<3>(
       this->_weights[1].size(),
       [&](const Index3& index) {
-        auto id = this->_weights[1].id(index);
         auto pt = vPos(index);
         real phi0 = boundarySdf.sample(pt + vec_type(-0.5f * h.x, 0.0f, -0.5f * h.z));
         real phi1 = boundarySdf.sample(pt + vec_type(-0.5f * h.x, 0.0f,  0.5f * h.z));
         real phi2 = boundarySdf.sample(pt + vec_type( 0.5f * h.x, 0.0f, -0.5f * h.z));
         real phi3 = boundarySdf.sample(pt + vec_type( 0.5f * h.x, 0.0f,  0.5f * h.z));
-        real frac = fractionInside(phi0, phi1, phi2, phi3);
-        real weight = math::clamp(1.0f - frac, 0.0f, 1.0f);
-
-        if (weight < 0.01f && weight > 0.0f)
-          weight = 0.01f;
-
-        this->_weights[1][id] = weight;
+        this->_weights[1][this->_weights[1].id(index)] =
+          Base::faceWeight(fractionInside(phi0, phi1, phi2, phi3));
       }
     );
 
     // w
-    forEachIndex<3>(
+    parallelForEachIndex<3>(
       this->_weights[2].size(),
       [&](const Index3& index) {
-        auto id = this->_weights[2].id(index);
-        auto pt = uPos(index);
+        auto pt = wPos(index);
         real phi0 = boundarySdf.sample(pt + vec_type(-0.5f * h.x, -0.5f * h.y, 0.0f));
         real phi1 = boundarySdf.sample(pt + vec_type(-0.5f * h.x,  0.5f * h.y, 0.0f));
         real phi2 = boundarySdf.sample(pt + vec_type( 0.5f * h.x, -0.5f * h.y, 0.0f));
         real phi3 = boundarySdf.sample(pt + vec_type( 0.5f * h.x,  0.5f * h.y, 0.0f));
-        real frac = fractionInside(phi0, phi1, phi2, phi3);
-        real weight = math::clamp(1.0f - frac, 0.0f, 1.0f);
+        this->_weights[2][this->_weights[2].id(index)] =
+          Base::faceWeight(fractionInside(phi0, phi1, phi2, phi3));
+      }
+    );
+  }
+
+  void buildAlignedFaceWeights(const FCGref input, const SdfGrid& boundarySdf) override
+  {
+    auto node = [&](const Index3& index, id_type dx, id_type dy, id_type dz) {
+      return Base::nodeValue(
+        boundarySdf, Index3{ index.x + dx, index.y + dy, index.z + dz });
+    };
+
+    // u
+    parallelForEachIndex<3>(
+      this->_weights[0].size(),
+      [&](const Index3& index) {
+        real phi0 = node(index, 0, 0, 0);
+        real phi1 = node(index, 0, 1, 0);
+        real phi2 = node(index, 0, 0, 1);
+        real phi3 = node(index, 0, 1, 1);
+        this->_weights[0][this->_weights[0].id(index)] =
+          Base::faceWeight(fractionInside(phi0, phi1, phi2, phi3));
+      }
+    );
 
-        if (weight < 0.01f && weight > 0.0f)
-          weight = 0.01f;
+    // v
+    parallelForEachIndex<3>(
+      this->_weights[1].size(),
+      [&](const Index3& index) {
+        real phi0 = node(index, 0, 0, 0);
+        real phi1 = node(index, 0, 0, 1);
+        real phi2 = node(index, 1, 0, 0);
+        real phi3 = node(index, 1, 0, 1);
+        this->_weights[1][this->_weights[1].id(index)] =
+          Base::faceWeight(fractionInside(phi0, phi1, phi2, phi3));
+      }
+    );
 
-        this->_weights[2][id] = weight;
+    // w
+    parallelForEachIndex<3>(
+      this->_weights[2].size(),
+      [&](const Index3& index) {
+        real phi0 = node(index, 0, 0, 0);
+        real phi1 = node(index, 0, 1, 0);
+        real phi2 = node(index, 1, 0, 0);
+        real phi3 = node(index, 1, 1, 0);
+        this->_weights[2][this->_weights[2].id(index)] =
+          Base::faceWeight(fractionInside(phi0, phi1, phi2, phi3));
       }
     );
   }
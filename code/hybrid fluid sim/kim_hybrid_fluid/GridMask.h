@@ -0,0 +1,105 @@
+#ifndef __GridMask_h
+#define __GridMask_h
+
+#include "geometry/Index3.h"
+#include <cstdint>
+#include <vector>
+
+namespace cg
+{
+
+/**
+* D-dimensional grid of flags, one bit per cell.
+*
+* The cells have the ids of a GridData of the same size, so a mask can mark
+* the cells of a grid without storing a char per cell. Reads and writes of
+* cells sharing a 64-bit word are not atomic: a mask must be written by a
+* single thread, or by threads writing disjoint words.
+*
+* \tparam D Defines the number of dimensions.
+*/
+template <int D>
+class GridMask
+{
+public:
+  using id_type = typename Index<D>::base_type;
+
+  /** Constructs an empty mask. */
+  GridMask() = default;
+
+  /** Constructs a mask of given \p size with every cell cleared. */
+  explicit GridMask(const Index<D>& size)
+  {
+    resize(size);
+  }
+
+  /** Returns the mask size. */
+  const auto& size() const { return _size; }
+
+  /** Returns the number of cells. */
+  id_type length() const { return _length; }
+
+  /** Returns the id of the cell \p index. */
+  id_type id(const Index<D>& index) const
+  {
+    id_type id = index[D - 1];
+    for (int d = D - 2; d >= 0; --d)
+      id = id * _size[d] + index[d];
+    return id;
+  }
+
+  /** Resizes the mask to \p size and clears every cell. */
+  void resize(const Index<D>& size)
+  {
+    _size = size;
+    _length = size.prod();
+    _words.assign(size_t((_length + 63) >> 6), 0);
+  }
+
+  /** Returns the flag of the cell \p id. */
+  bool operator [](id_type id) const
+  {
+    return (_words[size_t(id >> 6)] >> (id & 63)) & 1;
+  }
+
+  /** Sets the flag of the cell \p id. */
+  void set(id_type id)
+  {
+    _words[size_t(id >> 6)] |= uint64_t(1) << (id & 63);
+  }
+
+  /** Clears the flag of the cell \p id. */
+  void reset(id_type id)
+  {
+    _words[size_t(id >> 6)] &= ~(uint64_t(1) << (id & 63));
+  }
+
+  /** Sets or clears the flag of every cell. */
+  void fill(bool value)
+  {
+    std::fill(_words.begin(), _words.end(), value ? ~uint64_t(0) : 0);
+  }
+
+  void swap(GridMask& other)
+  {
+    std::swap(_size, other._size);
+    std::swap(_length, other._length);
+    _words.swap(other._words);
+  }
+
+  /** Returns the memory used by the flags, in bytes. */
+  size_t byteSize() const
+  {
+    return _words.size() * sizeof(uint64_t);
+  }
+
+private:
+  Index<D> _size{ id_type(0) };
+  id_type _length{};
+  std::vector<uint64_t> _words;
+
+}; // GridMask
+
+} // end namespace cg
+
+#endif // __GridMask_h
@@ -9,25 +9,40 @@
 #include "GridBackwardEulerDiffusionSolver.h"
 #include "GridFractionalSinglePhasePressureSolver.h"
 #include "GridFractionalBoundaryConditionSolver.h"
+#include "GridAdvectionSolver.h"
 #include "Collider.h"
+#include "AdaptiveDomain.h"
+#include "FrameCache.h"
+#include "StageHash.h"
 #include "Constants.h"
 
 
 namespace cg
 {
 
-  template <size_t D, typename real>
+  /**
+  * Smoke solver.
+  *
+  * \tparam S Storage type of the scalar channels: real, or Half to halve
+  * their memory and the bandwidth of their advection. Values are converted
+  * at the samplers, so the solver computes in real either way.
+  */
+  template <size_t D, typename real, typename S = real>
   class GridSolver : public PhysicsAnimation
   {
   public:
     using vec = Vector<real, D>;
+    using scalar_grid = CellCenteredScalarGrid<D, real, S>;
     template <typename T> using Ref = Reference<T>;
 
-    GridSolver(const Index<D>& size, const vec& spacing, const vec& origin)
+    GridSolver(const Index<D>& size, const vec& spacing, const vec& origin):
+      _domain{ size, spacing, origin }
     {
       _velocity = new FaceCenteredGrid<D, real>(size+2, spacing, origin-spacing);
-      _density = new CellCenteredScalarGrid<D, real>(size+2, spacing, origin-spacing);
+      _density = new scalar_grid(size+2, spacing, origin-spacing);
       _solverSize = Index2{ size.x,size.y };
+      _scalarChannels.push_back(_density);
+      _scalarChannelInitialValues.push_back(real(0.0f));
       // use Adaptive SubTimeStepping
       this->setIsUsingFixedSubTimeSteps(false);
     }
@@ -43,6 +58,8 @@ namespace cg
       Density = 2,
     };
 
+    using AdvectionMode = typename GridAdvectionSolver<D, real>::Mode;
+
     // Returns gravity for this solver.
     const auto& gravity() const { return _gravity; };
 
@@ -55,9 +72,18 @@ namespace cg
     // Sets the viscosity coefficient. Non-positive input will clamped to zero.
     void setViscosityCoefficient(real viscosity) { _viscosityCoefficient = math::max<real>(viscosity, 0.0f); }
 
+    // Returns the viscosity solver, e.g. to check how often it reuses its
+    // factorizations.
+    const auto& diffusionSolver() const { return _diffusionSolver; }
+
     // Returns the CFL number from current velocity field for given time interval.
     real cfl(double timeInterval) const;
 
+    // Discards the max velocity cached at the end of the last pressure
+    // projection. Call it after changing the velocity field from outside
+    // the solver.
+    void invalidateMaxVelocity() { _isMaxVelocityValid = false; }
+
     // Returns the max allowed CFL number.
     real maxCfl() const { return _maxCfl; }
 
@@ -70,6 +96,12 @@ namespace cg
     // Sets the closed domain boundary flag.
     void setClosedDomainBoundaryFlag(int flag);
 
+    // Returns true if the pressure CG runs in float with double residual correction.
+    bool isUsingMixedPrecisionPressure() const { return _pressureSolver.isUsingMixedPrecision(); }
+
+    // Sets the mixed precision pressure solve.
+    void setUseMixedPrecisionPressure(bool flag) { _pressureSolver.setUseMixedPrecision(flag); }
+
     // Returns grid size.
     const auto& size() const { return _solverSize; }
 
@@ -85,6 +117,37 @@ namespace cg
     // Returns the density field, represented by a CellCenteredScalarGrid
     const auto& density() const { return _density; }
 
+    // Registers a new cell-centered scalar channel (temperature, fuel, dye...)
+    // advected along with the density, and returns its channel index.
+    size_t addScalarChannel(real initialValue = 0.0f);
+
+    // Returns the number of scalar channels, density included.
+    size_t numberOfScalarChannels() const { return _scalarChannels.size(); }
+
+    // Returns the i-th scalar channel. Channel 0 is always the density.
+    const auto& scalarChannel(size_t i) const { return _scalarChannels[i]; }
+
+    // Returns the advection scheme used for velocity and scalar channels.
+    auto advectionMode() const { return _advectionSolver.mode(); }
+
+    // Sets the advection scheme: semi-Lagrangian, MacCormack or BFECC.
+    void setAdvectionMode(AdvectionMode mode) { _advectionSolver.setMode(mode); }
+
+    // Returns true if advection samples with the monotone cubic interpolator.
+    bool isUsingCubicSampler() const
+    {
+      return _advectionSolver.sampler() == GridAdvectionSolver<D, real>::Sampler::MonotoneCubic;
+    }
+
+    // Sets whether advection samples with the monotone cubic interpolator
+    // instead of the bilinear one.
+    void setUseCubicSampler(bool useCubic)
+    {
+      _advectionSolver.setSampler(useCubic ?
+        GridAdvectionSolver<D, real>::Sampler::MonotoneCubic :
+        GridAdvectionSolver<D, real>::Sampler::Linear);
+    }
+
     const auto& collider() const { return _collider; }
 
     void setCollider(Collider<D, real>* collider);
@@ -93,6 +156,27 @@ namespace cg
      TODO
     void setEmitte(const GridEmitter* emitter);*/
 
+    // Returns true if the grids only cover the window of the domain around
+    // the density.
+    bool isUsingAdaptiveDomain() const { return _isUsingAdaptiveDomain; }
+
+    // Sets whether the grids only cover the window of the domain around the
+    // cells whose density is above the adaptive domain threshold. The window
+    // is updated at the beginning of every time-step; disabling it makes the
+    // grids cover the whole domain again.
+    void setUseAdaptiveDomain(bool use);
+
+    // Returns the density above which cells are kept in the window.
+    real adaptiveDomainThreshold() const { return _adaptiveDomainThreshold; }
+
+    // Sets the density above which cells are kept in the window.
+    void setAdaptiveDomainThreshold(real threshold) { _adaptiveDomainThreshold = threshold; }
+
+    // Returns the adaptive domain, whose margin and block size can be set.
+    auto& adaptiveDomain() { return _domain; }
+
+    const auto& adaptiveDomain() const { return _domain; }
+
 
   protected:
     // PhysicsAnimation virtual functions
@@ -102,6 +186,20 @@ namespace cg
 
     size_t numberOfSubTimeSteps(double timeInterval) const override;
 
+    // Writes the grid window, the velocity field, the scalar channels and
+    // the collider state. The scalar channels must be added before a
+    // checkpoint is loaded.
+    void saveState(CheckpointWriter& writer) const override;
+
+    void loadState(CheckpointReader& reader) override;
+
+    // Writes the density as "density", the other scalar channels as
+    // "channel<i>" and the velocity as "velocity.u", "velocity.v"...
+    void writeFrameCache(FrameCacheWriter& cache) const override;
+
+    // Hashes the arrays written by writeFrameCache, with the same names.
+    void hashState(StageHashLog& log) const override;
+
     // Called at the beginning of a time-step.
     virtual void onBeginAdvanceTimeStep(double timeInterval);
 
@@ -114,11 +212,14 @@ namespace cg
 
     virtual void computePressure(double timeInterval);
 
-    void advectDensity(Index2 idx, double timeInterval);
+    void advectScalarChannels(double timeInterval);
 
     void computeAdvection(double timeInterval, AdvectType type);
    
-    void advectVelocity(Index2 idx, double timeInterval);
+    void advectVelocity(double timeInterval);
+
+    template <size_t I>
+    void advectVelocityComponent(double timeInterval);
 
     void computeSource(double timeInterval);
 
@@ -132,7 +233,13 @@ namespace cg
 
     void applyBoundaryCondition();
 
-    void extrapolateIntoCollider(CellCenteredScalarGrid<D, real>& grid);
+    // Extrapolates the velocity into the faces of the open sides, before
+    // the projection sets them from p = 0 outside the domain.
+    void applyOutflowCondition();
+
+    void applyScalarBoundaryCondition(scalar_grid& grid);
+
+    void extrapolateIntoCollider(scalar_grid& grid);
 
     ScalarField<D, real>* colliderSdf() const;
 
@@ -144,17 +251,30 @@ namespace cg
     real _viscosityCoefficient{ 0.0f };
     real _maxCfl{ 5.0f };
     int _closedDomainBoundaryFlag{ constants::directionAll };
+    AdaptiveDomain<D, real> _domain;
+    bool _isUsingAdaptiveDomain{ false };
+    real _adaptiveDomainThreshold{ real(1e-3f) };
+    // max absolute velocity per component, cached after the projection
+    vec _maxVelocity;
+    bool _isMaxVelocityValid{ false };
 
     Ref<FaceCenteredGrid<D, real>> _velocity;
-    Ref<CellCenteredScalarGrid<D, real>> _density;
+    Ref<scalar_grid> _density;
     Ref<Collider<D, real>> _collider;
+    // scalar channels advected in a single fused pass; [0] is _density
+    std::vector<Ref<scalar_grid>> _scalarChannels;
+    // values of the cells entering the window, per channel
+    std::vector<real> _scalarChannelInitialValues;
+    // advection output buffers
+    std::vector<S> _scalarChannelsBuffer;
+    std::array<std::vector<real>, D> _advectedVelocity;
     // grid Emitter TODO
 
     // Solvers
     GridBackwardEulerDiffusionSolver<D, real, false> _diffusionSolver;
     GridFractionalSinglePhasePressureSolver<D, real> _pressureSolver;
     GridFractionalBoundaryConditionSolver<D, real> _boundaryConditionSolver;
-    // advectionSolver TODO
+    GridAdvectionSolver<D, real> _advectionSolver;
 
     void beginAdvanceTimeStep(double timeInterval);
 
@@ -164,48 +284,169 @@ namespace cg
 
     void updateEmitter(double timeInterval);
 
+    void updateDomainWindow();
+
+    void resizeDomainWindow(const Index<D>& oldMin);
+
+    void updateDomainBoundaryFlag();
+
   }; // GridSolver<D, real>
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline real
-    GridSolver<D, real>::cfl(double timeInterval) const
+    GridSolver<D, real, S>::cfl(double timeInterval) const
   {
+    // after the projection, the velocity only changes by advection, whose
+    // interpolation and limited corrections cannot increase its max.
+    // Colliders and emitters change the faces they cover when the next step
+    // begins, so faster ones are only seen from the step after
+    auto maxAbsVel = _isMaxVelocityValid ? _maxVelocity : _velocity->maxAbsVelocity();
     real maxVel = 0.0f;
-    forEachIndex<D>(_velocity->size(), [&](const Index<D>& index) {
-      auto v = _velocity->valueAtCellCenter(index) + timeInterval * _gravity;
-      maxVel = math::max(maxVel, v.max());
-      });
+    for (int i = 0; i < int(D); ++i)
+      maxVel = math::max<real>(maxVel, maxAbsVel[i] + std::abs(timeInterval * _gravity[i]));
 
     return real(maxVel * timeInterval / _velocity->gridSpacing().min());
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::setClosedDomainBoundaryFlag(int flag)
+    GridSolver<D, real, S>::setClosedDomainBoundaryFlag(int flag)
   {
     _closedDomainBoundaryFlag = flag;
-    _boundaryConditionSolver.setClosedDomainBoundaryFlag(flag);
+    updateDomainBoundaryFlag();
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::setCollider(Collider<D, real>* collider)
+    GridSolver<D, real, S>::setUseAdaptiveDomain(bool use)
+  {
+    _isUsingAdaptiveDomain = use;
+    if (use)
+      return;
+
+    auto oldMin = _domain.windowMin();
+    if (_domain.reset())
+      resizeDomainWindow(oldMin);
+  }
+
+  template<size_t D, typename real, typename S>
+  inline size_t
+    GridSolver<D, real, S>::addScalarChannel(real initialValue)
+  {
+    _scalarChannels.push_back(new scalar_grid(
+      _density->size(),
+      _density->cellSize(),
+      _density->bounds().min(),
+      initialValue
+    ));
+    _scalarChannelInitialValues.push_back(initialValue);
+    return _scalarChannels.size() - 1;
+  }
+
+  template<size_t D, typename real, typename S>
+  inline void
+    GridSolver<D, real, S>::setCollider(Collider<D, real>* collider)
   {
     _collider = collider;
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::initialize()
+    GridSolver<D, real, S>::saveState(CheckpointWriter& writer) const
+  {
+    PhysicsAnimation::saveState(writer);
+    writer.writeTag("GSLV");
+    writer.write(_domain.size());
+    writer.write(_domain.windowMin());
+    writer.write(_domain.windowSize());
+    writer.writeGrid(*_velocity->data<0>());
+    writer.writeGrid(*_velocity->data<1>());
+    if constexpr (D == 3)
+      writer.writeGrid(*_velocity->data<2>());
+    writer.write(_scalarChannels.size());
+    for (const auto& channel : _scalarChannels)
+      writer.writeGrid(*channel);
+    writer.write(_maxVelocity);
+    writer.write(_isMaxVelocityValid);
+    _diffusionSolver.saveState(writer);
+    writer.write(_collider != nullptr);
+    if (_collider != nullptr)
+      _collider->saveState(writer);
+  }
+
+  template<size_t D, typename real, typename S>
+  inline void
+    GridSolver<D, real, S>::loadState(CheckpointReader& reader)
+  {
+    PhysicsAnimation::loadState(reader);
+    reader.expectTag("GSLV");
+    if (reader.read<Index<D>>() != _domain.size())
+      throw std::runtime_error("GridSolver: domain size mismatch");
+
+    auto min = reader.read<Index<D>>();
+    auto size = reader.read<Index<D>>();
+    if (_domain.setWindow(min, size))
+    {
+      auto spacing = _domain.spacing();
+      auto origin = _domain.windowOrigin() - spacing;
+
+      _velocity = new FaceCenteredGrid<D, real>(size + 2, spacing, origin);
+      for (size_t c = 0; c < _scalarChannels.size(); ++c)
+        _scalarChannels[c] = new scalar_grid(
+          size + 2, spacing, origin, _scalarChannelInitialValues[c]);
+      _density = _scalarChannels[0];
+      _solverSize = Index2{ size.x, size.y };
+      updateDomainBoundaryFlag();
+    }
+    reader.readGrid(*_velocity->data<0>());
+    reader.readGrid(*_velocity->data<1>());
+    if constexpr (D == 3)
+      reader.readGrid(*_velocity->data<2>());
+    if (reader.read<size_t>() != _scalarChannels.size())
+      throw std::runtime_error("GridSolver: scalar channel count mismatch");
+    for (auto& channel : _scalarChannels)
+      reader.readGrid(*channel);
+    reader.read(_maxVelocity);
+    reader.read(_isMaxVelocityValid);
+    _diffusionSolver.loadState(reader);
+    if (reader.read<bool>() != (_collider != nullptr))
+      throw std::runtime_error("GridSolver: collider mismatch");
+    if (_collider != nullptr)
+      _collider->loadState(reader);
+  }
+
+  template<size_t D, typename real, typename S>
+  inline void
+    GridSolver<D, real, S>::writeFrameCache(FrameCacheWriter& cache) const
+  {
+    cache.addScalarGrid("density", *_density);
+    for (size_t c = 1; c < _scalarChannels.size(); ++c)
+      cache.addScalarGrid(("channel" + std::to_string(c)).c_str(), *_scalarChannels[c]);
+    cache.addVelocity("velocity", *_velocity);
+  }
+
+  template<size_t D, typename real, typename S>
+  inline void
+    GridSolver<D, real, S>::hashState(StageHashLog& log) const
+  {
+    log.addGrid("density", *_density);
+    for (size_t c = 1; c < _scalarChannels.size(); ++c)
+      log.addGrid(("channel" + std::to_string(c)).c_str(), *_scalarChannels[c]);
+    log.addVelocity("velocity", *_velocity);
+  }
+
+  template<size_t D, typename real, typename S>
+  inline void
+    GridSolver<D, real, S>::initialize()
   {
     updateCollider(0.0);
 
     updateEmitter(0.0);
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::densityStep(double timeInterval)
+    GridSolver<D, real, S>::densityStep(double timeInterval)
   {
     computeSource(timeInterval);
 
@@ -214,9 +455,9 @@ namespace cg
     computeAdvection(timeInterval, AdvectType::Density);
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::velocityStep(double timeInterval)
+    GridSolver<D, real, S>::velocityStep(double timeInterval)
   {
 #ifdef _DEBUG
     // asserting min grid size
@@ -236,9 +477,9 @@ namespace cg
     endAdvanceTimeStep(timeInterval);
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::onAdvanceTimeStep(double timeInterval)
+    GridSolver<D, real, S>::onAdvanceTimeStep(double timeInterval)
   {
 #ifdef _DEBUG
     // asserting min grid size
@@ -246,46 +487,50 @@ namespace cg
 #endif // _DEBUG
 
     beginAdvanceTimeStep(timeInterval);
+    this->hashStage("begin");
 
     densityStep(timeInterval);
+    this->hashStage("density");
 
     velocityStep(timeInterval);
+    this->hashStage("velocity");
 
     endAdvanceTimeStep(timeInterval);
+    this->hashStage("end");
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline size_t
-    GridSolver<D, real>::numberOfSubTimeSteps(double timeInterval) const
+    GridSolver<D, real, S>::numberOfSubTimeSteps(double timeInterval) const
   {
     auto _cfl = cfl(timeInterval);
     return static_cast<size_t>(math::max<real>(std::ceil(_cfl / _maxCfl), 1.0f));
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::onBeginAdvanceTimeStep(double timeInterval)
+    GridSolver<D, real, S>::onBeginAdvanceTimeStep(double timeInterval)
   {
     // do nothing
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::onEndAdvanceTimeStep(double timeInterval)
+    GridSolver<D, real, S>::onEndAdvanceTimeStep(double timeInterval)
   {
     // do nothing
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::computeExternalForces(double timeInterval)
+    GridSolver<D, real, S>::computeExternalForces(double timeInterval)
   {
     computeGravity(timeInterval);
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::computeViscosity(double timeInterval)
+    GridSolver<D, real, S>::computeViscosity(double timeInterval)
   {
     Stopwatch s;
     if (math::isPositive(_viscosityCoefficient))
@@ -305,12 +550,16 @@ namespace cg
     }
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::computePressure(double timeInterval)
+    GridSolver<D, real, S>::computePressure(double timeInterval)
   {
     Stopwatch s;
     s.start();
+    applyOutflowCondition();
+
+    _pressureSolver.setBoundarySdfRevision(
+      _boundaryConditionSolver.colliderRevision());
     _pressureSolver.solve(
       _velocity,
       timeInterval,
@@ -322,96 +571,103 @@ namespace cg
     //debug("[INFO] Pressure solver took %lld ms\n", s.time());
 
     applyBoundaryCondition();
+
+    _maxVelocity = _velocity->maxAbsVelocity();
+    _isMaxVelocityValid = true;
   }
 
-  template<size_t D, typename real>
-  inline void GridSolver<D, real>::advectVelocity(Index2 idx, double timeInterval)
+  template<size_t D, typename real, typename S>
+  inline void GridSolver<D, real, S>::advectVelocity(double timeInterval)
+  {
+    // every component is traced through the old velocity field, so the
+    // advected components are only written back once all of them are done
+    advectVelocityComponent<0>(timeInterval);
+    advectVelocityComponent<1>(timeInterval);
+    if constexpr (D == 3)
+      advectVelocityComponent<2>(timeInterval);
+
+    for (size_t i = 0; i < D; ++i)
+    {
+      const auto& advected = _advectedVelocity[i];
+      auto* data = &_velocity->velocityAt(i, Index<D>{ 0 });
+      std::copy(advected.begin(), advected.end(), data);
+    }
+  }
+
+  template<size_t D, typename real, typename S>
+  template<size_t I>
+  inline void GridSolver<D, real, S>::advectVelocityComponent(double timeInterval)
   {
-    auto vel = vec(_velocity->velocityAt<0>(idx), _velocity->velocityAt<1>(idx));
     auto bounds = _velocity->bounds();
     auto cellSize = gridSpacing();
-    auto minX = bounds.min().x + cellSize.x;
-    auto maxX = bounds.max().x - cellSize.x;
-    auto minY = bounds.min().y + cellSize.y;
-    auto maxY = bounds.max().y - cellSize.y;
-
-    auto uPos = _velocity->positionInSpace<0>();
-
-    auto newUPos = uPos(idx) - vel * timeInterval;
 
     //Stop backtracing at cell face
-    newUPos.x = newUPos.x < minX ? minX : newUPos.x;
-    newUPos.x = newUPos.x > maxX ? maxX : newUPos.x;
-    newUPos.y = newUPos.y < minY ? minY : newUPos.y;
-    newUPos.y = newUPos.y > maxY ? maxY : newUPos.y;
-
-    _velocity->velocityAt<0>(idx) = _velocity->sample(newUPos).x;
-
-    auto vPos = _velocity->positionInSpace<1>();
-
-    auto newVPos = vPos(idx) - vel * timeInterval;
-
-    //Stop backtracing at cell face
-    newVPos.x = newVPos.x < minX ? minX : newVPos.x;
-    newVPos.x = newVPos.x > maxX ? maxX : newVPos.x;
-    newVPos.y = newVPos.y < minY ? minY : newVPos.y;
-    newVPos.y = newVPos.y > maxY ? maxY : newVPos.y;
+    _advectionSolver.trace(
+      _velocity->iSize<I>(),
+      _velocity->iOrigin<I>(),
+      cellSize,
+      Index2{ 1, 1 },
+      size() + 1,
+      Bounds<real, D>{ bounds.min() + cellSize, bounds.max() - cellSize },
+      [this](const vec& p) { return _velocity->sample(p); },
+      timeInterval
+    );
 
-    _velocity->velocityAt<1>(idx) = _velocity->sample(newVPos).y;
+    auto& advected = _advectedVelocity[I];
+    advected.resize(_velocity->iSize<I>().prod());
+    _advectionSolver.advect(&_velocity->velocityAt<I>(int64_t(0)), advected.data());
   }
 
-  template<size_t D, typename real>
-  inline void GridSolver<D, real>::advectDensity(Index2 idx, double timeInterval)
+  template<size_t D, typename real, typename S>
+  inline void GridSolver<D, real, S>::advectScalarChannels(double timeInterval)
   {
-    auto vel = vec(_velocity->velocityAt<0>(idx), _velocity->velocityAt<1>(idx));
-    auto pos = _density->dataPosition(idx);
     auto bounds = _density->bounds();
     auto cellSize = _density->cellSize();
 
-    //if (idx == Index2{ 64,64 })
-      //debug("aq");
-    auto minX = bounds.min().x + cellSize.x;
-    auto maxX = bounds.max().x - cellSize.x;
-    auto minY = bounds.min().y + cellSize.y;
-    auto maxY = bounds.max().y - cellSize.y;
-
+    // All channels share the density layout, so the backtrace is computed
+    // once and reused by every channel.
     //Stop backtracing at cell face
-    auto newPos = pos - vel * timeInterval;
-    newPos.x = newPos.x < minX ? minX : newPos.x;
-    newPos.x = newPos.x > maxX ? maxX : newPos.x;
-    newPos.y = newPos.y < minY ? minY : newPos.y;
-    newPos.y = newPos.y > maxY ? maxY : newPos.y;
+    _advectionSolver.trace(
+      _density->dataSize(),
+      _density->dataOrigin(),
+      cellSize,
+      Index2{ 1, 1 },
+      size() + 1,
+      Bounds<real, D>{ bounds.min() + cellSize, bounds.max() - cellSize },
+      [this](const vec& p) { return _velocity->sample(p); },
+      timeInterval
+    );
 
-    (*_density)[idx] = _density->sample(newPos - gridSpacing() * .5f);
+    _scalarChannelsBuffer.resize(_density->length());
+    for (auto& channel : _scalarChannels)
+    {
+      auto* data = &(*channel)[int64_t(0)];
+      _advectionSolver.advect(data, _scalarChannelsBuffer.data());
+      std::copy(_scalarChannelsBuffer.begin(), _scalarChannelsBuffer.end(), data);
+    }
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::computeAdvection(double timeInterval, AdvectType type)
+    GridSolver<D, real, S>::computeAdvection(double timeInterval, AdvectType type)
   {
-    auto N = size().x;
-    Index2 index;
     if(type == AdvectType::Density)
-      for (index.y = 1; index.y <= N; ++index.y)
-        for (index.x = 1; index.x <= N; ++index.x)
-          advectDensity(index, timeInterval);
+      advectScalarChannels(timeInterval);
     else if (type == AdvectType::Velocity)
-      for (index.y = 1; index.y <= N; ++index.y)
-        for (index.x = 1; index.x <= N; ++index.x)
-          advectVelocity(index, timeInterval);
+      advectVelocity(timeInterval);
 
     applyBoundaryCondition();
   }
 
-  template<size_t D, typename real>
-  inline void GridSolver<D, real>::computeSource(double timeInterval)
+  template<size_t D, typename real, typename S>
+  inline void GridSolver<D, real, S>::computeSource(double timeInterval)
   {    
     applyBoundaryCondition();
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::computeGravity(double timeInterval)
+    GridSolver<D, real, S>::computeGravity(double timeInterval)
   {
     if (this->_gravity.squaredNorm() > math::Limits<real>::eps())
     {
@@ -446,82 +702,136 @@ namespace cg
     }
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline ScalarField<D, real>*
-    GridSolver<D, real>::fluidSdf() const
+    GridSolver<D, real, S>::fluidSdf() const
   {
     return new ConstantScalarField<D, real>(math::Limits<real>::inf());
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::applyBoundaryCondition()
+    GridSolver<D, real, S>::applyBoundaryCondition()
   {
-    /*auto depth = static_cast<unsigned int>(std::ceil(_maxCfl));
-    _boundaryConditionSolver.constrainVelocity(_velocity, depth);*/
+    auto depth = static_cast<unsigned int>(std::ceil(_maxCfl));
+    _boundaryConditionSolver.constrainVelocity(_velocity, depth);
+
+    // walls on closed sides; open ones keep the faces the projection set
+    auto flag = _boundaryConditionSolver.closedDomainBoundaryFlag();
     auto N = size().x;
+    auto M = size().y;
+    auto& u = *_velocity;
+    for (int j = 1; j <= M; j++)
+    {
+      if (flag & constants::directionLeft)
+        u.velocityAt<0>(Index2(1, j)) = 0;
+      if (flag & constants::directionRight)
+        u.velocityAt<0>(Index2(N, j)) = 0;
+    }
     for (int i = 1; i <= N; i++)
     {
-      _velocity->velocityAt<0>(Index2(1, i)) = 0;
-      _velocity->velocityAt<0>(Index2(N, i)) = 0;
+      if (flag & constants::directionDown)
+        u.velocityAt<1>(Index2(i, 1)) = 0;
+      if (flag & constants::directionUp)
+        u.velocityAt<1>(Index2(i, M)) = 0;
+    }
 
-      _velocity->velocityAt<1>(Index2(i, 1)) = 0;
-      _velocity->velocityAt<1>(Index2(i, N)) = 0;
+    for (auto& channel : _scalarChannels)
+      applyScalarBoundaryCondition(*channel);
+  }
+
+  template<size_t D, typename real, typename S>
+  inline void
+    GridSolver<D, real, S>::applyOutflowCondition()
+  {
+    _boundaryConditionSolver.extrapolateOutflowVelocity(*_velocity);
 
-      _density->operator[](Index2(0, i)) = _density->operator[](Index2(1, i));
-      _density->operator[](Index2(N+1, i)) = _density->operator[](Index2(N, i));
-      _density->operator[](Index2(i, 0)) = _density->operator[](Index2(i, 1));
-      _density->operator[](Index2(i, N+1)) = _density->operator[](Index2(i, N));
+    // zero-gradient outflow on open sides
+    auto flag = _boundaryConditionSolver.closedDomainBoundaryFlag();
+    auto N = size().x;
+    auto M = size().y;
+    auto& u = *_velocity;
+    for (int j = 1; j <= M; j++)
+    {
+      if (!(flag & constants::directionLeft))
+        u.velocityAt<0>(Index2(1, j)) = u.velocityAt<0>(Index2(2, j));
+      if (!(flag & constants::directionRight))
+        u.velocityAt<0>(Index2(N, j)) = u.velocityAt<0>(Index2(N - 1, j));
+    }
+    for (int i = 1; i <= N; i++)
+    {
+      if (!(flag & constants::directionDown))
+        u.velocityAt<1>(Index2(i, 1)) = u.velocityAt<1>(Index2(i, 2));
+      if (!(flag & constants::directionUp))
+        u.velocityAt<1>(Index2(i, M)) = u.velocityAt<1>(Index2(i, M - 1));
     }
-    _density->operator[](Index2(0, 0)) = .5f* (_density->operator[](Index2(1, 0))+ _density->operator[](Index2(0, 1)));
-    _density->operator[](Index2(0, N+1)) = .5f * (_density->operator[](Index2(1, N+1)) + _density->operator[](Index2(0, N)));
-    _density->operator[](Index2(N+1, 0)) = .5f * (_density->operator[](Index2(N, 0)) + _density->operator[](Index2(N+1, 1)));
-    _density->operator[](Index2(N+1, N+1)) = .5f * (_density->operator[](Index2(N, N+1)) + _density->operator[](Index2(N+1, N)));
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::extrapolateIntoCollider(CellCenteredScalarGrid<D, real>& grid)
+    GridSolver<D, real, S>::applyScalarBoundaryCondition(scalar_grid& grid)
   {
-    GridData<D, char> marker;
-    marker.resize(grid.dataSize());
+    auto N = size().x;
+    auto M = size().y;
+    for (int j = 1; j <= M; j++)
+    {
+      grid[Index2(0, j)] = grid[Index2(1, j)];
+      grid[Index2(N+1, j)] = grid[Index2(N, j)];
+    }
+    for (int i = 1; i <= N; i++)
+    {
+      grid[Index2(i, 0)] = grid[Index2(i, 1)];
+      grid[Index2(i, M+1)] = grid[Index2(i, M)];
+    }
+    grid[Index2(0, 0)] = .5f * (grid[Index2(1, 0)] + grid[Index2(0, 1)]);
+    grid[Index2(0, M+1)] = .5f * (grid[Index2(1, M+1)] + grid[Index2(0, M)]);
+    grid[Index2(N+1, 0)] = .5f * (grid[Index2(N, 0)] + grid[Index2(N+1, 1)]);
+    grid[Index2(N+1, M+1)] = .5f * (grid[Index2(N, M+1)] + grid[Index2(N+1, M)]);
+  }
+
+  template<size_t D, typename real, typename S>
+  inline void
+    GridSolver<D, real, S>::extrapolateIntoCollider(scalar_grid& grid)
+  {
+    GridMask<D> marker{ grid.dataSize() };
 
     for (size_t i = 0; i < grid.length(); ++i)
     {
       auto index = grid.index(i);
       auto colliderSdfQuery = colliderSdf()->sample(grid.dataPosition(index));
-      if (isInsideSdf(colliderSdfQuery))
-        marker[i] = 0;
-      else
-        marker[i] = 1;
+      if (!isInsideSdf(colliderSdfQuery))
+        marker.set(i);
     }
 
     auto depth = static_cast<unsigned int>(std::ceil(_maxCfl));
     extrapolateToRegion(grid, marker, depth, grid);
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline ScalarField<D, real>*
-    GridSolver<D, real>::colliderSdf() const
+    GridSolver<D, real, S>::colliderSdf() const
   {
     return _boundaryConditionSolver.colliderSdf();
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline VectorField<D, real>*
-    GridSolver<D, real>::colliderVelocityField() const
+    GridSolver<D, real, S>::colliderVelocityField() const
   {
     return _boundaryConditionSolver.colliderVelocityField();
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::beginAdvanceTimeStep(double timeInterval)
+    GridSolver<D, real, S>::beginAdvanceTimeStep(double timeInterval)
   {
     updateCollider(timeInterval);
 
     updateEmitter(timeInterval);
 
+    if (_isUsingAdaptiveDomain)
+      updateDomainWindow();
+
     _boundaryConditionSolver.updateCollider(
       _collider,
       _velocity->size(),
@@ -535,29 +845,131 @@ namespace cg
     onBeginAdvanceTimeStep(timeInterval);
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::endAdvanceTimeStep(double timeInterval)
+    GridSolver<D, real, S>::endAdvanceTimeStep(double timeInterval)
   {
     // Invoke callback
     onEndAdvanceTimeStep(timeInterval);
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::updateCollider(double timeInterval)
+    GridSolver<D, real, S>::updateCollider(double timeInterval)
   {
     if (_collider != nullptr)
       _collider->update(this->currentTime(), timeInterval);
   }
 
-  template<size_t D, typename real>
+  template<size_t D, typename real, typename S>
   inline void
-    GridSolver<D, real>::updateEmitter(double timeInterval)
+    GridSolver<D, real, S>::updateEmitter(double timeInterval)
   {
     // TODO
   }
 
+  template<size_t D, typename real, typename S>
+  inline void
+    GridSolver<D, real, S>::updateDomainWindow()
+  {
+    struct Box
+    {
+      Index<D> min;
+      Index<D> max;
+    };
+
+    // bounding box of the interior cells whose density is above the threshold
+    const auto& grid = *_density;
+    const auto dataSize = grid.size();
+    const Box none{
+      Index<D>(std::numeric_limits<int64_t>::max()),
+      Index<D>(std::numeric_limits<int64_t>::min()) };
+
+    auto box = parallelReduce(int64_t(0), int64_t(grid.length()), none,
+      [&](int64_t b, int64_t e, Box box) {
+        for (auto i = b; i < e; ++i)
+        {
+          if (grid[i] <= _adaptiveDomainThreshold)
+            continue;
+
+          auto index = grid.index(i);
+          bool isInterior = true;
+          for (size_t d = 0; d < D; ++d)
+            isInterior = isInterior && index[d] > 0 && index[d] < dataSize[d] - 1;
+          if (!isInterior)
+            continue;
+
+          for (size_t d = 0; d < D; ++d)
+          {
+            box.min[d] = math::min(box.min[d], index[d]);
+            box.max[d] = math::max(box.max[d], index[d]);
+          }
+        }
+        return box;
+      },
+      [](Box a, const Box& b) {
+        for (size_t d = 0; d < D; ++d)
+        {
+          a.min[d] = math::min(a.min[d], b.min[d]);
+          a.max[d] = math::max(a.max[d], b.max[d]);
+        }
+        return a;
+      }, 4096);
+
+    // no dense cell: the window stays where it is
+    if (box.min.x > box.max.x)
+      return;
+
+    // data index i (ghost layer at 0) is lattice cell windowMin + i - 1
+    auto oldMin = _domain.windowMin();
+    auto toLattice = oldMin - Index<D>(int64_t(1));
+    if (_domain.fit(box.min + toLattice, box.max + toLattice))
+      resizeDomainWindow(oldMin);
+  }
+
+  template<size_t D, typename real, typename S>
+  inline void
+    GridSolver<D, real, S>::resizeDomainWindow(const Index<D>& oldMin)
+  {
+    // Both the old and the new grids lie on the lattice of the domain, so
+    // the data is shifted by a whole number of cells. Cells entering the
+    // window are at rest and hold the initial value of their channel.
+    auto offset = _domain.windowMin() - oldMin;
+    auto size = _domain.windowSize();
+    auto spacing = _domain.spacing();
+    auto origin = _domain.windowOrigin() - spacing;
+
+    Ref<FaceCenteredGrid<D, real>> velocity = new FaceCenteredGrid<D, real>(size + 2, spacing, origin);
+    copyShifted(*_velocity->data<0>(), offset, *velocity->data<0>(), real(0));
+    copyShifted(*_velocity->data<1>(), offset, *velocity->data<1>(), real(0));
+    if constexpr (D == 3)
+      copyShifted(*_velocity->data<2>(), offset, *velocity->data<2>(), real(0));
+    _velocity = velocity;
+
+    for (size_t c = 0; c < _scalarChannels.size(); ++c)
+    {
+      auto value = _scalarChannelInitialValues[c];
+      Ref<scalar_grid> channel =
+        new scalar_grid(size + 2, spacing, origin, value);
+      copyShifted(*_scalarChannels[c], offset, *channel, S(value));
+      _scalarChannels[c] = channel;
+    }
+    _density = _scalarChannels[0];
+    _solverSize = Index2{ size.x, size.y };
+
+    updateDomainBoundaryFlag();
+  }
+
+  template<size_t D, typename real, typename S>
+  inline void
+    GridSolver<D, real, S>::updateDomainBoundaryFlag()
+  {
+    // window sides inside the domain let the fluid through
+    auto flag = _domain.windowBoundaryFlag(_closedDomainBoundaryFlag);
+    _boundaryConditionSolver.setClosedDomainBoundaryFlag(flag);
+    _pressureSolver.setClosedDomainBoundaryFlag(flag);
+  }
+
 } // end namespace cg
 
 #endif // __GridSolver_h
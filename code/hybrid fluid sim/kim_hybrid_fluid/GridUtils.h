@@ -2,6 +2,9 @@
 #define __GridUtils_h
 
 #include "MathUtils.h"
+#include "Parallel.h"
+#include "GridMask.h"
+#include "Half.h"
 
 namespace cg
 {
@@ -138,10 +141,17 @@ fill(GridData<D, T>& grid, const T& value)
     grid[i] = value;
 }
 
-template <size_t D, typename T>
+/// <summary>
+/// Extrapolates the values of the valid cells into the invalid ones
+/// </summary>
+/// <typeparam name="T">Data type stored, real or Half</typeparam>
+/// <typeparam name="Mask">GridMask or GridData of char flagging the valid cells</typeparam>
+/// <param name="iterations">Number of layers of cells extrapolated</param>
+template <size_t D, typename T, typename Mask>
 inline void
-extrapolateToRegion(const Grid<D, T>& input, const GridData<D, char>& valid, unsigned iterations, Grid<D, T>& output)
+extrapolateToRegion(const Grid<D, T>& input, const Mask& valid, unsigned iterations, Grid<D, T>& output)
 {
+  using value_type = typename StorageTraits<T>::value_type;
   const auto size = input.size();
   auto n = size.prod();
 
@@ -150,13 +160,14 @@ extrapolateToRegion(const Grid<D, T>& input, const GridData<D, char>& valid, uns
   assert(size == output.size());
 #endif // _DEBUG
 
-  std::vector<char> valid0, valid1;
-  valid0.resize(n);
-  valid1.resize(n);
+  // bit-packed, so the validity of a whole neighborhood fits in a few words
+  GridMask<D> valid0{ size };
+  GridMask<D> valid1{ size };
 
   for (decltype(n) i = 0; i < n; ++i)
   {
-    valid0[i] = valid[i];
+    if (valid[i])
+      valid0.set(i);
     output[i] = input[i];
   }
 
@@ -166,7 +177,7 @@ extrapolateToRegion(const Grid<D, T>& input, const GridData<D, char>& valid, uns
   {
     for (decltype(n) i = 0; i < n; ++i)
     {
-      T sum = T(0);
+      value_type sum = value_type(0);
       unsigned count = 0;
 
       if (!valid0[i])
@@ -192,19 +203,103 @@ extrapolateToRegion(const Grid<D, T>& input, const GridData<D, char>& valid, uns
 
         if (count > 0)
         {
-          output[i] = sum / ((T)count);
-          valid1[i] = 1;
+          output[i] = sum / value_type(count);
+          valid1.set(i);
         }
       }
       else
       {
-        valid1[i] = 1;
+        valid1.set(i);
       }
     }
     valid1.swap(valid0);
   }
 }
 
+/// <summary>
+/// Copies the values of a grid into another grid of the same lattice
+/// </summary>
+/// <param name="input">Grid to copy from</param>
+/// <param name="offset">Index of the first cell of output in input</param>
+/// <param name="output">Grid to copy to</param>
+/// <param name="value">Value of the cells of output outside input</param>
+template <int D, typename T>
+inline void
+copyShifted(const Grid<D, T>& input, const Index<D>& offset, Grid<D, T>& output, const T& value)
+{
+  const auto inSize = input.size();
+  const auto outSize = output.size();
+
+  // x-rows are contiguous in both grids, so each one is a single copy
+  auto rows = outSize;
+  rows.x = 1;
+  auto x0 = math::min<int64_t>(math::max<int64_t>(-offset.x, 0), outSize.x);
+  auto x1 = math::max<int64_t>(math::min<int64_t>(inSize.x - offset.x, outSize.x), x0);
+
+  parallelForEachIndex<D>(rows, [&](const Index<D>& row) {
+    auto* out = &output[row];
+    auto src = row + offset;
+    bool isInside = true;
+    for (int d = 1; d < D; ++d)
+      isInside = isInside && src[d] >= 0 && src[d] < inSize[d];
+
+    if (!isInside || x0 == x1)
+    {
+      std::fill(out, out + outSize.x, value);
+      return;
+    }
+
+    src.x = x0 + offset.x;
+    std::fill(out, out + x0, value);
+    std::copy(&input[src], &input[src] + (x1 - x0), out + x0);
+    std::fill(out + x1, out + outSize.x, value);
+    });
+}
+
+/// <summary>
+/// Errors of a grid against a reference grid of the same size
+/// </summary>
+struct GridErrorReport
+{
+  double maxError{};
+  double rmsError{};
+  double relativeL2{};
+};
+
+/// <summary>
+/// Measures the error of a grid stored at a lower precision, such as a
+/// Half channel, against the same channel computed at full precision
+/// </summary>
+/// <param name="reference">Grid computed at full precision</param>
+/// <param name="grid">Grid to measure</param>
+template <int D, typename T, typename U>
+inline GridErrorReport
+compareGrids(const Grid<D, T>& reference, const Grid<D, U>& grid)
+{
+  if (reference.size() != grid.size())
+    throw std::runtime_error("compareGrids(): grids of different sizes");
+
+  GridErrorReport report;
+  double sumError = 0;
+  double sumReference = 0;
+  const auto n = reference.length();
+
+  for (decltype(reference.length()) i = 0; i < n; ++i)
+  {
+    // Half converts to float, which converts exactly to double
+    auto r = double(reference[i]);
+    auto e = std::abs(double(grid[i]) - r);
+    report.maxError = std::max(report.maxError, e);
+    sumError += e * e;
+    sumReference += r * r;
+  }
+  if (n > 0)
+    report.rmsError = std::sqrt(sumError / double(n));
+  if (sumReference > 0)
+    report.relativeL2 = std::sqrt(sumError / sumReference);
+  return report;
+}
+
 } // end namespace cg
 
 #endif // __GridUtils_h
@@ -0,0 +1,155 @@
+#ifndef __Half_h
+#define __Half_h
+
+#include <cstdint>
+#include <cstring>
+
+namespace cg
+{
+
+/**
+* IEEE 754 half precision (binary16) conversions.
+*
+* Half values are stored as their 16 bits. Conversions round to the nearest
+* even value, keep subnormals, and map values out of range to infinity.
+*/
+namespace half
+{
+
+/** Converts a float to the bits of the nearest half. */
+inline uint16_t fromFloat(float value)
+{
+  uint32_t f;
+  std::memcpy(&f, &value, sizeof(f));
+
+  uint32_t sign = (f >> 16) & 0x8000u;
+  f &= 0x7fffffffu;
+
+  // NaN stays NaN, and everything from 65520 on rounds to infinity
+  if (f > 0x7f800000u)
+    return uint16_t(sign | 0x7e00u);
+  if (f >= 0x477ff000u)
+    return uint16_t(sign | 0x7c00u);
+
+  if (f < 0x38800000u)
+  {
+    // subnormal half: align the mantissa, with its implicit bit, to 2^-24
+    if (f < 0x33000000u)
+      return uint16_t(sign);
+    auto e = f >> 23;
+    auto m = (f & 0x7fffffu) | 0x800000u;
+    auto shift = 126 - e;
+    auto h = m >> shift;
+    auto rest = m & ((1u << shift) - 1);
+    auto halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (h & 1)))
+      ++h;
+    return uint16_t(sign | h);
+  }
+
+  // normal half: rebias the exponent and round off 13 mantissa bits
+  auto h = (f - 0x38000000u) >> 13;
+  auto rest = f & 0x1fffu;
+  if (rest > 0x1000u || (rest == 0x1000u && (h & 1)))
+    ++h;
+  return uint16_t(sign | h);
+}
+
+/** Converts the bits of a half to a float. */
+inline float toFloat(uint16_t value)
+{
+  uint32_t sign = uint32_t(value & 0x8000u) << 16;
+  uint32_t e = (value >> 10) & 0x1fu;
+  uint32_t m = value & 0x3ffu;
+  uint32_t f;
+
+  if (e == 0x1fu)
+    f = sign | 0x7f800000u | (m << 13);
+  else if (e != 0)
+    f = sign | ((e + 112) << 23) | (m << 13);
+  else if (m == 0)
+    f = sign;
+  else
+  {
+    // subnormal half: normalize the mantissa
+    e = 113;
+    while ((m & 0x400u) == 0)
+    {
+      m <<= 1;
+      --e;
+    }
+    f = sign | (e << 23) | ((m & 0x3ffu) << 13);
+  }
+
+  float result;
+  std::memcpy(&result, &f, sizeof(f));
+  return result;
+}
+
+} // end namespace half
+
+/**
+* Half precision storage type.
+*
+* Grids of Half store 16 bits per value and convert to and from float on
+* every access, so samplers and solvers compute in full precision while the
+* data moves at half the bandwidth.
+*/
+struct Half
+{
+  uint16_t bits;
+
+  Half() = default;
+
+  Half(float value):
+    bits{ half::fromFloat(value) }
+  {
+    // do nothing
+  }
+
+  operator float() const
+  {
+    return half::toFloat(bits);
+  }
+
+  Half& operator +=(float value)
+  {
+    return *this = float(*this) + value;
+  }
+
+  Half& operator -=(float value)
+  {
+    return *this = float(*this) - value;
+  }
+
+  Half& operator *=(float value)
+  {
+    return *this = float(*this) * value;
+  }
+
+  Half& operator /=(float value)
+  {
+    return *this = float(*this) / value;
+  }
+
+}; // Half
+
+/**
+* Type in which values stored as T are computed: T itself, or float for
+* Half.
+*/
+template <typename T>
+struct StorageTraits
+{
+  using value_type = T;
+};
+
+template <>
+struct StorageTraits<Half>
+{
+  using value_type = float;
+};
+
+} // end namespace cg
+
+#endif // __Half_h
@@ -0,0 +1,635 @@
+#ifndef __Json_h
+#define __Json_h
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cg
+{
+
+/**
+* JSON value.
+*
+* A small JSON document model, enough for scene and configuration files.
+* Object members keep the order in which they were read, and lookups are
+* linear, which is fine for the handful of keys of a configuration object.
+*/
+class JsonValue
+{
+public:
+  enum class Type
+  {
+    Null,
+    Bool,
+    Number,
+    String,
+    Array,
+    Object
+  };
+
+  using Member = std::pair<std::string, JsonValue>;
+
+  /** Constructs a null value. */
+  JsonValue() = default;
+
+  JsonValue(bool value):
+    _type{ Type::Bool },
+    _bool{ value }
+  {
+    // do nothing
+  }
+
+  JsonValue(double value):
+    _type{ Type::Number },
+    _number{ value }
+  {
+    // do nothing
+  }
+
+  JsonValue(int value):
+    JsonValue{ double(value) }
+  {
+    // do nothing
+  }
+
+  JsonValue(const std::string& value):
+    _type{ Type::String },
+    _string{ value }
+  {
+    // do nothing
+  }
+
+  JsonValue(const char* value):
+    JsonValue{ std::string{ value } }
+  {
+    // do nothing
+  }
+
+  /** Returns an empty array. */
+  static JsonValue array()
+  {
+    JsonValue value;
+    value._type = Type::Array;
+    return value;
+  }
+
+  /** Returns an empty object. */
+  static JsonValue object()
+  {
+    JsonValue value;
+    value._type = Type::Object;
+    return value;
+  }
+
+  Type type() const { return _type; }
+
+  bool isNull() const { return _type == Type::Null; }
+  bool isBool() const { return _type == Type::Bool; }
+  bool isNumber() const { return _type == Type::Number; }
+  bool isString() const { return _type == Type::String; }
+  bool isArray() const { return _type == Type::Array; }
+  bool isObject() const { return _type == Type::Object; }
+
+  bool asBool() const
+  {
+    check(Type::Bool, "a boolean");
+    return _bool;
+  }
+
+  double asNumber() const
+  {
+    check(Type::Number, "a number");
+    return _number;
+  }
+
+  /** Returns the number, which must be an integer. */
+  int asInt() const
+  {
+    auto n = asNumber();
+    if (n != std::floor(n))
+      throw std::runtime_error("JsonValue: expected an integer");
+    return int(n);
+  }
+
+  const std::string& asString() const
+  {
+    check(Type::String, "a string");
+    return _string;
+  }
+
+  /** Returns the elements of an array. */
+  const std::vector<JsonValue>& elements() const
+  {
+    check(Type::Array, "an array");
+    return _elements;
+  }
+
+  /** Returns the members of an object. */
+  const std::vector<Member>& members() const
+  {
+    check(Type::Object, "an object");
+    return _members;
+  }
+
+  /** Returns the number of elements or members. */
+  size_t size() const
+  {
+    return _type == Type::Array ? _elements.size() :
+      _type == Type::Object ? _members.size() : 0;
+  }
+
+  const JsonValue& operator [](size_t i) const
+  {
+    if (i >= elements().size())
+      throw std::runtime_error("JsonValue: index out of range");
+    return _elements[i];
+  }
+
+  JsonValue& operator [](size_t i)
+  {
+    return const_cast<JsonValue&>(static_cast<const JsonValue&>(*this)[i]);
+  }
+
+  /** Appends \p value to an array. */
+  void append(const JsonValue& value)
+  {
+    check(Type::Array, "an array");
+    _elements.push_back(value);
+  }
+
+  /** Returns the member \p key of an object, or nullptr if there is none. */
+  const JsonValue* find(const std::string& key) const
+  {
+    for (const auto& member : members())
+      if (member.first == key)
+        return &member.second;
+    return nullptr;
+  }
+
+  JsonValue* find(const std::string& key)
+  {
+    return const_cast<JsonValue*>(static_cast<const JsonValue&>(*this).find(key));
+  }
+
+  bool contains(const std::string& key) const
+  {
+    return find(key) != nullptr;
+  }
+
+  /** Returns the member \p key of an object, which must exist. */
+  const JsonValue& operator [](const std::string& key) const
+  {
+    if (auto value = find(key))
+      return *value;
+    throw std::runtime_error("JsonValue: missing member \"" + key + "\"");
+  }
+
+  JsonValue& operator [](const std::string& key)
+  {
+    return const_cast<JsonValue&>(static_cast<const JsonValue&>(*this)[key]);
+  }
+
+  /** Sets the member \p key of an object, adding it if needed. */
+  void set(const std::string& key, const JsonValue& value)
+  {
+    if (auto member = find(key))
+      *member = value;
+    else
+      _members.emplace_back(key, value);
+  }
+
+  /** Returns the number \p key of an object, or \p value if there is none. */
+  double get(const std::string& key, double value) const
+  {
+    auto member = find(key);
+    return member != nullptr ? member->asNumber() : value;
+  }
+
+  int get(const std::string& key, int value) const
+  {
+    auto member = find(key);
+    return member != nullptr ? member->asInt() : value;
+  }
+
+  bool get(const std::string& key, bool value) const
+  {
+    auto member = find(key);
+    return member != nullptr ? member->asBool() : value;
+  }
+
+  std::string get(const std::string& key, const char* value) const
+  {
+    auto member = find(key);
+    return member != nullptr ? member->asString() : std::string{ value };
+  }
+
+  /** Parses the JSON text \p text. */
+  static JsonValue parse(const std::string& text);
+
+  /** Parses the JSON file \p path. */
+  static JsonValue load(const std::string& path)
+  {
+    std::ifstream file{ path, std::ios::binary };
+    if (!file)
+      throw std::runtime_error("JsonValue: cannot open " + path);
+
+    std::stringstream text;
+    text << file.rdbuf();
+    try
+    {
+      return parse(text.str());
+    }
+    catch (const std::exception& e)
+    {
+      throw std::runtime_error(path + ": " + e.what());
+    }
+  }
+
+  /** Returns the JSON text of the value, on a single line. */
+  std::string toString() const
+  {
+    std::string text;
+    write(text);
+    return text;
+  }
+
+private:
+  Type _type{ Type::Null };
+  bool _bool{};
+  double _number{};
+  std::string _string;
+  std::vector<JsonValue> _elements;
+  std::vector<Member> _members;
+
+  class Parser;
+
+  void check(Type type, const char* name) const
+  {
+    if (_type != type)
+      throw std::runtime_error(std::string("JsonValue: expected ") + name);
+  }
+
+  static void writeString(const std::string& s, std::string& text)
+  {
+    text += '"';
+    for (auto c : s)
+      switch (c)
+      {
+        case '"': text += "\\\""; break;
+        case '\\': text += "\\\\"; break;
+        case '\n': text += "\\n"; break;
+        case '\t': text += "\\t"; break;
+        case '\r': text += "\\r"; break;
+        default:
+          if ((unsigned char)c < 0x20)
+          {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            text += code;
+          }
+          else
+            text += c;
+      }
+    text += '"';
+  }
+
+  void write(std::string& text) const
+  {
+    switch (_type)
+    {
+      case Type::Null:
+        text += "null";
+        break;
+      case Type::Bool:
+        text += _bool ? "true" : "false";
+        break;
+      case Type::Number:
+      {
+        // JSON has no infinities nor NaNs
+        if (!std::isfinite(_number))
+        {
+          text += "null";
+          break;
+        }
+
+        // the shortest text that reads back the same number, whatever the
+        // locale
+        char number[32];
+        auto end = std::to_chars(number, number + sizeof(number), _number).ptr;
+        text.append(number, end);
+        break;
+      }
+      case Type::String:
+        writeString(_string, text);
+        break;
+      case Type::Array:
+        text += '[';
+        for (size_t i = 0; i < _elements.size(); ++i)
+        {
+          if (i > 0)
+            text += ", ";
+          _elements[i].write(text);
+        }
+        text += ']';
+        break;
+      case Type::Object:
+        text += '{';
+        for (size_t i = 0; i < _members.size(); ++i)
+        {
+          if (i > 0)
+            text += ", ";
+          writeString(_members[i].first, text);
+          text += ": ";
+          _members[i].second.write(text);
+        }
+        text += '}';
+        break;
+    }
+  }
+
+}; // JsonValue
+
+// Recursive descent parser of RFC 8259 JSON; errors report the line.
+class JsonValue::Parser
+{
+public:
+  Parser(const std::string& text):
+    _text(text)
+  {
+    // do nothing
+  }
+
+  JsonValue parseDocument()
+  {
+    auto value = parseValue(0);
+    skipSpace();
+    if (_pos != _text.size())
+      fail("unexpected text after the value");
+    return value;
+  }
+
+private:
+  static constexpr int maxDepth = 256;
+
+  const std::string& _text;
+  size_t _pos{};
+
+  [[noreturn]] void fail(const std::string& message) const
+  {
+    size_t line = 1;
+    for (size_t i = 0; i < _pos && i < _text.size(); ++i)
+      line += _text[i] == '\n';
+    throw std::runtime_error("line " + std::to_string(line) + ": " + message);
+  }
+
+  void skipSpace()
+  {
+    while (_pos < _text.size())
+    {
+      auto c = _text[_pos];
+      if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+        break;
+      ++_pos;
+    }
+  }
+
+  bool consume(char c)
+  {
+    skipSpace();
+    if (_pos < _text.size() && _text[_pos] == c)
+    {
+      ++_pos;
+      return true;
+    }
+    return false;
+  }
+
+  void expect(char c)
+  {
+    if (!consume(c))
+      fail(std::string("expected '") + c + "'");
+  }
+
+  bool consumeWord(const char* word)
+  {
+    auto n = strlen(word);
+    if (_text.compare(_pos, n, word) != 0)
+      return false;
+    _pos += n;
+    return true;
+  }
+
+  JsonValue parseValue(int depth)
+  {
+    if (depth > maxDepth)
+      fail("too deeply nested");
+    skipSpace();
+    if (_pos == _text.size())
+      fail("unexpected end of text");
+
+    auto c = _text[_pos];
+    if (c == '{')
+      return parseObject(depth);
+    if (c == '[')
+      return parseArray(depth);
+    if (c == '"')
+      return JsonValue{ parseString() };
+    if (consumeWord("true"))
+      return JsonValue{ true };
+    if (consumeWord("false"))
+      return JsonValue{ false };
+    if (consumeWord("null"))
+      return JsonValue{};
+    return JsonValue{ parseNumber() };
+  }
+
+  JsonValue parseObject(int depth)
+  {
+    auto object = JsonValue::object();
+    expect('{');
+    if (consume('}'))
+      return object;
+    do
+    {
+      skipSpace();
+      if (_pos == _text.size() || _text[_pos] != '"')
+        fail("expected a member name");
+      auto key = parseString();
+      expect(':');
+      object._members.emplace_back(std::move(key), parseValue(depth + 1));
+    } while (consume(','));
+    expect('}');
+    return object;
+  }
+
+  JsonValue parseArray(int depth)
+  {
+    auto array = JsonValue::array();
+    expect('[');
+    if (consume(']'))
+      return array;
+    do
+      array._elements.push_back(parseValue(depth + 1));
+    while (consume(','));
+    expect(']');
+    return array;
+  }
+
+  unsigned parseHex4()
+  {
+    if (_text.size() - _pos < 4)
+      fail("invalid unicode escape");
+    unsigned code = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+      auto c = _text[_pos++];
+      code <<= 4;
+      if (c >= '0' && c <= '9')
+        code |= c - '0';
+      else if (c >= 'a' && c <= 'f')
+        code |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F')
+        code |= c - 'A' + 10;
+      else
+        fail("invalid unicode escape");
+    }
+    return code;
+  }
+
+  static void appendUtf8(unsigned code, std::string& s)
+  {
+    if (code < 0x80)
+      s += char(code);
+    else if (code < 0x800)
+    {
+      s += char(0xc0 | (code >> 6));
+      s += char(0x80 | (code & 0x3f));
+    }
+    else if (code < 0x10000)
+    {
+      s += char(0xe0 | (code >> 12));
+      s += char(0x80 | ((code >> 6) & 0x3f));
+      s += char(0x80 | (code & 0x3f));
+    }
+    else
+    {
+      s += char(0xf0 | (code >> 18));
+      s += char(0x80 | ((code >> 12) & 0x3f));
+      s += char(0x80 | ((code >> 6) & 0x3f));
+      s += char(0x80 | (code & 0x3f));
+    }
+  }
+
+  std::string parseString()
+  {
+    std::string s;
+    ++_pos; // opening quote
+    for (;;)
+    {
+      if (_pos == _text.size())
+        fail("unterminated string");
+
+      auto c = _text[_pos++];
+      if (c == '"')
+        return s;
+      if ((unsigned char)c < 0x20)
+        fail("control character in string");
+      if (c != '\\')
+      {
+        s += c;
+        continue;
+      }
+      if (_pos == _text.size())
+        fail("unterminated string");
+      switch (c = _text[_pos++])
+      {
+        case '"': case '\\': case '/': s += c; break;
+        case 'b': s += '\b'; break;
+        case 'f': s += '\f'; break;
+        case 'n': s += '\n'; break;
+        case 'r': s += '\r'; break;
+        case 't': s += '\t'; break;
+        case 'u':
+        {
+          auto code = parseHex4();
+          if (code >= 0xdc00 && code < 0xe000)
+            fail("invalid surrogate pair");
+          if (code >= 0xd800 && code < 0xdc00)
+          {
+            // surrogate pair
+            if (!consumeWord("\\u"))
+              fail("invalid surrogate pair");
+            auto low = parseHex4();
+            if (low < 0xdc00 || low >= 0xe000)
+              fail("invalid surrogate pair");
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+          }
+          appendUtf8(code, s);
+          break;
+        }
+        default:
+          fail("invalid escape sequence");
+      }
+    }
+  }
+
+  double parseNumber()
+  {
+    auto begin = _pos;
+    auto digits = [this]() {
+      auto start = _pos;
+      while (_pos < _text.size() && _text[_pos] >= '0' && _text[_pos] <= '9')
+        ++_pos;
+      return _pos > start;
+    };
+
+    if (_pos < _text.size() && _text[_pos] == '-')
+      ++_pos;
+    auto integer = _pos;
+    if (!digits())
+      fail("unexpected character");
+    if (_text[integer] == '0' && _pos - integer > 1)
+      fail("leading zeros in a number");
+    if (_pos < _text.size() && _text[_pos] == '.')
+    {
+      ++_pos;
+      if (!digits())
+        fail("invalid number");
+    }
+    if (_pos < _text.size() && (_text[_pos] == 'e' || _text[_pos] == 'E'))
+    {
+      ++_pos;
+      if (_pos < _text.size() && (_text[_pos] == '+' || _text[_pos] == '-'))
+        ++_pos;
+      if (!digits())
+        fail("invalid number");
+    }
+
+    // from_chars does not depend on the locale, unlike strtod
+    double value;
+    auto result = std::from_chars(_text.data() + begin, _text.data() + _pos, value);
+    if (result.ec != std::errc{})
+      fail("number out of range");
+    return value;
+  }
+
+}; // JsonValue::Parser
+
+inline JsonValue
+JsonValue::parse(const std::string& text)
+{
+  return Parser{ text }.parseDocument();
+}
+
+} // end namespace cg
+
+#endif // __Json_h
@@ -9,10 +9,16 @@
 namespace cg
 {
 
-template <typename real, size_t D> class LinearArraySampler;
-
-template <typename real>
-class LinearArraySampler<real, 2> final
+/**
+* Linear sampler of the data of a grid.
+*
+* The data is stored as S, which is real or a compact storage type such as
+* Half, and converted to real as it is read.
+*/
+template <typename real, size_t D, typename S = real> class LinearArraySampler;
+
+template <typename real, typename S>
+class LinearArraySampler<real, 2, S> final
 {
 public:
   using vec_type = Vector2<real>;
@@ -20,7 +26,7 @@ public:
   ASSERT_REAL(real, "LinearArraySampler2: floating point type expected");
 
   explicit LinearArraySampler(
-    const Grid2<real>* grid,
+    const Grid2<S>* grid,
     const vec_type& gridSpacing,
     const vec_type& gridOrigin
   ) :
@@ -78,8 +84,8 @@ public:
         (*_data)[_data->id(Index2{ iPlus1, j })],
         (*_data)[_data->id(Index2{ i, jPlus1 })],
         (*_data)[_data->id(Index2{ iPlus1, jPlus1 })],
-        fx, fx
-        );
+        fx,
+        fy);
   };
 
   void getCoordinatesAndWeights(
@@ -110,7 +116,7 @@ public:
     weights[3] = fx * fy;
   }
 
-  void setGridData(const GridData<2, real>* data)
+  void setGridData(const GridData<2, S>* data)
   {
     _data = data;
   }
@@ -124,8 +130,8 @@ private:
   // non-assignable which becomes a problem in FaceCenteredGrid.ResetSampler
   // method
   // https://stackoverflow.com/questions/12387239/reference-member-variables-as-class-members#:~:text=There%20are%20a%20few%20important,the%20constructor%20member%20initializer%20list.
-  const GridData<2, real>* _data{ nullptr };
-  const Grid2<real>* _grid;
+  const GridData<2, S>* _data{ nullptr };
+  const Grid2<S>* _grid;
 };
 
 template <typename real>
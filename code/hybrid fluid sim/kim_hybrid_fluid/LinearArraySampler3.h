@@ -6,8 +6,8 @@
 namespace cg
 {
 
-template <typename real>
-class LinearArraySampler<real, 3> final
+template <typename real, typename S>
+class LinearArraySampler<real, 3, S> final
 {
 public:
   using vec_type = Vector3<real>;
@@ -15,7 +15,7 @@ public:
   ASSERT_REAL(real, "LinearArraySampler3: floating point type expected");
 
   explicit LinearArraySampler(
-    const Grid3<real>* grid,
+    const Grid3<S>* grid,
     const vec_type& gridSpacing,
     const vec_type& gridOrigin
   ) :
@@ -31,7 +31,7 @@ public:
   { }
 
   // copy constructor
-  LinearArraySampler(const LinearArraySampler<real, 3>& other) {
+  LinearArraySampler(const LinearArraySampler& other) {
     _gridSpacing = other._gridSpacing;
     _invGridSpacing = other._invGridSpacing;
     _origin = other._origin;
@@ -120,7 +120,7 @@ private:
   vec_type _gridSpacing;
   vec_type _invGridSpacing;
   vec_type _origin;
-  const Grid3<real>* _grid;
+  const Grid3<S>* _grid;
 }; // LinearArraySampler3
 
 } // end namespace cg
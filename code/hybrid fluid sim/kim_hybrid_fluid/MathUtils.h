@@ -78,9 +78,39 @@ inline S trilerp(
     tz);
 }
 
-template <typename real>
+/**
+* Monotone Catmull-Rom interpolation between \p f1 and \p f2.
+*
+* The end tangents are zeroed whenever they disagree in sign with the
+* secant, so the result never overshoots the [f1, f2] interval.
+*/
+template <typename S, typename T>
+inline S monotonicCatmullRom(
+  const S& f0,
+  const S& f1,
+  const S& f2,
+  const S& f3,
+  T t)
+{
+  S d1 = (f2 - f0) / 2;
+  S d2 = (f3 - f1) / 2;
+  S delta = f2 - f1;
+
+  if (std::abs(delta) < math::Limits<S>::eps())
+    d1 = d2 = 0;
+  if (d1 * delta < 0)
+    d1 = 0;
+  if (d2 * delta < 0)
+    d2 = 0;
+
+  S a3 = d1 + d2 - 2 * delta;
+  S a2 = 3 * delta - 2 * d1 - d2;
+  return ((a3 * t + a2) * t + d1) * t + f1;
+}
+
+template <typename real, typename T>
 inline Vector2<real>
-gradient2(const Grid2<real>& grid, const Vector2<real>& spacing, Index2::base_type i, Index2::base_type j)
+gradient2(const Grid2<T>& grid, const Vector2<real>& spacing, Index2::base_type i, Index2::base_type j)
 {
   auto size = grid.size();
 
@@ -97,9 +127,9 @@ gradient2(const Grid2<real>& grid, const Vector2<real>& spacing, Index2::base_ty
   return 0.5 * Vector2<real>{right - left, up - down} * spacing.inverse();
 }
 
-template <typename real>
+template <typename real, typename T>
 inline Vector3<real>
-gradient3(const Grid3<real>& grid, const Vector3<real>& spacing, Index3::base_type i, Index3::base_type j, Index3::base_type k)
+gradient3(const Grid3<T>& grid, const Vector3<real>& spacing, Index3::base_type i, Index3::base_type j, Index3::base_type k)
 {
   auto size = grid.size();
 
@@ -0,0 +1,392 @@
+#ifndef __Parallel_h
+#define __Parallel_h
+
+#include "geometry/Index3.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cg
+{
+
+inline unsigned int maxNumberOfThreads();
+
+namespace internal
+{
+
+inline unsigned int&
+maxNumberOfThreadsStorage()
+{
+  static unsigned int n = std::max(1u, std::thread::hardware_concurrency());
+  return n;
+}
+
+inline unsigned int&
+threadLimitStorage()
+{
+  thread_local unsigned int n = 0;
+  return n;
+}
+
+inline std::atomic<bool>&
+deterministicStorage()
+{
+  static std::atomic<bool> deterministic{ false };
+  return deterministic;
+}
+
+/** Size of the blocks of a reduction in deterministic mode. */
+constexpr int64_t deterministicBlockSize = 4096;
+
+/**
+* Splits [begin, end) into at most maxNumberOfThreads() chunks of at least
+* \p grainSize iterations and returns the chunk boundaries.
+*/
+inline std::vector<int64_t>
+parallelChunks(int64_t begin, int64_t end, int64_t grainSize)
+{
+  std::vector<int64_t> bounds;
+  auto n = end - begin;
+  if (n <= 0)
+    return bounds;
+
+  grainSize = std::max<int64_t>(grainSize, 1);
+  auto chunks = std::min<int64_t>(
+    maxNumberOfThreads(),
+    (n + grainSize - 1) / grainSize);
+  chunks = std::max<int64_t>(chunks, 1);
+
+  bounds.resize(chunks + 1);
+  for (int64_t c = 0; c <= chunks; ++c)
+    bounds[c] = begin + n * c / chunks;
+  return bounds;
+}
+
+/**
+* Pool of worker threads shared by the parallel helpers.
+*
+* The workers are started on demand and live until the program exits, so a
+* parallel loop only pays for waking them up. A loop is queued as a job of
+* numbered chunks; the caller runs chunks of its own job too, and only waits
+* for the chunks other threads are running, so a chunk can start a nested
+* loop without deadlocking the pool.
+*/
+class ThreadPool
+{
+public:
+  static ThreadPool& instance()
+  {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock{ _mutex };
+      _stop = true;
+    }
+    _workAvailable.notify_all();
+    for (auto& t : _workers)
+      t.join();
+  }
+
+  /**
+  * Invokes \p func(c) for each c in [0, chunks) and returns when every
+  * call is done. The first exception thrown by a call is rethrown.
+  */
+  template <typename Callback>
+  void run(int64_t chunks, Callback& func)
+  {
+    Job job;
+    job.func = &func;
+    job.invoke = [](void* func, int64_t c) { (*static_cast<Callback*>(func))(c); };
+    job.chunks = chunks;
+    job.limit = threadLimitStorage();
+
+    std::unique_lock<std::mutex> lock{ _mutex };
+    auto workers = std::min<size_t>(size_t(chunks - 1), maxNumberOfThreadsStorage() - 1);
+    while (_workers.size() < workers)
+      _workers.emplace_back([this]() { work(); });
+    _jobs.push_back(&job);
+    lock.unlock();
+    _workAvailable.notify_all();
+
+    lock.lock();
+    while (job.next < job.chunks)
+    {
+      auto c = claim(job);
+      lock.unlock();
+      execute(job, c);
+      lock.lock();
+      finish(job);
+    }
+    _jobDone.wait(lock, [&job]() { return job.done == job.chunks; });
+    lock.unlock();
+    if (job.error)
+      std::rethrow_exception(job.error);
+  }
+
+private:
+  struct Job
+  {
+    void* func;
+    void (*invoke)(void*, int64_t);
+    int64_t chunks;
+    int64_t next{};
+    int64_t done{};
+    unsigned int limit;
+    std::exception_ptr error;
+  };
+
+  std::mutex _mutex;
+  std::condition_variable _workAvailable;
+  std::condition_variable _jobDone;
+  std::deque<Job*> _jobs;
+  std::vector<std::thread> _workers;
+  bool _stop{};
+
+  ThreadPool() = default;
+
+  // claims the next chunk of job; called with the mutex locked
+  int64_t claim(Job& job)
+  {
+    auto c = job.next++;
+    if (job.next == job.chunks)
+      _jobs.erase(std::find(_jobs.begin(), _jobs.end(), &job));
+    return c;
+  }
+
+  void execute(Job& job, int64_t c)
+  {
+    try
+    {
+      job.invoke(job.func, c);
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock{ _mutex };
+      if (!job.error)
+        job.error = std::current_exception();
+    }
+  }
+
+  // called with the mutex locked
+  void finish(Job& job)
+  {
+    if (++job.done == job.chunks)
+      _jobDone.notify_all();
+  }
+
+  void work()
+  {
+    std::unique_lock<std::mutex> lock{ _mutex };
+    for (;;)
+    {
+      _workAvailable.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+      if (_stop)
+        return;
+
+      auto& job = *_jobs.front();
+      auto c = claim(job);
+      lock.unlock();
+      // the worker runs the chunk with the thread limit of the caller
+      threadLimitStorage() = job.limit;
+      execute(job, c);
+      lock.lock();
+      finish(job);
+    }
+  }
+
+}; // ThreadPool
+
+} // end namespace internal
+
+/**
+* Returns the max number of threads used by the parallel helpers called on
+* the current thread.
+*/
+inline unsigned int
+maxNumberOfThreads()
+{
+  auto n = internal::maxNumberOfThreadsStorage();
+  auto limit = internal::threadLimitStorage();
+  return limit > 0 ? std::min(n, limit) : n;
+}
+
+/**
+* Sets the max number of threads used by the parallel helpers.
+*
+* Zero restores the default, which is the number of hardware threads.
+* Setting it to one runs every parallel loop serially on the caller thread.
+*/
+inline void
+setMaxNumberOfThreads(unsigned int n)
+{
+  internal::maxNumberOfThreadsStorage() = n > 0 ?
+    n :
+    std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+* Limits the parallel helpers called on the current thread to \p n threads.
+*
+* The limit is inherited by the pool threads running the chunks of the
+* helpers, so independent tasks running side by side, such as the runs of a
+* parameter sweep, can share the cores without oversubscribing them. Zero
+* removes the limit.
+*/
+inline void
+setThreadLimit(unsigned int n)
+{
+  internal::threadLimitStorage() = n;
+}
+
+/** Returns true if the parallel reductions are deterministic. */
+inline bool
+isDeterministic()
+{
+  return internal::deterministicStorage().load();
+}
+
+/**
+* \brief Makes the parallel reductions deterministic, or not.
+*
+* By default, parallelReduce splits its range into one chunk per thread, so
+* a floating-point sum depends on the number of threads. In deterministic
+* mode the range is split into blocks whose bounds only depend on the range
+* and the grain size, and the partial results are combined in block order,
+* so a run gives the same bits with any number of threads, at the cost of
+* one partial result per block.
+*
+* The other floating-point sums of the solvers are serial: the dot products
+* and norms of the Eigen CG solves, Eigen being built without OpenMP, and
+* the residual norms of the mixed precision pressure refinement. The max
+* and bounds reductions give the same result in any order. The flag is
+* atomic, so it may be set while pool threads read it, but it should only
+* change between solver steps.
+*/
+inline void
+setDeterministic(bool enable)
+{
+  internal::deterministicStorage().store(enable);
+}
+
+/**
+* Invokes \p func(b, e) for contiguous sub-ranges of [begin, end) in parallel.
+*
+* The chunks run on the workers of a persistent thread pool and on the
+* caller thread. Ranges smaller than \p grainSize are processed serially,
+* without waking the pool.
+*/
+template <typename Callback>
+inline void
+parallelRangeFor(int64_t begin, int64_t end, Callback func, int64_t grainSize = 1)
+{
+  auto bounds = internal::parallelChunks(begin, end, grainSize);
+  if (bounds.empty())
+    return;
+
+  auto chunks = int64_t(bounds.size() - 1);
+  if (chunks == 1)
+  {
+    func(begin, end);
+    return;
+  }
+
+  auto chunk = [&func, &bounds](int64_t c) { func(bounds[c], bounds[c + 1]); };
+  internal::ThreadPool::instance().run(chunks, chunk);
+}
+
+/** Invokes \p func(i) for each i in [begin, end) in parallel. */
+template <typename Callback>
+inline void
+parallelFor(int64_t begin, int64_t end, Callback func, int64_t grainSize = 1)
+{
+  parallelRangeFor(begin, end, [&func](int64_t b, int64_t e) {
+    for (auto i = b; i < e; ++i)
+      func(i);
+    }, grainSize);
+}
+
+/**
+* Invokes \p func(index) for each index of a D-dimensional grid of given
+* \p size in parallel.
+*
+* The outermost dimension is split among the threads, so each thread walks
+* its slabs in memory order.
+*/
+template <size_t D, typename Callback>
+inline void
+parallelForEachIndex(const Index<D>& size, Callback func)
+{
+  constexpr int last = int(D) - 1;
+  parallelFor(0, size[last], [&](int64_t k) {
+    Index<D> index;
+    index[last] = k;
+    if constexpr (D == 2)
+    {
+      for (index.x = 0; index.x < size.x; index.x++)
+        func(index);
+    }
+    else if constexpr (D == 3)
+    {
+      for (index.y = 0; index.y < size.y; index.y++)
+        for (index.x = 0; index.x < size.x; index.x++)
+          func(index);
+    }
+    });
+}
+
+/**
+* Reduces [begin, end) in parallel.
+*
+* Each chunk computes \p func(b, e, identity) and the partial results are
+* combined with \p reduce in chunk order, so the result only depends on the
+* number of threads, not on their scheduling. In deterministic mode it does
+* not depend on the number of threads either; see setDeterministic.
+*/
+template <typename T, typename Callback, typename Reduce>
+inline T
+parallelReduce(
+  int64_t begin,
+  int64_t end,
+  const T& identity,
+  Callback func,
+  Reduce reduce,
+  int64_t grainSize = 1)
+{
+  std::vector<int64_t> bounds;
+  if (isDeterministic() && end > begin)
+  {
+    auto blockSize = std::max(grainSize, internal::deterministicBlockSize);
+    for (auto b = begin; b < end; b += blockSize)
+      bounds.push_back(b);
+    bounds.push_back(end);
+  }
+  else
+    bounds = internal::parallelChunks(begin, end, grainSize);
+  if (bounds.empty())
+    return identity;
+
+  auto chunks = bounds.size() - 1;
+  std::vector<T> partial(chunks, identity);
+  parallelFor(0, int64_t(chunks), [&](int64_t c) {
+    partial[c] = func(bounds[c], bounds[c + 1], identity);
+    });
+
+  T result = identity;
+  for (const auto& p : partial)
+    result = reduce(result, p);
+  return result;
+}
+
+} // end namespace cg
+
+#endif // __Parallel_h
@@ -0,0 +1,474 @@
+#ifndef __ParameterSweep_h
+#define __ParameterSweep_h
+
+#include "Scene.h"
+#include "Parallel.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace cg
+{
+
+/**
+* Parameter sweep of a scene.
+*
+* A sweep runs one scene for every combination of the values of its
+* parameters. A parameter is a dotted path into the scene description, such
+* as "solver.viscosity" or "emitters.0.initialVelocity", where numbers index
+* arrays. The runs are independent solver instances scheduled on a pool of
+* workers; each one advances its own solver with the parallel helpers limited
+* to threadsPerRun() threads, so many small runs fill the cores that a single
+* one cannot.
+*
+* A sweep file is a JSON object:
+*
+*   {
+*     "scene": "dam.json",             // or the scene description itself
+*     "parameters": [
+*       { "path": "solver.viscosity", "values": [0, 0.001, 0.01] },
+*       { "path": "solver.maxCfl", "range": [1, 5, 3] }   // first, last, count
+*     ],
+*     "workers": 8, "threadsPerRun": 1,
+*     "memoryBudget": 512, "totalMemory": 8192    // MiB
+*   }
+*
+* The cache, particle cache and checkpoint prefixes of the scene output get
+* the run number, so the runs do not overwrite each other.
+*/
+class ParameterSweep
+{
+public:
+  /** Result of a run. */
+  struct Run
+  {
+    size_t index{};             ///< Run number.
+    JsonValue parameters;       ///< Parameter values, by path.
+    bool succeeded{};           ///< Whether the run completed.
+    std::string error;          ///< Error message of a failed run.
+    size_t memoryEstimate{};    ///< Estimated solver memory, in bytes.
+    double buildSeconds{};      ///< Time to build the scene.
+    double runSeconds{};        ///< Time to advance the frames.
+    double meanFrameSeconds{};  ///< Mean time of a frame.
+    double maxFrameSeconds{};   ///< Max time of a frame.
+    int frames{};               ///< Number of frames advanced.
+    Scene::Metrics metrics;     ///< Metrics of the last frame.
+  };
+
+  /** Constructs a sweep of the scene described by \p scene. */
+  ParameterSweep(const JsonValue& scene):
+    _scene(scene)
+  {
+    // do nothing
+  }
+
+  /** Builds the sweep described by the JSON file \p path. */
+  static ParameterSweep load(const std::string& path);
+
+  /** Returns the scene description. */
+  const auto& scene() const { return _scene; }
+
+  /** Adds the parameter \p path taking each one of \p values. */
+  void addParameter(const std::string& path, const std::vector<JsonValue>& values)
+  {
+    if (values.empty())
+      throw std::runtime_error("ParameterSweep: no values for " + path);
+    _parameters.push_back({ path, values });
+  }
+
+  /** Adds the parameter \p path taking \p count values from \p first to \p last. */
+  void addRange(const std::string& path, double first, double last, int count)
+  {
+    std::vector<JsonValue> values;
+    for (int i = 0; i < count; ++i)
+      values.emplace_back(count > 1 ? first + (last - first) * i / (count - 1) : first);
+    addParameter(path, values);
+  }
+
+  /** Returns the number of runs of the sweep. */
+  size_t numberOfRuns() const
+  {
+    size_t n = 1;
+    for (const auto& p : _parameters)
+      n *= p.values.size();
+    return n;
+  }
+
+  /**
+  * Returns the parameter values of run \p index, by path. The last
+  * parameter varies fastest.
+  */
+  JsonValue parameters(size_t index) const;
+
+  /** Returns the scene description of run \p index. */
+  JsonValue description(size_t index) const;
+
+  /** Returns the number of runs advanced at the same time. */
+  unsigned int numberOfWorkers() const
+  {
+    return _numberOfWorkers > 0 ?
+      _numberOfWorkers :
+      std::max(1u, maxNumberOfThreads() / _threadsPerRun);
+  }
+
+  /**
+  * Sets the number of runs advanced at the same time. Zero uses the number
+  * of threads divided by threadsPerRun().
+  */
+  void setNumberOfWorkers(unsigned int n) { _numberOfWorkers = n; }
+
+  /** Returns the number of threads of each run. */
+  unsigned int threadsPerRun() const { return _threadsPerRun; }
+
+  /** Sets the number of threads of each run. */
+  void setThreadsPerRun(unsigned int n) { _threadsPerRun = std::max(n, 1u); }
+
+  /** Returns the memory budget of a run, in bytes. */
+  size_t memoryBudget() const { return _memoryBudget; }
+
+  /**
+  * \brief Sets the memory budget of a run, in bytes.
+  *
+  * Runs whose estimated memory exceeds the budget fail without being built.
+  * Zero removes the budget.
+  */
+  void setMemoryBudget(size_t bytes) { _memoryBudget = bytes; }
+
+  /** Returns the memory shared by the runs, in bytes. */
+  size_t totalMemory() const { return _totalMemory; }
+
+  /**
+  * \brief Sets the memory shared by the runs, in bytes.
+  *
+  * Together with the memory budget, it caps the number of workers so that
+  * the budgets of the runs in flight fit in it. Zero removes the cap.
+  */
+  void setTotalMemory(size_t bytes) { _totalMemory = bytes; }
+
+  /** Sets a function called, one at a time, when each run finishes. */
+  void setOnRunFinished(const std::function<void(const Run&)>& callback)
+  {
+    _onRunFinished = callback;
+  }
+
+  /**
+  * Returns a rough estimate of the memory of the solver described by
+  * \p description: the grids of the fluid solver plus the particle capacity.
+  */
+  static size_t estimateMemory(const JsonValue& description);
+
+  /** Runs the sweep and returns the results, in run order. */
+  const std::vector<Run>& run();
+
+  /** Returns the results of the last sweep. */
+  const auto& runs() const { return _runs; }
+
+  /** Returns the wall time of the last sweep, in seconds. */
+  double wallSeconds() const { return _wallSeconds; }
+
+  /**
+  * Returns the speedup of the last sweep: the total time of its runs
+  * over its wall time.
+  */
+  double speedup() const;
+
+  /**
+  * Writes the results of the last sweep to the CSV file \p path, one line
+  * per run, with the parameters, timings and metrics.
+  */
+  void writeReport(const std::string& path) const;
+
+  /** Returns the value at \p path in \p root, adding missing members. */
+  static JsonValue& at(JsonValue& root, const std::string& path);
+
+private:
+  struct Parameter
+  {
+    std::string path;
+    std::vector<JsonValue> values;
+  };
+
+  JsonValue _scene;
+  std::vector<Parameter> _parameters;
+  unsigned int _numberOfWorkers{};
+  unsigned int _threadsPerRun{ 1 };
+  size_t _memoryBudget{};
+  size_t _totalMemory{};
+  std::function<void(const Run&)> _onRunFinished;
+  std::vector<Run> _runs;
+  double _wallSeconds{};
+
+  void advance(Run& run) const;
+
+}; // ParameterSweep
+
+inline JsonValue&
+ParameterSweep::at(JsonValue& root, const std::string& path)
+{
+  auto value = &root;
+  size_t begin = 0;
+  for (;;)
+  {
+    auto end = path.find('.', begin);
+    auto key = path.substr(begin, end - begin);
+    if (key.empty())
+      throw std::runtime_error("ParameterSweep: invalid path " + path);
+
+    if (value->isArray())
+    {
+      if (key.find_first_not_of("0123456789") != std::string::npos)
+        throw std::runtime_error("ParameterSweep: expected an index in " + path);
+      value = &(*value)[size_t(std::stoul(key))];
+    }
+    else
+    {
+      if (value->isNull())
+        *value = JsonValue::object();
+      if (!value->contains(key))
+        value->set(key, JsonValue{});
+      value = value->find(key);
+    }
+    if (end == std::string::npos)
+      return *value;
+    begin = end + 1;
+  }
+}
+
+inline JsonValue
+ParameterSweep::parameters(size_t index) const
+{
+  std::vector<size_t> choice(_parameters.size());
+  for (auto p = _parameters.size(); p-- > 0;)
+  {
+    choice[p] = index % _parameters[p].values.size();
+    index /= _parameters[p].values.size();
+  }
+
+  auto result = JsonValue::object();
+  for (size_t p = 0; p < _parameters.size(); ++p)
+    result.set(_parameters[p].path, _parameters[p].values[choice[p]]);
+  return result;
+}
+
+inline JsonValue
+ParameterSweep::description(size_t index) const
+{
+  auto description = _scene;
+  auto values = parameters(index);
+  for (const auto& p : values.members())
+    at(description, p.first) = p.second;
+
+  if (auto output = description.find("output"))
+  {
+    char run[16];
+    snprintf(run, sizeof(run), "run%03zu_", index);
+    for (auto key : { "cache", "particles", "checkpointPrefix" })
+      if (auto prefix = output->find(key))
+        *prefix = prefix->asString() + run;
+  }
+  return description;
+}
+
+inline size_t
+ParameterSweep::estimateMemory(const JsonValue& description)
+{
+  // bytes per cell of the velocity, pressure system, markers and level sets
+  constexpr size_t fieldsPerCell = 24;
+  // bytes per particle of the searcher, besides the positions and velocities
+  constexpr size_t searcherBytes = 16;
+
+  auto dimension = size_t(description.get("dimension", 2));
+  auto realSize = description.get("precision", "float") == "double" ? 8 : 4;
+
+  const auto& size = description["grid"]["size"];
+  size_t cells = 1;
+  for (size_t d = 0; d < dimension; ++d)
+    cells *= size_t(size.isNumber() ? size.asInt() : size[d].asInt()) + 2;
+
+  auto bytes = cells * fieldsPerCell * realSize;
+  const auto& solver = description["solver"];
+  if (solver.get("type", "flip") != "grid")
+  {
+    auto capacity = size_t(solver.get("particleCapacity", 100000.0));
+    bytes += capacity * (2 * dimension * realSize + searcherBytes);
+  }
+  return bytes;
+}
+
+inline void
+ParameterSweep::advance(Run& run) const
+{
+  using clock = std::chrono::steady_clock;
+  auto seconds = [](clock::time_point start) {
+    return std::chrono::duration<double>(clock::now() - start).count();
+  };
+
+  auto description = this->description(run.index);
+  run.memoryEstimate = estimateMemory(description);
+  if (_memoryBudget > 0 && run.memoryEstimate > _memoryBudget)
+    throw std::runtime_error("ParameterSweep: run exceeds the memory budget");
+
+  auto start = clock::now();
+  auto scene = Scene::build(description);
+  run.buildSeconds = seconds(start);
+
+  start = clock::now();
+  while (scene->nextFrame() < scene->numberOfFrames())
+  {
+    auto frameStart = clock::now();
+    scene->advance();
+    run.maxFrameSeconds = std::max(run.maxFrameSeconds, seconds(frameStart));
+    ++run.frames;
+  }
+  scene->run();
+  run.runSeconds = seconds(start);
+  run.meanFrameSeconds = run.frames > 0 ? run.runSeconds / run.frames : 0;
+  run.metrics = scene->metrics();
+}
+
+inline const std::vector<ParameterSweep::Run>&
+ParameterSweep::run()
+{
+  auto n = numberOfRuns();
+  _runs.assign(n, Run{});
+  for (size_t i = 0; i < n; ++i)
+  {
+    _runs[i].index = i;
+    _runs[i].parameters = parameters(i);
+  }
+
+  size_t workers = std::min<size_t>(numberOfWorkers(), n);
+  if (_totalMemory > 0 && _memoryBudget > 0)
+    workers = std::min(workers, std::max<size_t>(_totalMemory / _memoryBudget, 1));
+
+  std::atomic<size_t> next{ 0 };
+  std::mutex mutex;
+  auto worker = [&]() {
+    setThreadLimit(_threadsPerRun);
+    for (size_t i; (i = next++) < n;)
+    {
+      auto& run = _runs[i];
+      try
+      {
+        advance(run);
+        run.succeeded = true;
+      }
+      catch (const std::exception& e)
+      {
+        run.error = e.what();
+      }
+      if (_onRunFinished)
+      {
+        std::lock_guard<std::mutex> lock{ mutex };
+        _onRunFinished(run);
+      }
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  threads.reserve(workers);
+  for (size_t w = 0; w < workers; ++w)
+    threads.emplace_back(worker);
+  for (auto& t : threads)
+    t.join();
+  _wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return _runs;
+}
+
+inline double
+ParameterSweep::speedup() const
+{
+  auto total = 0.0;
+  for (const auto& run : _runs)
+    total += run.buildSeconds + run.runSeconds;
+  return _wallSeconds > 0 ? total / _wallSeconds : 0;
+}
+
+inline void
+ParameterSweep::writeReport(const std::string& path) const
+{
+  std::ofstream file{ path };
+  if (!file)
+    throw std::runtime_error("ParameterSweep: cannot write " + path);
+
+  // the metrics of the runs, in the order they first appear
+  std::vector<std::string> metrics;
+  for (const auto& run : _runs)
+    for (const auto& m : run.metrics)
+      if (std::find(metrics.begin(), metrics.end(), m.first) == metrics.end())
+        metrics.push_back(m.first);
+
+  file << "run";
+  for (const auto& p : _parameters)
+    file << ",\"" << p.path << '"';
+  file << ",status,memoryMiB,buildSeconds,runSeconds,frames,meanFrameSeconds,maxFrameSeconds";
+  for (const auto& m : metrics)
+    file << ',' << m;
+  file << '\n';
+
+  for (const auto& run : _runs)
+  {
+    file << run.index;
+    for (const auto& p : run.parameters.members())
+    {
+      // vectors are written in quotes, as their JSON text
+      auto text = p.second.toString();
+      if (p.second.isArray() || p.second.isObject())
+        file << ",\"" << text << '"';
+      else
+        file << ',' << text;
+    }
+    file << ',' << (run.succeeded ? "ok" : "failed")
+      << ',' << run.memoryEstimate / double(1 << 20)
+      << ',' << run.buildSeconds
+      << ',' << run.runSeconds
+      << ',' << run.frames
+      << ',' << run.meanFrameSeconds
+      << ',' << run.maxFrameSeconds;
+    for (const auto& m : metrics)
+    {
+      file << ',';
+      for (const auto& value : run.metrics)
+        if (value.first == m)
+          file << value.second;
+    }
+    file << '\n';
+  }
+}
+
+inline ParameterSweep
+ParameterSweep::load(const std::string& path)
+{
+  auto description = JsonValue::load(path);
+  const auto& scene = description["scene"];
+  ParameterSweep sweep{ scene.isString() ? JsonValue::load(scene.asString()) : scene };
+
+  if (auto parameters = description.find("parameters"))
+    for (const auto& p : parameters->elements())
+    {
+      const auto& name = p["path"].asString();
+      if (auto range = p.find("range"))
+      {
+        if (range->size() != 3)
+          throw std::runtime_error("ParameterSweep: range must be [first, last, count]");
+        sweep.addRange(name, (*range)[0].asNumber(), (*range)[1].asNumber(), (*range)[2].asInt());
+      }
+      else
+        sweep.addParameter(name, p["values"].elements());
+    }
+
+  constexpr double MiB = 1 << 20;
+  sweep.setNumberOfWorkers(unsigned(description.get("workers", 0)));
+  sweep.setThreadsPerRun(unsigned(description.get("threadsPerRun", 1)));
+  sweep.setMemoryBudget(size_t(description.get("memoryBudget", 0.0) * MiB));
+  sweep.setTotalMemory(size_t(description.get("totalMemory", 0.0) * MiB));
+  return sweep;
+}
+
+} // end namespace cg
+
+#endif // __ParameterSweep_h
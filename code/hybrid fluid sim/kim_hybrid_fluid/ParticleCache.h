@@ -0,0 +1,675 @@
+#ifndef __ParticleCache_h
+#define __ParticleCache_h
+
+#include "Half.h"
+#include "Parallel.h"
+#include "geometry/Bounds3.h"
+#include "utils/MappedFile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cg
+{
+
+/**
+* Header of a particle cache file, followed by the chunk directory, the
+* survivor bitmap of a delta frame and the chunk payloads.
+*/
+struct ParticleCacheHeader
+{
+  char tag[4];
+  uint32_t version;
+  int32_t frame;
+  /** Keyframe the frame is decoded from, the frame itself for a keyframe. */
+  int32_t keyframe;
+  double time;
+  uint32_t dimension;
+  /** Bits of each quantized position component. */
+  uint32_t positionBits;
+  uint32_t flags;
+  uint32_t chunkCount;
+  float boundsMin[3];
+  float boundsMax[3];
+  /** Number of particles of the frame. */
+  uint64_t count;
+  /** Number of particles of the previous frame, 0 for a keyframe. */
+  uint64_t previousCount;
+  /** Number of particles kept from the previous frame, stored first. */
+  uint64_t survivorCount;
+
+  static constexpr uint32_t currentVersion = 1;
+  /** Set if the particle ids are stored. */
+  static constexpr uint32_t hasIds = 1;
+
+}; // ParticleCacheHeader
+
+/** Directory entry of a chunk of consecutive stored particles. */
+struct ParticleCacheChunk
+{
+  uint64_t first;
+  uint64_t count;
+  /** Offset of the payload from the beginning of the file. */
+  uint64_t offset;
+  uint64_t byteSize;
+
+}; // ParticleCacheChunk
+
+namespace internal
+{
+
+constexpr size_t particleCacheChunkSize = 1 << 16;
+
+inline uint64_t
+zigzag(int64_t value)
+{
+  return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+inline int64_t
+unzigzag(uint64_t value)
+{
+  return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+inline uint8_t*
+putVarint(uint8_t* out, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    *out++ = uint8_t(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = uint8_t(value);
+  return out;
+}
+
+inline bool
+getVarint(const uint8_t*& in, const uint8_t* end, uint64_t& value)
+{
+  value = 0;
+  for (int shift = 0; shift < 64 && in < end; shift += 7)
+  {
+    auto byte = *in++;
+    value |= uint64_t(byte & 0x7f) << shift;
+    if (byte < 0x80)
+      return true;
+  }
+  return false;
+}
+
+/**
+* Maps positions inside the bounds of a particle cache frame to unsigned
+* integers of a given number of bits and back.
+*/
+struct ParticleQuantizer
+{
+  double min[3]{};
+  double scale[3]{};
+  double inverseScale[3]{};
+  uint32_t maxValue{};
+
+  ParticleQuantizer(const ParticleCacheHeader& header)
+  {
+    maxValue = uint32_t((uint64_t(1) << header.positionBits) - 1);
+    for (uint32_t d = 0; d < header.dimension; ++d)
+    {
+      auto extent = double(header.boundsMax[d]) - header.boundsMin[d];
+      min[d] = header.boundsMin[d];
+      scale[d] = extent > 0 ? maxValue / extent : 0;
+      inverseScale[d] = extent > 0 ? extent / maxValue : 0;
+    }
+  }
+
+  uint32_t quantize(double x, int d) const
+  {
+    auto q = std::floor((x - min[d]) * scale[d] + 0.5);
+    // particles outside the bounds are clamped onto them
+    return q <= 0 ? 0 : q >= maxValue ? maxValue : uint32_t(q);
+  }
+
+  float dequantize(uint32_t q, int d) const
+  {
+    return float(min[d] + q * inverseScale[d]);
+  }
+
+}; // ParticleQuantizer
+
+} // end namespace internal
+
+/**
+* Writer of a compressed per-frame particle cache.
+*
+* Every frame goes to its own file. Positions are quantized to
+* positionBits per component over the bounds passed to write, usually the
+* bounds of the simulation grid, and velocities are stored as IEEE half
+* precision values.
+*
+* A keyframe stores the particles sorted by cell, so consecutive particles
+* are close and their positions are stored as small variable-length deltas.
+* When particle ids are given, the frames between keyframes are delta frames
+* against the previous frame: a bitmap tells which particles of the previous
+* frame survive, the survivors come first in their previous order with the
+* deltas of their positions and of the bits of their half velocities, and
+* the particles that are new since the previous frame follow, sorted by
+* cell as in a keyframe. A keyframe is written every keyframeInterval
+* frames, and whenever the frames are not consecutive or the bounds change,
+* so any frame can be decoded from its keyframe on.
+*
+* The stored particles are split into chunks of 64K particles, encoded in
+* parallel.
+*/
+class ParticleCacheWriter
+{
+public:
+  /**
+  * Constructs a writer whose frame files are \p pathPrefix, followed by
+  * the frame index and ".sgpc". A keyframeInterval of 1 writes keyframes
+  * only.
+  */
+  explicit ParticleCacheWriter(const std::string& pathPrefix,
+    int keyframeInterval = 10,
+    int positionBits = 16):
+    _pathPrefix(pathPrefix),
+    _keyframeInterval(std::max(keyframeInterval, 1)),
+    _positionBits(std::clamp(positionBits, 8, 24))
+  {
+    // do nothing
+  }
+
+  /** Returns the path of the file of \p frame. */
+  std::string path(int frame) const
+  {
+    return _pathPrefix + std::to_string(frame) + ".sgpc";
+  }
+
+  /** Returns the max number of frames from a keyframe to the next one. */
+  int keyframeInterval() const { return _keyframeInterval; }
+
+  /** Returns the bits of each quantized position component. */
+  int positionBits() const { return _positionBits; }
+
+  /** Returns the number of bytes written so far. */
+  uint64_t bytesWritten() const { return _bytesWritten; }
+
+  /**
+  * Writes the \p count particles of \p frame.
+  *
+  * \p ids, which may be null, must be unique within a frame and identify
+  * the same particle from one frame to the next. Without them every frame
+  * is a keyframe.
+  */
+  template <typename real, int D>
+  void write(int frame,
+    double time,
+    const Bounds<real, D>& bounds,
+    const Vector<real, D>* positions,
+    const Vector<real, D>* velocities,
+    const uint64_t* ids,
+    size_t count);
+
+private:
+  std::string _pathPrefix;
+  int _keyframeInterval;
+  int _positionBits;
+  uint64_t _bytesWritten{};
+  // previous frame, in stored order
+  bool _hasPrevious{};
+  ParticleCacheHeader _previous{};
+  std::vector<uint32_t> _previousPositions;
+  std::vector<uint16_t> _previousVelocities;
+  std::vector<uint64_t> _previousIds;
+
+  static uint32_t sortKey(const uint32_t* q, int dimension, int bits)
+  {
+    // 2^24 cells over the bounds
+    auto cellBits = 24 / dimension;
+    auto shift = bits > cellBits ? bits - cellBits : 0;
+    uint32_t key = q[dimension - 1] >> shift;
+    for (auto d = dimension - 2; d >= 0; --d)
+      key = (key << cellBits) | (q[d] >> shift);
+    return key;
+  }
+
+}; // ParticleCacheWriter
+
+template <typename real, int D>
+void
+ParticleCacheWriter::write(int frame,
+  double time,
+  const Bounds<real, D>& bounds,
+  const Vector<real, D>* positions,
+  const Vector<real, D>* velocities,
+  const uint64_t* ids,
+  size_t count)
+{
+  static_assert(D == 2 || D == 3, "ParticleCacheWriter: 2D or 3D particles expected");
+  if (count >= (uint64_t(1) << 32))
+    throw std::runtime_error("ParticleCacheWriter: too many particles");
+
+  ParticleCacheHeader header{};
+  std::memcpy(header.tag, "SGPC", 4);
+  header.version = ParticleCacheHeader::currentVersion;
+  header.frame = frame;
+  header.time = time;
+  header.dimension = D;
+  header.positionBits = uint32_t(_positionBits);
+  header.flags = ids != nullptr ? ParticleCacheHeader::hasIds : 0;
+  for (int d = 0; d < D; ++d)
+  {
+    header.boundsMin[d] = float(bounds.min()[d]);
+    header.boundsMax[d] = float(bounds.max()[d]);
+  }
+  header.count = count;
+
+  auto n = int64_t(count);
+  internal::ParticleQuantizer quantizer{ header };
+  std::vector<uint32_t> q(count * D);
+  std::vector<uint16_t> h(count * D);
+  parallelFor(0, n, [&](int64_t i) {
+    for (int d = 0; d < D; ++d)
+    {
+      q[i * D + d] = quantizer.quantize(double(positions[i][d]), d);
+      h[i * D + d] = half::fromFloat(float(velocities[i][d]));
+    }
+    }, 4096);
+
+  auto isDelta = ids != nullptr
+    && _keyframeInterval > 1
+    && _hasPrevious
+    && frame == _previous.frame + 1
+    && frame - _previous.keyframe < _keyframeInterval
+    && (_previous.flags & ParticleCacheHeader::hasIds) != 0
+    && _previous.dimension == header.dimension
+    && _previous.positionBits == header.positionBits
+    && std::memcmp(_previous.boundsMin, header.boundsMin, sizeof(header.boundsMin)) == 0
+    && std::memcmp(_previous.boundsMax, header.boundsMax, sizeof(header.boundsMax)) == 0;
+
+  // stored order: the survivors, then the new particles sorted by cell
+  std::vector<uint32_t> order;
+  std::vector<uint32_t> survivorPrevious;
+  std::vector<uint64_t> bitmap;
+  std::vector<char> isSurvivor(count);
+  order.reserve(count);
+  if (isDelta)
+  {
+    header.keyframe = _previous.keyframe;
+    header.previousCount = _previousIds.size();
+
+    // merge join of the ids of both frames, sorted
+    using entry = std::pair<uint64_t, uint32_t>;
+    std::vector<entry> previous(_previousIds.size());
+    for (size_t p = 0; p < previous.size(); ++p)
+      previous[p] = { _previousIds[p], uint32_t(p) };
+    std::sort(previous.begin(), previous.end());
+    std::vector<entry> current(count);
+    for (size_t i = 0; i < count; ++i)
+      current[i] = { ids[i], uint32_t(i) };
+    if (!std::is_sorted(ids, ids + count))
+      std::sort(current.begin(), current.end());
+
+    std::vector<uint32_t> previousToCurrent(previous.size(), UINT32_MAX);
+    for (size_t a = 0, b = 0; a < previous.size() && b < count;)
+      if (previous[a].first < current[b].first)
+        ++a;
+      else if (current[b].first < previous[a].first)
+        ++b;
+      else
+      {
+        previousToCurrent[previous[a++].second] = current[b].second;
+        isSurvivor[current[b++].second] = 1;
+      }
+
+    bitmap.assign((previous.size() + 63) >> 6, 0);
+    for (size_t p = 0; p < previous.size(); ++p)
+      if (previousToCurrent[p] != UINT32_MAX)
+      {
+        bitmap[p >> 6] |= uint64_t(1) << (p & 63);
+        order.push_back(previousToCurrent[p]);
+        survivorPrevious.push_back(uint32_t(p));
+      }
+    header.survivorCount = order.size();
+  }
+  else
+    header.keyframe = frame;
+
+  {
+    std::vector<uint64_t> keys;
+    keys.reserve(count - order.size());
+    for (size_t i = 0; i < count; ++i)
+      if (!isSurvivor[i])
+        keys.push_back(uint64_t(sortKey(&q[i * D], D, _positionBits)) << 32 | i);
+    std::sort(keys.begin(), keys.end());
+    for (auto key : keys)
+      order.push_back(uint32_t(key));
+  }
+
+  // worst case of a particle: D position deltas, an id delta and D
+  // velocity deltas
+  constexpr size_t maxParticleSize = D * 5 + 10 + D * 3;
+  auto chunkCount = (count + internal::particleCacheChunkSize - 1) / internal::particleCacheChunkSize;
+  std::vector<ParticleCacheChunk> chunks(chunkCount);
+  std::vector<std::vector<uint8_t>> payloads(chunkCount);
+  auto hasIds = ids != nullptr;
+  auto survivorCount = header.survivorCount;
+
+  parallelFor(0, int64_t(chunkCount), [&](int64_t c) {
+    auto& chunk = chunks[c];
+    chunk.first = uint64_t(c) * internal::particleCacheChunkSize;
+    chunk.count = std::min<uint64_t>(internal::particleCacheChunkSize, count - chunk.first);
+
+    auto& payload = payloads[c];
+    payload.resize(size_t(chunk.count) * maxParticleSize);
+    auto out = payload.data();
+    // the new particles of a chunk are deltas of each other
+    uint32_t last[D]{};
+    uint64_t lastId = 0;
+
+    for (auto s = chunk.first; s < chunk.first + chunk.count; ++s)
+    {
+      auto i = order[s];
+      const auto* qi = &q[size_t(i) * D];
+      const auto* hi = &h[size_t(i) * D];
+      if (s < survivorCount)
+      {
+        auto p = size_t(survivorPrevious[s]) * D;
+        for (int d = 0; d < D; ++d)
+          out = internal::putVarint(out, internal::zigzag(int64_t(qi[d]) - _previousPositions[p + d]));
+        for (int d = 0; d < D; ++d)
+          out = internal::putVarint(out, internal::zigzag(int64_t(hi[d]) - _previousVelocities[p + d]));
+        continue;
+      }
+      if (hasIds)
+      {
+        out = internal::putVarint(out, internal::zigzag(int64_t(ids[i] - lastId)));
+        lastId = ids[i];
+      }
+      for (int d = 0; d < D; ++d)
+      {
+        out = internal::putVarint(out, internal::zigzag(int64_t(qi[d]) - last[d]));
+        last[d] = qi[d];
+      }
+      std::memcpy(out, hi, 2 * D);
+      out += 2 * D;
+    }
+    payload.resize(size_t(out - payload.data()));
+    });
+
+  header.chunkCount = uint32_t(chunkCount);
+  auto offset = sizeof(header) + chunkCount * sizeof(ParticleCacheChunk)
+    + bitmap.size() * sizeof(uint64_t);
+  for (size_t c = 0; c < chunkCount; ++c)
+  {
+    chunks[c].offset = offset;
+    chunks[c].byteSize = payloads[c].size();
+    offset += payloads[c].size();
+  }
+
+  auto path = this->path(frame);
+  FILE* file = nullptr;
+#ifdef _WIN32
+  fopen_s(&file, path.c_str(), "wb");
+#else
+  file = fopen(path.c_str(), "wb");
+#endif
+  if (file == nullptr)
+    throw std::runtime_error("ParticleCacheWriter: cannot open " + path);
+
+  auto ok = fwrite(&header, sizeof(header), 1, file) == 1
+    && fwrite(chunks.data(), sizeof(ParticleCacheChunk), chunkCount, file) == chunkCount
+    && fwrite(bitmap.data(), sizeof(uint64_t), bitmap.size(), file) == bitmap.size();
+  for (size_t c = 0; c < chunkCount && ok; ++c)
+    ok = fwrite(payloads[c].data(), 1, payloads[c].size(), file) == payloads[c].size();
+  if (fclose(file) != 0 || !ok)
+    throw std::runtime_error("ParticleCacheWriter: cannot write " + path);
+  _bytesWritten += offset;
+
+  // the next delta frame refers to this one, in stored order
+  _previousPositions.resize(count * D);
+  _previousVelocities.resize(count * D);
+  _previousIds.resize(hasIds ? count : 0);
+  parallelFor(0, n, [&](int64_t s) {
+    auto i = order[s];
+    for (int d = 0; d < D; ++d)
+    {
+      _previousPositions[s * D + d] = q[size_t(i) * D + d];
+      _previousVelocities[s * D + d] = h[size_t(i) * D + d];
+    }
+    if (hasIds)
+      _previousIds[s] = ids[i];
+    }, 4096);
+  _previous = header;
+  _hasPrevious = true;
+}
+
+/**
+* Reader of the particle cache written by ParticleCacheWriter.
+*
+* Frames are streamed: the reader keeps the particles of the last frame
+* read only, and maps one file at a time. Reading the frame that follows
+* the current one decodes a single file; any other frame is decoded from
+* its keyframe on. The particles are in stored order, which is not the
+* order they were written in; their ids, if stored, tell them apart. The
+* chunks of a frame are decoded in parallel.
+*/
+class ParticleCacheReader
+{
+public:
+  /** Constructs a reader of the frame files \p pathPrefix + frame + ".sgpc". */
+  explicit ParticleCacheReader(const std::string& pathPrefix):
+    _pathPrefix(pathPrefix)
+  {
+    // do nothing
+  }
+
+  /** Returns the path of the file of \p frame. */
+  std::string path(int frame) const
+  {
+    return _pathPrefix + std::to_string(frame) + ".sgpc";
+  }
+
+  /** Decodes the particles of \p frame. */
+  void read(int frame)
+  {
+    if (_hasFrame && frame == _header.frame)
+      return;
+    if (!_hasFrame || frame != _header.frame + 1)
+    {
+      MappedFile file{ path(frame).c_str() };
+      auto keyframe = readHeader(file, path(frame)).keyframe;
+      for (auto k = keyframe; k < frame; ++k)
+        decode(k);
+    }
+    decode(frame);
+  }
+
+  /** Returns the index of the current frame. */
+  int frame() const { return _header.frame; }
+
+  /** Returns the simulation time of the current frame. */
+  double time() const { return _header.time; }
+
+  /** Returns the number of dimensions of the particles. */
+  int dimension() const { return int(_header.dimension); }
+
+  /** Returns the number of particles of the current frame. */
+  size_t size() const { return size_t(_header.count); }
+
+  /** Returns dimension() position components per particle. */
+  const auto& positions() const { return _positions; }
+
+  /** Returns dimension() velocity components per particle. */
+  const auto& velocities() const { return _velocities; }
+
+  /** Returns the particle ids, or an empty array if they are not stored. */
+  const auto& ids() const { return _ids; }
+
+private:
+  std::string _pathPrefix;
+  bool _hasFrame{};
+  ParticleCacheHeader _header{};
+  std::vector<uint32_t> _quantized;
+  std::vector<uint16_t> _halfVelocities;
+  std::vector<float> _positions;
+  std::vector<float> _velocities;
+  std::vector<uint64_t> _ids;
+
+  static ParticleCacheHeader readHeader(const MappedFile& file, const std::string& path)
+  {
+    ParticleCacheHeader header;
+    if (!file.isOpen() || file.size() < sizeof(header))
+      throw std::runtime_error("ParticleCacheReader: cannot read " + path);
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.tag, "SGPC", 4) != 0
+      || header.version != ParticleCacheHeader::currentVersion
+      || (header.dimension != 2 && header.dimension != 3)
+      || header.positionBits < 1 || header.positionBits > 24
+      || header.survivorCount > header.count
+      || header.survivorCount > header.previousCount)
+      throw std::runtime_error("ParticleCacheReader: " + path + " is not a particle cache");
+    return header;
+  }
+
+  void decode(int frame);
+
+}; // ParticleCacheReader
+
+inline void
+ParticleCacheReader::decode(int frame)
+{
+  auto path = this->path(frame);
+  MappedFile file{ path.c_str() };
+  auto header = readHeader(file, path);
+  auto isDelta = header.keyframe != header.frame;
+  if (isDelta && (!_hasFrame
+    || _header.frame != frame - 1
+    || _header.count != header.previousCount
+    || _header.dimension != header.dimension
+    || _ids.size() != _header.count))
+    throw std::runtime_error("ParticleCacheReader: " + path + " needs the previous frame");
+
+  auto truncated = [&path]() {
+    return std::runtime_error("ParticleCacheReader: " + path + " is truncated");
+  };
+  auto bitmapWords = size_t((header.previousCount + 63) >> 6);
+  auto tableSize = header.chunkCount * sizeof(ParticleCacheChunk) + bitmapWords * sizeof(uint64_t);
+  if (file.size() - sizeof(header) < tableSize)
+    throw truncated();
+
+  std::vector<ParticleCacheChunk> chunks(header.chunkCount);
+  auto table = file.data() + sizeof(header);
+  if (!chunks.empty())
+    std::memcpy(chunks.data(), table, chunks.size() * sizeof(ParticleCacheChunk));
+  uint64_t first = 0;
+  for (const auto& chunk : chunks)
+  {
+    if (chunk.first != first
+      || chunk.offset > file.size()
+      || chunk.byteSize > file.size() - chunk.offset)
+      throw truncated();
+    first += chunk.count;
+  }
+  if (first != header.count)
+    throw truncated();
+
+  std::vector<uint32_t> survivorPrevious;
+  if (isDelta)
+  {
+    std::vector<uint64_t> bitmap(bitmapWords);
+    if (bitmapWords > 0)
+      std::memcpy(bitmap.data(), table + chunks.size() * sizeof(ParticleCacheChunk),
+        bitmapWords * sizeof(uint64_t));
+    survivorPrevious.reserve(size_t(header.survivorCount));
+    for (uint64_t p = 0; p < header.previousCount; ++p)
+      if ((bitmap[p >> 6] >> (p & 63)) & 1)
+        survivorPrevious.push_back(uint32_t(p));
+    if (survivorPrevious.size() != header.survivorCount)
+      throw std::runtime_error("ParticleCacheReader: " + path + " is corrupt");
+  }
+
+  auto D = int(header.dimension);
+  auto count = size_t(header.count);
+  auto hasIds = (header.flags & ParticleCacheHeader::hasIds) != 0;
+  internal::ParticleQuantizer quantizer{ header };
+  std::vector<uint32_t> quantized(count * D);
+  std::vector<uint16_t> halfVelocities(count * D);
+  std::vector<float> positions(count * D);
+  std::vector<float> velocities(count * D);
+  std::vector<uint64_t> ids(hasIds ? count : 0);
+  std::vector<char> isCorrupt(chunks.size());
+
+  parallelFor(0, int64_t(chunks.size()), [&](int64_t c) {
+    const auto& chunk = chunks[c];
+    auto in = (const uint8_t*)file.data() + chunk.offset;
+    auto end = in + chunk.byteSize;
+    uint32_t last[3]{};
+    uint64_t lastId = 0;
+    uint64_t value;
+
+    for (auto s = chunk.first; s < chunk.first + chunk.count; ++s)
+    {
+      auto* qs = &quantized[size_t(s) * D];
+      auto* hs = &halfVelocities[size_t(s) * D];
+      if (s < header.survivorCount)
+      {
+        auto p = size_t(survivorPrevious[s]) * D;
+        for (int d = 0; d < 2 * D; ++d)
+        {
+          if (!internal::getVarint(in, end, value))
+            return void(isCorrupt[c] = 1);
+          if (d < D)
+            qs[d] = uint32_t(_quantized[p + d] + internal::unzigzag(value));
+          else
+            hs[d - D] = uint16_t(_halfVelocities[p + d - D] + internal::unzigzag(value));
+        }
+        if (hasIds)
+          ids[s] = _ids[survivorPrevious[s]];
+      }
+      else
+      {
+        if (hasIds)
+        {
+          if (!internal::getVarint(in, end, value))
+            return void(isCorrupt[c] = 1);
+          ids[s] = lastId += uint64_t(internal::unzigzag(value));
+        }
+        for (int d = 0; d < D; ++d)
+        {
+          if (!internal::getVarint(in, end, value))
+            return void(isCorrupt[c] = 1);
+          qs[d] = last[d] = uint32_t(last[d] + internal::unzigzag(value));
+        }
+        if (end - in < 2 * D)
+          return void(isCorrupt[c] = 1);
+        std::memcpy(hs, in, 2 * D);
+        in += 2 * D;
+      }
+      for (int d = 0; d < D; ++d)
+      {
+        if (qs[d] > quantizer.maxValue)
+          return void(isCorrupt[c] = 1);
+        positions[size_t(s) * D + d] = quantizer.dequantize(qs[d], d);
+        velocities[size_t(s) * D + d] = half::toFloat(hs[d]);
+      }
+    }
+    });
+  if (std::find(isCorrupt.begin(), isCorrupt.end(), 1) != isCorrupt.end())
+    throw std::runtime_error("ParticleCacheReader: " + path + " is corrupt");
+
+  _header = header;
+  _quantized.swap(quantized);
+  _halfVelocities.swap(halfVelocities);
+  _positions.swap(positions);
+  _velocities.swap(velocities);
+  _ids.swap(ids);
+  _hasFrame = true;
+}
+
+} // end namespace cg
+
+#endif // __ParticleCache_h
@@ -3,6 +3,7 @@
 
 #include <functional>
 #include "geometry/ParticleSystem.h"
+#include "Checkpoint.h"
 
 namespace cg
 {
@@ -67,6 +68,20 @@ public:
   */
   void setOnBeginUpdateCallback(const OnBeginUpdateCallback& callback) { _onBeginUpdateCallback = callback; }
 
+  /** Writes the emitter state to a checkpoint. */
+  virtual void saveState(CheckpointWriter& writer) const
+  {
+    writer.writeTag("EMIT");
+    writer.write(_isEnabled);
+  }
+
+  /** Reads the emitter state written by ParticleEmitter::saveState. */
+  virtual void loadState(CheckpointReader& reader)
+  {
+    reader.expectTag("EMIT");
+    reader.read(_isEnabled);
+  }
+
 protected:
   /** Called when ParticleEmitter::setTarget is executed. */
   virtual void onSetTarget(PointArray& particles);
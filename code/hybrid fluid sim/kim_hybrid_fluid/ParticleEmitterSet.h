@@ -37,6 +37,20 @@ public:
     _emitters.push_back(emitter);
   }
 
+  void saveState(CheckpointWriter& writer) const override
+  {
+    Base::saveState(writer);
+    for (auto& emitter : _emitters)
+      emitter->saveState(writer);
+  }
+
+  void loadState(CheckpointReader& reader) override
+  {
+    Base::loadState(reader);
+    for (auto& emitter : _emitters)
+      emitter->loadState(reader);
+  }
+
 private:
   EmitterVector _emitters;
 
@@ -1,5 +1,8 @@
 #include "PhysicsAnimation.h"
+#include "FrameCache.h"
+#include "StageHash.h"
 #include "utils/Stopwatch.h"
+#include <memory>
 
 namespace cg
 {
@@ -53,7 +56,8 @@ PhysicsAnimation::PhysicsAnimation()
 
 PhysicsAnimation::~PhysicsAnimation()
 {
-  // do nothing
+  if (_pendingCheckpoint.valid())
+    _pendingCheckpoint.wait();
 }
 
 Frame
@@ -80,21 +84,124 @@ PhysicsAnimation::advanceFrame(const Frame& frame)
   if (frame.index > _frame.index)
   {
     if (_frame.index < 0)
+    {
       initialize();
+      hashStage("initialize");
+    }
 
     int numberOfFrames = frame.index - _frame.index;
     for (auto i = 0; i < numberOfFrames; ++i) {
       advanceTimeStep(frame.timeIntervalInSeconds);
+
+      _frame.index++;
+      _frame.timeIntervalInSeconds = frame.timeIntervalInSeconds;
+      if (_checkpointInterval > 0 && _frame.index % _checkpointInterval == 0)
+      {
+        // only the copy of the state stalls the simulation
+        waitForCheckpoint();
+        auto writer = std::make_shared<CheckpointWriter>();
+        saveState(*writer);
+        auto path = _checkpointPrefix + std::to_string(_frame.index) + ".ckpt";
+        _pendingCheckpoint = std::async(std::launch::async, [writer, path]() {
+          writer->save(path);
+        });
+      }
+      if (_frameCache != nullptr)
+      {
+        _frameCache->beginFrame(_frame.index, _currentTime);
+        writeFrameCache(*_frameCache);
+        _frameCache->endFrame();
+      }
+      onEndFrame();
     }
 
     _frame = frame;
   }
 }
 
+void
+PhysicsAnimation::saveCheckpoint(const std::string& path) const
+{
+  CheckpointWriter writer;
+  saveState(writer);
+  writer.save(path);
+}
+
+void
+PhysicsAnimation::loadCheckpoint(const std::string& path)
+{
+  waitForCheckpoint();
+
+  CheckpointReader reader{ path };
+  loadState(reader);
+  if (!reader.atEnd())
+    throw std::runtime_error("PhysicsAnimation: " + path + " does not match this simulation");
+}
+
+void
+PhysicsAnimation::setCheckpointInterval(int interval, const std::string& pathPrefix)
+{
+  _checkpointInterval = math::max(interval, 0);
+  _checkpointPrefix = pathPrefix;
+}
+
+void
+PhysicsAnimation::waitForCheckpoint()
+{
+  if (_pendingCheckpoint.valid())
+    _pendingCheckpoint.get();
+}
+
+void
+PhysicsAnimation::saveState(CheckpointWriter& writer) const
+{
+  writer.writeTag("ANIM");
+  writer.write(_frame.index);
+  writer.write(_frame.timeIntervalInSeconds);
+  writer.write(_currentTime);
+}
+
+void
+PhysicsAnimation::loadState(CheckpointReader& reader)
+{
+  reader.expectTag("ANIM");
+  reader.read(_frame.index);
+  reader.read(_frame.timeIntervalInSeconds);
+  reader.read(_currentTime);
+}
+
+void
+PhysicsAnimation::writeFrameCache(FrameCacheWriter& cache) const
+{
+  // do nothing
+}
+
+void
+PhysicsAnimation::onEndFrame()
+{
+  // do nothing
+}
+
+void
+PhysicsAnimation::hashState(StageHashLog& log) const
+{
+  // do nothing
+}
+
+void
+PhysicsAnimation::hashStage(const char* stage) const
+{
+  if (_stageHashLog == nullptr)
+    return;
+  _stageHashLog->beginStage(_frame.index + 1, _subTimeStep, stage);
+  hashState(*_stageHashLog);
+}
+
 void
 PhysicsAnimation::advanceTimeStep(double timeInterval)
 {
   _currentTime = _frame.timeInSeconds();
+  _subTimeStep = 0;
 
   if (_usingFixedSubTimeSteps)
   {
@@ -111,6 +218,7 @@ PhysicsAnimation::advanceTimeStep(double timeInterval)
       debug("[INFO] End onAdvanceTimeStep: %lld ms\n", s.lap());
 
       _currentTime += actualTimeInterval;
+      ++_subTimeStep;
     }
   }
   else
@@ -135,6 +243,7 @@ PhysicsAnimation::advanceTimeStep(double timeInterval)
 
       remainingTime -= actualTimeInterval;
       _currentTime += actualTimeInterval;
+      ++_subTimeStep;
     }
   }
 }
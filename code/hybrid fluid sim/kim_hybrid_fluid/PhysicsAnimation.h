@@ -1,8 +1,11 @@
 #ifndef __PhysicsAnimation_h
 #define __PhysicsAnimation_h
 
+#include <future>
 #include <iostream>
+#include <string>
 #include "math/Real.h"
+#include "Checkpoint.h"
 
 namespace cg
 {
@@ -42,6 +45,9 @@ struct Frame final
 
 }; // Frame
 
+class FrameCacheWriter;
+class StageHashLog;
+
 /**
 * Abstract base class for physics based animations.
 * 
@@ -95,6 +101,61 @@ public:
   /** \returns the current simulation time. */
   auto currentTime() const { return _currentTime; }
 
+  /**
+  * Writes the complete simulation state to the file \p path.
+  * 
+  * Restoring the checkpoint with PhysicsAnimation::loadCheckpoint and
+  * advancing the same frames produces the same bits as the run that wrote
+  * it.
+  */
+  void saveCheckpoint(const std::string& path) const;
+
+  /** Restores the simulation state written by saveCheckpoint. */
+  void loadCheckpoint(const std::string& path);
+
+  /** \returns the number of frames between periodic checkpoints. */
+  int checkpointInterval() const { return _checkpointInterval; }
+
+  /**
+  * \brief Writes a checkpoint every \p interval frames.
+  * 
+  * The checkpoint of frame i goes to \p pathPrefix followed by i and
+  * ".ckpt". The state is copied at the end of the frame and written by a
+  * background task, so the following frames are computed while the file is
+  * written. Zero disables the periodic checkpoints.
+  */
+  void setCheckpointInterval(int interval, const std::string& pathPrefix);
+
+  /**
+  * Waits for the pending periodic checkpoint to be written and rethrows
+  * its error, if any.
+  */
+  void waitForCheckpoint();
+
+  /** \returns the frame cache every frame is written to, if any. */
+  FrameCacheWriter* frameCache() const { return _frameCache; }
+
+  /**
+  * \brief Writes every frame to \p cache, or stops writing them if
+  * \p cache is null.
+  * 
+  * The cache is not owned by the animation and must outlive it, or be
+  * reset first.
+  */
+  void setFrameCache(FrameCacheWriter* cache) { _frameCache = cache; }
+
+  /** \returns the log the state is hashed to at every stage, if any. */
+  StageHashLog* stageHashLog() const { return _stageHashLog; }
+
+  /**
+  * \brief Hashes the state at the end of every stage of every time-step
+  * into \p log, or stops hashing it if \p log is null.
+  * 
+  * Comparing the logs of two runs tells the first stage where they
+  * diverge; see findDivergence. The log is not owned by the animation.
+  */
+  void setStageHashLog(StageHashLog* log) { _stageHashLog = log; }
+
 protected:
   /**
   * Returns the required number of sub-timesteps for given time interval.
@@ -128,6 +189,57 @@ protected:
   */
   virtual void onAdvanceTimeStep(double timeInterval) = 0;
 
+  /**
+  * Writes the simulation state to a checkpoint.
+  * 
+  * Subclasses that keep state from one time-step to the next should
+  * override this method, call the base class method first and then write
+  * their own state. Data rebuilt at the beginning of every time-step need
+  * not be written.
+  * 
+  * \param[in] writer The checkpoint writer.
+  */
+  virtual void saveState(CheckpointWriter& writer) const;
+
+  /**
+  * Reads the simulation state written by PhysicsAnimation::saveState.
+  * 
+  * \param[in] reader The checkpoint reader.
+  */
+  virtual void loadState(CheckpointReader& reader);
+
+  /**
+  * Adds the channels of the current frame to a frame cache.
+  * 
+  * Called at the end of every frame when a frame cache is set. The base
+  * class adds nothing.
+  * 
+  * \param[in] cache The frame cache writer.
+  */
+  virtual void writeFrameCache(FrameCacheWriter& cache) const;
+
+  /**
+  * Called at the end of every frame, after the periodic checkpoint and the
+  * frame cache are written. The base class does nothing.
+  */
+  virtual void onEndFrame();
+
+  /**
+  * Adds the hashes of the simulation state to a stage hash log.
+  * 
+  * Subclasses should hash the arrays they write with saveState. The base
+  * class adds nothing.
+  * 
+  * \param[in] log The stage hash log.
+  */
+  virtual void hashState(StageHashLog& log) const;
+
+  /**
+  * Hashes the state at the end of the stage \p stage of the current
+  * time-step, if a stage hash log is set.
+  */
+  void hashStage(const char* stage) const;
+
 private:
   /** Simulation frame. */
   Frame _frame;
@@ -137,6 +249,18 @@ private:
   size_t _numberOfFixedSubTimeSteps = 1ULL;
   /** Current simulation time. */
   double _currentTime = 0.0;
+  /** Number of frames between periodic checkpoints, 0 if disabled. */
+  int _checkpointInterval = 0;
+  /** Path prefix of the periodic checkpoints. */
+  std::string _checkpointPrefix;
+  /** Periodic checkpoint being written. */
+  std::future<void> _pendingCheckpoint;
+  /** Frame cache, not owned. */
+  FrameCacheWriter* _frameCache = nullptr;
+  /** Stage hash log, not owned. */
+  StageHashLog* _stageHashLog = nullptr;
+  /** Sub-time-step of the frame being advanced. */
+  int _subTimeStep = 0;
 
   /**
   * Called by PhysicsAnimation::advanceFrame to subdivide the time-step and
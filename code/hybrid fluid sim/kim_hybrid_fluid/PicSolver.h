@@ -4,7 +4,9 @@
 #include "geometry/ParticleSystem.h"
 #include "GridFluidSolver.h"
 #include "PointGridHashSearcher.h"
+#include "ParticleCache.h"
 #include "ParticleEmitter.h"
+#include <atomic>
 
 namespace cg
 {
@@ -41,6 +43,19 @@ public:
 
   const auto& particleSystem() const { return _particleSystem; }
 
+  auto& particleSystem() { return _particleSystem; }
+
+  // Ids of the particles, in the order of the particle system. Every
+  // particle gets the next id when it is emitted and keeps it until it is
+  // killed, so the ids are unique and ascending.
+  const auto& particleIds() const { return _particleIds; }
+
+  ParticleCacheWriter* particleCache() const { return _particleCache; }
+
+  // Writes the particles of every frame to cache, or stops writing them if
+  // cache is null. The cache is not owned by the solver.
+  void setParticleCache(ParticleCacheWriter* cache) { _particleCache = cache; }
+
   const auto particleEmitter() const { return _particleEmitter; }
 
   void setParticleEmitter(ParticleEmitter<PicParticleSystem>* emitter)
@@ -49,18 +64,57 @@ public:
     _particleEmitter->setTarget(_particleSystem);
   }
 
+  // Particles that enter a kill region are removed at the end of the step.
+  void addKillRegion(math::Surface<D, real>* region)
+  {
+    _killRegions.push_back(region);
+  }
+
+  void clearKillRegions()
+  {
+    _killRegions.clear();
+  }
+
+  bool killOutsideDomain() const { return _killOutsideDomain; }
+
+  // If true, particles that leave the domain through its open sides are
+  // removed at the end of the step.
+  void setKillOutsideDomain(bool kill) { _killOutsideDomain = kill; }
+
 protected:
-  std::array<GridData<D, char>, D> _markers;
+  // faces touched by particles, one bit per face
+  std::array<GridMask<D>, D> _markers;
   PicParticleSystem _particleSystem;
 
   void initialize() override;
 
   void onBeginAdvanceTimeStep(double timeInterval) override;
 
+  // Writes the particles and the emitter state after the grid state.
+  void saveState(CheckpointWriter& writer) const override;
+
+  void loadState(CheckpointReader& reader) override;
+
+  // Writes the particles as "particles.position" and "particles.velocity"
+  // after the grid channels.
+  void writeFrameCache(FrameCacheWriter& cache) const override;
+
+  void onEndFrame() override;
+
+  // Hashes the particles as "particles.position", "particles.velocity" and
+  // "particles.id" after the grid arrays.
+  void hashState(StageHashLog& log) const override;
+
   void computeAdvection(double timeInterval) override;
 
   ScalarField<D, real>* fluidSdf() const override;
 
+  // The adaptive domain window follows the particles. Particles emitted
+  // outside the window are splatted onto its sides for a single step.
+  bool activeRegionBounds(Bounds<real, D>& bounds) const override;
+
+  void onDomainWindowChanged(const Index<D>& offset) override;
+
   // Transfers velocity field from particles to grids.
   virtual void transferFromParticlesToGrids();
 
@@ -74,13 +128,39 @@ private:
   Ref<ParticleEmitter<PicParticleSystem>> _particleEmitter;
   Ref<Searcher> _searcher;
   Ref<CellCenteredScalarGrid<D, real>> _signedDistanceField;
+  std::vector<Ref<math::Surface<D, real>>> _killRegions;
+  bool _killOutsideDomain{};
+  // 1 for the particles that survive the step, reused across steps
+  std::vector<char> _isAlive;
+  std::vector<uint64_t> _particleIds;
+  // particle to grid transfer: lower stencil row of every particle, the
+  // particles binned by row and the faces they reach
+  std::vector<int64_t> _particleRows;
+  std::vector<int64_t> _rowOffsets;
+  std::vector<uint32_t> _rowParticles;
+  std::vector<char> _isFaceTouched;
+  uint64_t _nextParticleId{};
+  ParticleCacheWriter* _particleCache{};
 
   void extrapolateVelocityToAir();
 
+  void transferComponentToGrid(const LinearArraySampler2<real>& sampler,
+    Grid<2, real>& data,
+    GridMask<2>& marker,
+    int component);
+
+  void killParticles();
+
+  void compactParticles();
+
+  void assignParticleIds();
+
   void buildSignedDistanceField();
 
   void updateParticleEmitter(double timeInterval);
 
+  vec maxAbsParticleVelocity() const;
+
 }; // PicSolver<D, real, ArrayAllocator>
 
 template<size_t D, typename real, typename ArrayAllocator>
@@ -90,6 +170,101 @@ PicSolver<D, real, ArrayAllocator>::initialize()
   GridFluidSolver<D, real>::initialize();
 
   updateParticleEmitter(0.0);
+  assignParticleIds();
+}
+
+template<size_t D, typename real, typename ArrayAllocator>
+inline void
+PicSolver<D, real, ArrayAllocator>::saveState(CheckpointWriter& writer) const
+{
+  Base::saveState(writer);
+  writer.writeTag("PICS");
+
+  // positions and velocities are written as two raw arrays
+  auto n = _particleSystem.size();
+  writer.write(n);
+  if (n > 0)
+  {
+    writer.write(&_particleSystem.position(0), n);
+    writer.write(&_particleSystem.get<1>(0), n);
+  }
+  writer.write(_nextParticleId);
+  writer.write(_particleIds.size());
+  writer.write(_particleIds.data(), _particleIds.size());
+  writer.write(_particleEmitter != nullptr);
+  if (_particleEmitter != nullptr)
+    _particleEmitter->saveState(writer);
+}
+
+template<size_t D, typename real, typename ArrayAllocator>
+inline void
+PicSolver<D, real, ArrayAllocator>::loadState(CheckpointReader& reader)
+{
+  Base::loadState(reader);
+  reader.expectTag("PICS");
+
+  auto n = reader.read<size_t>();
+  if (_particleSystem.capacity() < n)
+    _particleSystem.resize(n);
+  else
+  {
+    _particleSystem.clear();
+    _particleSystem.append(n);
+  }
+  if (n > 0)
+  {
+    reader.read(&_particleSystem.position(0), n);
+    reader.read(&_particleSystem.get<1>(0), n);
+  }
+  reader.read(_nextParticleId);
+  _particleIds.resize(reader.read<size_t>());
+  reader.read(_particleIds.data(), _particleIds.size());
+  assignParticleIds();
+  if (reader.read<bool>() != (_particleEmitter != nullptr))
+    throw std::runtime_error("PicSolver: particle emitter mismatch");
+  if (_particleEmitter != nullptr)
+    _particleEmitter->loadState(reader);
+}
+
+template<size_t D, typename real, typename ArrayAllocator>
+inline void
+PicSolver<D, real, ArrayAllocator>::writeFrameCache(FrameCacheWriter& cache) const
+{
+  Base::writeFrameCache(cache);
+
+  auto n = _particleSystem.size();
+  cache.addPoints("particles.position", n > 0 ? &_particleSystem.position(0) : nullptr, n);
+  cache.addPoints("particles.velocity", n > 0 ? &_particleSystem.get<1>(0) : nullptr, n);
+}
+
+template<size_t D, typename real, typename ArrayAllocator>
+inline void
+PicSolver<D, real, ArrayAllocator>::hashState(StageHashLog& log) const
+{
+  Base::hashState(log);
+
+  auto n = _particleSystem.size();
+  log.addArray("particles.position", n > 0 ? &_particleSystem.position(0) : nullptr, n);
+  log.addArray("particles.velocity", n > 0 ? &_particleSystem.get<1>(0) : nullptr, n);
+  log.addArray("particles.id", _particleIds.data(), _particleIds.size());
+}
+
+template<size_t D, typename real, typename ArrayAllocator>
+inline void
+PicSolver<D, real, ArrayAllocator>::onEndFrame()
+{
+  if (_particleCache == nullptr)
+    return;
+
+  assignParticleIds();
+  auto n = _particleSystem.size();
+  _particleCache->write(this->frame().index,
+    this->currentTime(),
+    this->adaptiveDomain().bounds(),
+    n > 0 ? &_particleSystem.position(0) : nullptr,
+    n > 0 ? &_particleSystem.get<1>(0) : nullptr,
+    _particleIds.data(),
+    n);
 }
 
 template<size_t D, typename real, typename ArrayAllocator>
@@ -97,12 +272,15 @@ inline void
 PicSolver<D, real, ArrayAllocator>::onBeginAdvanceTimeStep(double timeInterval)
 {
   updateParticleEmitter(timeInterval);
+  assignParticleIds();
 
   transferFromParticlesToGrids();
+  this->hashStage("particlesToGrid");
 
   buildSignedDistanceField();
 
   extrapolateVelocityToAir();
+  this->hashStage("extrapolation");
 
   this->applyBoundaryCondition();
 }
@@ -121,9 +299,15 @@ PicSolver<D, real, ArrayAllocator>::computeAdvection(double timeInterval)
   s.lap();
   transferFromGridsToParticles();
   debug("[INFO] TransferFromGridsToParticles took %lld ms\n", s.lap());
+  this->hashStage("gridToParticles");
 
   moveParticles(timeInterval);
   debug("[INFO] MoveParticles took %lld ms\n", s.lap());
+
+  // FLIP updates and collisions can take the particles faster than the
+  // projected grid, and the next step splats them back to the grid, whose
+  // components cannot exceed the ones of the particles
+  this->setMaxVelocity(maxAbsParticleVelocity());
 }
 
 template<size_t D, typename real, typename ArrayAllocator>
@@ -133,6 +317,62 @@ PicSolver<D, real, ArrayAllocator>::fluidSdf() const
   return signedDistanceField().get();
 }
 
+template<size_t D, typename real, typename ArrayAllocator>
+inline bool
+PicSolver<D, real, ArrayAllocator>::activeRegionBounds(Bounds<real, D>& bounds) const
+{
+  auto numberOfParticles = int64_t(_particleSystem.size());
+  if (numberOfParticles == 0)
+    return false;
+
+  bounds = parallelReduce(int64_t(0), numberOfParticles, Bounds<real, D>{},
+    [&](int64_t b, int64_t e, Bounds<real, D> box) {
+      for (auto i = b; i < e; ++i)
+        box.inflate(_particleSystem[i]);
+      return box;
+    },
+    [](Bounds<real, D> a, const Bounds<real, D>& b) {
+      if (b.min().x <= b.max().x)
+      {
+        a.inflate(b.min());
+        a.inflate(b.max());
+      }
+      return a;
+    }, 4096);
+  return true;
+}
+
+template<size_t D, typename real, typename ArrayAllocator>
+inline Vector<real, D>
+PicSolver<D, real, ArrayAllocator>::maxAbsParticleVelocity() const
+{
+  return parallelReduce(int64_t(0), int64_t(_particleSystem.size()), vec::null(),
+    [&](int64_t b, int64_t e, vec m) {
+      for (auto i = b; i < e; ++i)
+      {
+        const auto& v = _particleSystem.get<1>(i);
+        for (size_t d = 0; d < D; ++d)
+          m[d] = math::max(m[d], std::abs(v[d]));
+      }
+      return m;
+    },
+    [](vec a, const vec& b) {
+      for (size_t d = 0; d < D; ++d)
+        a[d] = math::max(a[d], b[d]);
+      return a;
+    }, 4096);
+}
+
+template<size_t D, typename real, typename ArrayAllocator>
+inline void
+PicSolver<D, real, ArrayAllocator>::onDomainWindowChanged(const Index<D>& offset)
+{
+  // the particle SDF is rebuilt every step, only its shape has to follow
+  auto vel = this->velocity();
+  _signedDistanceField = new CellCenteredScalarGrid<D, real>(
+    vel->size(), vel->gridSpacing(), vel->origin(), math::Limits<real>::inf());
+}
+
 template<size_t D, typename real, typename ArrayAllocator>
 inline void
 PicSolver<D, real, ArrayAllocator>::transferFromParticlesToGrids()
@@ -154,57 +394,89 @@ PicSolver<D, real, ArrayAllocator>::transferFromParticlesToGrids()
       vel->iOrigin<1>()
     );
 
-    auto uSize = this->velocity()->iSize<0>();
-    auto vSize = this->velocity()->iSize<1>();
-
     // fill velocity with zero
     this->velocity()->fill(vec::null());
-    GridData<2, real> uWeight;
-    GridData<2, real> vWeight;
-    uWeight.resize(uSize);
-    vWeight.resize(vSize);
+    transferComponentToGrid(uSampler, *vel->data<0>(), _markers[0], 0);
+    transferComponentToGrid(vSampler, *vel->data<1>(), _markers[1], 1);
+  }
+}
 
-    _markers[0].resize(uSize);
-    _markers[1].resize(vSize);
+template<size_t D, typename real, typename ArrayAllocator>
+inline void
+PicSolver<D, real, ArrayAllocator>::transferComponentToGrid(
+  const LinearArraySampler2<real>& sampler,
+  Grid<2, real>& data,
+  GridMask<2>& marker,
+  int component)
+{
+  // Each face sums the contributions of its particles in particle order, as
+  // a serial loop over the particles would, so the grid has the same bits
+  // with any number of threads. The particles are binned by the lower row
+  // of their stencil, then each row of faces gathers the two bins that
+  // reach it, in parallel.
+  const auto size = data.size();
+  auto numberOfParticles = int64_t(_particleSystem.size());
+  GridData<2, real> weight;
+  weight.resize(size);
+  fill(weight, real(0));
+
+  _particleRows.resize(size_t(numberOfParticles));
+  parallelFor(0, numberOfParticles, [&](int64_t i) {
+    std::array<Index2, 4> indices;
+    std::array<real, 4> weights;
+    sampler.getCoordinatesAndWeights(_particleSystem[i], indices, weights);
+    _particleRows[i] = indices[0].y;
+    }, 4096);
+
+  _rowOffsets.assign(size_t(size.y) + 1, 0);
+  for (auto row : _particleRows)
+    ++_rowOffsets[size_t(row) + 1];
+  for (int64_t y = 0; y < size.y; ++y)
+    _rowOffsets[y + 1] += _rowOffsets[y];
+  _rowParticles.resize(size_t(numberOfParticles));
+  {
+    auto next = _rowOffsets;
+    for (int64_t i = 0; i < numberOfParticles; ++i)
+      _rowParticles[next[_particleRows[i]]++] = uint32_t(i);
+  }
 
-    fill(uWeight, (real)0.0f);
-    fill(_markers[0], (char)0);
-    fill(vWeight, (real)0.0f);
-    fill(_markers[1], (char)0);
+  _isFaceTouched.assign(size_t(size.prod()), 0);
+  parallelFor(0, size.y, [&](int64_t y) {
+    auto a = _rowOffsets[y > 0 ? y - 1 : y];
+    auto aEnd = _rowOffsets[y];
+    auto b = _rowOffsets[y];
+    auto bEnd = _rowOffsets[y + 1];
+    std::array<Index2, 4> indices;
+    std::array<real, 4> weights;
 
-    auto numberOfParticles = this->_particleSystem.size();
-    for (size_t i = 0; i < numberOfParticles; ++i)
+    while (a < aEnd || b < bEnd)
     {
-      std::array<Index2, 4> indices;
-      std::array<real, 4> weights;
+      auto i = b == bEnd || (a < aEnd && _rowParticles[a] < _rowParticles[b]) ?
+        _rowParticles[a++] :
+        _rowParticles[b++];
+      auto v = _particleSystem.get<1>(i)[component];
 
-      uSampler.getCoordinatesAndWeights(this->_particleSystem[i], indices, weights);
+      sampler.getCoordinatesAndWeights(_particleSystem[i], indices, weights);
       for (int j = 0; j < 4; ++j)
-      {
-        vel->velocityAt<0>(indices[j])
-          += _particleSystem.get<1>(i).x * weights[j];
-        uWeight[uWeight.id(indices[j])] += weights[j];
-        _markers[0][_markers[0].id(indices[j])] = 1;
-      }
-
-      vSampler.getCoordinatesAndWeights(this->_particleSystem[i], indices, weights);
-      for (int j = 0; j < 4; ++j)
-      {
-        vel->velocityAt<1>(indices[j])
-          += _particleSystem.get<1>(i).y * weights[j];
-        vWeight[vWeight.id(indices[j])] += weights[j];
-        _markers[1][_markers[1].id(indices[j])] = 1;
-      }
+        if (indices[j].y == y)
+        {
+          auto id = data.id(indices[j]);
+          data[id] += v * weights[j];
+          weight[id] += weights[j];
+          _isFaceTouched[size_t(id)] = 1;
+        }
     }
+    });
 
-    for (int64_t i = 0; i < uSize.prod(); ++i)
-      if (uWeight[i] > 0.0f)
-        vel->velocityAt<0>(i) /= uWeight[i];
+  marker.resize(size);
+  for (int64_t i = 0; i < size.prod(); ++i)
+    if (_isFaceTouched[size_t(i)])
+      marker.set(i);
 
-    for (int64_t i = 0; i < vSize.prod(); ++i)
-      if (vWeight[i] > 0.0f)
-        vel->velocityAt<1>(i) /= vWeight[i];
-  }
+  parallelFor(0, size.prod(), [&](int64_t i) {
+    if (weight[i] > 0.0f)
+      data[i] /= weight[i];
+    }, 4096);
 }
 
 template<size_t D, typename real, typename ArrayAllocator>
@@ -214,10 +486,9 @@ PicSolver<D, real, ArrayAllocator>::transferFromGridsToParticles()
   auto numberOfParticles = _particleSystem.size();
   auto& particles = _particleSystem;
   auto vel = this->velocity();
-  for (size_t i = 0; i < numberOfParticles; ++i)
-  {
+  parallelFor(0, int64_t(numberOfParticles), [&](int64_t i) {
     particles.get<1>(i) = vel->sample(particles[i]);
-  }
+    }, 1024);
 }
 
 template<size_t D, typename real, typename ArrayAllocator>
@@ -226,9 +497,10 @@ PicSolver<D, real, ArrayAllocator>::moveParticles(double timeInterval)
 {
   auto numberOfParticles = _particleSystem.size();
   auto velocity = this->velocity();
+  auto maxSubSteps = math::max<real>(std::floor(this->maxCfl()), 1.0f);
+  auto invH = real(1) / this->gridSpacing().min();
 
-  for (size_t i = 0; i < numberOfParticles; ++i)
-  {
+  parallelFor(0, int64_t(numberOfParticles), [&](int64_t i) {
     vec pt0{ _particleSystem[i] };
     vec pt1{ pt0 };
     vec vel{ _particleSystem.get<1>(i) };
@@ -236,13 +508,18 @@ PicSolver<D, real, ArrayAllocator>::moveParticles(double timeInterval)
     vec boundsMin{ bounds.min() };
     vec boundsMax{ bounds.max() };
 
-    // Adaptive time-stepping
-    unsigned int numSubSteps
-      = static_cast<unsigned int>(math::max<real>(this->maxCfl(), 1.0f));
+    // Adaptive time-stepping: each particle takes as many substeps as its
+    // own local CFL number requires, so slow particles take a single one
+    vec vel0{ velocity->sample(pt0) };
+    auto speed = math::max<real>(vel0.length(), vel.length());
+    auto localCfl = real(speed * timeInterval * invH);
+    unsigned int numSubSteps = static_cast<unsigned int>(
+      math::min<real>(math::max<real>(std::ceil(localCfl), 1.0f), maxSubSteps));
     real dt = static_cast<real>(timeInterval / numSubSteps);
     for (unsigned t = 0; t < numSubSteps; ++t)
     {
-      vec vel0{ velocity->sample(pt0) };
+      if (t > 0)
+        vel0 = velocity->sample(pt0);
 
       // mid-point rule
       vec midPt{ pt0 + 0.5 * dt * vel0 };
@@ -252,8 +529,9 @@ PicSolver<D, real, ArrayAllocator>::moveParticles(double timeInterval)
       pt0 = pt1;
     }
 
-    // review this!!!!!!
-    auto flag = this->closedDomainBoundaryFlag();
+    // closed sides clamp the particles onto the wall; through open sides
+    // they leave the domain and are removed by killParticles()
+    auto flag = this->windowBoundaryFlag();
     if ((flag & constants::directionLeft) && (pt1.x <= boundsMin.x))
     {
       pt1.x = boundsMin.x;
@@ -284,27 +562,118 @@ PicSolver<D, real, ArrayAllocator>::moveParticles(double timeInterval)
       }
       if ((flag & constants::directionFront) && (pt1.z >= boundsMax.z))
       {
-        pt1.y = boundsMax.y;
-        vel.y = 0.0f;
+        pt1.z = boundsMax.z;
+        vel.z = 0.0f;
       }
     }
 
     _particleSystem.set(i, pt1, vel);
-  }
+    }, 256);
 
   auto col = this->collider();
-  if (col != nullptr)
+  if (col != nullptr && numberOfParticles > 0)
   {
-    for (size_t i = 0; i < numberOfParticles; ++i)
+    col->resolveCollisions(
+      0.0f,
+      0.0f,
+      &_particleSystem[0],
+      &_particleSystem.get<1>(0),
+      numberOfParticles
+    );
+  }
+
+  killParticles();
+}
+
+template<size_t D, typename real, typename ArrayAllocator>
+inline void
+PicSolver<D, real, ArrayAllocator>::killParticles()
+{
+  auto numberOfParticles = _particleSystem.size();
+  if (numberOfParticles == 0 || (!_killOutsideDomain && _killRegions.empty()))
+    return;
+
+  // closed sides clamp the particles to the bounds, so only the ones that
+  // left through open sides are outside them
+  auto bounds = this->adaptiveDomain().bounds();
+  std::vector<Bounds<real, D>> regionBounds;
+  for (const auto& region : _killRegions)
+    regionBounds.push_back(region->bounds());
+
+  _isAlive.resize(numberOfParticles);
+  std::atomic<bool> hasDead{ false };
+  parallelFor(0, int64_t(numberOfParticles), [&](int64_t i) {
+    const auto& p = _particleSystem[i];
+    bool isAlive = !_killOutsideDomain || bounds.contains(p);
+
+    for (size_t r = 0; r < _killRegions.size() && isAlive; ++r)
     {
-      col->resolveCollision(
-        0.0f,
-        0.0f,
-        _particleSystem[i],
-        _particleSystem.get<1>(i)
-      );
+      const auto& region = _killRegions[r];
+      if (!region->isBounded() || regionBounds[r].contains(p))
+        isAlive = !region->isInside(p);
     }
+    _isAlive[i] = isAlive;
+    if (!isAlive)
+      hasDead = true;
+    }, 256);
+
+  if (hasDead)
+    compactParticles();
+}
+
+template<size_t D, typename real, typename ArrayAllocator>
+inline void
+PicSolver<D, real, ArrayAllocator>::compactParticles()
+{
+  // Stable compaction: each chunk first packs its live particles at its
+  // beginning in parallel, then the packed chunks are moved down in order
+  assignParticleIds();
+  auto numberOfParticles = int64_t(_particleSystem.size());
+  auto chunks = int64_t(maxNumberOfThreads());
+  std::vector<int64_t> counts(chunks);
+  auto chunkBegin = [&](int64_t c) { return numberOfParticles * c / chunks; };
+
+  parallelFor(0, chunks, [&](int64_t c) {
+    auto n = chunkBegin(c);
+    for (auto i = n; i < chunkBegin(c + 1); ++i)
+      if (_isAlive[i])
+      {
+        if (i != n)
+        {
+          _particleSystem.copy(i, n);
+          _particleIds[n] = _particleIds[i];
+        }
+        ++n;
+      }
+    counts[c] = n - chunkBegin(c);
+    });
+
+  int64_t size = counts[0];
+  for (int64_t c = 1; c < chunks; ++c)
+  {
+    auto begin = chunkBegin(c);
+    if (begin != size)
+      for (int64_t k = 0; k < counts[c]; ++k)
+      {
+        _particleSystem.copy(begin + k, size + k);
+        _particleIds[size + k] = _particleIds[begin + k];
+      }
+    size += counts[c];
   }
+  _particleSystem.truncate(size_t(size));
+  _particleIds.resize(size_t(size));
+}
+
+template<size_t D, typename real, typename ArrayAllocator>
+inline void
+PicSolver<D, real, ArrayAllocator>::assignParticleIds()
+{
+  // emitters only append particles, so the new ones are at the end
+  auto n = _particleSystem.size();
+  if (_particleIds.size() > n)
+    _particleIds.resize(n);
+  while (_particleIds.size() < n)
+    _particleIds.push_back(_nextParticleId++);
 }
 
 template<size_t D, typename real, typename ArrayAllocator>
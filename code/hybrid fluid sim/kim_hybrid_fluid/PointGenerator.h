@@ -25,7 +25,10 @@ public:
 
   // Generates points to output array points inside given bounds
   // with target point spacing.
-  void generate(const bounds_type& bounds, real spacing, std::vector<vec_type>& points) const
+  //
+  // Generators should override this method to append the points in bulk,
+  // without going through the callback of forEachPoint.
+  virtual void generate(const bounds_type& bounds, real spacing, std::vector<vec_type>& points) const
   {
     forEachPoint(bounds, spacing, [&points](const vec_type& v) {
       points.push_back(v);
@@ -0,0 +1,206 @@
+#ifndef __PoissonDiskPointGenerator_h
+#define __PoissonDiskPointGenerator_h
+
+#include "PointGenerator.h"
+#include <cmath>
+#include <random>
+
+namespace cg
+{
+
+// Blue noise point generator backed by a tileable Poisson disk pattern.
+//
+// The pattern is generated once, in the constructor, with Bridson's
+// algorithm over a periodic tile of tileSize x tileSize (x tileSize) unit
+// distances, so copies of the tile can be placed side by side without seams.
+// Generating points only scales and repeats the tile: no two points are
+// closer than the spacing, which avoids the aliasing of regular lattices.
+template <size_t D, typename real>
+class PoissonDiskPointGenerator final : public PointGenerator<D, real>
+{
+  ASSERT_REAL(real, "*PoissonDiskPointGenerator: real should be float or double");
+public:
+  using vec_type = Vector<real, D>;
+  using bounds_type = Bounds<real, D>;
+  using callback_type = typename PointGenerator<D, real>::callback_type;
+
+  // Builds the tile with tileSize unit distances per side.
+  PoissonDiskPointGenerator(int tileSize = 16, unsigned seed = 0):
+    _tileSize(tileSize)
+  {
+    buildTile(seed);
+  }
+
+  // Returns the number of points of the tile.
+  auto tilePointCount() const
+  {
+    return _tile.size();
+  }
+
+  void generate(const bounds_type& bounds, real spacing, std::vector<vec_type>& points) const override
+  {
+    forEachTilePoint(bounds, spacing, [&points](const vec_type& p) {
+      points.push_back(p);
+      return true;
+    });
+  }
+
+  void forEachPoint(const bounds_type& bounds, real spacing, const callback_type& callback) const override
+  {
+    forEachTilePoint(bounds, spacing, callback);
+  }
+
+private:
+  int _tileSize;
+  // points of the tile in unit distances, in [0, tileSize)
+  std::vector<vec_type> _tile;
+
+  void buildTile(unsigned seed);
+
+  template <typename Callback>
+  void forEachTilePoint(const bounds_type& bounds, real spacing, const Callback& callback) const;
+
+}; // PoissonDiskPointGenerator
+
+template<size_t D, typename real>
+inline void
+PoissonDiskPointGenerator<D, real>::buildTile(unsigned seed)
+{
+  // Bridson's algorithm with unit radius and periodic distances
+  const auto L = real(_tileSize);
+  // cells no wider than 1 / sqrt(D) hold at most one point
+  const auto n = std::max(1, int(std::ceil(L * std::sqrt(real(D)))));
+  const auto h = L / n;
+  constexpr int k = 30;
+
+  int cellCount = 1;
+  for (size_t d = 0; d < D; ++d)
+    cellCount *= n;
+  std::vector<int> cells(cellCount, -1);
+
+  auto cellOf = [&](const vec_type& p) {
+    int id = 0;
+    for (int d = int(D) - 1; d >= 0; --d)
+      id = id * n + std::min(n - 1, int(p[d] / h));
+    return id;
+  };
+
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<real> uniform(0, 1);
+
+  auto fits = [&](const vec_type& p) {
+    int c[3]{};
+    for (size_t d = 0; d < D; ++d)
+      c[d] = std::min(n - 1, int(p[d] / h));
+
+    // a unit disk spans at most two cells of size 1 / sqrt(D) on each side
+    int o[3]{};
+    for (o[2] = D == 3 ? -2 : 0; o[2] <= (D == 3 ? 2 : 0); ++o[2])
+      for (o[1] = -2; o[1] <= 2; ++o[1])
+        for (o[0] = -2; o[0] <= 2; ++o[0])
+        {
+          int id = 0;
+          for (int d = int(D) - 1; d >= 0; --d)
+            id = id * n + (c[d] + o[d] + n) % n;
+
+          auto q = cells[id];
+          if (q < 0)
+            continue;
+
+          real d2 = 0;
+          for (size_t d = 0; d < D; ++d)
+          {
+            auto e = std::abs(p[d] - _tile[q][d]);
+            e = std::min(e, L - e);
+            d2 += e * e;
+          }
+          if (d2 < 1)
+            return false;
+        }
+    return true;
+  };
+
+  vec_type first;
+  for (size_t d = 0; d < D; ++d)
+    first[d] = uniform(rng) * L;
+  _tile.push_back(first);
+  cells[cellOf(first)] = 0;
+
+  std::vector<int> active{ 0 };
+  while (!active.empty())
+  {
+    auto a = std::uniform_int_distribution<size_t>(0, active.size() - 1)(rng);
+    const auto center = _tile[active[a]];
+    bool found = false;
+
+    for (int i = 0; i < k && !found; ++i)
+    {
+      // candidate in the annulus [1, 2) around the center
+      vec_type dir;
+      real len;
+      do
+      {
+        for (size_t d = 0; d < D; ++d)
+          dir[d] = uniform(rng) * 2 - 1;
+        len = dir.length();
+      } while (len > 1 || len < real(1e-3f));
+
+      auto r = 1 + uniform(rng);
+      auto p = center + dir * (r / len);
+      for (size_t d = 0; d < D; ++d)
+        p[d] = std::fmod(p[d] + L, L);
+
+      if (fits(p))
+      {
+        cells[cellOf(p)] = int(_tile.size());
+        active.push_back(int(_tile.size()));
+        _tile.push_back(p);
+        found = true;
+      }
+    }
+
+    if (!found)
+    {
+      active[a] = active.back();
+      active.pop_back();
+    }
+  }
+}
+
+template<size_t D, typename real>
+template<typename Callback>
+inline void
+PoissonDiskPointGenerator<D, real>::forEachTilePoint(const bounds_type& bounds, real spacing, const Callback& callback) const
+{
+  const auto tileWidth = spacing * _tileSize;
+  const auto& min = bounds.min();
+  const auto boxSize = bounds.size();
+
+  int tiles[3]{ 1, 1, 1 };
+  for (size_t d = 0; d < D; ++d)
+    tiles[d] = std::max(1, int(std::ceil(boxSize[d] / tileWidth)));
+
+  // tiles are laid out from the min corner of the bounds
+  int t[3]{};
+  for (t[2] = 0; t[2] < tiles[2]; ++t[2])
+    for (t[1] = 0; t[1] < tiles[1]; ++t[1])
+      for (t[0] = 0; t[0] < tiles[0]; ++t[0])
+      {
+        vec_type origin = min;
+        for (size_t d = 0; d < D; ++d)
+          origin[d] += t[d] * tileWidth;
+
+        for (const auto& q : _tile)
+        {
+          auto p = origin + q * spacing;
+          if (!bounds.contains(p))
+            continue;
+          if (!callback(p))
+            return;
+        }
+      }
+}
+
+} // end namespace cg
+
+#endif // __PoissonDiskPointGenerator_h
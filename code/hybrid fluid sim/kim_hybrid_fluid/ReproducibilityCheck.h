@@ -0,0 +1,153 @@
+#ifndef __ReproducibilityCheck_h
+#define __ReproducibilityCheck_h
+
+#include "Scene.h"
+#include "StageHash.h"
+#include <array>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace cg
+{
+
+/**
+* Verifies that a scene gives the same bits when run twice.
+*
+* The scene is run twice with a stage hash log, without its output, and the
+* logs are compared: the result tells the first stage, and the first array
+* of that stage, where the runs diverge. By default the first run is serial
+* and the second one uses every thread, both in deterministic mode (see
+* setDeterministic), which is how the QC runs diff their frames:
+*
+*   ReproducibilityCheck check{ JsonValue::load("dam.json") };
+*   check.setFrames(10);
+*   auto divergence = check.run();
+*   puts(divergence.describe().c_str());
+*   check.saveLogs("dam_hashes_");
+*
+* compareHalfChannels() runs a grid scene with full precision and with half
+* precision scalar channels instead, and measures how far the half
+* precision density drifts from the full precision one.
+*/
+class ReproducibilityCheck
+{
+public:
+  /** Constructs a check of the scene described by \p description. */
+  explicit ReproducibilityCheck(const JsonValue& description):
+    _description(description)
+  {
+    // do nothing
+  }
+
+  /** Returns the max number of threads of \p run, 0 for every thread. */
+  unsigned int threads(int run) const { return _threads[run]; }
+
+  /** Sets the max number of threads of each run, 0 for every thread. */
+  void setThreads(unsigned int first, unsigned int second)
+  {
+    _threads = { first, second };
+  }
+
+  /** Returns the number of frames of each run, 0 for the scene frames. */
+  int frames() const { return _frames; }
+
+  void setFrames(int frames) { _frames = std::max(frames, 0); }
+
+  /** Returns true if the runs are in deterministic mode. */
+  bool isDeterministic() const { return _deterministic; }
+
+  void setDeterministic(bool deterministic) { _deterministic = deterministic; }
+
+  /** Returns the stage hash log of \p run, 0 or 1. */
+  const StageHashLog& log(int run) const { return _logs[run]; }
+
+  /** Runs the scene twice and returns the first divergence of the runs. */
+  StageHashDivergence run()
+  {
+    auto description = _description;
+    description.set("output", JsonValue::object());
+
+    auto wasDeterministic = cg::isDeterministic();
+    auto threadLimit = internal::threadLimitStorage();
+    cg::setDeterministic(_deterministic);
+    try
+    {
+      for (int r = 0; r < 2; ++r)
+      {
+        _logs[r].clear();
+        setThreadLimit(_threads[r]);
+
+        auto scene = Scene::build(description);
+        scene->solver()->setStageHashLog(&_logs[r]);
+        scene->advance(_frames > 0 ? _frames : scene->numberOfFrames());
+      }
+    }
+    catch (...)
+    {
+      cg::setDeterministic(wasDeterministic);
+      setThreadLimit(threadLimit);
+      throw;
+    }
+    cg::setDeterministic(wasDeterministic);
+    setThreadLimit(threadLimit);
+    return findDivergence(_logs[0], _logs[1]);
+  }
+
+  /**
+  * Runs the scene, a grid scene, with "real" and with "half" channel
+  * storage, and returns the error of the half precision density against
+  * the full precision density.
+  */
+  GridErrorReport compareHalfChannels() const
+  {
+    auto description = _description;
+    description.set("output", JsonValue::object());
+    if (description.get("dimension", 2) != 2 || description["solver"].get("type", "flip") != "grid")
+      throw std::runtime_error("ReproducibilityCheck: half channels need a 2D grid scene");
+
+    std::unique_ptr<Scene> scenes[2];
+    const char* storage[2]{ "real", "half" };
+    for (int r = 0; r < 2; ++r)
+    {
+      description["solver"].set("channelStorage", storage[r]);
+      scenes[r] = Scene::build(description);
+      scenes[r]->advance(_frames > 0 ? _frames : scenes[r]->numberOfFrames());
+    }
+    if (description.get("precision", "float") == "float")
+      return compareDensity<float>(*scenes[0], *scenes[1]);
+    return compareDensity<double>(*scenes[0], *scenes[1]);
+  }
+
+  /**
+  * Writes the logs of the runs to \p pathPrefix followed by "0.txt" and
+  * "1.txt", to be compared with the logs of other builds or machines.
+  */
+  void saveLogs(const std::string& pathPrefix) const
+  {
+    for (int r = 0; r < 2; ++r)
+      _logs[r].save(pathPrefix + std::to_string(r) + ".txt");
+  }
+
+private:
+  JsonValue _description;
+  std::array<unsigned int, 2> _threads{ 1, 0 };
+  int _frames{};
+  bool _deterministic{ true };
+  StageHashLog _logs[2];
+
+  template <typename real>
+  static GridErrorReport compareDensity(const Scene& reference, const Scene& scene)
+  {
+    auto a = dynamic_cast<const GridSolver<2, real>*>(reference.solver());
+    auto b = dynamic_cast<const GridSolver<2, real, Half>*>(scene.solver());
+    if (a == nullptr || b == nullptr)
+      throw std::runtime_error("ReproducibilityCheck: unexpected solver type");
+    return compareGrids(*a->density(), *b->density());
+  }
+
+}; // ReproducibilityCheck
+
+} // end namespace cg
+
+#endif // __ReproducibilityCheck_h
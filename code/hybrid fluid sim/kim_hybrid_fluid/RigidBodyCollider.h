@@ -0,0 +1,74 @@
+#ifndef __RigidBodyCollider_h
+#define __RigidBodyCollider_h
+
+#include "Collider.h"
+#include <type_traits>
+
+namespace cg
+{
+
+/**
+* Collider of a rigid body.
+*
+* The velocity of the collider at a point is given by the linear and the
+* angular velocity of the body around the position of the surface transform.
+* The motion itself is driven by the update callback, which is expected to
+* move the surface transform and to set the velocities accordingly.
+*
+* \see Fluid Engine Development by Doyub Kim.
+*
+* \tparam D Defines the number of dimensions.
+* \tparam real A floating point type.
+*/
+template <size_t D, typename real>
+class RigidBodyCollider : public Collider<D, real>
+{
+public:
+  using vec_type = Vector<real, D>; ///< Vector type alias.
+  /// Angular velocity type: a scalar in 2D and a vector in 3D.
+  using angular_type = std::conditional_t<D == 2, real, vec_type>;
+
+  /** Linear velocity of the rigid body. */
+  vec_type linearVelocity{ real(0.0f) };
+
+  /** Angular velocity of the rigid body, in radians per second. */
+  angular_type angularVelocity{ real(0.0f) };
+
+  /** Constructs a rigid body collider with the given \p surface. */
+  RigidBodyCollider(const Reference<math::Surface<D, real>> surface)
+  {
+    this->setSurface(surface);
+  }
+
+  /** Returns the velocity of the collider at point \p p. */
+  vec_type velocityAt(const vec_type& p) const override
+  {
+    auto r = p - this->surface()->transform.position();
+
+    if constexpr (D == 2)
+      return linearVelocity + angularVelocity * vec_type{ -r.y, r.x };
+    else
+      return linearVelocity + angularVelocity.cross(r);
+  }
+
+  /** Writes the transform and the velocities of the body. */
+  void saveState(CheckpointWriter& writer) const override
+  {
+    Collider<D, real>::saveState(writer);
+    writer.write(linearVelocity);
+    writer.write(angularVelocity);
+  }
+
+  /** Reads the state written by RigidBodyCollider::saveState. */
+  void loadState(CheckpointReader& reader) override
+  {
+    Collider<D, real>::loadState(reader);
+    reader.read(linearVelocity);
+    reader.read(angularVelocity);
+  }
+
+}; // RigidBodyCollider
+
+} // end namespace cg
+
+#endif // __RigidBodyCollider_h
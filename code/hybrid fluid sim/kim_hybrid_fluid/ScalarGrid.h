@@ -3,7 +3,7 @@
 
 #include "geometry/Grid3.h"
 #include "ScalarField.h"
-#include "LinearArraySampler2.h"
+#include "LinearArraySampler3.h"
 
 namespace cg
 {
@@ -13,12 +13,13 @@ namespace cg
 /// </summary>
 /// <typeparam name="D">Dimenso. Toma valor 2 ou 3</typeparam>
 /// <typeparam name="real">Tipo de ponto flutuante</typeparam>
-template <size_t D, typename real>
-class ScalarGrid: public ScalarField<D, real>, public RegionGrid<D, real, real>
+/// <typeparam name="S">Tipo de armazenamento dos valores: real ou Half</typeparam>
+template <size_t D, typename real, typename S = real>
+class ScalarGrid: public ScalarField<D, real>, public RegionGrid<D, real, S>
 {
 public:
-  using Base = RegionGrid<D, real, real>;
-  using bounds_type = typename RegionGrid<D, real, real>::bounds_type;
+  using Base = RegionGrid<D, real, S>;
+  using bounds_type = typename Base::bounds_type;
   using vec_type = typename ScalarField<D, real>::vec_type;
   // using id_type = Index<D>::base_type;
 
@@ -113,7 +114,7 @@ protected:
   // simple grid class and inherit from it
 
 private:
-  LinearArraySampler<real, D> _linearSampler;
+  LinearArraySampler<real, D, S> _linearSampler;
 };
 
 } // end namespace cg
@@ -0,0 +1,682 @@
+#ifndef __Scene_h
+#define __Scene_h
+
+#include "Json.h"
+#include "GridSolver.h"
+#include "FlipSolver.h"
+#include "RigidBodyCollider.h"
+#include "VolumeParticleEmitter.h"
+#include "ParticleEmitterSet.h"
+#include "Box.h"
+#include "Sphere.h"
+#include "CsgSurface.h"
+#include "TriangleMeshSurface.h"
+#include "FrameCache.h"
+#include "utils/MeshReader.h"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cg
+{
+
+/**
+* Simulation built from a scene description.
+*
+* A scene description is a JSON object:
+*
+*   {
+*     "name": "dam break",
+*     "dimension": 2,                  // only 2D scenes are built
+*     "precision": "float",            // "float" or "double"
+*     "grid": { "size": [64, 64], "spacing": 0.015625, "origin": [0, 0] },
+*     "solver": {
+*       "type": "flip",                // "grid", "pic" or "flip"
+*       "gravity": [0, -9.8], "viscosity": 0, "maxCfl": 5,
+*       "closedBoundary": ["left", "right", "down"], // or a direction flag
+*       "adaptiveDomain": false, "particleCapacity": 100000,
+*       "mixedPrecisionPressure": false, // float CG, double residual
+*       "channelStorage": "real",      // grid only: "real" or "half"
+*       "picBlending": 0.05            // flip only
+*     },
+*     "time": { "frameRate": 60, "frames": 120, "subSteps": "adaptive" },
+*     "emitters": [ { "shape": { "type": "box", "min": [0, 0], "max": [0.5, 0.8] },
+*                     "spacing": 0.005, "initialVelocity": [0, 0] } ],
+*     "collider": { "shape": { "type": "sphere", "center": [0, 0], "radius": 0.1 },
+*                   "friction": 0,
+*                   "keyframes": [ { "time": 0, "position": [0.7, 0.3] },
+*                                  { "time": 2, "position": [0.3, 0.3], "rotation": 90 } ] },
+*     "output": { "cache": "out/dam_", "encoding": "half",
+*                 "queueDepth": 2, "writers": 1,   // frames in flight, I/O threads
+*                 "particles": "out/dam_",         // pic and flip only
+*                 "keyframeInterval": 10, "positionBits": 16,
+*                 "checkpointInterval": 0, "checkpointPrefix": "out/dam_" }
+*   }
+*
+* Vectors may be given as a single number, used for every axis. Shapes are
+* boxes ("min", "max"), spheres ("center", "radius"), OBJ or PLY meshes
+* ("path", 3D only) and CSG combinations ("children", each one with an "operation"
+* of "union", "intersection" or "difference"); any shape can also have a
+* "position", a "rotation" in degrees and a "scale". Particle emitters of
+* PIC and FLIP scenes take the keys of VolumeParticleEmitter; emitters of
+* grid scenes set the "density" and the "velocity" inside their shape before
+* the first frame. "subSteps" is either "adaptive" or the number of fixed
+* sub-steps. Collider keyframes are interpolated linearly; the collider
+* stays at the first and the last keyframe outside of their time range.
+*/
+class Scene
+{
+public:
+  using Metrics = std::vector<std::pair<std::string, double>>;
+
+  /** Builds the scene described by the JSON file \p path. */
+  static std::unique_ptr<Scene> load(const std::string& path)
+  {
+    return build(JsonValue::load(path));
+  }
+
+  /** Builds the scene described by \p description. */
+  static std::unique_ptr<Scene> build(const JsonValue& description);
+
+  /** Returns the description the scene was built from. */
+  const auto& description() const { return _description; }
+
+  /** Returns the scene name. */
+  const auto& name() const { return _name; }
+
+  /** Returns the number of dimensions. */
+  int dimension() const { return _dimension; }
+
+  /** Returns the solver type. */
+  const auto& solverType() const { return _solverType; }
+
+  /** Returns the solver. */
+  PhysicsAnimation* solver() const { return _solver.get(); }
+
+  /** Returns the frame cache, or nullptr if the scene writes none. */
+  FrameCacheWriter* frameCache() const { return _frameCache.get(); }
+
+  /** Returns the particle cache, or nullptr if the scene writes none. */
+  ParticleCacheWriter* particleCache() const { return _particleCache.get(); }
+
+  /** Returns the frame time interval. */
+  double frameInterval() const { return _frameInterval; }
+
+  /** Returns the number of frames of the scene. */
+  int numberOfFrames() const { return _numberOfFrames; }
+
+  /** Returns the index of the next frame to be advanced. */
+  int nextFrame() const { return _nextFrame; }
+
+  /**
+  * Returns summary metrics of the current solver state: a bound of the max
+  * speed, from the max velocity components, and the CFL number of a frame,
+  * plus the smoke mass of grid scenes, or the
+  * number of particles and their kinetic energy per unit mass of particle
+  * scenes.
+  */
+  Metrics metrics() const
+  {
+    Metrics m;
+    if (_metrics)
+      _metrics(m);
+    return m;
+  }
+
+  /** Advances the solver \p count frames, or up to the last frame. */
+  void advance(int count = 1)
+  {
+    auto last = std::min(_nextFrame + count, _numberOfFrames);
+    while (_nextFrame < last)
+      _solver->advanceFrame(Frame{ _nextFrame++, _frameInterval });
+  }
+
+  /** Advances the solver through the remaining frames. */
+  void run()
+  {
+    advance(_numberOfFrames - _nextFrame);
+    if (_frameCache != nullptr)
+      _frameCache->flush();
+    _solver->waitForCheckpoint();
+  }
+
+private:
+  // the cache outlives the solver that writes to it
+  std::unique_ptr<FrameCacheWriter> _frameCache;
+  std::unique_ptr<ParticleCacheWriter> _particleCache;
+  std::unique_ptr<PhysicsAnimation> _solver;
+  JsonValue _description;
+  std::string _name;
+  int _dimension{};
+  std::string _solverType;
+  double _frameInterval{ 1.0 / 60.0 };
+  int _numberOfFrames{};
+  int _nextFrame{};
+  std::function<void(Metrics&)> _metrics;
+
+  template <size_t D, typename real> friend class SceneBuilder;
+
+}; // Scene
+
+/**
+* Builder of the D-dimensional scenes of type real.
+*
+* Scene::build dispatches to the builder of the dimension and precision of
+* the description. The builder is written for any dimension, but the scenes
+* are 2D until the 3D solvers are complete.
+*/
+template <size_t D, typename real>
+class SceneBuilder
+{
+public:
+  using vec_type = Vector<real, D>;
+  using bounds_type = Bounds<real, D>;
+  using surface_type = math::Surface<D, real>;
+  using pic_type = PicSolver<D, real, ArrayAllocator>;
+  using flip_type = FlipSolver<D, real, ArrayAllocator>;
+  using particles_type = typename pic_type::PicParticleSystem;
+
+  SceneBuilder(const JsonValue& description, Scene& scene):
+    _description(description),
+    _scene(scene)
+  {
+    // do nothing
+  }
+
+  void build();
+
+  /** Returns \p value, an array of D numbers or a single number. */
+  static vec_type toVector(const JsonValue& value)
+  {
+    if (value.isNumber())
+      return vec_type{ real(value.asNumber()) };
+    if (value.size() != D)
+      throw std::runtime_error("Scene: expected a vector of " + std::to_string(D) + " numbers");
+
+    vec_type v;
+    for (size_t d = 0; d < D; ++d)
+      v[d] = real(value[d].asNumber());
+    return v;
+  }
+
+  /** Returns the vector \p key of \p object, or \p v if there is none. */
+  static vec_type toVector(const JsonValue& object, const char* key, const vec_type& v)
+  {
+    auto value = object.find(key);
+    return value != nullptr ? toVector(*value) : v;
+  }
+
+  /** Builds the surface described by \p shape. */
+  static Reference<surface_type> buildShape(const JsonValue& shape);
+
+  /** Returns the direction flag described by \p value. */
+  static int toDirectionFlag(const JsonValue& value);
+
+private:
+  const JsonValue& _description;
+  Scene& _scene;
+  Index<D> _size;
+  vec_type _spacing;
+  vec_type _origin;
+
+  static Transform<D, real> toTransform(const JsonValue& shape);
+
+  template <typename Solver>
+  void configure(Solver& solver) const;
+
+  template <typename S>
+  void buildGridSolver();
+
+  template <typename Solver>
+  void buildParticleSolver();
+
+  template <size_t I>
+  static void fillVelocity(FaceCenteredGrid<D, real>& grid,
+    const surface_type& shape,
+    const vec_type& velocity);
+
+  Reference<Collider<D, real>> buildCollider(const JsonValue& collider) const;
+
+  template <typename Solver>
+  static void addVelocityMetrics(const Solver& solver, double dt, Scene::Metrics& m);
+
+}; // SceneBuilder
+
+template<size_t D, typename real>
+inline Transform<D, real>
+SceneBuilder<D, real>::toTransform(const JsonValue& shape)
+{
+  Transform<D, real> t;
+  t.setPosition(toVector(shape, "position", vec_type{ real(0) }));
+  t.setScale(toVector(shape, "scale", vec_type{ real(1) }));
+  if (auto rotation = shape.find("rotation"))
+  {
+    if constexpr (D == 2)
+      t.setRotation(real(math::toRadians(rotation->asNumber())));
+    else
+      t.setEulerAngles(toVector(*rotation));
+  }
+  return t;
+}
+
+template<size_t D, typename real>
+inline Reference<math::Surface<D, real>>
+SceneBuilder<D, real>::buildShape(const JsonValue& shape)
+{
+  auto type = shape["type"].asString();
+  auto t = toTransform(shape);
+
+  if (type == "box")
+    return new Box<D, real>(toVector(shape["min"]), toVector(shape["max"]), t);
+  if (type == "sphere")
+    return new Sphere<D, real>(toVector(shape["center"]), real(shape["radius"].asNumber()), t);
+  if (type == "csg")
+  {
+    Reference<CsgSurface<D, real>> csg = new CsgSurface<D, real>(t);
+    for (const auto& child : shape["children"].elements())
+    {
+      auto op = child.get("operation", "union");
+      auto operation = op == "union" ? CsgOperation::Union :
+        op == "intersection" ? CsgOperation::Intersection :
+        op == "difference" ? CsgOperation::Difference :
+        throw std::runtime_error("Scene: unknown CSG operation " + op);
+      csg->add(buildShape(child), operation);
+    }
+    return csg.get();
+  }
+  if (type == "mesh")
+  {
+    if constexpr (D == 3)
+    {
+      auto path = shape["path"].asString();
+      Reference<TriangleMesh> mesh = MeshReader::read(path.c_str());
+      if (mesh == nullptr)
+        throw std::runtime_error("Scene: cannot read mesh " + path);
+      return new TriangleMeshSurface<real>(*mesh, t);
+    }
+    else
+      throw std::runtime_error("Scene: mesh shapes are 3D only");
+  }
+  throw std::runtime_error("Scene: unknown shape type " + type);
+}
+
+template<size_t D, typename real>
+inline int
+SceneBuilder<D, real>::toDirectionFlag(const JsonValue& value)
+{
+  if (value.isNumber())
+    return value.asInt();
+  if (value.isString() && value.asString() == "all")
+    return constants::directionAll;
+
+  int flag = constants::directionNone;
+  for (const auto& side : value.elements())
+  {
+    const auto& name = side.asString();
+    if (name == "left")
+      flag |= constants::directionLeft;
+    else if (name == "right")
+      flag |= constants::directionRight;
+    else if (name == "down")
+      flag |= constants::directionDown;
+    else if (name == "up")
+      flag |= constants::directionUp;
+    else if (name == "back")
+      flag |= constants::directionBack;
+    else if (name == "front")
+      flag |= constants::directionFront;
+    else
+      throw std::runtime_error("Scene: unknown direction " + name);
+  }
+  return flag;
+}
+
+template<size_t D, typename real>
+inline void
+SceneBuilder<D, real>::build()
+{
+  const auto& grid = _description["grid"];
+  auto size = toVector(grid["size"]);
+  for (size_t d = 0; d < D; ++d)
+  {
+    _size[d] = int64_t(size[d]);
+    if (_size[d] <= 0 || real(_size[d]) != size[d])
+      throw std::runtime_error("Scene: grid size must be positive integers");
+  }
+  _spacing = toVector(grid["spacing"]);
+  _origin = toVector(grid, "origin", vec_type{ real(0) });
+
+  const auto& type = _scene._solverType;
+  if (type == "grid")
+  {
+    // the smoke solver lays its grids out in 2D
+    if constexpr (D == 2)
+    {
+      auto storage = _description["solver"].get("channelStorage", "real");
+      if (storage == "real")
+        buildGridSolver<real>();
+      else if (storage == "half")
+        buildGridSolver<Half>();
+      else
+        throw std::runtime_error("Scene: unknown channel storage " + storage);
+    }
+    else
+      throw std::runtime_error("Scene: grid solver scenes are 2D only");
+  }
+  else if (type == "pic")
+    buildParticleSolver<pic_type>();
+  else if (type == "flip")
+    buildParticleSolver<flip_type>();
+  else
+    throw std::runtime_error("Scene: unknown solver type " + type);
+
+  auto& solver = *_scene._solver;
+  if (auto time = _description.find("time"))
+  {
+    _scene._frameInterval = 1.0 / time->get("frameRate", 60.0);
+    _scene._numberOfFrames = time->get("frames", 0);
+    if (auto subSteps = time->find("subSteps"))
+    {
+      auto isAdaptive = subSteps->isString();
+      if (isAdaptive && subSteps->asString() != "adaptive")
+        throw std::runtime_error("Scene: subSteps must be \"adaptive\" or a number");
+      solver.setIsUsingFixedSubTimeSteps(!isAdaptive);
+      if (!isAdaptive)
+        solver.setNumberOfSubTimeSteps(size_t(std::max(subSteps->asInt(), 1)));
+    }
+  }
+
+  if (auto output = _description.find("output"))
+  {
+    if (auto cache = output->find("cache"))
+    {
+      _scene._frameCache = std::make_unique<FrameCacheWriter>(cache->asString(),
+        size_t(std::max(output->get("queueDepth", 2), 1)),
+        size_t(std::max(output->get("writers", 1), 1)));
+      auto encoding = output->get("encoding", "float");
+      if (encoding == "half")
+        _scene._frameCache->setDefaultEncoding(CacheEncoding::Float16);
+      else if (encoding != "float")
+        throw std::runtime_error("Scene: unknown encoding " + encoding);
+      solver.setFrameCache(_scene._frameCache.get());
+    }
+    if (auto particles = output->find("particles"))
+    {
+      auto pic = dynamic_cast<pic_type*>(_scene._solver.get());
+      if (pic == nullptr)
+        throw std::runtime_error("Scene: particle caches need a pic or flip solver");
+      _scene._particleCache = std::make_unique<ParticleCacheWriter>(particles->asString(),
+        output->get("keyframeInterval", 10),
+        output->get("positionBits", 16));
+      pic->setParticleCache(_scene._particleCache.get());
+    }
+    if (auto interval = output->find("checkpointInterval"))
+      solver.setCheckpointInterval(interval->asInt(), output->get("checkpointPrefix", ""));
+  }
+}
+
+template<size_t D, typename real>
+template<typename Solver>
+inline void
+SceneBuilder<D, real>::configure(Solver& solver) const
+{
+  auto gravity = vec_type{ real(0) };
+  gravity[1] = real(-9.8f);
+
+  const auto& config = _description["solver"];
+  solver.setGravity(toVector(config, "gravity", gravity));
+  solver.setViscosityCoefficient(real(config.get("viscosity", 0.0)));
+  solver.setMaxCfl(real(config.get("maxCfl", double(solver.maxCfl()))));
+  if (auto flag = config.find("closedBoundary"))
+    solver.setClosedDomainBoundaryFlag(toDirectionFlag(*flag));
+  solver.setUseAdaptiveDomain(config.get("adaptiveDomain", false));
+  solver.setUseMixedPrecisionPressure(config.get("mixedPrecisionPressure", false));
+
+  if (auto collider = _description.find("collider"))
+    solver.setCollider(buildCollider(*collider));
+}
+
+template<size_t D, typename real>
+template<size_t I>
+inline void
+SceneBuilder<D, real>::fillVelocity(FaceCenteredGrid<D, real>& grid,
+  const surface_type& shape,
+  const vec_type& velocity)
+{
+  auto position = grid.positionInSpace<I>();
+  parallelForEachIndex<D>(grid.iSize<I>(), [&](const Index<D>& index) {
+    if (shape.isInside(position(index)))
+      grid.velocityAt<I>(index) = velocity[I];
+  });
+}
+
+template<size_t D, typename real>
+template<typename S>
+inline void
+SceneBuilder<D, real>::buildGridSolver()
+{
+  auto solver = std::make_unique<GridSolver<D, real, S>>(_size, _spacing, _origin);
+  configure(*solver);
+
+  if (auto emitters = _description.find("emitters"))
+    for (const auto& emitter : emitters->elements())
+    {
+      auto shape = buildShape(emitter["shape"]);
+      auto density = real(emitter.get("density", 1.0));
+      auto& grid = *solver->density();
+      parallelForEachIndex<D>(grid.size(), [&](const Index<D>& index) {
+        if (shape->isInside(grid.dataPosition(index)))
+          grid[index] = density;
+      });
+
+      if (auto velocity = emitter.find("velocity"))
+      {
+        auto v = toVector(*velocity);
+        auto& u = *solver->velocity();
+        fillVelocity<0>(u, *shape, v);
+        fillVelocity<1>(u, *shape, v);
+        if constexpr (D == 3)
+          fillVelocity<2>(u, *shape, v);
+        solver->invalidateMaxVelocity();
+      }
+    }
+  auto cellVolume = 1.0;
+  for (size_t d = 0; d < D; ++d)
+    cellVolume *= double(_spacing[d]);
+  _scene._metrics = [s = solver.get(), scene = &_scene, cellVolume](Scene::Metrics& m) {
+    addVelocityMetrics(*s, scene->_frameInterval, m);
+
+    const auto& density = *s->density();
+    auto mass = parallelReduce<double>(0, density.length(), 0.0,
+      [&](int64_t b, int64_t e, double sum) {
+        for (auto k = b; k < e; ++k)
+          sum += density[k];
+        return sum;
+      },
+      std::plus<double>());
+    m.emplace_back("smokeMass", mass * cellVolume);
+  };
+  _scene._solver = std::move(solver);
+}
+
+template<size_t D, typename real>
+template<typename Solver>
+inline void
+SceneBuilder<D, real>::buildParticleSolver()
+{
+  const auto& config = _description["solver"];
+  auto capacity = size_t(config.get("particleCapacity", 100000.0));
+  auto solver = std::make_unique<Solver>(_size, _spacing, _origin, capacity);
+  configure(*solver);
+  if constexpr (std::is_same_v<Solver, flip_type>)
+    solver->setPicBlendingFactor(real(config.get("picBlending", 0.0)));
+
+  if (auto emitters = _description.find("emitters"))
+  {
+    auto& particles = solver->particleSystem();
+    bounds_type domain{ _origin, _origin + _spacing * vec_type{ _size } };
+    Reference<ParticleEmitterSet<particles_type>> set = new ParticleEmitterSet<particles_type>(particles);
+
+    for (const auto& emitter : emitters->elements())
+    {
+      auto max = emitter.get("maxParticles", -1.0);
+      auto angular = typename VolumeParticleEmitter<D, real, particles_type>::angular_type{ real(0) };
+      if (auto value = emitter.find("angularVelocity"))
+      {
+        if constexpr (D == 2)
+          angular = real(value->asNumber());
+        else
+          angular = toVector(*value);
+      }
+      bounds_type bounds = domain;
+      if (auto value = emitter.find("bounds"))
+        bounds = bounds_type{ toVector((*value)["min"]), toVector((*value)["max"]) };
+
+      set->addEmitter(new VolumeParticleEmitter<D, real, particles_type>(
+        particles,
+        buildShape(emitter["shape"]),
+        bounds,
+        real(emitter.get("spacing", double(_spacing.min()) * 0.5)),
+        toVector(emitter, "initialVelocity", vec_type{ real(0) }),
+        toVector(emitter, "linearVelocity", vec_type{ real(0) }),
+        angular,
+        max < 0 ? math::Limits<size_t>::inf() : size_t(max),
+        emitter.get("oneShot", true),
+        emitter.get("allowOverlapping", false)));
+    }
+    solver->setParticleEmitter(set);
+  }
+  _scene._metrics = [s = solver.get(), scene = &_scene](Scene::Metrics& m) {
+    addVelocityMetrics(*s, scene->_frameInterval, m);
+
+    const auto& particles = s->particleSystem();
+    auto n = int64_t(particles.size());
+    auto energy = parallelReduce<double>(0, n, 0.0,
+      [&](int64_t b, int64_t e, double sum) {
+        for (auto i = b; i < e; ++i)
+          sum += double(particles.get<1>(i).squaredNorm());
+        return sum;
+      },
+      std::plus<double>());
+    m.emplace_back("particles", double(n));
+    m.emplace_back("kineticEnergy", 0.5 * energy);
+  };
+  _scene._solver = std::move(solver);
+}
+
+template<size_t D, typename real>
+template<typename Solver>
+inline void
+SceneBuilder<D, real>::addVelocityMetrics(const Solver& solver, double dt, Scene::Metrics& m)
+{
+  auto maxVelocity = solver.velocity()->maxAbsVelocity();
+  m.emplace_back("maxSpeed", double(maxVelocity.length()));
+  m.emplace_back("cfl", double(solver.cfl(dt)));
+}
+
+template<size_t D, typename real>
+inline Reference<Collider<D, real>>
+SceneBuilder<D, real>::buildCollider(const JsonValue& description) const
+{
+  Reference<RigidBodyCollider<D, real>> collider =
+    new RigidBodyCollider<D, real>(buildShape(description["shape"]));
+  collider->setFrictionCoefficient(real(description.get("friction", 0.0)));
+
+  auto keyframes = description.find("keyframes");
+  if (keyframes == nullptr || keyframes->size() == 0)
+    return collider.get();
+
+  using rotation_type = std::conditional_t<D == 2, real, vec_type>;
+  struct Keyframe
+  {
+    double time;
+    vec_type position;
+    rotation_type rotation; // degrees
+  };
+
+  const auto& transform = collider->surface()->transform;
+  std::vector<Keyframe> frames;
+  for (const auto& k : keyframes->elements())
+  {
+    Keyframe frame{ k["time"].asNumber(), transform.position(), rotation_type{ real(0) } };
+    if (auto p = k.find("position"))
+      frame.position = toVector(*p);
+    if (auto r = k.find("rotation"))
+    {
+      if constexpr (D == 2)
+        frame.rotation = real(r->asNumber());
+      else
+        frame.rotation = toVector(*r);
+    }
+    frames.push_back(frame);
+  }
+  std::stable_sort(frames.begin(), frames.end(), [](const Keyframe& a, const Keyframe& b) {
+    return a.time < b.time;
+  });
+
+  auto pose = [frames](double time) {
+    if (time <= frames.front().time)
+      return frames.front();
+
+    auto next = std::upper_bound(frames.begin(), frames.end(), time,
+      [](double t, const Keyframe& k) { return t < k.time; });
+    if (next == frames.end())
+      return frames.back();
+
+    auto& a = *(next - 1);
+    auto& b = *next;
+    auto s = real((time - a.time) / (b.time - a.time));
+    return Keyframe{ time, a.position + (b.position - a.position) * s, a.rotation + (b.rotation - a.rotation) * s };
+  };
+
+  // the velocities are the finite differences over the coming time-step
+  collider->setOnBeginUpdateCallback([pose](Collider<D, real>* c, real time, real dt) {
+    auto body = static_cast<RigidBodyCollider<D, real>*>(c);
+    auto& t = body->surface()->transform;
+    auto k0 = pose(time);
+    auto k1 = pose(time + dt);
+
+    t.setPosition(k0.position);
+    if constexpr (D == 2)
+      t.setRotation(real(math::toRadians(k0.rotation)));
+    else
+      t.setEulerAngles(k0.rotation);
+
+    if (dt > 0)
+    {
+      body->linearVelocity = (k1.position - k0.position) * (1 / dt);
+      // exact for rotations about a single axis
+      body->angularVelocity = (k1.rotation - k0.rotation) * real(math::toRadians(1.0) / dt);
+    }
+  });
+  return collider.get();
+}
+
+inline std::unique_ptr<Scene>
+Scene::build(const JsonValue& description)
+{
+  auto scene = std::make_unique<Scene>();
+  scene->_description = description;
+  scene->_name = description.get("name", "");
+  scene->_dimension = description.get("dimension", 2);
+  scene->_solverType = description["solver"].get("type", "flip");
+
+  auto precision = description.get("precision", "float");
+  if (precision != "float" && precision != "double")
+    throw std::runtime_error("Scene: unknown precision " + precision);
+
+  // the 3D samplers of the solvers do not support particle transfers yet
+  if (scene->_dimension != 2)
+    throw std::runtime_error("Scene: only 2D scenes are supported");
+  if (precision == "float")
+    SceneBuilder<2, float>{ description, *scene }.build();
+  else
+    SceneBuilder<2, double>{ description, *scene }.build();
+  return scene;
+}
+
+} // end namespace cg
+
+#endif // __Scene_h
@@ -43,6 +43,8 @@ private:
 
   real localClosestDistance(const vec& p) const override;
 
+  void localClosestQuery(const vec& p, typename Base::QueryResult& result) const override;
+
 }; // Sphere<D, real>
 
 template<size_t D, typename real>
@@ -84,6 +86,18 @@ Sphere<D, real>::localClosestDistance(const vec& p) const
   return math::abs<real>((p - center).length() - radius);
 }
 
+template<size_t D, typename real>
+inline void
+Sphere<D, real>::localClosestQuery(const vec& p, typename Base::QueryResult& result) const
+{
+  auto length = (p - center).length();
+
+  result.normal = localClosestNormal(p);
+  result.point = result.normal * radius + center;
+  result.distance = math::abs<real>(length - radius);
+  result.isInside = length < radius;
+}
+
 } // end namespace cg
 
 #endif // __Sphere_h
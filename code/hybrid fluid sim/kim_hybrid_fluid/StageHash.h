@@ -0,0 +1,262 @@
+#ifndef __StageHash_h
+#define __StageHash_h
+
+#include "FaceCenteredGrid.h"
+#include "Parallel.h"
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cg
+{
+
+namespace internal
+{
+
+inline uint64_t
+mixHash(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  return h ^ (h >> 33);
+}
+
+inline uint64_t
+hashBlock(const char* data, size_t size, uint64_t h)
+{
+  constexpr uint64_t prime = 0x100000001b3ull;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8)
+  {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    h = (h ^ word) * prime;
+    h ^= h >> 29;
+  }
+  for (; i < size; ++i)
+    h = (h ^ uint8_t(data[i])) * prime;
+  return mixHash(h ^ size);
+}
+
+} // end namespace internal
+
+/**
+* Returns a 64-bit hash of \p size bytes.
+*
+* Blocks of 1 MiB are hashed in parallel and their hashes are combined in
+* order, so the hash does not depend on the number of threads.
+*/
+inline uint64_t
+hashBytes(const void* data, size_t size)
+{
+  constexpr size_t blockSize = size_t(1) << 20;
+  auto bytes = static_cast<const char*>(data);
+  auto blocks = int64_t((size + blockSize - 1) / blockSize);
+  std::vector<uint64_t> partial(static_cast<size_t>(blocks));
+  parallelFor(0, blocks, [&](int64_t b) {
+    auto offset = size_t(b) * blockSize;
+    partial[b] = internal::hashBlock(bytes + offset, std::min(blockSize, size - offset), uint64_t(b));
+    });
+
+  uint64_t h = 0xcbf29ce484222325ull ^ size;
+  for (auto p : partial)
+    h = internal::mixHash(h ^ p) + 0x9e3779b97f4a7c15ull;
+  return h;
+}
+
+/** Hash of an array of the simulation state at the end of a stage. */
+struct StageHash
+{
+  int frame;
+  /** Sub-time-step of the frame, from 0. */
+  int step;
+  std::string stage;
+  std::string array;
+  uint64_t hash;
+
+}; // StageHash
+
+/**
+* Log of the hashes of the simulation state at the end of every stage.
+*
+* A solver with a stage hash log hashes its grids and particle arrays at
+* the end of each stage of a time-step; see
+* PhysicsAnimation::setStageHashLog. Two runs that should give the same
+* bits, e.g. with different numbers of threads, have the same logs, and the
+* first entry where their logs differ is the first stage where they diverge.
+*/
+class StageHashLog
+{
+public:
+  /** Starts a stage; the arrays added next belong to it. */
+  void beginStage(int frame, int step, const char* stage)
+  {
+    _frame = frame;
+    _step = step;
+    _stage = stage;
+  }
+
+  /** Adds the hash of \p size bytes of the current stage. */
+  void add(const char* name, const void* data, size_t size)
+  {
+    _entries.push_back({ _frame, _step, _stage, name, hashBytes(data, size) });
+  }
+
+  /** Adds the hash of \p count values. */
+  template <typename T>
+  void addArray(const char* name, const T* values, size_t count)
+  {
+    add(name, values, count * sizeof(T));
+  }
+
+  /** Adds the hash of the size and the values of \p grid. */
+  template <int D, typename T>
+  void addGrid(const char* name, const Grid<D, T>& grid)
+  {
+    auto hash = internal::mixHash(hashBytes(&grid.size(), sizeof(Index<D>)));
+    if (grid.length() > 0)
+      hash ^= hashBytes(&grid[0], size_t(grid.length()) * sizeof(T));
+    _entries.push_back({ _frame, _step, _stage, name, hash });
+  }
+
+  /**
+  * Adds the hashes of the face values of \p grid, named \p name followed
+  * by ".u", ".v" and ".w".
+  */
+  template <size_t D, typename real>
+  void addVelocity(const char* name, const FaceCenteredGrid<D, real>& grid)
+  {
+    std::string prefix{ name };
+    addGrid((prefix + ".u").c_str(), *grid.data<0>());
+    addGrid((prefix + ".v").c_str(), *grid.data<1>());
+    if constexpr (D == 3)
+      addGrid((prefix + ".w").c_str(), *grid.data<2>());
+  }
+
+  /** Returns the entries, in the order they were added. */
+  const auto& entries() const { return _entries; }
+
+  void clear()
+  {
+    _entries.clear();
+  }
+
+  /**
+  * Writes the entries to the text file \p path, one per line: frame,
+  * step, stage, array and hash.
+  */
+  void save(const std::string& path) const
+  {
+    std::ofstream file{ path };
+    if (!file)
+      throw std::runtime_error("StageHashLog: cannot write " + path);
+
+    char hash[20];
+    for (const auto& e : _entries)
+    {
+      snprintf(hash, sizeof(hash), "%016" PRIx64, e.hash);
+      file << e.frame << ' ' << e.step << ' ' << e.stage << ' ' << e.array << ' ' << hash << '\n';
+    }
+    if (!file)
+      throw std::runtime_error("StageHashLog: cannot write " + path);
+  }
+
+  /** Reads the entries written by save. */
+  static StageHashLog load(const std::string& path)
+  {
+    std::ifstream file{ path };
+    if (!file)
+      throw std::runtime_error("StageHashLog: cannot read " + path);
+
+    StageHashLog log;
+    std::string line;
+    while (std::getline(file, line))
+    {
+      std::istringstream in{ line };
+      StageHash e;
+      std::string hash;
+      if (!(in >> e.frame >> e.step >> e.stage >> e.array >> hash))
+        throw std::runtime_error("StageHashLog: bad line in " + path + ": " + line);
+      e.hash = std::stoull(hash, nullptr, 16);
+      log._entries.push_back(std::move(e));
+    }
+    return log;
+  }
+
+private:
+  std::vector<StageHash> _entries;
+  int _frame{};
+  int _step{};
+  std::string _stage;
+
+}; // StageHashLog
+
+/** First difference between two stage hash logs. */
+struct StageHashDivergence
+{
+  /** False if the logs are the same. */
+  bool hasDiverged{};
+  /** Index of the first entry that differs. */
+  size_t index{};
+  /** Entries of both logs at index; missing if a log ends there. */
+  const StageHash* first{};
+  const StageHash* second{};
+
+  /** Returns a one-line description of the divergence. */
+  std::string describe() const
+  {
+    if (!hasDiverged)
+      return "the runs are identical";
+
+    const auto& e = first != nullptr ? *first : *second;
+    std::ostringstream out;
+    out << "first divergence at frame " << e.frame << " step " << e.step
+      << ", stage " << e.stage << ", array " << e.array;
+    if (first == nullptr || second == nullptr)
+      out << " (only in the " << (first != nullptr ? "first" : "second") << " run)";
+    else if (first->stage != second->stage || first->array != second->array)
+      out << " (the second run has stage " << second->stage << ", array " << second->array << ')';
+    return out.str();
+  }
+
+}; // StageHashDivergence
+
+/**
+* Returns the first entry where the logs \p a and \p b differ. The
+* divergence refers to the entries of the logs, which must outlive it.
+*/
+inline StageHashDivergence
+findDivergence(const StageHashLog& a, const StageHashLog& b)
+{
+  const auto& x = a.entries();
+  const auto& y = b.entries();
+  StageHashDivergence d;
+  auto n = std::min(x.size(), y.size());
+
+  for (d.index = 0; d.index < n; ++d.index)
+  {
+    const auto& e = x[d.index];
+    const auto& f = y[d.index];
+    if (e.hash != f.hash || e.frame != f.frame || e.step != f.step
+      || e.stage != f.stage || e.array != f.array)
+      break;
+  }
+  if (d.index < x.size() || d.index < y.size())
+  {
+    d.hasDiverged = true;
+    d.first = d.index < x.size() ? &x[d.index] : nullptr;
+    d.second = d.index < y.size() ? &y[d.index] : nullptr;
+  }
+  return d;
+}
+
+} // end namespace cg
+
+#endif // __StageHash_h
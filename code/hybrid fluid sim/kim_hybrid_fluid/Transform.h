@@ -17,6 +17,7 @@ public:
 
   Transform():
     _position{real(0.0f)},
+    _scale{real(1.0f)},
     _angle{real(0.0f)},
     _cosAngle{real(1.0f)},
     _sinAngle{real(0.0f)}
@@ -102,28 +103,22 @@ public:
   /// Transforms \c p from local space to world space.
   vec2 transform(const vec2& p) const
   {
-    return vec2{
-      _cosAngle * p.x - _sinAngle * p.y + _position.x,
-      _sinAngle * p.x + _cosAngle * p.y + _position.y
-    };
+    return transformVector(p) + _position;
   }
 
   /// Transforms \c p from world space to local space.
   vec2 inverseTransform(const vec2& p) const
   {
-    const auto t = p - _position;
-    return vec2{
-       _cosAngle * t.x + _sinAngle * t.y,
-      -_sinAngle * t.x + _cosAngle * t.y
-    };
+    return inverseTransformVector(p - _position);
   }
 
   /// Transforms \c v from local space to world space.
   vec2 transformVector(const vec2& v) const
   {
+    const auto s = v * _scale;
     return vec2{
-      _cosAngle * v.x - _sinAngle * v.y,
-      _sinAngle * v.x + _cosAngle * v.y
+      _cosAngle * s.x - _sinAngle * s.y,
+      _sinAngle * s.x + _cosAngle * s.y
     };
   }
 
@@ -133,18 +128,34 @@ public:
     return vec2{
        _cosAngle * v.x + _sinAngle * v.y,
       -_sinAngle * v.x + _cosAngle * v.y
-    };
+    } * _scale.inverse();
   }
 
-  /// Transforms \c d from world space to local space.
+  /// Rotates the direction \c d from local space to world space. The
+  /// scale is not applied.
   vec2 transformDirection(const vec2& d) const
   {
-    return inverseTransformVector(d);
+    return vec2{
+      _cosAngle * d.x - _sinAngle * d.y,
+      _sinAngle * d.x + _cosAngle * d.y
+    };
   }
 
   /// Sets this transform as an identity transform.
   void reset();
 
+  bool operator ==(const Transform<2, real>& other) const
+  {
+    return _position == other._position &&
+      _scale == other._scale &&
+      _angle == other._angle;
+  }
+
+  bool operator !=(const Transform<2, real>& other) const
+  {
+    return !operator ==(other);
+  }
+
 private:
   vec2 _position;
   vec2 _scale;
@@ -311,7 +322,8 @@ public:
     return _inverseMatrix.transformVector(v);
   }
 
-  /// Transforms \c d from world space to local space.
+  /// Rotates the direction \c d from local space to world space. The
+  /// scale is not applied.
   vec transformDirection(const vec& d) const
   {
     return _rotation.rotate(d);
@@ -320,6 +332,18 @@ public:
   /// Sets this transform as an identity transform.
   void reset();
 
+  bool operator ==(const Transform<3, real>& other) const
+  {
+    return _position == other._position &&
+      _rotation == other._rotation &&
+      _scale == other._scale;
+  }
+
+  bool operator !=(const Transform<3, real>& other) const
+  {
+    return !operator ==(other);
+  }
+
 private:
   vec _position;
   quat _rotation;
@@ -0,0 +1,558 @@
+#ifndef __TriangleMeshSurface_h
+#define __TriangleMeshSurface_h
+
+#include "math/Surface.h"
+#include "geometry/TriangleMesh.h"
+#include "CellCenteredScalarGrid.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <array>
+#include <vector>
+
+namespace cg
+{
+
+/**
+* 3D triangle mesh geometry.
+*
+* This class extends Surface with the triangles of a TriangleMesh, which
+* are copied to local coordinates at construction. Closest point queries
+* are answered by a bounding volume hierarchy (BVH) over the triangles.
+*
+* The mesh is expected to be closed: a point is inside the surface if a
+* ray cast from it crosses the triangles an odd number of times.
+*
+* The surface also keeps a narrow-band signed distance grid in local
+* coordinates (see TriangleMeshSurface::buildSdf), so signed distance
+* queries are answered by interpolation, without traversing the BVH.
+* Distances are exact within the band and clamped to the band width
+* everywhere else.
+*
+* \tparam real A floating point type.
+*/
+template <typename real>
+class TriangleMeshSurface: public math::Surface<3, real>
+{
+public:
+  using Base = math::Surface<3, real>;  ///< Base class alias.
+  using vec_type = Vector<real, 3>;     ///< Vector type alias.
+  using bounds_type = Bounds<real, 3>;  ///< Bounding box type alias.
+  using SdfGrid = CellCenteredScalarGrid<3, real>;
+
+  /** Number of SDF cells along the largest side of the mesh bounds. */
+  static constexpr int defaultSdfResolution = 64;
+
+  /**
+  * Constructs a surface from the triangles of \p mesh.
+  *
+  * The BVH and the SDF grid are built with defaultSdfResolution cells
+  * along the largest side of the mesh bounds and a band of 4 cells.
+  */
+  TriangleMeshSurface(const TriangleMesh& mesh, const Transform<3, real>& t = Transform<3, real>());
+
+  virtual ~TriangleMeshSurface()
+  {
+    // do nothing
+  }
+
+  /** Returns the number of triangles of this surface. */
+  auto numberOfTriangles() const
+  {
+    return (int)_triangles.size();
+  }
+
+  /** Returns the narrow-band SDF grid in local coordinates. */
+  const SdfGrid* sdfGrid() const
+  {
+    return _sdf.get();
+  }
+
+  /** Returns the band width of the SDF grid. */
+  real sdfBandWidth() const
+  {
+    return _bandWidth;
+  }
+
+  /**
+  * Rasterizes the narrow-band SDF grid.
+  *
+  * \param[in] spacing Cell size of the grid, in local coordinates.
+  * \param[in] bandWidth Distance to the surface within which the SDF is
+  * exact. Values farther than that are clamped to +/- bandWidth.
+  */
+  void buildSdf(real spacing, real bandWidth);
+
+protected:
+  // Surface methods
+
+  bounds_type localBounds() const override
+  {
+    return _bounds;
+  }
+
+  vec_type localClosestPoint(const vec_type& p) const override;
+
+  vec_type localClosestNormal(const vec_type& p) const override;
+
+  real localClosestDistance(const vec_type& p) const override;
+
+  bool localIsInside(const vec_type& p) const override;
+
+  real localSignedDistance(const vec_type& p) const override;
+
+  void localClosestQuery(const vec_type& p, typename Base::QueryResult& result) const override;
+
+private:
+  /**
+  * BVH node.
+  *
+  * Nodes are stored in depth-first order, so the left child of an interior
+  * node is the next node in the array and \c index is the right child. For
+  * leaves, \c index is the first entry of _order and \c count > 0 is the
+  * number of triangles.
+  */
+  struct Node
+  {
+    bounds_type bounds;
+    int index;
+    int count;
+  };
+
+  static constexpr int maxTrianglesPerLeaf = 4;
+
+  std::vector<vec_type> _vertices;
+  std::vector<std::array<int, 3>> _triangles;
+  std::vector<vec_type> _normals;
+  std::vector<Node> _nodes;
+  std::vector<int> _order;
+  bounds_type _bounds;
+  Reference<SdfGrid> _sdf;
+  real _bandWidth{};
+
+  int buildNode(int begin, int end, const std::vector<vec_type>& centers);
+
+  static vec_type closestPointOnTriangle(
+    const vec_type& p,
+    const vec_type& a,
+    const vec_type& b,
+    const vec_type& c);
+
+  static real squaredDistance(const bounds_type& b, const vec_type& p);
+
+  /**
+  * Finds the triangle closest to \p p within \p maxDistance. Returns false
+  * if there is none.
+  */
+  bool closestTriangle(const vec_type& p, real maxDistance, int& triangle, vec_type& point) const;
+
+  /**
+  * Collects the x coordinates where the line parallel to the x axis
+  * through \p p crosses the triangles.
+  */
+  void crossingsAlongX(const vec_type& p, std::vector<real>& xs) const;
+
+  // Small offset of the parity rays, to keep them off shared edges.
+  vec_type rayOffset() const
+  {
+    auto s = _bounds.size().max();
+    return vec_type{ 0, s * real(1.37e-5), s * real(0.71e-5) };
+  }
+
+}; // TriangleMeshSurface
+
+template <typename real>
+TriangleMeshSurface<real>::TriangleMeshSurface(const TriangleMesh& mesh, const Transform<3, real>& t):
+  Base(t)
+{
+  const auto& data = mesh.data();
+
+  _vertices.resize(data.numberOfVertices);
+  for (int i = 0; i < data.numberOfVertices; ++i)
+  {
+    const auto& v = data.vertices[i];
+    _vertices[i] = vec_type{ real(v.x), real(v.y), real(v.z) };
+    _bounds.inflate(_vertices[i]);
+  }
+
+  auto nt = data.numberOfTriangles;
+  std::vector<vec_type> centers(nt);
+
+  _triangles.resize(nt);
+  _normals.resize(nt);
+  _order.resize(nt);
+  for (int i = 0; i < nt; ++i)
+  {
+    const auto* v = data.triangles[i].v;
+    _triangles[i] = { v[0], v[1], v[2] };
+
+    const auto& p0 = _vertices[v[0]];
+    const auto& p1 = _vertices[v[1]];
+    const auto& p2 = _vertices[v[2]];
+    _normals[i] = triangle::normal(p0, p1, p2);
+    centers[i] = (p0 + p1 + p2) * math::inverse(real(3));
+    _order[i] = i;
+  }
+
+  _nodes.reserve(2 * (nt / maxTrianglesPerLeaf + 1));
+  if (nt > 0)
+    buildNode(0, nt, centers);
+
+  auto spacing = _bounds.size().max() / defaultSdfResolution;
+  if (math::isPositive(spacing))
+    buildSdf(spacing, 4 * spacing);
+}
+
+template <typename real>
+int
+TriangleMeshSurface<real>::buildNode(int begin, int end, const std::vector<vec_type>& centers)
+{
+  auto nodeId = (int)_nodes.size();
+  _nodes.push_back(Node{});
+
+  bounds_type bounds;
+  bounds_type centerBounds;
+  for (int i = begin; i < end; ++i)
+  {
+    const auto& t = _triangles[_order[i]];
+    bounds.inflate(_vertices[t[0]]);
+    bounds.inflate(_vertices[t[1]]);
+    bounds.inflate(_vertices[t[2]]);
+    centerBounds.inflate(centers[_order[i]]);
+  }
+  _nodes[nodeId].bounds = bounds;
+
+  if (end - begin <= maxTrianglesPerLeaf)
+  {
+    _nodes[nodeId].index = begin;
+    _nodes[nodeId].count = end - begin;
+    return nodeId;
+  }
+
+  // median split along the largest extent of the triangle centers
+  auto extent = centerBounds.size();
+  int axis = 0;
+  if (extent.y > extent[axis])
+    axis = 1;
+  if (extent.z > extent[axis])
+    axis = 2;
+
+  auto mid = (begin + end) / 2;
+  std::nth_element(
+    _order.begin() + begin,
+    _order.begin() + mid,
+    _order.begin() + end,
+    [&](int a, int b) { return centers[a][axis] < centers[b][axis]; });
+
+  buildNode(begin, mid, centers);
+  auto right = buildNode(mid, end, centers);
+  _nodes[nodeId].index = right;
+  _nodes[nodeId].count = 0;
+  return nodeId;
+}
+
+template <typename real>
+inline real
+TriangleMeshSurface<real>::squaredDistance(const bounds_type& b, const vec_type& p)
+{
+  real d2 = 0;
+
+  for (int i = 0; i < 3; ++i)
+  {
+    auto d = math::max(b.min()[i] - p[i], p[i] - b.max()[i]);
+    if (d > 0)
+      d2 += d * d;
+  }
+  return d2;
+}
+
+template <typename real>
+Vector<real, 3>
+TriangleMeshSurface<real>::closestPointOnTriangle(
+  const vec_type& p,
+  const vec_type& a,
+  const vec_type& b,
+  const vec_type& c)
+{
+  // Real-Time Collision Detection by Christer Ericson, section 5.1.5
+  auto ab = b - a;
+  auto ac = c - a;
+  auto ap = p - a;
+  auto d1 = ab.dot(ap);
+  auto d2 = ac.dot(ap);
+  if (d1 <= 0 && d2 <= 0)
+    return a;
+
+  auto bp = p - b;
+  auto d3 = ab.dot(bp);
+  auto d4 = ac.dot(bp);
+  if (d3 >= 0 && d4 <= d3)
+    return b;
+
+  auto vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0)
+    return a + ab * (d1 / (d1 - d3));
+
+  auto cp = p - c;
+  auto d5 = ab.dot(cp);
+  auto d6 = ac.dot(cp);
+  if (d6 >= 0 && d5 <= d6)
+    return c;
+
+  auto vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0)
+    return a + ac * (d2 / (d2 - d6));
+
+  auto va = d3 * d6 - d5 * d4;
+  if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+  auto denom = math::inverse(va + vb + vc);
+  return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+template <typename real>
+bool
+TriangleMeshSurface<real>::closestTriangle(
+  const vec_type& p,
+  real maxDistance,
+  int& triangle,
+  vec_type& point) const
+{
+  if (_nodes.empty())
+    return false;
+
+  auto best = maxDistance < math::Limits<real>::inf() ?
+    maxDistance * maxDistance :
+    math::Limits<real>::inf();
+  triangle = -1;
+
+  int stack[64];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0)
+  {
+    const auto& node = _nodes[stack[--top]];
+    if (squaredDistance(node.bounds, p) >= best)
+      continue;
+
+    if (node.count > 0)
+    {
+      for (int i = node.index; i < node.index + node.count; ++i)
+      {
+        const auto& t = _triangles[_order[i]];
+        auto q = closestPointOnTriangle(
+          p, _vertices[t[0]], _vertices[t[1]], _vertices[t[2]]);
+        auto d2 = (q - p).squaredNorm();
+        if (d2 < best)
+        {
+          best = d2;
+          triangle = _order[i];
+          point = q;
+        }
+      }
+      continue;
+    }
+
+    // visit the nearest child first
+    auto left = int(&node - _nodes.data()) + 1;
+    auto right = node.index;
+    if (squaredDistance(_nodes[left].bounds, p) < squaredDistance(_nodes[right].bounds, p))
+      std::swap(left, right);
+    stack[top++] = left;
+    stack[top++] = right;
+  }
+  return triangle >= 0;
+}
+
+template <typename real>
+void
+TriangleMeshSurface<real>::crossingsAlongX(const vec_type& p, std::vector<real>& xs) const
+{
+  xs.clear();
+  if (_nodes.empty())
+    return;
+
+  int stack[64];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0)
+  {
+    const auto& node = _nodes[stack[--top]];
+    const auto& b = node.bounds;
+    if (p.y < b.min().y || p.y > b.max().y || p.z < b.min().z || p.z > b.max().z)
+      continue;
+
+    if (node.count == 0)
+    {
+      stack[top++] = int(&node - _nodes.data()) + 1;
+      stack[top++] = node.index;
+      continue;
+    }
+
+    for (int i = node.index; i < node.index + node.count; ++i)
+    {
+      const auto& t = _triangles[_order[i]];
+      const auto& a = _vertices[t[0]];
+      const auto& v1 = _vertices[t[1]];
+      const auto& v2 = _vertices[t[2]];
+
+      // barycentric coordinates of (p.y, p.z) in the yz projection
+      auto det = (v1.y - a.y) * (v2.z - a.z) - (v2.y - a.y) * (v1.z - a.z);
+      if (det == 0)
+        continue;
+
+      auto invDet = math::inverse(det);
+      auto dy = p.y - a.y;
+      auto dz = p.z - a.z;
+      auto u = (dy * (v2.z - a.z) - (v2.y - a.y) * dz) * invDet;
+      auto v = ((v1.y - a.y) * dz - dy * (v1.z - a.z)) * invDet;
+      if (u < 0 || v < 0 || u + v > 1)
+        continue;
+      xs.push_back(a.x + u * (v1.x - a.x) + v * (v2.x - a.x));
+    }
+  }
+  std::sort(xs.begin(), xs.end());
+}
+
+template <typename real>
+void
+TriangleMeshSurface<real>::buildSdf(real spacing, real bandWidth)
+{
+  _bandWidth = bandWidth;
+  if (_triangles.empty())
+  {
+    _sdf = nullptr;
+    return;
+  }
+
+  // pad the mesh bounds by the band plus one cell, so that any point out
+  // of the grid is farther than the band from the surface
+  auto pad = bandWidth + spacing;
+  auto origin = _bounds.min() - vec_type{ pad };
+  auto extent = _bounds.size() + vec_type{ 2 * pad };
+  Index3 size;
+  for (int i = 0; i < 3; ++i)
+    size[i] = (int64_t)std::ceil(extent[i] / spacing) + 1;
+
+  _sdf = new SdfGrid(size, vec_type{ spacing }, origin, bandWidth);
+
+  auto& sdf = *_sdf;
+  auto offset = rayOffset();
+
+  // The grid sampler places node i at origin + i * spacing, so that is
+  // where the distances are evaluated. Each row along x shares the ray
+  // used to classify its nodes as inside or outside.
+  parallelFor(0, size.y * size.z, [&](int64_t row) {
+    std::vector<real> xs;
+    Index3 index{ 0, row % size.y, row / size.y };
+    auto p = origin + spacing * vec_type{ index };
+
+    crossingsAlongX(p + offset, xs);
+
+    size_t crossed = 0;
+    for (; index.x < size.x; ++index.x)
+    {
+      p.x = origin.x + spacing * index.x;
+      while (crossed < xs.size() && xs[crossed] < p.x)
+        ++crossed;
+
+      int triangle;
+      vec_type q;
+      auto d = closestTriangle(p, bandWidth, triangle, q) ?
+        (q - p).length() :
+        bandWidth;
+      sdf[sdf.id(index)] = crossed % 2 == 1 ? -d : d;
+    }
+  }, 4);
+}
+
+template <typename real>
+Vector<real, 3>
+TriangleMeshSurface<real>::localClosestPoint(const vec_type& p) const
+{
+  int triangle;
+  vec_type q{ p };
+
+  closestTriangle(p, math::Limits<real>::inf(), triangle, q);
+  return q;
+}
+
+template <typename real>
+Vector<real, 3>
+TriangleMeshSurface<real>::localClosestNormal(const vec_type& p) const
+{
+  int triangle;
+  vec_type q;
+
+  if (!closestTriangle(p, math::Limits<real>::inf(), triangle, q))
+    return vec_type{ 1, 0, 0 };
+  return _normals[triangle];
+}
+
+template <typename real>
+real
+TriangleMeshSurface<real>::localClosestDistance(const vec_type& p) const
+{
+  int triangle;
+  vec_type q;
+
+  if (!closestTriangle(p, math::Limits<real>::inf(), triangle, q))
+    return math::Limits<real>::inf();
+  return (q - p).length();
+}
+
+template <typename real>
+bool
+TriangleMeshSurface<real>::localIsInside(const vec_type& p) const
+{
+  if (!_bounds.contains(p))
+    return false;
+  if (_sdf != nullptr)
+    return localSignedDistance(p) < 0;
+
+  std::vector<real> xs;
+  crossingsAlongX(p + rayOffset(), xs);
+  auto crossed = std::upper_bound(xs.begin(), xs.end(), p.x) - xs.begin();
+  return crossed % 2 == 1;
+}
+
+template <typename real>
+real
+TriangleMeshSurface<real>::localSignedDistance(const vec_type& p) const
+{
+  if (_sdf == nullptr)
+    return Base::localSignedDistance(p);
+
+  // out of the grid the point is farther than the band from the surface
+  auto h = _sdf->cellSize();
+  auto min = _sdf->bounds().min();
+  auto max = min + h * vec_type{ _sdf->size() - Index3{ 1, 1, 1 } };
+  if (!bounds_type{ min, max }.contains(p))
+    return _bandWidth;
+  return _sdf->sample(p);
+}
+
+template <typename real>
+void
+TriangleMeshSurface<real>::localClosestQuery(
+  const vec_type& p,
+  typename Base::QueryResult& result) const
+{
+  int triangle;
+
+  if (!closestTriangle(p, math::Limits<real>::inf(), triangle, result.point))
+  {
+    result.point = p;
+    result.normal = vec_type{ 1, 0, 0 };
+    result.distance = math::Limits<real>::inf();
+    result.isInside = false;
+    return;
+  }
+  result.normal = _normals[triangle];
+  result.distance = (result.point - p).length();
+  result.isInside = localIsInside(p);
+}
+
+} // end namespace cg
+
+#endif // __TriangleMeshSurface_h
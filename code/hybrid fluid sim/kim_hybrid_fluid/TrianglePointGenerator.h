@@ -15,12 +15,33 @@ public:
   using bounds_type = Bounds<real, 2>;
   using callback_type = typename PointGenerator<2, real>::callback_type;
 
+  // Appends the right triangle points inside boundingBox to points.
+  void generate(const bounds_type& bounds, real spacing, std::vector<vec_type>& points) const override
+  {
+    const auto boxSize = bounds.size();
+    const auto ySpacing = spacing * real(std::sqrt(3.0f) / 2.0f);
+    points.reserve(points.size() +
+      size_t((boxSize.x / spacing + 2) * (boxSize.y / ySpacing + 2)));
+
+    forEachLatticePoint(bounds, spacing, [&points](const vec_type& p) {
+      points.push_back(p);
+      return true;
+    });
+  }
+
   // Invokes callback function for each right triangle points
   // inside boundingBox.
   //
   // This function iterates every right triangle points inside boundingBox
   // where spacing is the size of the right triangle structure.
   void forEachPoint(const bounds_type& bounds, real spacing, const callback_type& callback) const override
+  {
+    forEachLatticePoint(bounds, spacing, callback);
+  }
+
+private:
+  template <typename Callback>
+  void forEachLatticePoint(const bounds_type& bounds, real spacing, const Callback& callback) const
   {
     const auto halfSpacing = spacing * 0.5f;
     const auto ySpacing = spacing * real(std::sqrt(3.0f) / 2.0f);
@@ -3,9 +3,12 @@
 
 #include <vector>
 #include <algorithm>
+#include <type_traits>
 #include "ParticleEmitter.h"
 #include "TrianglePointGenerator.h"
+#include "BccLatticePointGenerator.h"
 #include "math/Surface.h"
+#include "Parallel.h"
 
 namespace cg
 {
@@ -21,36 +24,25 @@ namespace cg
 * \tparam real A floating point type.
 * \tparam PointArray An array of points, or particles.
 * 
-* \todo Implement 3-D template specialization.
-*/
-template <size_t D, typename real, typename PointArray>
-class VolumeParticleEmitter;
-
-/**
-* Template class for a 2-D volumetric particle emitter.
-* 
-* This class specializes the template class VolumeParticleEmitter to a 2-D
-* case.
-* 
-* \tparam real A floating point type.
-* \tparam PointArray An array of points, or particles.
-* 
 * \todo Allow random seed to be provided.
 * \todo Use ImplicitSurface instead of Surface
 * \todo Implement case where emitter is not one shot.
 */
-template <typename real, typename PointArray>
-class VolumeParticleEmitter<2, real, PointArray> final : public ParticleEmitter<PointArray>
+template <size_t D, typename real, typename PointArray>
+class VolumeParticleEmitter final : public ParticleEmitter<PointArray>
 {
 public:
   using Base = ParticleEmitter<PointArray>; ///< Base class alias.
-  using vec_type = Vector<real, 2>; ///< Vector type alias.
-  using bounds_type = Bounds<real, 2>; ///< Bounds type alias.
+  using vec_type = Vector<real, D>; ///< Vector type alias.
+  using bounds_type = Bounds<real, D>; ///< Bounds type alias.
+  /// Angular velocity type: a scalar in 2-D and a vector in 3-D.
+  using angular_type = std::conditional_t<D == 2, real, vec_type>;
 
   /**
   * Constructs an emitter that generates particles inside a given surface
   * that defines the volumetric geometry. These particles are placed in
-  * \p particles. By default uses TrianglePointGenerator to produce particles.
+  * \p particles. By default uses TrianglePointGenerator in 2-D and
+  * BccLatticePointGenerator in 3-D to produce particles.
   * 
   * \param[in, out] particles     The object to put particles into.
   * \param[in]  surface           The surface.
@@ -66,12 +58,12 @@ public:
   */
   VolumeParticleEmitter(
     PointArray& particles,
-    math::Surface<2, real>* surface,
+    math::Surface<D, real>* surface,
     const bounds_type& bounds,
     real spacing,
     const vec_type& initialVel = vec_type::null(),
     const vec_type& linearVel = vec_type::null(),
-    real angularVel = 0.0f,
+    const angular_type& angularVel = angular_type{ real(0.0f) },
     size_t maxParticles = math::Limits<size_t>::inf(),
     bool isOneShot = true,
     bool allowOverlapping = false
@@ -87,7 +79,10 @@ public:
     _isOneShot(isOneShot),
     _allowOverlapping(allowOverlapping)
   {
-    _pointsGen = new TrianglePointGenerator<real>();
+    if constexpr (D == 2)
+      _pointsGen = new TrianglePointGenerator<real>();
+    else
+      _pointsGen = new BccLatticePointGenerator<real>();
   }
 
   /** Destructor */
@@ -97,13 +92,13 @@ public:
   }
 
   /** Sets a new point generator. */
-  void setPointGenerator(PointGenerator<2, real>* pointsGen) { _pointsGen = pointsGen; }
+  void setPointGenerator(PointGenerator<D, real>* pointsGen) { _pointsGen = pointsGen; }
 
   /** Returns the surface. */
-  const math::Surface<2, real>* surface() const { return _surface.get(); }
+  const math::Surface<D, real>* surface() const { return _surface.get(); }
 
   /** Sets the surface. */
-  void setSurface(math::Surface<2, real>* surface) { _surface = surface; }
+  void setSurface(math::Surface<D, real>* surface) { _surface = surface; }
 
   /** Returns the bounds in which particles can be generated. */
   const auto& maxRegion() const { return _bounds; }
@@ -148,14 +143,28 @@ public:
   void setLinearVelocity(const vec_type& vel) { _linearVel = vel; }
 
   /** Returns the angular velocity of the emitter. */
-  real angularVelocity() const { return _angularVel; }
+  auto angularVelocity() const { return _angularVel; }
 
   /** Sets the angular velocity of the emitter. */
-  void setAngularVelocity(real vel) { _angularVel = vel; }
+  void setAngularVelocity(const angular_type& vel) { _angularVel = vel; }
+
+  /** Writes the emitter state, with the number of emitted particles. */
+  void saveState(CheckpointWriter& writer) const override
+  {
+    Base::saveState(writer);
+    writer.write(_numberOfEmittedParticles);
+  }
+
+  /** Reads the state written by VolumeParticleEmitter::saveState. */
+  void loadState(CheckpointReader& reader) override
+  {
+    Base::loadState(reader);
+    reader.read(_numberOfEmittedParticles);
+  }
 
 private:
   /** Surface reference. */
-  Reference<math::Surface<2, real>> _surface; // should be replaced by implicit surface
+  Reference<math::Surface<D, real>> _surface; // should be replaced by implicit surface
   /** Emitter bounds. */
   bounds_type _bounds;
   /** Particle spacing. */
@@ -165,9 +174,9 @@ private:
   /** Emitter linear velocity. */
   vec_type _linearVel;
   /** Emitter angular velocity. */
-  real _angularVel = 0.0f;
+  angular_type _angularVel{ real(0.0f) };
   /** Point generator. */
-  PointGenerator<2, real>* _pointsGen;
+  PointGenerator<D, real>* _pointsGen;
 
   /** Max number of particles. */
   size_t _maxNumberOfParticles = math::Limits<size_t>::inf();
@@ -186,13 +195,15 @@ private:
   void onUpdate(double currentTimeInSeconds, double timeIntervalInSeconds) override;
 
   /**
-  * \brief    Emits particles filling their information into
-  *           \p positions and \p velocities.
+  * \brief    Emits particles straight into the target particle system.
   * 
-  * Uses the point generator instance to produce particles within bounds.
-  * The velocities calculated by VolumeParticleEmitter::velocityAt.
+  * Uses the point generator instance to produce particles within the
+  * intersection of the bounds and the surface bounds, tests them against
+  * the surface in parallel and writes the ones inside into the storage of
+  * the particles appended to the target. The velocities calculated by
+  * VolumeParticleEmitter::velocityAt.
   */
-  void emit(std::vector<vec_type>& positions, std::vector<vec_type>& velocities);
+  void emit();
 
   /**
   * Calculates the velocity of a particle based on the emitter's properties.
@@ -204,94 +215,88 @@ private:
 
 }; // VolumeParticleEmitter
 
-template<typename real, typename PointArray>
+template<size_t D, typename real, typename PointArray>
 inline void
-VolumeParticleEmitter<2, real, PointArray>::onUpdate(double currentTimeInSeconds, double timeIntervalInSeconds)
+VolumeParticleEmitter<D, real, PointArray>::onUpdate(double currentTimeInSeconds, double timeIntervalInSeconds)
 {
-  auto& particles = this->target();
-
   if (!this->isEnabled()) return;
 
-  std::vector<vec_type> newPositions, newVelocities;
-
-  emit(newPositions, newVelocities);
-
-  for (size_t i = 0; i < newPositions.size(); ++i)
-  {
-    if (!particles.add(newPositions[i], newVelocities[i]))
-    {
-#ifdef _DEBUG
-      printf("Early stopping in VolumeParticleEmitter, particle system capacity reached.\n");
-#endif
-      break;
-    }
-  }
+  emit();
 
   if (_isOneShot)
     this->setIsEnabled(false);
 }
 
-template<typename real, typename PointArray>
+template<size_t D, typename real, typename PointArray>
 inline void
-VolumeParticleEmitter<2, real, PointArray>::emit(std::vector<vec_type>& positions, std::vector<vec_type>& velocities)
+VolumeParticleEmitter<D, real, PointArray>::emit()
 {
   if (_surface == nullptr)
     return;
 
+  // points out of the surface bounds cannot be inside it
   vec_type min = _bounds.min(), max = _bounds.max();
   if (_surface->isBounded())
   {
     auto bb = _surface->bounds();
-    const auto& _min = bb.min();
-    const auto& _max = bb.max();
-    max = vec_type{
-      math::max(max.x, _max.x),
-      math::max(max.y, _max.y)
-    };
-    min = vec_type{
-      math::min(min.x, _min.x),
-      math::min(min.y, _min.y)
-    };
+    for (size_t d = 0; d < D; ++d)
+    {
+      min[d] = math::max(min[d], bb.min()[d]);
+      max[d] = math::min(max[d], bb.max()[d]);
+      if (min[d] > max[d])
+        return;
+    }
   }
   bounds_type region{ min, max };
 
-  size_t numNewParticles = 0;
-
   if (_allowOverlapping || _isOneShot)
   {
-    _pointsGen->forEachPoint(region, _spacing, [&](const vec_type& point) {
-      if (_surface->isInside(point))
-      {
-        if (_numberOfEmittedParticles < _maxNumberOfParticles)
-        {
-          positions.push_back(point);
-          ++_numberOfEmittedParticles;
-          ++numNewParticles;
-        }
-        else
-        {
-          return false;
-        }
-      }
-      return true;
-    });
+    std::vector<vec_type> candidates;
+    _pointsGen->generate(region, _spacing, candidates);
+
+    // only the sign matters, so the surface can clamp far points to the
+    // spacing without computing their distances
+    std::vector<real> distances(candidates.size());
+    parallelRangeFor(0, int64_t(candidates.size()), [&](int64_t b, int64_t e) {
+      _surface->signedDistance(&candidates[b], size_t(e - b), &distances[b], _spacing);
+      }, 1024);
+
+    size_t count = 0;
+    for (size_t i = 0; i < candidates.size(); ++i)
+      if (distances[i] < 0)
+        candidates[count++] = candidates[i];
+
+    if (_maxNumberOfParticles - _numberOfEmittedParticles < count)
+      count = _maxNumberOfParticles - _numberOfEmittedParticles;
+
+    auto& particles = this->target();
+    auto first = particles.size();
+    auto n = particles.append(count);
+#ifdef _DEBUG
+    if (n < count)
+      printf("Early stopping in VolumeParticleEmitter, particle system capacity reached.\n");
+#endif
+
+    parallelFor(0, int64_t(n), [&](int64_t i) {
+      particles.set(first + i, candidates[i], velocityAt(candidates[i]));
+      }, 1024);
+    _numberOfEmittedParticles += n;
   }
   else
   {
     // TODO
   }
-
-  velocities.resize(positions.size());
-  for (size_t i = 0; i < positions.size(); ++i)
-    velocities[i] = velocityAt(positions[i]);
 }
 
-template<typename real, typename PointArray>
-inline Vector<real, 2>
-VolumeParticleEmitter<2, real, PointArray>::velocityAt(const vec_type& point) const
+template<size_t D, typename real, typename PointArray>
+inline Vector<real, D>
+VolumeParticleEmitter<D, real, PointArray>::velocityAt(const vec_type& point) const
 {
   auto r = point - _surface->transform.transform(vec_type::null());
-  return _linearVel + _angularVel * vec_type{ -r.y, r.x } + _initialVel;
+  if constexpr (D == 2)
+    return _linearVel + _angularVel * vec_type{ -r.y, r.x } + _initialVel;
+  else
+    return _linearVel + _angularVel.cross(r) + _initialVel;
 }
 
 } // end namespace cg
@@ -18,6 +18,15 @@ public:
   using vec_type = Vector<real, D>;
   using bounds_type = Bounds<real, D>;
 
+  /// Result of a closest point query
+  struct QueryResult
+  {
+    vec_type point;
+    vec_type normal;
+    real distance;
+    bool isInside;
+  };
+
   Transform<D, real> transform;
 
   Surface(const Transform<D, real>& t) :
@@ -34,7 +43,18 @@ public:
   bounds_type bounds() const
   {
     auto b = localBounds();
-    return bounds_type{ transform.transform(b.min()), transform.transform(b.max()) };
+    bounds_type ret;
+
+    // every corner is transformed, so rotated surfaces are still enclosed
+    for (int i = 0; i < (1 << D); ++i)
+    {
+      auto p = b.min();
+      for (size_t d = 0; d < D; ++d)
+        if (i & (1 << d))
+          p[d] = b.max()[d];
+      ret.inflate(transform.transform(p));
+    }
+    return ret;
   }
 
   /// Returns the closest point from given point p to the surface.
@@ -46,7 +66,7 @@ public:
   /// Returns the closest distance from the given point to the surface
   real closestDistance(const vec_type& p) const
   {
-    return localClosestDistance(transform.inverseTransform(p));
+    return localClosestDistance(transform.inverseTransform(p)) * distanceScale();
   }
 
   /// Returns the normal to the closest point on the surface from given point p
@@ -55,6 +75,32 @@ public:
     return transform.transformDirection(localClosestNormal(transform.inverseTransform(p)));
   }
 
+  /// Computes the closest point, normal, distance and the inside flag of
+  /// the given point at once
+  void closestQuery(const vec_type& p, QueryResult& result) const
+  {
+    localClosestQuery(transform.inverseTransform(p), result);
+    result.point = transform.transform(result.point);
+    result.normal = transform.transformDirection(result.normal);
+    result.distance *= distanceScale();
+  }
+
+  /// Returns the signed distance from the given point to the surface,
+  /// negative inside it
+  real signedDistance(const vec_type& p) const
+  {
+    return localSignedDistance(transform.inverseTransform(p)) * distanceScale();
+  }
+
+  /// Computes the signed distances of count points at once. The distances
+  /// are clamped to [-band, band], so surfaces can skip the points farther
+  /// than band from them
+  void signedDistance(const vec_type* points, size_t count, real* distances,
+    real band = math::Limits<real>::inf()) const
+  {
+    batchSignedDistance(points, count, distances, band);
+  }
+
   bool intesects(const Ray<real, D>& ray) const
   {
     // TODO
@@ -72,6 +118,17 @@ public:
     return localIsInside(transform.inverseTransform(p));
   }
 
+  /// Returns the factor that converts local distances to world distances.
+  /// A scale s divides local distances by s; with a non-uniform scale, the
+  /// smallest one gives a lower bound of the distance
+  real distanceScale() const
+  {
+    auto scale = math::abs(transform.scale()[0]);
+    for (size_t d = 1; d < D; ++d)
+      scale = math::min(scale, math::abs(transform.scale()[d]));
+    return scale;
+  }
+
 protected:
   /// Returns the bounding box of this surface object in local coordinates
   virtual bounds_type localBounds() const = 0;
@@ -96,6 +153,30 @@ protected:
     return (p - _localCP).dot(_localN) < 0.0f;
   }
 
+  /// Computes the closest point query of p in local coordinates
+  virtual void localClosestQuery(const vec_type& p, QueryResult& result) const
+  {
+    result.point = localClosestPoint(p);
+    result.normal = localClosestNormal(p);
+    result.distance = localClosestDistance(p);
+    result.isInside = localIsInside(p);
+  }
+
+  /// Returns the signed distance from p to the surface in local coordinates
+  virtual real localSignedDistance(const vec_type& p) const
+  {
+    auto d = localClosestDistance(p);
+    return localIsInside(p) ? -d : d;
+  }
+
+  /// Computes the clamped signed distances of an array of points in world
+  /// coordinates
+  virtual void batchSignedDistance(const vec_type* points, size_t count, real* distances, real band) const
+  {
+    for (size_t i = 0; i < count; ++i)
+      distances[i] = math::clamp(signedDistance(points[i]), -band, band);
+  }
+
 }; // Surface
 
 } // end namespace cg::math
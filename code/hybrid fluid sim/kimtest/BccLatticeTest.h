@@ -0,0 +1,134 @@
+#ifndef __BccLatticeTest_h
+#define __BccLatticeTest_h
+
+#include "BccLatticePointGenerator.h"
+#include "Sphere.h"
+#include "Test.h"
+#include "VolumeParticleEmitter.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// The lattice of a box has the expected number of points, inside the box
+// and no closer than the BCC neighbor distance, and generate appends the
+// points forEachPoint visits, in the same order.
+inline void
+testBccLattice()
+{
+  using namespace cg;
+  using vec_type = cg::Vector<float, 3>;
+
+  puts("**BCC lattice test**");
+
+  BccLatticePointGenerator<float> generator;
+  Bounds<float, 3> bounds{ vec_type{ -0.5f, 0.0f, 0.25f }, vec_type{ 0.5f, 1.0f, 1.25f } };
+  const auto spacing = 0.25f;
+
+  // 5 layers of 5x5 points and 4 shifted layers of 4x4 points
+  std::vector<vec_type> points{ vec_type{ 9.0f } };
+  generator.generate(bounds, spacing, points);
+  CHECK(points.size() == 1 + 5 * 25 + 4 * 16);
+  CHECK(points[0] == vec_type{ 9.0f });
+
+  auto minDistance = math::Limits<float>::inf();
+  size_t outside = 0;
+
+  for (size_t i = 1; i < points.size(); ++i)
+  {
+    outside += !bounds.contains(points[i]);
+    for (size_t j = i + 1; j < points.size(); ++j)
+      minDistance = std::min(minDistance, (points[i] - points[j]).length());
+  }
+  CHECK(outside == 0);
+  CHECK(std::abs(minDistance - spacing * std::sqrt(3.0f) * 0.5f) < 1e-5f);
+
+  size_t count = 1;
+  bool same = true;
+
+  generator.forEachPoint(bounds, spacing, [&](const vec_type& p) {
+    same = same && count < points.size() && points[count] == p;
+    ++count;
+    return true;
+  });
+  CHECK(same);
+  CHECK(count == points.size());
+
+  // the iteration stops when the callback returns false
+  count = 0;
+  generator.forEachPoint(bounds, spacing, [&](const vec_type&) {
+    return ++count < 10;
+  });
+  CHECK(count == 10);
+}
+
+// A 3D emitter fills a sphere with the lattice points inside it, up to its
+// max number of particles and to the capacity of the particle system.
+inline void
+testVolumeEmitter3()
+{
+  using namespace cg;
+  using vec_type = cg::Vector<float, 3>;
+  using particle_system = ParticleSystem<3, float, ArrayAllocator, vec_type>;
+  using emitter_type = VolumeParticleEmitter<3, float, particle_system>;
+
+  puts("**3D volume emitter test**");
+
+  const vec_type center{ 0.5f };
+  const auto radius = 0.3f;
+  const auto spacing = 0.05f;
+  const vec_type velocity{ 1.0f, 2.0f, 3.0f };
+  Bounds<float, 3> domain{ vec_type{ 0.0f }, vec_type{ 1.0f } };
+
+  // the lattice points strictly inside the sphere bounds and the sphere
+  size_t expected = 0;
+  BccLatticePointGenerator<float>{}.forEachPoint(
+    Bounds<float, 3>{ center - vec_type{ radius }, center + vec_type{ radius } },
+    spacing,
+    [&](const vec_type& p) {
+      expected += (p - center).length() < radius;
+      return true;
+    });
+
+  particle_system particles{ 10000 };
+  Reference<emitter_type> emitter = new emitter_type{ particles,
+    new Sphere<3, float>{ center, radius }, domain, spacing, velocity };
+
+  emitter->update(0, 0.1);
+  CHECK(particles.size() == expected);
+  CHECK(expected > 1000);
+
+  size_t outside = 0;
+  size_t wrongVelocity = 0;
+  for (size_t i = 0; i < particles.size(); ++i)
+  {
+    outside += (particles[i] - center).length() >= radius + 1e-5f;
+    wrongVelocity += particles.get<1>(i) != velocity;
+  }
+  CHECK(outside == 0);
+  CHECK(wrongVelocity == 0);
+
+  // one shot: a second update emits nothing
+  emitter->update(0.1, 0.1);
+  CHECK(particles.size() == expected);
+
+  // limited by the max number of particles
+  particle_system limited{ 10000 };
+  Reference<emitter_type> maxEmitter = new emitter_type{ limited,
+    new Sphere<3, float>{ center, radius }, domain, spacing, velocity,
+    vec_type::null(), vec_type::null(), 100 };
+
+  maxEmitter->update(0, 0.1);
+  CHECK(limited.size() == 100);
+
+  // limited by the capacity of the particle system
+  particle_system small{ 50 };
+  Reference<emitter_type> smallEmitter = new emitter_type{ small,
+    new Sphere<3, float>{ center, radius }, domain, spacing };
+
+  smallEmitter->update(0, 0.1);
+  CHECK(small.size() == 50);
+  for (size_t i = 0; i < small.size(); ++i)
+    CHECK((small[i] - center).length() < radius + 1e-5f);
+}
+
+#endif // __BccLatticeTest_h
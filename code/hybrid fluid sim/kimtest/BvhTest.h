@@ -0,0 +1,99 @@
+#ifndef __BvhTest_h
+#define __BvhTest_h
+
+#include "geometry/MeshSweeper.h"
+#include "Test.h"
+#include "TriangleMeshSurface.h"
+#include <algorithm>
+#include <cmath>
+
+// Closest point of a segment, the reference of the closest triangle point.
+inline cg::vec3f
+closestPointOnSegment(const cg::vec3f& p, const cg::vec3f& a, const cg::vec3f& b)
+{
+  auto ab = b - a;
+  auto t = std::clamp((p - a).dot(ab) / ab.dot(ab), 0.0f, 1.0f);
+
+  return a + ab * t;
+}
+
+// Distance from p to the triangle abc, computed by projecting p onto the
+// plane of the triangle and falling back to the edges.
+inline float
+triangleDistance(const cg::vec3f& p, const cg::vec3f& a, const cg::vec3f& b, const cg::vec3f& c)
+{
+  auto n = (b - a).cross(c - a);
+  auto q = p - n * ((p - a).dot(n) / n.dot(n));
+
+  if ((b - a).cross(q - a).dot(n) >= 0 &&
+    (c - b).cross(q - b).dot(n) >= 0 &&
+    (a - c).cross(q - c).dot(n) >= 0)
+    return (p - q).length();
+
+  auto d = (p - closestPointOnSegment(p, a, b)).length();
+
+  d = std::min(d, (p - closestPointOnSegment(p, b, c)).length());
+  return std::min(d, (p - closestPointOnSegment(p, c, a)).length());
+}
+
+// The BVH gives the closest point found by testing every triangle.
+inline void
+testBvhClosestPoint()
+{
+  using namespace cg;
+
+  puts("**BVH closest point test**");
+
+  Reference<TriangleMesh> mesh = MeshSweeper::makeSphere(24);
+  TriangleMeshSurface<float> surface{ *mesh };
+  const auto& data = mesh->data();
+
+  for (int i = 0; i < 500; ++i)
+  {
+    vec3f p{ frand(-2, 2), frand(-2, 2), frand(-2, 2) };
+    auto expected = math::Limits<float>::inf();
+
+    for (int t = 0; t < data.numberOfTriangles; ++t)
+    {
+      const auto* v = data.triangles[t].v;
+      expected = std::min(expected, triangleDistance(p,
+        data.vertices[v[0]],
+        data.vertices[v[1]],
+        data.vertices[v[2]]));
+    }
+
+    auto q = surface.closestPoint(p);
+
+    CHECK(std::abs(surface.closestDistance(p) - expected) < 1e-5f);
+    CHECK(std::abs((q - p).length() - expected) < 1e-5f);
+  }
+}
+
+// The BVH classifies points of the box mesh [-1, 1]^3 as the box does.
+inline void
+testBvhInside()
+{
+  using namespace cg;
+
+  puts("**BVH inside test**");
+
+  Reference<TriangleMesh> mesh = MeshSweeper::makeBox();
+  TriangleMeshSurface<float> surface{ *mesh };
+
+  for (int i = 0; i < 500; ++i)
+  {
+    vec3f p{ frand(-1.5f, 1.5f), frand(-1.5f, 1.5f), frand(-1.5f, 1.5f) };
+    auto m = std::max({ std::abs(p.x), std::abs(p.y), std::abs(p.z) });
+
+    // the inside test samples an SDF grid, which is exact away from the faces
+    if (std::abs(m - 1) < 0.05f)
+      continue;
+    CHECK(surface.isInside(p) == (m < 1));
+
+    auto q = surface.closestPoint(p);
+
+    CHECK(std::abs(std::max({ std::abs(q.x), std::abs(q.y), std::abs(q.z) }) - 1) < 1e-5f);
+  }
+}
+
+#endif // __BvhTest_h
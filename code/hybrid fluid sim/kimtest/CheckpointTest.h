@@ -0,0 +1,158 @@
+#ifndef __CheckpointTest_h
+#define __CheckpointTest_h
+
+#include "Checkpoint.h"
+#include "Scene.h"
+#include "Test.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+// Values, arrays and grids read back with the same bits and in the same
+// order, and malformed files are rejected.
+inline void
+testCheckpointFormat()
+{
+  using namespace cg;
+
+  printf("**Checkpoint format test**\n");
+
+  auto path = tempPath("format.ckpt");
+  Grid<3, float> grid{ Index3{ int64_t(5), int64_t(3), int64_t(2) } };
+  double values[] = { 0.1, -0.0, math::Limits<double>::inf() };
+
+  for (int64_t i = 0; i < grid.length(); ++i)
+    grid[i] = frand(-1, 1);
+
+  CheckpointWriter writer;
+
+  writer.writeTag("TEST");
+  writer.write(uint64_t(0x0123456789abcdef));
+  writer.write(values, 3);
+  writer.writeGrid(grid);
+  writer.save(path);
+
+  {
+    CheckpointReader reader{ path };
+    double readValues[3];
+    Grid<3, float> readGrid{ grid.size() };
+
+    reader.expectTag("TEST");
+    CHECK(reader.read<uint64_t>() == 0x0123456789abcdef);
+    reader.read(readValues, 3);
+    CHECK(std::memcmp(readValues, values, sizeof(values)) == 0);
+    reader.readGrid(readGrid);
+    CHECK(std::memcmp(&readGrid[0], &grid[0], sizeof(float) * 30) == 0);
+    CHECK(reader.atEnd());
+    CHECK(throwsRuntimeError([&]() { reader.read<char>(); }));
+  }
+  CHECK(throwsRuntimeError([&]() {
+    CheckpointReader reader{ path };
+    reader.expectTag("XXXX");
+    }));
+  CHECK(throwsRuntimeError([&]() {
+    CheckpointReader reader{ path };
+    Grid<3, float> readGrid{ Index3{ int64_t(3), int64_t(5), int64_t(2) } };
+
+    reader.expectTag("TEST");
+    reader.read<uint64_t>();
+    reader.read<double>();
+    reader.read<double>();
+    reader.read<double>();
+    reader.readGrid(readGrid);
+    }));
+
+  // a truncated file fails on the first read past its end
+  std::filesystem::resize_file(path, writer.buffer().size() - 1);
+  CHECK(throwsRuntimeError([&]() {
+    CheckpointReader reader{ path };
+    Grid<3, float> readGrid{ grid.size() };
+
+    reader.expectTag("TEST");
+    reader.read<uint64_t>();
+    reader.read<double>();
+    reader.read<double>();
+    reader.read<double>();
+    reader.readGrid(readGrid);
+    }));
+
+  // so does one cut inside the header
+  std::filesystem::resize_file(path, 6);
+  CHECK(throwsRuntimeError([&]() { CheckpointReader reader{ path }; }));
+
+  // and a file of another version is refused
+  writer.clear();
+  {
+    auto buffer = writer.buffer();
+    auto version = CheckpointWriter::version + 1;
+
+    std::memcpy(buffer.data() + 4, &version, sizeof(version));
+    std::ofstream{ path, std::ios::binary }.write(buffer.data(), buffer.size());
+  }
+  CHECK(throwsRuntimeError([&]() { CheckpointReader reader{ path }; }));
+  CHECK(throwsRuntimeError([&]() { CheckpointReader reader{ path + ".none" }; }));
+}
+
+// A viscous FLIP scene restored from a checkpoint continues with the same
+// bits as the run that wrote it, and the restored viscosity solver reuses
+// the factorization of the saved system.
+inline void
+testCheckpointRestore()
+{
+  using namespace cg;
+  using Solver = PicSolver<2, float, ArrayAllocator>;
+
+  printf("**Checkpoint restore test**\n");
+
+  auto description = JsonValue::parse(R"({
+    "dimension": 2,
+    "grid": { "size": 32, "spacing": 0.03125 },
+    "time": { "frames": 6 },
+    "solver": {
+      "type": "flip",
+      "closedBoundary": "all",
+      "viscosity": 0.05
+    },
+    "emitters": [{
+      "shape": { "type": "box", "min": [0, 0], "max": [1, 0.4] },
+      "spacing": 0.01
+    }]
+  })");
+  auto path = tempPath("restore.ckpt");
+  auto scene = Scene::build(description);
+  auto restoredScene = Scene::build(description);
+  auto solver = dynamic_cast<Solver*>(scene->solver());
+  auto restored = dynamic_cast<Solver*>(restoredScene->solver());
+
+  scene->advance(6);
+  solver->saveCheckpoint(path);
+  restored->loadCheckpoint(path);
+
+  auto frame = solver->frame();
+  auto directSolves = solver->diffusionSolver().directSolveCount();
+  auto iterativeSolves = solver->diffusionSolver().iterativeSolveCount();
+
+  for (int i = 0; i < 3; ++i)
+  {
+    ++frame;
+    solver->advanceFrame(frame);
+    restored->advanceFrame(frame);
+  }
+
+  const auto& particles = solver->particleSystem();
+  const auto& restoredParticles = restored->particleSystem();
+  auto same = particles.size() == restoredParticles.size() &&
+    solver->particleIds() == restored->particleIds();
+
+  for (size_t i = 0; same && i < particles.size(); ++i)
+    same = std::memcmp(&particles[i], &restoredParticles[i], sizeof(particles[i])) == 0 &&
+      std::memcmp(&particles.get<1>(i), &restoredParticles.get<1>(i), sizeof(particles[i])) == 0;
+  CHECK(same);
+  directSolves = solver->diffusionSolver().directSolveCount() - directSolves;
+  CHECK(directSolves > 0);
+  CHECK(restored->diffusionSolver().directSolveCount() == directSolves);
+  CHECK(restored->diffusionSolver().iterativeSolveCount() ==
+    solver->diffusionSolver().iterativeSolveCount() - iterativeSolves);
+}
+
+#endif // __CheckpointTest_h
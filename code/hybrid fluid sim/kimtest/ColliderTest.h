@@ -0,0 +1,50 @@
+#ifndef __ColliderTest_h
+#define __ColliderTest_h
+
+#include "Box.h"
+#include "RigidBodyCollider.h"
+#include "Test.h"
+#include <cmath>
+
+// A box collider rotated by 90 degrees gives its normals in world space,
+// and pushes penetrating points out along them.
+inline void
+testColliderRotatedNormal()
+{
+  using namespace cg;
+  using vec_type = cg::Vector<float, 2>;
+  using surface_type = math::Surface<2, float>;
+
+  puts("**Collider rotated normal test**");
+
+  // [-1, 1] x [-0.5, 0.5] rotated to [-0.5, 0.5] x [-1, 1] in world space
+  Reference<surface_type> box = new Box<2, float>(vec_type{ -1.0f, -0.5f }, vec_type{ 1.0f, 0.5f });
+  box->transform.setRotation(math::pi<float>() * 0.5f);
+
+  RigidBodyCollider<2, float> collider{ box };
+  surface_type::QueryResult result;
+
+  // outside the right face
+  vec_type p{ 0.7f, 0.0f };
+  collider.surface()->closestQuery(p, result);
+  CHECK((result.normal - vec_type{ 1.0f, 0.0f }).length() < 1e-5f);
+  CHECK((result.point - vec_type{ 0.5f, 0.0f }).length() < 1e-5f);
+  CHECK(std::abs(result.distance - 0.2f) < 1e-5f);
+  CHECK(!result.isInside);
+  CHECK((box->closestNormal(p) - vec_type{ 1.0f, 0.0f }).length() < 1e-5f);
+
+  // outside the top face
+  p = vec_type{ 0.0f, 1.5f };
+  CHECK((box->closestNormal(p) - vec_type{ 0.0f, 1.0f }).length() < 1e-5f);
+
+  // inside, moving towards the left: pushed out of the right face
+  const auto radius = 0.01f;
+  vec_type position{ 0.3f, 0.0f };
+  vec_type velocity{ -1.0f, 0.0f };
+
+  collider.resolveCollision(radius, 0.0f, position, velocity);
+  CHECK((position - vec_type{ 0.5f + radius, 0.0f }).length() < 1e-5f);
+  CHECK(velocity.x >= -1e-5f);
+}
+
+#endif // __ColliderTest_h
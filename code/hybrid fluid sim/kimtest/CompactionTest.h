@@ -0,0 +1,102 @@
+#ifndef __CompactionTest_h
+#define __CompactionTest_h
+
+#include "PicSolver.h"
+#include "Sphere.h"
+#include "Test.h"
+#include "VolumeParticleEmitter.h"
+#include <algorithm>
+#include <vector>
+
+// Runs a 2D PIC drop falling through a kill region and out of the open
+// domain with the given number of threads. Returns the ids and positions
+// of the particles after every frame.
+inline void
+runCompactionScene(unsigned int threads,
+  std::vector<std::vector<uint64_t>>& ids,
+  std::vector<std::vector<cg::Vector<float, 2>>>& positions)
+{
+  using namespace cg;
+  using vec_type = cg::Vector<float, 2>;
+  using Solver = PicSolver<2, float, ArrayAllocator>;
+
+  setMaxNumberOfThreads(threads);
+
+  Solver solver{ Index2{ int64_t(32) }, vec_type{ 1.0f / 32 }, vec_type{ 0.0f } };
+  auto emitter = new VolumeParticleEmitter<2, float, Solver::PicParticleSystem>
+    (solver.particleSystem(),
+    new Sphere<2, float>{ vec_type{ 0.5f }, 0.3f },
+    Bounds<float, 2>{ vec_type{ 0.0f }, vec_type{ 1.0f } },
+    0.01f);
+
+  solver.setParticleEmitter(emitter);
+  solver.addKillRegion(new Sphere<2, float>{ vec_type{ 0.5f, 0.2f }, 0.1f });
+  solver.setKillOutsideDomain(true);
+  solver.setClosedDomainBoundaryFlag(0);
+
+  Frame frame;
+
+  ids.clear();
+  positions.clear();
+  for (int i = 0; i < 20; ++i)
+  {
+    frame.advance();
+    solver.advanceFrame(frame);
+
+    const auto& particles = solver.particleSystem();
+
+    ids.push_back(solver.particleIds());
+    positions.emplace_back(particles.size());
+    for (size_t p = 0; p < particles.size(); ++p)
+      positions.back()[p] = particles[p];
+  }
+  setMaxNumberOfThreads(0);
+}
+
+// Killing particles keeps the survivors in emission order with their ids,
+// and the chunked compaction gives the same particles for any number of
+// chunks.
+inline void
+testStableCompaction()
+{
+  using namespace cg;
+
+  printf("**Stable particle compaction test**\n");
+
+  std::vector<std::vector<uint64_t>> ids;
+  std::vector<std::vector<cg::Vector<float, 2>>> positions;
+
+  runCompactionScene(1, ids, positions);
+
+  size_t unordered = 0;
+  size_t unknown = 0;
+  size_t inside = 0;
+
+  for (size_t f = 0; f < ids.size(); ++f)
+  {
+    unordered += std::adjacent_find(ids[f].begin(), ids[f].end(),
+      [](uint64_t a, uint64_t b) { return a >= b; }) != ids[f].end();
+    // the emitter fills the sphere once, so no frame adds particles
+    if (f > 0)
+      unknown += !std::includes(ids[f - 1].begin(), ids[f - 1].end(),
+        ids[f].begin(), ids[f].end());
+    for (const auto& p : positions[f])
+      inside += (p - cg::Vector<float, 2>{ 0.5f, 0.2f }).length() < 0.1f ||
+        p.x < 0 || p.x > 1 || p.y < 0 || p.y > 1;
+    CHECK(ids[f].size() == positions[f].size());
+  }
+  CHECK(unordered == 0);
+  CHECK(unknown == 0);
+  CHECK(inside == 0);
+  // the drop must actually lose particles for the test to mean anything
+  CHECK(ids.back().size() < ids.front().size() / 2);
+
+  std::vector<std::vector<uint64_t>> chunkedIds;
+  std::vector<std::vector<cg::Vector<float, 2>>> chunkedPositions;
+
+  runCompactionScene(7, chunkedIds, chunkedPositions);
+  CHECK(chunkedIds == ids);
+  CHECK(chunkedPositions == positions);
+}
+
+#endif // __CompactionTest_h
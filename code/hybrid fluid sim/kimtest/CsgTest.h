@@ -0,0 +1,204 @@
+#ifndef __CsgTest_h
+#define __CsgTest_h
+
+#include "Box.h"
+#include "CsgSurface.h"
+#include "Sphere.h"
+#include "Test.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// The compiled program combines the distances of its children as the
+// operations define: min for union, max for intersection and max(a, -b)
+// for difference.
+inline void
+testCsgOperations()
+{
+  using namespace cg;
+  using vec_type = cg::Vector<float, 2>;
+  using surface_type = math::Surface<2, float>;
+
+  puts("**CSG operations test**");
+
+  Reference<surface_type> a = new Sphere<2, float>(vec_type{ 0.0f }, 1.0f);
+  Reference<surface_type> b = new Box<2, float>(vec_type{ 0.2f, -0.4f }, vec_type{ 1.5f, 0.4f });
+  CsgSurface<2, float> csg[3];
+
+  csg[0].add(a);
+  csg[0].add(b, CsgOperation::Union);
+  csg[1].add(a);
+  csg[1].add(b, CsgOperation::Intersection);
+  csg[2].add(a);
+  csg[2].add(b, CsgOperation::Difference);
+  for (int i = 0; i < 500; ++i)
+  {
+    vec_type p{ frand(-2, 2), frand(-2, 2) };
+    auto da = a->signedDistance(p);
+    auto db = b->signedDistance(p);
+    float expected[3]{ std::min(da, db), std::max(da, db), std::max(da, -db) };
+
+    for (int k = 0; k < 3; ++k)
+    {
+      CHECK(std::abs(csg[k].signedDistance(p) - expected[k]) < 1e-5f);
+      // the inside test is exact away from the surface
+      if (std::abs(expected[k]) > 1e-4f)
+        CHECK(csg[k].isInside(p) == (expected[k] < 0));
+    }
+  }
+}
+
+// Scales of the children and of nested CSG surfaces scale their distances.
+inline void
+testCsgScale()
+{
+  using namespace cg;
+  using vec_type = cg::Vector<float, 2>;
+  using surface_type = math::Surface<2, float>;
+
+  puts("**CSG scale test**");
+
+  // a unit box scaled by (2, 0.5) in a CSG scaled by 3 and moved to (1, 1)
+  Reference<surface_type> box = new Box<2, float>(vec_type{ -1.0f }, vec_type{ 1.0f });
+  box->transform.setScale(vec_type{ 2.0f, 0.5f });
+
+  Reference<CsgSurface<2, float>> inner = new CsgSurface<2, float>;
+  inner->add(box);
+  inner->transform.setScale(3.0f);
+  inner->transform.setPosition(vec_type{ 1.0f, 1.0f });
+
+  CsgSurface<2, float> csg;
+  csg.add(Reference<surface_type>(inner.get()));
+
+  // the same box in world space: [-5, 7] x [-0.5, 2.5]
+  Box<2, float> reference{ vec_type{ -5.0f, -0.5f }, vec_type{ 7.0f, 2.5f } };
+
+  for (int i = 0; i < 500; ++i)
+  {
+    vec_type p{ frand(-8, 10), frand(-4, 6) };
+    auto expected = reference.signedDistance(p);
+
+    // a non-uniform scale only bounds the distance along its short axis
+    if (expected > 0)
+      CHECK(csg.signedDistance(p) <= expected + 1e-4f);
+    if (std::abs(expected) > 1e-4f)
+      CHECK(csg.isInside(p) == (expected < 0));
+  }
+
+  // a uniformly scaled sphere is a sphere of the scaled radius
+  Reference<surface_type> sphere = new Sphere<2, float>(vec_type{ 0.0f }, 1.0f);
+  sphere->transform.setPosition(vec_type{ 3.0f, 0.0f });
+  sphere->transform.setScale(2.0f);
+
+  CsgSurface<2, float> scaled;
+  scaled.add(sphere);
+  for (int i = 0; i < 100; ++i)
+  {
+    vec_type p{ frand(-2, 8), frand(-4, 4) };
+    auto expected = (p - vec_type{ 3.0f, 0.0f }).length() - 2;
+
+    CHECK(std::abs(scaled.signedDistance(p) - expected) < 1e-4f);
+  }
+}
+
+// Scaled surfaces give their distances in world units, alone and as the
+// root of a CSG surface, in single and batched queries.
+inline void
+testSurfaceScale()
+{
+  using namespace cg;
+  using vec_type = cg::Vector<float, 2>;
+  using surface_type = math::Surface<2, float>;
+
+  puts("**Surface scale test**");
+
+  Sphere<2, float> sphere{ vec_type{ 0.0f }, 1.0f };
+  sphere.transform.setPosition(vec_type{ 3.0f, 0.0f });
+  sphere.transform.setScale(2.0f);
+
+  // a CSG surface scaled by 2 around a unit sphere
+  CsgSurface<2, float> csg;
+  csg.add(new Sphere<2, float>(vec_type{ 0.0f }, 1.0f));
+  csg.transform.setPosition(vec_type{ 3.0f, 0.0f });
+  csg.transform.setScale(2.0f);
+
+  // the same sphere behind a CSG surface as a generic child
+  Reference<surface_type> box = new Box<2, float>(vec_type{ -1.0f }, vec_type{ 1.0f });
+  box->transform.setScale(2.0f);
+
+  CsgSurface<2, float> generic;
+  generic.add(box);
+
+  constexpr int n = 100;
+  const auto band = 1.5f;
+  vec_type points[n];
+  float expected[n];
+  float distances[n];
+
+  for (int i = 0; i < n; ++i)
+  {
+    points[i] = vec_type{ frand(-2, 8), frand(-4, 4) };
+    expected[i] = (points[i] - vec_type{ 3.0f, 0.0f }).length() - 2;
+
+    surface_type::QueryResult result;
+    sphere.closestQuery(points[i], result);
+    CHECK(std::abs(sphere.signedDistance(points[i]) - expected[i]) < 1e-4f);
+    CHECK(std::abs(sphere.closestDistance(points[i]) - std::abs(expected[i])) < 1e-4f);
+    CHECK(std::abs(result.distance - std::abs(expected[i])) < 1e-4f);
+    CHECK(std::abs(csg.signedDistance(points[i]) - expected[i]) < 1e-4f);
+
+    // [-2, 2]^2 in world space
+    auto q = vec_type{ std::abs(points[i].x), std::abs(points[i].y) } - vec_type{ 2.0f };
+    auto boxDistance = vec_type{ std::max(q.x, 0.0f), std::max(q.y, 0.0f) }.length() +
+      std::min(std::max(q.x, q.y), 0.0f);
+    CHECK(std::abs(box->signedDistance(points[i]) - boxDistance) < 1e-4f);
+    CHECK(std::abs(generic.signedDistance(points[i]) - boxDistance) < 1e-4f);
+  }
+
+  sphere.signedDistance(points, n, distances, band);
+  for (int i = 0; i < n; ++i)
+    CHECK(std::abs(distances[i] - std::clamp(expected[i], -band, band)) < 1e-4f);
+  csg.signedDistance(points, n, distances, band);
+  for (int i = 0; i < n; ++i)
+    CHECK(std::abs(distances[i] - std::clamp(expected[i], -band, band)) < 1e-4f);
+}
+
+// A child that would overflow the evaluation stack is rejected, and the
+// surface keeps its previous children.
+inline void
+testCsgDepth()
+{
+  using namespace cg;
+  using vec_type = cg::Vector<float, 2>;
+  using surface_type = math::Surface<2, float>;
+
+  puts("**CSG depth test**");
+
+  Reference<CsgSurface<2, float>> inner = new CsgSurface<2, float>;
+  inner->add(new Sphere<2, float>(vec_type{ 0.0f }, 1.0f));
+
+  constexpr auto maxStackSize = CsgSurface<2, float>::maxStackSize;
+  size_t depth = 1;
+  bool thrown = false;
+
+  for (; depth <= maxStackSize + 1 && !thrown; ++depth)
+  {
+    Reference<CsgSurface<2, float>> outer = new CsgSurface<2, float>;
+    outer->add(new Box<2, float>(vec_type{ -2.0f }, vec_type{ 2.0f }));
+    try
+    {
+      outer->add(Reference<surface_type>(inner.get()), CsgOperation::Difference);
+      inner = outer;
+    }
+    catch (const std::runtime_error&)
+    {
+      thrown = true;
+      CHECK(outer->size() == 1);
+      CHECK(std::abs(outer->signedDistance(vec_type{ 3.0f, 0.0f }) - 1) < 1e-5f);
+    }
+  }
+  CHECK(thrown);
+  CHECK(depth > maxStackSize / 2);
+}
+
+#endif // __CsgTest_h
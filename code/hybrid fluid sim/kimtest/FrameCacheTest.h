@@ -0,0 +1,137 @@
+#ifndef __FrameCacheTest_h
+#define __FrameCacheTest_h
+
+#include "CellCenteredScalarGrid.h"
+#include "FaceCenteredGrid.h"
+#include "FrameCache.h"
+#include "Test.h"
+#include <filesystem>
+
+// Scalar grids, velocities and points read back from the frame files with
+// their layout, exactly in Float32 and rounded to half in Float16.
+inline void
+testFrameCacheRoundTrip()
+{
+  using namespace cg;
+  using vec_type = cg::Vector<float, 2>;
+
+  printf("**Frame cache round trip test**\n");
+
+  Index2 size{ int64_t(24), int64_t(17) };
+  vec_type spacing{ 0.5f, 0.25f };
+  vec_type origin{ -1.0f, 2.0f };
+  CellCenteredScalarGrid<2, float> density{ size, spacing, origin };
+  FaceCenteredGrid<2, float> velocity{ size, spacing, origin };
+  Grid<2, float>* grids[]{ velocity.data<0>(), velocity.data<1>() };
+  vec_type points[]{ { 1.0f, 2.0f }, { -3.0f, 1e-3f }, { 65504.0f, 1e5f } };
+
+  for (int64_t i = 0; i < density.length(); ++i)
+    density[i] = frand(0, 1);
+  for (auto grid : grids)
+    for (int64_t i = 0; i < grid->length(); ++i)
+      (*grid)[i] = frand(-10, 10);
+
+  {
+    FrameCacheWriter writer{ tempPath("frame_"), 1 };
+
+    for (int frame = 0; frame < 2; ++frame)
+    {
+      writer.setDefaultEncoding(frame == 0 ? CacheEncoding::Float32 : CacheEncoding::Float16);
+      writer.beginFrame(frame, frame / 60.0);
+      writer.addScalarGrid("density", density);
+      writer.addVelocity("velocity", velocity);
+      writer.addPoints("points", points, 3);
+      writer.endFrame();
+    }
+    writer.flush();
+    CHECK(writer.path(1) == tempPath("frame_") + "0001.sgfc");
+  }
+
+  for (int frame = 0; frame < 2; ++frame)
+  {
+    auto encoding = frame == 0 ? CacheEncoding::Float32 : CacheEncoding::Float16;
+    auto decode = [&](float value) {
+      return frame == 0 ? value : half::toFloat(half::fromFloat(value));
+    };
+    FrameCacheReader reader{ tempPath("frame_") + (frame == 0 ? "0000.sgfc" : "0001.sgfc") };
+
+    CHECK(reader.frame() == frame);
+    CHECK(reader.time() == frame / 60.0);
+    CHECK(reader.channels().size() == 4);
+    for (const auto& channel : reader.channels())
+    {
+      CHECK(channel.encoding == encoding);
+      CHECK(channel.offset % FrameCacheHeader::alignment == 0);
+    }
+
+    auto channel = reader.findChannel("density");
+    auto values = reader.read("density");
+    size_t mismatches = 0;
+
+    CHECK(channel != nullptr && channel->kind == CacheChannelKind::Grid);
+    CHECK(channel->size[0] == 24 && channel->size[1] == 17 && channel->size[2] == 1);
+    CHECK(channel->origin[0] == density.dataOrigin().x && channel->origin[1] == density.dataOrigin().y);
+    CHECK(channel->spacing[0] == 0.5f && channel->spacing[1] == 0.25f);
+    for (int64_t i = 0; i < density.length(); ++i)
+      mismatches += values[i] != decode(density[i]);
+
+    const char* names[]{ "velocity.u", "velocity.v" };
+
+    for (int d = 0; d < 2; ++d)
+    {
+      channel = reader.findChannel(names[d]);
+      values = reader.read(names[d]);
+      CHECK(channel->size[0] == grids[d]->size().x && channel->size[1] == grids[d]->size().y);
+      CHECK(values.size() == size_t(grids[d]->length()));
+      for (int64_t i = 0; i < grids[d]->length(); ++i)
+        mismatches += values[i] != decode((*grids[d])[i]);
+    }
+
+    channel = reader.findChannel("points");
+    values = reader.read("points");
+    CHECK(channel->kind == CacheChannelKind::Points && channel->components == 2);
+    CHECK(values.size() == 6);
+    for (size_t i = 0; i < 6; ++i)
+      mismatches += values[i] != decode(points[i / 2][int(i % 2)]);
+    CHECK(mismatches == 0);
+    CHECK(reader.findChannel("pressure") == nullptr);
+    CHECK(throwsRuntimeError([&]() { reader.read("pressure"); }));
+  }
+}
+
+// Bad channel names and damaged files are reported.
+inline void
+testFrameCacheErrors()
+{
+  using namespace cg;
+
+  printf("**Frame cache errors test**\n");
+
+  Index2 size{ int64_t(8) };
+  CellCenteredScalarGrid<2, float> density{ size, cg::Vector<float, 2>{ 1.0f }, cg::Vector<float, 2>{ 0.0f } };
+  auto prefix = tempPath("errors_");
+  FrameCacheWriter writer{ prefix };
+
+  writer.beginFrame(0, 0);
+  CHECK(throwsRuntimeError([&]() {
+    writer.addScalarGrid("a_channel_name_of_thirty_two_chr", density);
+    }));
+  // 31 characters still fit with the terminator
+  writer.addScalarGrid("a_channel_name_of_thirty_one_ch", density);
+  writer.endFrame();
+  writer.flush();
+
+  auto path = writer.path(0);
+  auto fileSize = std::filesystem::file_size(path);
+
+  CHECK(FrameCacheReader{ path }.findChannel("a_channel_name_of_thirty_one_ch") != nullptr);
+  std::filesystem::resize_file(path, fileSize - 1);
+  CHECK(throwsRuntimeError([&]() { FrameCacheReader reader{ path }; }));
+  std::filesystem::resize_file(path, sizeof(FrameCacheHeader) + 1);
+  CHECK(throwsRuntimeError([&]() { FrameCacheReader reader{ path }; }));
+  std::filesystem::resize_file(path, 4);
+  CHECK(throwsRuntimeError([&]() { FrameCacheReader reader{ path }; }));
+  CHECK(throwsRuntimeError([&]() { FrameCacheReader reader{ writer.path(1) }; }));
+}
+
+#endif // __FrameCacheTest_h
@@ -0,0 +1,140 @@
+#ifndef __HalfTest_h
+#define __HalfTest_h
+
+#include "Half.h"
+#include "ReproducibilityCheck.h"
+#include "Test.h"
+#include <cmath>
+
+// Every half converts to a float and back to the same bits, floats round to
+// the nearest half with ties to even, and the ends of the range go to zero,
+// subnormals and infinity as IEEE 754 says.
+inline void
+testHalfConversion()
+{
+  using namespace cg;
+
+  printf("**Half conversion test**\n");
+
+  size_t badRoundTrips = 0;
+  size_t badRoundings = 0;
+
+  for (uint32_t h = 0; h < 0x10000u; ++h)
+  {
+    auto f = half::toFloat(uint16_t(h));
+    auto isNaN = (h & 0x7c00u) == 0x7c00u && (h & 0x3ffu) != 0;
+
+    if (isNaN)
+      badRoundTrips += !std::isnan(f) || !std::isnan(half::toFloat(half::fromFloat(f)));
+    else
+      badRoundTrips += half::fromFloat(f) != h;
+
+    // the midpoint between h and the next half up is exact in float, and
+    // goes to whichever of the two is even
+    if ((h & 0x7fffu) >= 0x7bffu)
+      continue;
+
+    auto next = half::toFloat(uint16_t(h + 1));
+    auto middle = (f + next) / 2;
+    auto even = uint16_t(h & 1 ? h + 1 : h);
+
+    badRoundings += half::fromFloat(middle) != even;
+    badRoundings += half::fromFloat(std::nextafter(middle, 2 * next)) != h + 1;
+    badRoundings += half::fromFloat(std::nextafter(middle, 2 * f - next)) != h;
+  }
+  CHECK(badRoundTrips == 0);
+  CHECK(badRoundings == 0);
+
+  auto inf = math::Limits<float>::inf();
+
+  CHECK(half::toFloat(0x3c00u) == 1.0f);
+  CHECK(half::toFloat(0x0001u) == std::ldexp(1.0f, -24));
+  CHECK(half::toFloat(0x7bffu) == 65504.0f);
+  CHECK(half::fromFloat(-0.0f) == 0x8000u);
+  CHECK(half::fromFloat(65519.99f) == 0x7bffu);
+  CHECK(half::fromFloat(65520.0f) == 0x7c00u);
+  CHECK(half::fromFloat(1e10f) == 0x7c00u);
+  CHECK(half::fromFloat(inf) == 0x7c00u);
+  CHECK(half::fromFloat(-inf) == 0xfc00u);
+  CHECK(half::fromFloat(std::ldexp(1.0f, -25)) == 0);
+  CHECK(half::fromFloat(std::nextafter(std::ldexp(1.0f, -25), 1.0f)) == 1);
+  CHECK(half::fromFloat(-1e-10f) == 0x8000u);
+  CHECK(std::isnan(half::toFloat(half::fromFloat(std::nanf("")))));
+
+  Half value{ 1.0f };
+
+  value += 1.0f / 4096;
+  CHECK(float(value) == 1.0f);
+  value *= 3;
+  CHECK(float(value) == 3.0f);
+}
+
+// Returns a 2D grid scene advecting a density block of size^2 cells for
+// the given number of frames.
+inline cg::JsonValue
+densityBlockScene(int size, int frames)
+{
+  auto description = cg::JsonValue::parse(R"({
+    "dimension": 2,
+    "solver": { "type": "grid", "gravity": [0, 0] },
+    "emitters": [{
+      "shape": { "type": "box", "min": [0.3, 0.3], "max": [0.6, 0.6] },
+      "density": 1,
+      "velocity": [0.5, 0.2]
+    }]
+  })");
+  auto grid = cg::JsonValue::object();
+  auto time = cg::JsonValue::object();
+
+  grid.set("size", size);
+  grid.set("spacing", 1.0 / size);
+  time.set("frames", frames);
+  description.set("grid", grid);
+  description.set("time", time);
+  return description;
+}
+
+// A density advected with half precision channels stays close to the full
+// precision one.
+inline void
+testHalfChannels()
+{
+  using namespace cg;
+
+  printf("**Half channels test**\n");
+
+  auto error = ReproducibilityCheck{ densityBlockScene(48, 30) }.compareHalfChannels();
+
+  CHECK(error.maxError > 0);
+  CHECK(error.maxError < 2e-3);
+  CHECK(error.relativeL2 < 2e-3);
+  CHECK(throwsRuntimeError([]() {
+    auto description = densityBlockScene(16, 1);
+
+    description["solver"].set("type", "flip");
+    ReproducibilityCheck{ description }.compareHalfChannels();
+    }));
+}
+
+// Error and time of the half precision channels on a 96x96 density block
+// advected for 60 frames.
+inline void
+benchHalfChannels()
+{
+  using namespace cg;
+
+  printf("**Half channels benchmark**\n");
+
+  GridErrorReport error;
+  auto time = seconds([&]() {
+    error = ReproducibilityCheck{ densityBlockScene(96, 60) }.compareHalfChannels();
+    });
+
+  printf("96x96, 60 frames: max %.2g, rms %.2g, relative L2 %.2g (%.2f s)\n",
+    error.maxError,
+    error.rmsError,
+    error.relativeL2,
+    time);
+}
+
+#endif // __HalfTest_h
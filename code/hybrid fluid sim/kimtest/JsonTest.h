@@ -0,0 +1,135 @@
+#ifndef __JsonTest_h
+#define __JsonTest_h
+
+#include "Json.h"
+#include "Test.h"
+#include <clocale>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <string>
+
+// Returns true if a and b have the same bits, which tells -0 from 0.
+inline bool
+isSameNumber(double a, double b)
+{
+  return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+// Values parse with their types, and toString gives back text that parses
+// to the same values, numbers and escaped strings included.
+inline void
+testJsonRoundTrip()
+{
+  using namespace cg;
+
+  printf("**JSON round trip test**\n");
+
+  auto value = JsonValue::parse(R"( {
+    "null": null, "true": true, "false": false,
+    "numbers": [0, -0.0, 1e308, 5e-324, 0.1, -12.5E-3, 123456789012],
+    "string": "quote \" backslash \\ slash \/ \b\f\n\r\t \u00e9 \ud83d\ude00 \u0001",
+    "empty": { "array": [], "object": {} }
+  } )");
+
+  CHECK(value.isObject() && value.size() == 6);
+  CHECK(value["null"].isNull());
+  CHECK(value["true"].asBool() && !value["false"].asBool());
+  CHECK(value.get("missing", 7) == 7);
+  CHECK(value["empty"]["array"].isArray() && value["empty"]["array"].size() == 0);
+  CHECK(value["empty"]["object"].isObject() && value["empty"]["object"].size() == 0);
+
+  const auto& numbers = value["numbers"];
+  double expected[] = { 0, -0.0, 1e308, 5e-324, 0.1, -12.5e-3, 123456789012.0 };
+
+  CHECK(numbers.size() == 7);
+  for (size_t i = 0; i < 7; ++i)
+    CHECK(isSameNumber(numbers[i].asNumber(), expected[i]));
+  CHECK(value["string"].asString() ==
+    "quote \" backslash \\ slash / \b\f\n\r\t \xc3\xa9 \xf0\x9f\x98\x80 \x01");
+
+  auto text = value.toString();
+  auto reparsed = JsonValue::parse(text);
+
+  CHECK(reparsed.toString() == text);
+  CHECK(reparsed["string"].asString() == value["string"].asString());
+  for (size_t i = 0; i < 7; ++i)
+    CHECK(isSameNumber(reparsed["numbers"][i].asNumber(), expected[i]));
+
+  // members keep their order
+  CHECK(reparsed.members()[0].first == "null" && reparsed.members()[5].first == "empty");
+  CHECK(JsonValue::parse(JsonValue{ 1.0 / 3 }.toString()).asNumber() == 1.0 / 3);
+
+  // JSON has no infinities nor NaNs
+  CHECK(JsonValue{ std::numeric_limits<double>::infinity() }.toString() == "null");
+  CHECK(JsonValue{ std::numeric_limits<double>::quiet_NaN() }.toString() == "null");
+
+  // numbers do not depend on the locale, where one with a decimal comma
+  // is available
+  std::string locale = setlocale(LC_NUMERIC, nullptr);
+
+  for (auto name : { "de_DE.UTF-8", "de_DE", "German_Germany.1252", "fr_FR.UTF-8" })
+    if (setlocale(LC_NUMERIC, name) != nullptr)
+    {
+      CHECK(JsonValue::parse("0.5").asNumber() == 0.5);
+      CHECK(JsonValue{ 2.25 }.toString() == "2.25");
+      break;
+    }
+  setlocale(LC_NUMERIC, locale.c_str());
+}
+
+// Malformed text is rejected with the line of the error, and nesting is
+// limited before it can overflow the stack.
+inline void
+testJsonErrors()
+{
+  using namespace cg;
+
+  printf("**JSON errors test**\n");
+
+  const char* invalid[] = {
+    "", " ", "[1,]", "[1 2]", "{\"a\" 1}", "{\"a\": 1,}", "{a: 1}",
+    "01", "-", "1.", "1e", ".5", "+1", "tru", "nul", "[1] x",
+    "\"abc", "\"\\x\"", "\"\\u12g4\"", "\"\\ud800\"", "\"\\ud800\\u0041\"",
+    "\"\\udc00\"", "\"\\udfff\\ud800\"", "1e999", "-1e999",
+    "\"tab\there\"", "'a'"
+  };
+  size_t accepted = 0;
+
+  for (auto text : invalid)
+    if (!throwsRuntimeError([&]() { JsonValue::parse(text); }))
+    {
+      printf("accepted: %s\n", text);
+      ++accepted;
+    }
+  CHECK(accepted == 0);
+
+  std::string message;
+
+  try
+  {
+    JsonValue::parse("{\n  \"a\": 1,\n  \"b\": x\n}");
+  }
+  catch (const std::runtime_error& e)
+  {
+    message = e.what();
+  }
+  CHECK(message.find("line 3") == 0);
+
+  auto nested = [](size_t depth) {
+    return std::string(depth, '[') + std::string(depth, ']');
+  };
+
+  CHECK(!throwsRuntimeError([&]() { JsonValue::parse(nested(257)); }));
+  CHECK(throwsRuntimeError([&]() { JsonValue::parse(nested(258)); }));
+  CHECK(throwsRuntimeError([&]() { JsonValue::parse(nested(100000)); }));
+
+  auto value = JsonValue::parse("{\"a\": [1.5, \"s\"]}");
+
+  CHECK(throwsRuntimeError([&]() { value["b"]; }));
+  CHECK(throwsRuntimeError([&]() { value["a"][2]; }));
+  CHECK(throwsRuntimeError([&]() { value["a"][0].asInt(); }));
+  CHECK(throwsRuntimeError([&]() { value["a"][1].asNumber(); }));
+}
+
+#endif // __JsonTest_h
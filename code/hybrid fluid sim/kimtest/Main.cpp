@@ -0,0 +1,62 @@
+#include "BccLatticeTest.h"
+#include "BvhTest.h"
+#include "CheckpointTest.h"
+#include "ColliderTest.h"
+#include "CompactionTest.h"
+#include "CsgTest.h"
+#include "FrameCacheTest.h"
+#include "HalfTest.h"
+#include "JsonTest.h"
+#include "MeshReaderTest.h"
+#include "OutflowTest.h"
+#include "ParticleCacheTest.h"
+#include "PoissonDiskTest.h"
+#include "PressureTest.h"
+#include "ReproducibilityTest.h"
+#include <cstring>
+
+// Runs the tests, or the benchmarks if the first argument is "bench".
+// Returns the number of failed checks.
+int
+main(int argc, char** argv)
+{
+  if (argc > 1 && strcmp(argv[1], "bench") == 0)
+  {
+    benchHalfChannels();
+    benchMixedPrecisionPressure();
+    benchMeshReader();
+    benchParticleCache();
+    return 0;
+  }
+  testBvhClosestPoint();
+  testBvhInside();
+  testColliderRotatedNormal();
+  testCsgOperations();
+  testCsgScale();
+  testSurfaceScale();
+  testCsgDepth();
+  testPoissonDiskSpacing<2>(0.05f, 2.0f, 0.6f);
+  testPoissonDiskSpacing<3>(0.1f, 1.0f, 0.45f);
+  testBccLattice();
+  testVolumeEmitter3();
+  testStableCompaction();
+  testCheckpointFormat();
+  testCheckpointRestore();
+  testFrameCacheRoundTrip();
+  testFrameCacheErrors();
+  testJsonRoundTrip();
+  testJsonErrors();
+  testHalfConversion();
+  testHalfChannels();
+  testMixedPrecisionPressure();
+  testOutflowProjection();
+  testWindowEdgeProjection();
+  testObjReader();
+  testPlyReader();
+  testMeshCache();
+  testParticleCacheVarint();
+  testParticleCacheFrames();
+  testDeterministicRuns();
+  printf("%d failed checks\n", failureCount());
+  return failureCount();
+}
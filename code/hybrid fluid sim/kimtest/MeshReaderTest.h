@@ -0,0 +1,332 @@
+#ifndef __MeshReaderTest_h
+#define __MeshReaderTest_h
+
+#include "Test.h"
+#include "utils/MeshReader.h"
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+// Writes size bytes of data to the scratch file name and returns its path.
+inline std::string
+writeTestFile(const std::string& name, const void* data, size_t size)
+{
+  auto path = tempPath(name);
+
+  std::ofstream{ path, std::ios::binary }.write((const char*)data, size);
+  return path;
+}
+
+inline std::string
+writeTestFile(const std::string& name, const std::string& text)
+{
+  return writeTestFile(name, text.data(), text.size());
+}
+
+// Returns true if mesh has the given vertices and triangles.
+inline bool
+isMesh(const cg::TriangleMesh* mesh,
+  const std::vector<cg::vec3f>& vertices,
+  const std::vector<std::array<int, 3>>& triangles)
+{
+  if (mesh == nullptr)
+    return false;
+
+  const auto& data = mesh->data();
+
+  if (data.numberOfVertices != int(vertices.size())
+    || data.numberOfTriangles != int(triangles.size()))
+    return false;
+  for (size_t i = 0; i < vertices.size(); ++i)
+    if (data.vertices[i] != vertices[i])
+      return false;
+  for (size_t i = 0; i < triangles.size(); ++i)
+    for (int j = 0; j < 3; ++j)
+      if (data.triangles[i].v[j] != triangles[i][j])
+        return false;
+  return true;
+}
+
+// Vertices and triangles of the meshes written by the reader tests.
+inline const std::vector<cg::vec3f>&
+testMeshVertices()
+{
+  static const std::vector<cg::vec3f> vertices{
+    { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 }, { 0.5f, 0.5f, 1.5f }
+  };
+  return vertices;
+}
+
+inline const std::vector<std::array<int, 3>>&
+testMeshTriangles()
+{
+  static const std::vector<std::array<int, 3>> triangles{
+    { 0, 1, 2 }, { 0, 1, 2 }, { 0, 2, 3 }, { 4, 3, 2 }
+  };
+  return triangles;
+}
+
+// Faces of every vertex format, polygons split into fans and relative
+// indices read as the OBJ format says; bad files fail to read.
+inline void
+testObjReader()
+{
+  using namespace cg;
+
+  printf("**OBJ reader test**\n");
+
+  auto path = writeTestFile("mesh.obj",
+    "# comment\n"
+    "o mesh\r\n"
+    "v 0 0 0\n"
+    "v 1.0 0 0\r\n"
+    "  v 1 1e0 0\n"
+    "v 0 1 -0\n"
+    "vn 0 0 1\n"
+    "vt 0 0\n"
+    "\n"
+    "f 1 2 3\n"
+    "f 1/1/1 2/1/1 3/1/1 4/1/1\r\n"
+    "v 0.5 0.5 15E-1\n"
+    "f -1//1 -2//1 -3//1");
+  Reference<TriangleMesh> mesh = MeshReader::readOBJ(path.c_str());
+
+  CHECK(isMesh(mesh, testMeshVertices(), testMeshTriangles()));
+  CHECK(mesh != nullptr && mesh->hasVertexNormals());
+
+  const char* invalid[]{
+    "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n",
+    "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 -4\n",
+    "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 0 1 2\n",
+    "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 x\n",
+    "v 0 0\n"
+  };
+  size_t accepted = 0;
+
+  for (auto text : invalid)
+  {
+    path = writeTestFile("invalid.obj", text);
+    accepted += Reference<TriangleMesh>{ MeshReader::readOBJ(path.c_str()) } != nullptr;
+  }
+  CHECK(accepted == 0);
+  CHECK(MeshReader::readOBJ(tempPath("none.obj").c_str()) == nullptr);
+
+  // a mesh large enough to be parsed in several chunks on a multicore
+  constexpr int n = 400;
+  std::string text;
+  std::vector<vec3f> vertices;
+  std::vector<std::array<int, 3>> triangles;
+
+  for (int j = 0; j <= n; ++j)
+    for (int i = 0; i <= n; ++i)
+    {
+      vertices.emplace_back(i * 0.25f, j * 0.5f, float(i ^ j));
+      text += "v " + std::to_string(i * 0.25) + ' ' + std::to_string(j * 0.5) +
+        ' ' + std::to_string(i ^ j) + '\n';
+    }
+  for (int j = 0; j < n; ++j)
+    for (int i = 0; i < n; ++i)
+    {
+      auto v = j * (n + 1) + i + 1;
+
+      triangles.push_back({ v - 1, v, v + n + 1 });
+      triangles.push_back({ v - 1, v + n + 1, v + n });
+      text += "f " + std::to_string(v) + ' ' + std::to_string(v + 1) + ' ' +
+        std::to_string(v + n + 2) + ' ' + std::to_string(v + n + 1) + '\n';
+    }
+  path = writeTestFile("grid.obj", text);
+  mesh = MeshReader::readOBJ(path.c_str());
+  CHECK(isMesh(mesh, vertices, triangles));
+}
+
+// ASCII and binary little endian PLY files give the same mesh as the OBJ
+// file, whatever the property types and the extra properties.
+inline void
+testPlyReader()
+{
+  using namespace cg;
+
+  printf("**PLY reader test**\n");
+
+  auto path = writeTestFile("ascii.ply",
+    "ply\n"
+    "format ascii 1.0\n"
+    "comment test mesh\n"
+    "element vertex 5\n"
+    "property float x\n"
+    "property float y\n"
+    "property float z\n"
+    "property uchar red\n"
+    "element face 3\n"
+    "property list uchar int vertex_indices\n"
+    "end_header\n"
+    "0 0 0 255\n"
+    "1 0 0 0\n"
+    "1 1 0 0\n"
+    "0 1 0 0\n"
+    "0.5 0.5 1.5 0\n"
+    "3 0 1 2\n"
+    "4 0 1 2 3\n"
+    "3 4 3 2\n");
+  Reference<TriangleMesh> mesh = MeshReader::readPLY(path.c_str());
+
+  CHECK(isMesh(mesh, testMeshVertices(), testMeshTriangles()));
+
+  std::string binary{
+    "ply\n"
+    "format binary_little_endian 1.0\n"
+    "element vertex 5\n"
+    "property double x\n"
+    "property float y\n"
+    "property short z\n"
+    "property uchar red\n"
+    "element face 3\n"
+    "property list uchar uint vertex_indices\n"
+    "property uchar flags\n"
+    "end_header\n"
+  };
+  auto append = [&binary](auto value) {
+    binary.append((const char*)&value, sizeof(value));
+  };
+
+  // z is a short, so the apex goes up to 2 instead of 1.5
+  for (const auto& v : testMeshVertices())
+  {
+    append(double(v.x));
+    append(float(v.y));
+    append(int16_t(v.z + 0.5f));
+    append(uint8_t(7));
+  }
+  for (const auto& face : std::vector<std::vector<uint32_t>>{ { 0, 1, 2 }, { 0, 1, 2, 3 }, { 4, 3, 2 } })
+  {
+    append(uint8_t(face.size()));
+    for (auto v : face)
+      append(v);
+    append(uint8_t(1));
+  }
+
+  auto vertices = testMeshVertices();
+
+  vertices[4].z = 2;
+  path = writeTestFile("binary.ply", binary.data(), binary.size());
+  mesh = MeshReader::readPLY(path.c_str());
+  CHECK(isMesh(mesh, vertices, testMeshTriangles()));
+
+  // truncated bodies and out of range indices fail
+  path = writeTestFile("binary.ply", binary.data(), binary.size() - 1);
+  CHECK(Reference<TriangleMesh>{ MeshReader::readPLY(path.c_str()) } == nullptr);
+  binary[binary.size() - 2] = 5;
+  path = writeTestFile("binary.ply", binary.data(), binary.size());
+  CHECK(Reference<TriangleMesh>{ MeshReader::readPLY(path.c_str()) } == nullptr);
+  path = writeTestFile("invalid.ply", "ply\nformat binary_big_endian 1.0\nend_header\n");
+  CHECK(MeshReader::readPLY(path.c_str()) == nullptr);
+}
+
+// read() writes binary copies only when a cache directory is set, one per
+// mesh file, and reads the mesh back from them while they are up to date.
+inline void
+testMeshCache()
+{
+  using namespace cg;
+  namespace fs = std::filesystem;
+
+  printf("**Mesh cache test**\n");
+
+  auto countCopies = [](const fs::path& directory) {
+    size_t n = 0;
+
+    for (const auto& entry : fs::recursive_directory_iterator{ directory })
+      n += entry.path().extension() == ".cgm";
+    return n;
+  };
+  auto directory = fs::path{ tempPath("cache") };
+  auto assets = directory.parent_path();
+  auto path = (assets / "cached.obj").string();
+  auto otherPath = assets / "other" / "cached.obj";
+
+  fs::remove_all(directory);
+  fs::create_directories(otherPath.parent_path());
+  fs::copy_file(tempPath("mesh.obj"), path, fs::copy_options::overwrite_existing);
+  fs::copy_file(path, otherPath, fs::copy_options::overwrite_existing);
+
+  // no copies by default
+  auto copies = countCopies(assets);
+  Reference<TriangleMesh> mesh = MeshReader::read(path.c_str());
+
+  CHECK(MeshReader::cacheDirectory().empty());
+  CHECK(isMesh(mesh, testMeshVertices(), testMeshTriangles()));
+  CHECK(countCopies(assets) == copies);
+
+  // a mesh of the same name in another directory gets its own copy
+  MeshReader::setCacheDirectory(directory.string());
+  mesh = MeshReader::read(path.c_str());
+  CHECK(isMesh(mesh, testMeshVertices(), testMeshTriangles()));
+  mesh = MeshReader::read(otherPath.string().c_str());
+  CHECK(isMesh(mesh, testMeshVertices(), testMeshTriangles()));
+  CHECK(countCopies(directory) == 2);
+
+  // the copy, normals included, is read while it is newer than the file
+  std::ofstream{ path } << "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n";
+
+  auto now = fs::file_time_type::clock::now();
+
+  fs::last_write_time(path, now - std::chrono::hours{ 1 });
+  mesh = MeshReader::read(path.c_str());
+  CHECK(isMesh(mesh, testMeshVertices(), testMeshTriangles()));
+  CHECK(mesh != nullptr && mesh->hasVertexNormals());
+  fs::last_write_time(path, now + std::chrono::hours{ 1 });
+  mesh = MeshReader::read(path.c_str());
+  CHECK(mesh != nullptr && mesh->data().numberOfTriangles == 1);
+  CHECK(countCopies(directory) == 2);
+  MeshReader::setCacheDirectory("");
+  CHECK(MeshReader::readCache(path.c_str()) == nullptr);
+}
+
+// Load times of a 700x700 grid mesh OBJ (491k vertices, 980k triangles)
+// parsed from the file and read from its binary copy.
+inline void
+benchMeshReader()
+{
+  using namespace cg;
+
+  printf("**Mesh reader benchmark**\n");
+
+  constexpr int n = 700;
+  std::string text;
+  char line[64];
+
+  for (int j = 0; j <= n; ++j)
+    for (int i = 0; i <= n; ++i)
+    {
+      snprintf(line, sizeof(line), "v %.6f %.6f %.6f\n", i / double(n), j / double(n), 0.1 * ((i * j) % 7));
+      text += line;
+    }
+  for (int j = 0; j < n; ++j)
+    for (int i = 0; i < n; ++i)
+    {
+      auto v = j * (n + 1) + i + 1;
+
+      snprintf(line, sizeof(line), "f %d %d %d\nf %d %d %d\n", v, v + 1, v + n + 2, v, v + n + 2, v + n + 1);
+      text += line;
+    }
+
+  auto path = writeTestFile("bench.obj", text);
+  Reference<TriangleMesh> mesh;
+  auto parseTime = seconds([&]() { mesh = MeshReader::readOBJ(path.c_str()); });
+  auto cache = tempPath("bench.cgm");
+
+  MeshReader::writeCache(*mesh, cache.c_str());
+
+  auto cacheTime = seconds([&]() { mesh = MeshReader::readCache(cache.c_str()); });
+
+  printf("%.1f MB OBJ, %d vertices, %d triangles: parsed %.3f s, cached copy %.3f s\n",
+    text.size() / 1e6,
+    mesh->data().numberOfVertices,
+    mesh->data().numberOfTriangles,
+    parseTime,
+    cacheTime);
+}
+
+#endif // __MeshReaderTest_h
@@ -0,0 +1,185 @@
+#ifndef __OutflowTest_h
+#define __OutflowTest_h
+
+#include "GridFluidSolver.h"
+#include "Test.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Grid fluid solver filled with fluid, with no forces, whose time-steps
+// only project the velocity. Its adaptive domain window covers the active
+// region set, if any.
+class ProjectionTestSolver: public cg::GridFluidSolver<2, double>
+{
+public:
+  using Base = cg::GridFluidSolver<2, double>;
+
+  ProjectionTestSolver(int64_t n):
+    Base{ cg::Index2{ n }, cg::Vector<double, 2>{ 1.0 / n }, cg::Vector<double, 2>{ 0.0 } }
+  {
+    setGravity(cg::Vector<double, 2>{ 0.0 });
+  }
+
+  // Runs one time-step of the solver.
+  void step(double timeInterval)
+  {
+    onAdvanceTimeStep(timeInterval);
+  }
+
+  // Applies the boundary condition the solver applies after a projection.
+  void constrainVelocity()
+  {
+    applyBoundaryCondition();
+  }
+
+  // Sets the region the adaptive domain window must cover.
+  void setActiveRegion(const cg::Bounds<double, 2>& bounds)
+  {
+    _activeRegion = bounds;
+  }
+
+protected:
+  cg::ScalarField<2, double>* fluidSdf() const override
+  {
+    return new cg::ConstantScalarField<2, double>(-1.0);
+  }
+
+  bool activeRegionBounds(cg::Bounds<double, 2>& bounds) const override
+  {
+    bounds = _activeRegion;
+    return !_activeRegion.empty();
+  }
+
+private:
+  cg::Bounds<double, 2> _activeRegion;
+
+}; // ProjectionTestSolver
+
+// Returns the max absolute flux through the faces of a cell of velocity,
+// i.e. its discrete divergence times the cell spacing, over the cells
+// with a face on the given side (or over all the cells if side < 0).
+inline double
+maxCellFlux(const cg::FaceCenteredGrid<2, double>& velocity, int side = -1)
+{
+  using cg::Index2;
+
+  auto n = velocity.size();
+  double flux = 0;
+
+  for (int64_t j = 0; j < n.y; ++j)
+    for (int64_t i = 0; i < n.x; ++i)
+    {
+      bool onSide[] = { i == 0, i == n.x - 1, j == 0, j == n.y - 1 };
+
+      if (side >= 0 && !onSide[side])
+        continue;
+
+      auto f = velocity.velocityAt<0>(Index2(i + 1, j)) - velocity.velocityAt<0>(Index2(i, j)) +
+        velocity.velocityAt<1>(Index2(i, j + 1)) - velocity.velocityAt<1>(Index2(i, j));
+
+      flux = std::max(flux, std::abs(f));
+    }
+  return flux;
+}
+
+// A uniform flow from the open left side to the open right side of the
+// domain, perturbed by random vertical velocities, is projected to a
+// divergence free field, also in the cells at the outflow, and the boundary
+// condition applied after the projection keeps the outflow faces.
+inline void
+testOutflowProjection()
+{
+  using namespace cg;
+
+  puts("**Outflow projection test**");
+
+  constexpr int64_t n = 32;
+  ProjectionTestSolver solver{ n };
+  auto& u = *solver.velocity();
+
+  solver.setClosedDomainBoundaryFlag(constants::directionDown | constants::directionUp);
+  for (int64_t j = 0; j < n; ++j)
+    for (int64_t i = 0; i <= n; ++i)
+      u.velocityAt<0>(Index2(i, j)) = 1;
+  for (int64_t j = 0; j <= n; ++j)
+    for (int64_t i = 0; i < n; ++i)
+      u.velocityAt<1>(Index2(i, j)) = frand(-1, 1);
+  CHECK(maxCellFlux(u) > 0.1);
+
+  solver.step(0.01);
+  CHECK(maxCellFlux(u, 1) < 1e-6);
+  CHECK(maxCellFlux(u) < 1e-6);
+
+  std::vector<double> outflow;
+  double maxOutflow = 0;
+
+  for (int64_t j = 0; j < n; ++j)
+  {
+    outflow.push_back(u.velocityAt<0>(Index2(n, j)));
+    maxOutflow = std::max(maxOutflow, std::abs(outflow.back()));
+  }
+  CHECK(maxOutflow > 0.1);
+
+  solver.constrainVelocity();
+
+  size_t changed = 0;
+
+  for (int64_t j = 0; j < n; ++j)
+    changed += u.velocityAt<0>(Index2(n, j)) != outflow[j];
+  CHECK(changed == 0);
+  CHECK(maxCellFlux(u) < 1e-6);
+}
+
+// The sides of an adaptive domain window inside the domain are open, and
+// the projection of a random velocity in the window is divergence free up
+// to the cells next to its edges.
+inline void
+testWindowEdgeProjection()
+{
+  using namespace cg;
+  using vec_type = cg::Vector<double, 2>;
+
+  puts("**Adaptive window edge projection test**");
+
+  constexpr int64_t n = 64;
+  ProjectionTestSolver solver{ n };
+
+  solver.setClosedDomainBoundaryFlag(constants::directionLeft | constants::directionRight |
+    constants::directionDown | constants::directionUp);
+  solver.adaptiveDomain().setMargin(2);
+  solver.adaptiveDomain().setBlockSize(8);
+  solver.setActiveRegion(Bounds<double, 2>{ vec_type{ 0.4 }, vec_type{ 0.6 } });
+  solver.setUseAdaptiveDomain(true);
+
+  // the first step moves the window around the active region
+  solver.step(0.01);
+
+  const auto& window = solver.adaptiveDomain();
+  auto windowMin = window.windowMin();
+  auto windowSize = window.windowSize();
+
+  CHECK(windowMin.x > 0 && windowMin.y > 0);
+  CHECK(windowMin.x + windowSize.x < n && windowMin.y + windowSize.y < n);
+  CHECK(solver.windowBoundaryFlag() == constants::directionNone);
+
+  auto& u = *solver.velocity();
+
+  CHECK(u.size() == windowSize);
+  for (int64_t j = 0; j < windowSize.y; ++j)
+    for (int64_t i = 0; i <= windowSize.x; ++i)
+      u.velocityAt<0>(Index2(i, j)) = frand(-1, 1);
+  for (int64_t j = 0; j <= windowSize.y; ++j)
+    for (int64_t i = 0; i < windowSize.x; ++i)
+      u.velocityAt<1>(Index2(i, j)) = frand(-1, 1);
+  CHECK(maxCellFlux(u) > 0.1);
+
+  solver.step(0.01);
+  CHECK(window.windowMin() == windowMin);
+  CHECK(solver.velocity().get() == &u);
+  for (int side = 0; side < 4; ++side)
+    CHECK(maxCellFlux(u, side) < 1e-6);
+  CHECK(maxCellFlux(u) < 1e-6);
+}
+
+#endif // __OutflowTest_h
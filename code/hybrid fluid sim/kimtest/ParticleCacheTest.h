@@ -0,0 +1,317 @@
+#ifndef __ParticleCacheTest_h
+#define __ParticleCacheTest_h
+
+#include "Half.h"
+#include "ParticleCache.h"
+#include "Test.h"
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+// Frames of a synthetic 3D particle stream in a unit box: the particles
+// drift, and 1% of them are killed and as many emitted every frame.
+struct TestParticleStream
+{
+  using vec_type = cg::Vector<float, 3>;
+
+  std::vector<vec_type> positions;
+  std::vector<vec_type> velocities;
+  std::vector<uint64_t> ids;
+  uint64_t nextId{};
+
+  explicit TestParticleStream(size_t count)
+  {
+    for (size_t i = 0; i < count; ++i)
+      emit(vec_type{ frand(0, 1), frand(0, 0.5f), frand(0, 1) },
+        vec_type{ frand(-0.5f, 0.5f), -1, 0.1f });
+  }
+
+  void emit(const vec_type& position, const vec_type& velocity)
+  {
+    positions.push_back(position);
+    velocities.push_back(velocity);
+    ids.push_back(nextId++);
+  }
+
+  void step()
+  {
+    size_t n = 0;
+    auto count = positions.size();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (frand(0, 1) < 0.01f)
+        continue;
+      for (int d = 0; d < 3; ++d)
+        positions[n][d] = std::clamp(positions[i][d] + velocities[i][d] / 600, 0.0f, 1.0f);
+      velocities[n] = velocities[i];
+      ids[n++] = ids[i];
+    }
+    positions.resize(n);
+    velocities.resize(n);
+    ids.resize(n);
+    for (size_t i = 0; i < count / 100; ++i)
+      emit(vec_type{ frand(0, 1), frand(0.9f, 1), frand(0, 1) }, vec_type{ 0, -1, 0 });
+  }
+
+}; // TestParticleStream
+
+// Returns the header of the particle cache file path.
+inline cg::ParticleCacheHeader
+readParticleCacheHeader(const std::string& path)
+{
+  cg::ParticleCacheHeader header{};
+
+  std::ifstream{ path, std::ios::binary }.read((char*)&header, sizeof(header));
+  return header;
+}
+
+// Errors of a decoded frame against the particles written, matched by id.
+struct ParticleFrameError
+{
+  bool sameParticles{};
+  double position{};
+  double velocity{};
+
+  ParticleFrameError(const cg::ParticleCacheReader& reader,
+    const std::vector<cg::Vector<float, 3>>& positions,
+    const std::vector<cg::Vector<float, 3>>& velocities,
+    const std::vector<uint64_t>& ids)
+  {
+    std::unordered_map<uint64_t, size_t> index;
+
+    for (size_t i = 0; i < ids.size(); ++i)
+      index[ids[i]] = i;
+    sameParticles = reader.size() == ids.size() && reader.ids().size() == ids.size();
+    for (size_t k = 0; sameParticles && k < reader.size(); ++k)
+    {
+      auto i = index.find(reader.ids()[k]);
+
+      if (i == index.end())
+      {
+        sameParticles = false;
+        break;
+      }
+      for (int d = 0; d < 3; ++d)
+      {
+        auto v = cg::half::toFloat(cg::half::fromFloat(velocities[i->second][d]));
+
+        position = std::max(position, double(std::abs(reader.positions()[k * 3 + d] - positions[i->second][d])));
+        velocity = std::max(velocity, double(std::abs(reader.velocities()[k * 3 + d] - v)));
+      }
+      index.erase(i);
+    }
+  }
+
+}; // ParticleFrameError
+
+// Zigzag varints round trip over the whole 64-bit range, take one byte per
+// 7 bits, and truncated ones are rejected.
+inline void
+testParticleCacheVarint()
+{
+  using namespace cg::internal;
+
+  printf("**Particle cache varint test**\n");
+
+  std::vector<int64_t> values{ 0, 1, -1, 63, -64, 64, -65, 1 << 20,
+    std::numeric_limits<int64_t>::max(), std::numeric_limits<int64_t>::min() };
+
+  for (int i = 0; i < 1000; ++i)
+    values.push_back(int64_t(rng()()) << (i % 33) ^ -int64_t(i & 1));
+
+  std::vector<uint8_t> buffer(values.size() * 10);
+  auto out = buffer.data();
+
+  for (auto value : values)
+    out = putVarint(out, zigzag(value));
+
+  const uint8_t* in = buffer.data();
+  size_t mismatches = 0;
+
+  for (auto value : values)
+  {
+    uint64_t code;
+
+    mismatches += !getVarint(in, out, code) || unzigzag(code) != value;
+  }
+  CHECK(mismatches == 0);
+  CHECK(in == out);
+  CHECK(zigzag(-1) == 1 && zigzag(1) == 2 && zigzag(-64) == 127);
+  CHECK(putVarint(buffer.data(), 127) - buffer.data() == 1);
+  CHECK(putVarint(buffer.data(), 128) - buffer.data() == 2);
+  CHECK(putVarint(buffer.data(), ~uint64_t(0)) - buffer.data() == 10);
+
+  uint64_t code;
+
+  in = buffer.data();
+  CHECK(!getVarint(in, buffer.data() + 9, code));
+}
+
+// Keyframes and delta frames decode to the particles written, read in
+// order or seeking back and forth, and damaged frames are reported.
+inline void
+testParticleCacheFrames()
+{
+  using namespace cg;
+
+  printf("**Particle cache frames test**\n");
+
+  // more than two chunks of 64K particles
+  TestParticleStream stream{ 150000 };
+  std::vector<TestParticleStream> frames;
+  auto prefix = tempPath("particles_");
+  ParticleCacheWriter writer{ prefix, 5 };
+  Bounds<float, 3> bounds{ TestParticleStream::vec_type{ 0.0f }, TestParticleStream::vec_type{ 1.0f } };
+  std::vector<uint64_t> sizes;
+
+  for (int f = 0; f < 12; ++f)
+  {
+    frames.push_back(stream);
+    writer.write(f, f / 60.0, bounds, stream.positions.data(), stream.velocities.data(), stream.ids.data(), stream.positions.size());
+    sizes.push_back(std::filesystem::file_size(writer.path(f)));
+    stream.step();
+  }
+  // frames 0, 5 and 10 are keyframes
+  CHECK(readParticleCacheHeader(writer.path(4)).keyframe == 0);
+  CHECK(readParticleCacheHeader(writer.path(5)).keyframe == 5);
+  CHECK(readParticleCacheHeader(writer.path(11)).keyframe == 10);
+  CHECK(sizes[1] < sizes[0] && sizes[5] > sizes[4] && sizes[10] > sizes[9]);
+
+  // half a quantization step, plus the rounding of the float result
+  auto maxPositionError = 0.5 / 65535 + 1e-7;
+  auto checkFrame = [&](const ParticleCacheReader& reader, int f) {
+    ParticleFrameError error{ reader, frames[f].positions, frames[f].velocities, frames[f].ids };
+
+    CHECK(reader.frame() == f);
+    CHECK(reader.time() == f / 60.0);
+    CHECK(error.sameParticles);
+    CHECK(error.position <= maxPositionError);
+    CHECK(error.velocity == 0);
+  };
+
+  {
+    ParticleCacheReader reader{ prefix };
+
+    for (int f = 0; f < 12; ++f)
+    {
+      reader.read(f);
+      checkFrame(reader, f);
+    }
+    for (int f : { 7, 3, 10, 4, 4, 11 })
+    {
+      reader.read(f);
+      checkFrame(reader, f);
+    }
+  }
+
+  // a gap in the frames forces a keyframe
+  writer.write(20, 1.0, bounds, stream.positions.data(), stream.velocities.data(), stream.ids.data(), 100);
+
+  ParticleCacheReader reader{ prefix };
+
+  reader.read(20);
+  CHECK(reader.size() == 100);
+  CHECK(readParticleCacheHeader(writer.path(20)).keyframe == 20);
+
+  // without ids every frame is a keyframe
+  auto path = tempPath("noids_");
+  ParticleCacheWriter noIds{ path, 5 };
+
+  for (int f = 0; f < 2; ++f)
+    noIds.write(f, 0.0, bounds, frames[f].positions.data(), frames[f].velocities.data(), nullptr, 1000);
+  CHECK(readParticleCacheHeader(noIds.path(1)).keyframe == 1);
+  reader = ParticleCacheReader{ path };
+  reader.read(1);
+  CHECK(reader.size() == 1000 && reader.ids().empty());
+
+  // 2D frames, with an empty one between them
+  using vec2 = cg::Vector<float, 2>;
+  std::vector<vec2> positions2(1000);
+  std::vector<vec2> velocities2(1000);
+  std::vector<uint64_t> ids2(1000);
+
+  for (size_t i = 0; i < 1000; ++i)
+  {
+    positions2[i] = vec2{ frand(-1, 1), frand(2, 3) };
+    velocities2[i] = vec2{ frand(-1, 1), 0.25f };
+    ids2[i] = 999 - i;
+  }
+  path = tempPath("particles2_");
+
+  ParticleCacheWriter writer2{ path, 5 };
+  Bounds<float, 2> bounds2{ vec2{ -1, 2 }, vec2{ 1, 3 } };
+
+  writer2.write(0, 0.0, bounds2, positions2.data(), velocities2.data(), ids2.data(), 1000);
+  writer2.write(1, 0.1, bounds2, positions2.data(), velocities2.data(), ids2.data(), 0);
+  writer2.write(2, 0.2, bounds2, positions2.data(), velocities2.data(), ids2.data(), 500);
+  reader = ParticleCacheReader{ path };
+  reader.read(1);
+  CHECK(reader.dimension() == 2 && reader.size() == 0);
+  reader.read(2);
+  CHECK(reader.dimension() == 2 && reader.size() == 500);
+
+  size_t mismatches = 0;
+
+  for (size_t k = 0; k < reader.size(); ++k)
+  {
+    auto i = 999 - reader.ids()[k];
+
+    mismatches += i >= 500
+      || std::abs(reader.positions()[k * 2] - positions2[i].x) > 1 / 65535.0
+      || std::abs(reader.positions()[k * 2 + 1] - positions2[i].y) > 0.5 / 65535.0
+      || reader.velocities()[k * 2 + 1] != 0.25f;
+  }
+  CHECK(mismatches == 0);
+
+  // a truncated delta frame fails, as does a missing one
+  std::filesystem::resize_file(writer.path(8), sizes[8] / 2);
+  reader = ParticleCacheReader{ prefix };
+  CHECK(throwsRuntimeError([&]() { reader.read(8); }));
+  CHECK(throwsRuntimeError([&]() { ParticleCacheReader{ prefix }.read(13); }));
+}
+
+// Sizes and read time of 8 frames of 1M 3D particles, with 1% of the
+// particles killed and emitted per frame.
+inline void
+benchParticleCache()
+{
+  using namespace cg;
+
+  printf("**Particle cache benchmark**\n");
+
+  TestParticleStream stream{ 1000000 };
+  std::vector<TestParticleStream> frames;
+  auto prefix = tempPath("bench_particles_");
+  ParticleCacheWriter writer{ prefix, 5 };
+  Bounds<float, 3> bounds{ TestParticleStream::vec_type{ 0.0f }, TestParticleStream::vec_type{ 1.0f } };
+  double writeTime = 0;
+
+  for (int f = 0; f < 8; ++f)
+  {
+    frames.push_back(stream);
+    writeTime += seconds([&]() {
+      writer.write(f, f / 60.0, bounds, stream.positions.data(), stream.velocities.data(), stream.ids.data(), stream.positions.size());
+      });
+    printf("frame %d: %.1f B/particle\n",
+      f,
+      double(std::filesystem::file_size(writer.path(f))) / stream.positions.size());
+    stream.step();
+  }
+
+  ParticleCacheReader reader{ prefix };
+  auto readTime = seconds([&]() {
+    for (int f = 0; f < 8; ++f)
+      reader.read(f);
+    });
+  ParticleFrameError error{ reader, frames[7].positions, frames[7].velocities, frames[7].ids };
+
+  printf("24 B/particle raw; written in %.2f s, read in %.2f s, max position error %.2g\n",
+    writeTime,
+    readTime,
+    error.position);
+}
+
+#endif // __ParticleCacheTest_h
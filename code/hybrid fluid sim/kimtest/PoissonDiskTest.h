@@ -0,0 +1,44 @@
+#ifndef __PoissonDiskTest_h
+#define __PoissonDiskTest_h
+
+#include "PoissonDiskPointGenerator.h"
+#include "Test.h"
+#include <vector>
+
+// No two generated points are closer than the spacing, across the seams of
+// the tiles too, and there are at least minFill points per spacing^D.
+template <size_t D>
+inline void
+testPoissonDiskSpacing(float spacing, float extent, float minFill)
+{
+  using namespace cg;
+  using vec_type = cg::Vector<float, D>;
+
+  printf("**Poisson disk %dD spacing test**\n", int(D));
+
+  // small tiles, so the bounds hold several of them
+  PoissonDiskPointGenerator<D, float> generator{ 4 };
+  Bounds<float, D> bounds{ vec_type{ 0.0f }, vec_type{ extent } };
+  std::vector<vec_type> points;
+
+  generator.generate(bounds, spacing, points);
+
+  auto minDistance = math::Limits<float>::inf();
+  size_t outside = 0;
+
+  for (size_t i = 0; i < points.size(); ++i)
+  {
+    outside += !bounds.contains(points[i]);
+    for (size_t j = i + 1; j < points.size(); ++j)
+      minDistance = std::min(minDistance, (points[i] - points[j]).length());
+  }
+  CHECK(outside == 0);
+  CHECK(minDistance >= spacing * 0.999f);
+
+  auto volume = 1.0f;
+  for (size_t d = 0; d < D; ++d)
+    volume *= extent / spacing;
+  CHECK(float(points.size()) >= minFill * volume);
+}
+
+#endif // __PoissonDiskTest_h
@@ -0,0 +1,204 @@
+#ifndef __PressureTest_h
+#define __PressureTest_h
+
+#include "GridFractionalSinglePhasePressureSolver.h"
+#include "Scene.h"
+#include "Test.h"
+#include <array>
+
+// Fractional pressure solver whose full precision CG tolerance can be set,
+// to compare it with a mixed precision solve at the same tolerance.
+template <size_t D, typename real>
+class TestPressureSolver: public cg::GridFractionalSinglePhasePressureSolver<D, real>
+{
+public:
+  TestPressureSolver()
+  {
+    // open sides make the system positive definite
+    this->setClosedDomainBoundaryFlag(0);
+  }
+
+  void setCgTolerance(double tolerance)
+  {
+    this->solver.setTolerance(real(tolerance));
+  }
+
+  double cgError() const
+  {
+    return this->solver.error();
+  }
+
+}; // TestPressureSolver
+
+// Returns the D component grids of velocity.
+template <size_t D, typename real>
+inline auto
+faceGrids(const cg::FaceCenteredGrid<D, real>& velocity)
+{
+  std::array<cg::Grid<D, real>*, D> grids;
+
+  grids[0] = velocity.template data<0>();
+  grids[1] = velocity.template data<1>();
+  if constexpr (D == 3)
+    grids[2] = velocity.template data<2>();
+  return grids;
+}
+
+// Returns a face centered grid of n^D cells with the velocities of source,
+// or random velocities if there is no source.
+template <size_t D, typename real, typename S = real>
+inline cg::Reference<cg::FaceCenteredGrid<D, real>>
+newVelocity(int64_t n, const cg::FaceCenteredGrid<D, S>* source = nullptr)
+{
+  using vec_type = cg::Vector<real, D>;
+
+  auto velocity = new cg::FaceCenteredGrid<D, real>{ cg::Index<D>{ n },
+    vec_type{ real(1) / n },
+    vec_type{ real(0) } };
+  auto grids = faceGrids(*velocity);
+
+  for (size_t d = 0; d < D; ++d)
+    for (int64_t i = 0; i < grids[d]->length(); ++i)
+      (*grids[d])[i] = source ? real((*faceGrids(*source)[d])[i]) : real(frand(-1, 1));
+  return velocity;
+}
+
+// Returns the max difference of the face velocities of a and b.
+template <size_t D, typename real>
+inline double
+maxVelocityDifference(const cg::FaceCenteredGrid<D, double>& a, const cg::FaceCenteredGrid<D, real>& b)
+{
+  auto u = faceGrids(a);
+  auto v = faceGrids(b);
+  double difference = 0;
+
+  for (size_t d = 0; d < D; ++d)
+    for (int64_t i = 0; i < u[d]->length(); ++i)
+      difference = std::max(difference, std::abs((*u[d])[i] - double((*v[d])[i])));
+  return difference;
+}
+
+// The mixed precision solve reaches the double precision tolerance, on
+// double and on float grids, and projects the velocity as the double CG
+// does. A solve that cannot reach its tolerance fails as the CG does.
+inline void
+testMixedPrecisionPressure()
+{
+  using namespace cg;
+
+  printf("**Mixed precision pressure test**\n");
+
+  constexpr int64_t n = 48;
+  auto input = newVelocity<2, double>(n);
+  auto reference = newVelocity<2, double>(n);
+  auto mixed = newVelocity<2, double>(n);
+  auto floatInput = newVelocity<2, float>(n, input.get());
+  auto floatMixed = newVelocity<2, float>(n);
+  TestPressureSolver<2, double> solver;
+  TestPressureSolver<2, float> floatSolver;
+
+  solver.setCgTolerance(1e-12);
+  solver.solve(input, 1.0, reference);
+  solver.setUseMixedPrecision(true);
+  solver.solve(input, 1.0, mixed);
+  CHECK(solver.refinements() > 1);
+  CHECK(solver.relativeResidual() <= 1e-10);
+  CHECK(maxVelocityDifference(*reference, *mixed) < 1e-8);
+
+  floatSolver.setUseMixedPrecision(true);
+  floatSolver.solve(floatInput, 1.0, floatMixed);
+  CHECK(floatSolver.relativeResidual() <= 1e-10);
+  CHECK(maxVelocityDifference(*reference, *floatMixed) < 1e-5);
+
+  // refinements ending above the tolerance fail as the double CG does:
+  // the pressure is dropped and the velocity is not projected
+  auto failed = newVelocity<2, double>(n, input.get());
+
+  solver.setTolerance(1e-14);
+  solver.setMaxRefinements(1);
+  solver.solve(input, 1.0, failed);
+  CHECK(solver.relativeResidual() > solver.tolerance());
+  CHECK(maxVelocityDifference(*input, *failed) == 0);
+}
+
+// Times of the double and mixed precision pressure solves quoted for the
+// mixed precision mode: a 64^3 system solved to a relative residual of
+// 1e-10, and a 128^2 PIC dam break.
+inline void
+benchMixedPrecisionPressure()
+{
+  using namespace cg;
+
+  printf("**Mixed precision pressure benchmark**\n");
+
+  auto input = newVelocity<3, double>(64);
+  auto output = newVelocity<3, double>(64);
+  TestPressureSolver<3, double> solver;
+
+  solver.setCgTolerance(1e-10);
+
+  // best of three solves, so the first one does not pay for the warm up
+  auto bestTime = [&]() {
+    auto time = math::Limits<double>::inf();
+
+    for (int i = 0; i < 3; ++i)
+      time = std::min(time, seconds([&]() { solver.solve(input, 1.0, output); }));
+    return time;
+  };
+  auto doubleTime = bestTime();
+  auto doubleError = solver.cgError();
+
+  solver.setUseMixedPrecision(true);
+
+  auto mixedTime = bestTime();
+
+  printf("64^3 Poisson: double CG %.2f s (residual %.2g), mixed %.2f s (residual %.2g, %d refinements)\n",
+    doubleTime,
+    doubleError,
+    mixedTime,
+    solver.relativeResidual(),
+    solver.refinements());
+
+  auto floatInput = newVelocity<3, float>(64);
+  auto floatOutput = newVelocity<3, float>(64);
+  TestPressureSolver<3, float> floatSolver;
+
+  floatSolver.solve(floatInput, 1.0, floatOutput);
+
+  auto floatError = floatSolver.cgError();
+
+  floatSolver.setUseMixedPrecision(true);
+  floatSolver.solve(floatInput, 1.0, floatOutput);
+  printf("64^3 Poisson, float grid: float CG residual %.2g, mixed %.2g\n",
+    floatError,
+    floatSolver.relativeResidual());
+
+  for (auto mixedPrecision : { false, true })
+  {
+    auto description = JsonValue::parse(R"({
+      "dimension": 2,
+      "precision": "double",
+      "grid": { "size": 128, "spacing": 0.0078125 },
+      "solver": { "type": "pic", "particleCapacity": 200000, "closedBoundary": "all" },
+      "time": { "frames": 6 },
+      "emitters": [{
+        "shape": { "type": "box", "min": [0, 0], "max": [0.4, 0.7] },
+        "spacing": 0.004
+      }]
+    })");
+
+    description["solver"].set("mixedPrecisionPressure", mixedPrecision);
+
+    auto scene = Scene::build(description);
+    auto time = seconds([&]() { scene->run(); });
+
+    for (const auto& metric : scene->metrics())
+      if (metric.first == "kineticEnergy")
+        printf("128^2 PIC dam break, %s: %.2f s, kinetic energy %.9g\n",
+          mixedPrecision ? "mixed" : "double",
+          time,
+          metric.second);
+  }
+}
+
+#endif // __PressureTest_h
@@ -0,0 +1,122 @@
+#ifndef __ReproducibilityTest_h
+#define __ReproducibilityTest_h
+
+#include "HalfTest.h"
+#include "Parallel.h"
+#include "ReproducibilityCheck.h"
+#include "Test.h"
+#include <vector>
+
+// Returns a 2D dam break scene of the solver type, 64x64 cells, 8 frames.
+inline cg::JsonValue
+damBreakScene(const char* type)
+{
+  auto description = cg::JsonValue::parse(R"({
+    "dimension": 2,
+    "grid": { "size": 64, "spacing": 0.015625 },
+    "solver": { "closedBoundary": "all", "particleCapacity": 100000 },
+    "time": { "frames": 8 },
+    "emitters": [{
+      "shape": { "type": "box", "min": [0, 0], "max": [0.4, 0.7] },
+      "spacing": 0.005
+    }]
+  })");
+
+  description["solver"].set("type", type);
+  return description;
+}
+
+// Returns the sum of values computed by parallelReduce with n chunks, or
+// with the blocks of the deterministic mode.
+inline float
+chunkedSum(const std::vector<float>& values, unsigned int n)
+{
+  cg::setMaxNumberOfThreads(n);
+
+  auto sum = cg::parallelReduce<float>(0, int64_t(values.size()), 0.0f,
+    [&values](int64_t b, int64_t e, float s) {
+      for (auto i = b; i < e; ++i)
+        s += values[i];
+      return s;
+    },
+    [](float a, float b) { return a + b; });
+
+  cg::setMaxNumberOfThreads(0);
+  return sum;
+}
+
+// In deterministic mode parallelReduce sums give the same bits with any
+// number of chunks, and so do whole runs: their other float sums, the CG
+// dot products and norms and the mixed precision residuals, are serial.
+// The second runs use 7 chunks, so they split the work as a 7-core machine
+// would even where there is a single core.
+inline void
+testDeterministicRuns()
+{
+  using namespace cg;
+
+  printf("**Deterministic runs test**\n");
+
+  std::vector<float> values(1 << 20);
+
+  for (auto& v : values)
+    v = frand(0, 1);
+
+  // the chunks change the sum unless the mode is deterministic
+  CHECK(!isDeterministic());
+  CHECK(chunkedSum(values, 1) != chunkedSum(values, 7));
+  setDeterministic(true);
+  CHECK(chunkedSum(values, 1) == chunkedSum(values, 7));
+  setDeterministic(false);
+
+  auto flip = damBreakScene("flip");
+  auto viscous = damBreakScene("flip");
+  auto pic = damBreakScene("pic");
+
+  flip["solver"].set("picBlending", 0.05);
+  viscous["solver"].set("viscosity", 0.01);
+  pic["solver"].set("mixedPrecisionPressure", true);
+
+  auto smoke = densityBlockScene(64, 8);
+
+  smoke["solver"].set("gravity", JsonValue::parse("[0, -1]"));
+  smoke["solver"].set("mixedPrecisionPressure", true);
+
+  size_t divergences = 0;
+
+  setMaxNumberOfThreads(7);
+  for (const auto& description : { flip, viscous, pic, smoke })
+  {
+    ReproducibilityCheck sceneCheck{ description };
+    auto divergence = sceneCheck.run();
+
+    if (divergence.hasDiverged || sceneCheck.log(0).entries().empty())
+    {
+      printf("%s\n", divergence.describe().c_str());
+      ++divergences;
+    }
+  }
+  CHECK(divergences == 0);
+
+  // a change of the simulation is reported where it first shows
+  auto other = flip;
+
+  other["solver"].set("picBlending", 0.1);
+
+  ReproducibilityCheck flipCheck{ flip };
+  ReproducibilityCheck otherCheck{ other };
+
+  flipCheck.setThreads(1, 1);
+  flipCheck.run();
+  otherCheck.setThreads(1, 1);
+  otherCheck.run();
+
+  auto divergence = findDivergence(flipCheck.log(0), otherCheck.log(0));
+
+  CHECK(divergence.hasDiverged && divergence.first != nullptr);
+  CHECK(divergence.first != nullptr && divergence.first->frame == 0);
+  CHECK(divergence.first != nullptr && divergence.first->stage == "gridToParticles");
+  setMaxNumberOfThreads(0);
+}
+
+#endif // __ReproducibilityTest_h
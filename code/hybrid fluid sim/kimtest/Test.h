@@ -0,0 +1,84 @@
+#ifndef __Test_h
+#define __Test_h
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+// Number of failed checks of the run.
+inline int&
+failureCount()
+{
+  static int n = 0;
+  return n;
+}
+
+// Reports a failed check of expression.
+inline bool
+check(bool ok, const char* expression, const char* file, int line)
+{
+  if (!ok)
+  {
+    printf("%s(%d): check failed: %s\n", file, line, expression);
+    ++failureCount();
+  }
+  return ok;
+}
+
+#define CHECK(e) check(bool(e), #e, __FILE__, __LINE__)
+
+// Returns the path of the scratch file name of the tests.
+inline std::string
+tempPath(const std::string& name)
+{
+  auto directory = std::filesystem::temp_directory_path() / "kimtest";
+
+  std::filesystem::create_directories(directory);
+  return (directory / name).string();
+}
+
+// Random number generator of the tests, seeded the same way every run.
+inline std::mt19937&
+rng()
+{
+  static std::mt19937 generator{ 1 };
+  return generator;
+}
+
+inline float
+frand(float min, float max)
+{
+  return std::uniform_real_distribution<float>{ min, max }(rng());
+}
+
+// Returns the seconds spent in func.
+template <typename F>
+inline double
+seconds(F func)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  func();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Returns true if func throws std::runtime_error.
+template <typename F>
+inline bool
+throwsRuntimeError(F func)
+{
+  try
+  {
+    func();
+  }
+  catch (const std::runtime_error&)
+  {
+    return true;
+  }
+  return false;
+}
+
+#endif // __Test_h